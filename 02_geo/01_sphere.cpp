@@ -4,7 +4,7 @@
 - https://github.com/mwernerds/spatial-cpp
 
 Program: Points
-Compile: g++ -I $(BOOST_DIR) -Wall -std=c++11  -o 01_sphere 01_sphere.cpp
+Compile: g++ -I $(BOOST_DIR) -Wall -std=c++11 -pthread -o 01_sphere 01_sphere.cpp
 */
 
 
@@ -13,6 +13,9 @@ Compile: g++ -I $(BOOST_DIR) -Wall -std=c++11  -o 01_sphere 01_sphere.cpp
 #include <boost/geometry/geometries/point_xy.hpp>
 #include <boost/geometry/geometries/polygon.hpp>
 
+#include "haversine.hpp" // many great-circle distances at once
+#include "sphere_transform.hpp" // many points to 3D at once
+
 using namespace boost::geometry;
 
 
@@ -82,5 +85,30 @@ int main(int argc, char **argv)
     // Geodesic distance
     std::cout << distance(cast(amsterdam),cast(paris)) << std::endl;
 
+    // a whole trip at once: longitudes and latitudes as separate arrays
+    double lon[] = {4.90, 2.35, 13.40, 16.37, 4.90}; // Amsterdam, Paris, Berlin, Vienna, Amsterdam
+    double lat[] = {52.37, 48.86, 52.52, 48.21, 52.37};
+    double legs[4];
+    spatial::haversine_track(lon, lat, 5, legs, earth_radius);
+    double trip = 0;
+    for (size_t i=0; i < 4; i++)
+    {
+	std::cout << "Leg " << i << ": " << legs[i] << " km (one at a time: "
+		  << distance(spherical_point(lon[i], lat[i]), spherical_point(lon[i+1], lat[i+1])) * earth_radius
+		  << " km)" << std::endl;
+	trip += legs[i];
+    }
+    std::cout << "Trip: " << trip << " km" << std::endl;
+
+    // and all cities to 3D at once, instead of tf for every single point
+    double x[5], y[5], z[5];
+    spatial::spherical_to_xyz(lon, lat, 5, x, y, z);
+    for (size_t i=0; i < 4; i++)
+	std::cout << "Leg " << i << " (drill hole): "
+		  << std::sqrt(std::pow(x[i+1]-x[i], 2) + std::pow(y[i+1]-y[i], 2) + std::pow(z[i+1]-z[i], 2)) * earth_radius
+		  << " km (one at a time: "
+		  << distance(tf(spherical_point(lon[i], lat[i])), tf(spherical_point(lon[i+1], lat[i+1]))) * earth_radius
+		  << " km)" << std::endl;
+
     return 0;
 }
@@ -4,13 +4,17 @@
 - https://github.com/mwernerds/spatial-cpp
 
 Program: Points
-Compile: g++ -I $(BOOST_DIR) -Wall -std=c++11  -o 02_simplefeatures 02_simplefeatures.cpp
+Compile: g++ -I $(BOOST_DIR) -Wall -std=c++17 -pthread -o 02_simplefeatures 02_simplefeatures.cpp
 */
 
 #include<iostream>
 #include<fstream>
 #include <boost/geometry.hpp>
 
+#include "prepared_polygon.hpp"
+#include "result_writer.hpp"
+#include "relate.hpp"
+
 namespace bg = boost::geometry;
 
 typedef bg::model::point<double, 2, bg::cs::cartesian> point;
@@ -63,9 +67,10 @@ int main(int argc, char **argv)
     std::cout << bg::wkt(A) << std::endl;
     std::cout << bg::wkt(B) << std::endl;
 
-    // DE-9IM Matrix
-    bg::de9im::matrix matrix = boost::geometry::relation(A,B);
-    std::string code = matrix.str();
+    // DE-9IM Matrix, together with the predicates below: one relate pass computes the
+    // turns of A and B once and answers all of them (relate.hpp)
+    std::string code;
+    uint64_t holds = spatial::relate(A, B, spatial::relate_query(spatial::rel_all), &code);
     std::cout << "relation: " << code << std::endl;
     // generic relate operation:
    
@@ -77,21 +82,21 @@ int main(int argc, char **argv)
     // some algorithms relations:
 
     std::cout << "area: " << bg::area(A) << std::endl;
-    std::cout << "covered_by: " <<  bg::covered_by (A,B) << std::endl;
-    std::cout << "disjoint: " <<  bg::disjoint(A,B) << std::endl;
-    std::cout << "equals: " <<  bg::equals(A,B) << std::endl;
-    std::cout << "intersects: " <<  bg::intersects   (A,B) << std::endl;
-    std::cout << "overlaps: " <<  bg::overlaps (A,B) << std::endl;
-    std::cout << "touches: " <<  bg::touches (A,B) << std::endl;
-    std::cout << "within: " <<  bg::within (A,B) << std::endl;
+    std::cout << "covered_by: " <<  bool(holds & spatial::rel_covered_by) << std::endl;
+    std::cout << "disjoint: " <<  bool(holds & spatial::rel_disjoint) << std::endl;
+    std::cout << "equals: " <<  bool(holds & spatial::rel_equals) << std::endl;
+    std::cout << "intersects: " <<  bool(holds & spatial::rel_intersects) << std::endl;
+    std::cout << "overlaps: " <<  bool(holds & spatial::rel_overlaps) << std::endl;
+    std::cout << "touches: " <<  bool(holds & spatial::rel_touches) << std::endl;
+    std::cout << "within: " <<  bool(holds & spatial::rel_within) << std::endl;
 
    
     // write CSV
     {
-    std::ofstream ofs("geometry.csv");
-    ofs << "wkt" << std::endl;
-    ofs << bg::wkt(A)<< std::endl;
-    ofs << bg::wkt(B) << std::endl;
+    spatial::result_writer ofs("geometry.csv");
+    ofs << "wkt\n";
+    ofs.wkt(A) << '\n';
+    ofs.wkt(B) << '\n';
     ofs.close();
     }
 
@@ -99,15 +104,18 @@ int main(int argc, char **argv)
     
     // and now let us test within with random floating points
     {
-    std::ofstream ofs("points.csv");
-    ofs << "wkt; within" << std::endl;
+    spatial::result_writer ofs("points.csv"); // buffered, written when it goes out of scope
+    ofs << "wkt; within\n";
+    // many points against the same two polygons: prepare them once (same answers as bg::within)
+    auto preparedA = spatial::prepare(A);
+    auto preparedB = spatial::prepare(B);
     for (size_t i=0; i < 500; i++)
     {
 	auto p = bg::make<point>( static_cast<double>(std::rand())/RAND_MAX*10.0,static_cast<double>(std::rand())/RAND_MAX*10.0);
-	auto rel1 = bg::within(p,A);
-	auto rel2 = bg::within(p,B);
+	auto rel1 = preparedA.within(p);
+	auto rel2 = preparedB.within(p);
 	int score = (rel1 << 1) + rel2;
-	ofs << bg::wkt(p) << ";" << score << std::endl;
+	ofs.wkt(p) << ";" << score << '\n';
     }
     }
     
@@ -4,50 +4,36 @@
 - https://github.com/mwernerds/spatial-cpp
 
 Program: R-Tree
-Compile: g++ -I $(BOOST_DIR) -Ofast -march=native  -Wall -std=c++11  -o 03_rtree 03_rtree.cpp
+Compile: g++ -I $(BOOST_DIR) -Ofast -march=native  -Wall -std=c++17 -pthread -o 03_rtree 03_rtree.cpp
 */
 
 #include<iostream>
 #include<fstream>
 #include <boost/geometry.hpp>
-#include <boost/algorithm/string.hpp>
 #include<chrono>
 
-#include<set>
+#include<thread>
+#include<cstdlib>
 
 #include <boost/range/adaptor/indexed.hpp>
 using  boost::adaptors::indexed;
-#include <boost/range/adaptor/transformed.hpp>
-using  boost::adaptors::transformed;
 #include <boost/function_output_iterator.hpp>
 
-namespace bg = boost::geometry;
-namespace bgi = boost::geometry::index;
+#include "types.hpp"         // point, box, polygon, value, rtree as in the other programs
+#include "wkt_loader.hpp"    // memory-mapped in-place WKT parsing
+#include "polygon_store.hpp" // all polygons in one flat buffer
+#include "knn.hpp"           // exact kNN on the polygons
+#include "result_writer.hpp" // buffered CSV/WKT output
+#include "packed_rtree.hpp"  // parallel envelopes and bulk loading
+#include "flat_rtree.hpp"    // read-only R-tree in flat arrays
+#include "range_query.hpp"   // range queries refined on the polygons
 
-typedef bg::model::point<double, 2, bg::cs::cartesian> point;
-typedef bg::model::box<point> box;
-typedef bg::model::linestring<point> linestring;
-typedef bg::model::polygon<point, false, false> polygon; // ccw, open polygon
-typedef bg::model::multi_polygon<polygon> multi_polygon; // ccw, open polygon
-typedef std::pair<box, size_t> value; // <- this is what the R-tree will hold
+// Instead of a std::vector<std::pair<polygon, size_t>> with one heap block per ring,
+// all coordinates live in one buffer. dataset[i] is a Boost.Geometry polygon view,
+// dataset.id(i) the OSM id.
+spatial::polygon_store dataset;
 
 
-typedef bgi::rtree< value, bgi::rstar<16, 4> > rtree;
-
-std::vector<std::pair<polygon, size_t>> dataset;
-
-
-struct value_maker
-{
-    template<typename T>
-    inline value operator()(T const& v) const
-    {
-	box b;
-	bg::envelope(v.value().first,b);
-        return value(b, v.index());
-    }
-};
-
 std::ostream &operator<< (std::ostream &os, box &b)
 {
     os << "(" << bg::get<0>(b.min_corner()) << ";" << bg::get<1>(b.min_corner()) << ")" << "-->"
@@ -81,46 +67,33 @@ point random_point_in_box(box b)
 int main(int argc, char **argv)
 {
     std::srand(std::time(0)); //use current time as seed for random generator
+    // optional first argument: number of threads used for loading (default: all cores)
+    unsigned threads = spatial::default_threads();
+    if (argc > 1 && !spatial::parse_threads(argv[1], threads))
+    {
+	std::cerr << "FAILED: the number of threads must be in [1, " << spatial::max_threads << "], not " << argv[1] << std::endl;
+	return 1;
+    }
+    std::cout << "Using " << threads << " threads" << std::endl;
     
 // Load the OSM polygons and explode each multipolygon into polygons to be added to the index.
     box roi(point(0,0),point(0,0));
     { // scope for timing
     auto start = std::chrono::high_resolution_clock::now();
    
-    std::ifstream ifs("washington_dc_osm_buildings.wkt");
-    std::string line;
-
-    
-    while(std::getline(ifs, line))
-    {
-	// split at ";"
-	std::vector<std::string> entries;
-	boost::split(entries, line, [](char c){return c == ';';});
-	size_t osm_id = boost::lexical_cast<size_t>(entries[0]);
-
-	// remove "
-	 entries[1].erase(remove_if(entries[1].begin(), entries[1].end(), [](const char& c) {
-        return c=='"';   }), entries[1].end());
-	multi_polygon mp;
-	bg::read_wkt(entries[1],mp);
-	for (auto &p: mp) // each building part!
-	{
-	    bg::correct(p);
-	    dataset.push_back(std::make_pair(p,osm_id));
-	    if (bg::get<0>(roi.min_corner()) == 0){ // bad hack
-		bg::envelope(p,roi);
-	    }else{
-		box q;
-		bg::envelope(p,q);
-		bg::expand(roi,q);
-	    }
-	}
-    }
+    // The file is mapped into memory and parsed in place: no getline, no split, no
+    // string copies. Newline-aligned chunks are parsed (and corrected) by a pool of
+    // threads, each computing the MBR of its chunk; the chunks are merged in file order.
+    spatial::load_stats stats = spatial::load_wkt_file("washington_dc_osm_buildings.wkt", dataset, roi, threads);
     std::cout << "Dataset contains " << dataset.size() << " polygons" << std::endl;
+    std::cout << "Polygon store uses " << dataset.memory_usage() / (1024.0*1024.0) << " MB for "
+	      << dataset.num_points() << " points" << std::endl;
     std::cout << "MBR of dataset: " << roi << std::endl;
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> diff = end-start;
-    std::cout << " Load CSV in " << diff.count() << "seconds" << std::endl;
+    std::cout << " Load CSV in " << diff.count() << "seconds"
+	      << " (" << stats.bytes / (1024.0*1024.0) / diff.count() << " MB/s, "
+	      << stats.rows / diff.count() << " rows/s)" << std::endl;
     } // loading scope
     // now load this into an R-tree: variant 1: sequential insert
 
@@ -128,12 +101,9 @@ int main(int argc, char **argv)
     auto start = std::chrono::high_resolution_clock::now();
     rtree rt;
     
-    for (const auto &d:dataset |indexed())
-    {
-	box b;
-	bg::envelope(d.value().first, b); // create MBR
-	rt.insert(value(b,d.index()));
-    }
+    // the store computed the MBR of each polygon once, when it was loaded
+    for (size_t i=0; i < dataset.size(); i++)
+	rt.insert(value(dataset.envelope(i), i));
 
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> diff = end-start;
@@ -143,12 +113,29 @@ int main(int argc, char **argv)
     // variant 2: bulk-load
     { // bulk load scope
     auto start = std::chrono::high_resolution_clock::now();
-    rt2 = rtree (dataset | indexed()
-                       | transformed(value_maker()));
+    // the packing constructor of bgi::rtree runs on one thread; only the (envelope,
+    // index) values are computed on all threads (packed_rtree.hpp), in the order of
+    // the polygons, so it builds the same tree as from a serial copy
+    rt2 = rtree (spatial::envelopes(dataset, threads));
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> diff = end-start;
-    std::cout << " Bulk-Load R-Tree in " << diff.count() << "seconds" << std::endl;
+    std::cout << " Bulk-Load R-Tree in " << diff.count() << "seconds (serial packing)" << std::endl;
     } // bulk load scope
+    // variant 3: a packed_rtree sorts and packs on all threads, into the same tree for
+    // any number of threads (15_parallel_bulk_load); rt2 stays the bgi::rtree that
+    // knn_exact and flat_rtree below work on
+    { // parallel bulk load scope
+    auto start = std::chrono::high_resolution_clock::now();
+    spatial::packed_rtree<16> packed(spatial::envelopes(dataset, threads), spatial::packing_str, 16, threads);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end-start;
+    std::cout << " Parallel bulk-load (STR) of a packed R-Tree with " << packed.all_nodes().size()
+	      << " nodes in " << diff.count() << "seconds" << std::endl;
+    } // parallel bulk load scope
+    // rt2 is never modified from here on: a frozen copy in flat arrays answers the same
+    // queries with less memory and fewer cache misses (flat_rtree.hpp, 16_flat_rtree)
+    spatial::flat_rtree frozen(rt2);
+    std::cout << " Frozen R-Tree uses " << frozen.memory_usage() / (1024.0*1024.0) << " MB" << std::endl;
     
     // Let us now do a kNN (k = 10) query for a single random point
     std::vector<value> result;
@@ -156,16 +143,17 @@ int main(int argc, char **argv)
     // for reproducibilty:
     p = bg::make<point>(-76.8117, 38.812);
     std::cout << "Anchor: " << bg::wkt(p) << std::endl;
-    rt2.query(bgi::nearest(p, 10), std::back_inserter(result));
-    // two issues to be resolved: first, kNN is not ordered, second, r-tree knows bbox only
-    std::sort(result.begin(), result.end(), [p](const value & a, const value & b){
-	return bg::distance(dataset[a.second].first,p) < bg::distance(dataset[b.second].first,p );
-    });
-    
-    for (const auto &v:result | indexed())
+    // the r-tree knows bbox only, so bgi::nearest gives the 10 nearest boxes, not buildings.
+    // knn_exact walks the tree by box distance and refines with the polygon distance
+    // until no box left can contain a closer polygon. The result comes out ordered.
+    std::vector<spatial::neighbor> neighbors;
+    size_t refined = spatial::knn_exact(rt2, dataset, p, 10, std::back_inserter(neighbors));
+    std::cout << "Refined " << refined << " polygons" << std::endl;
+
+    for (const auto &n:neighbors | indexed())
     {
-	auto id = v.value().second;
-	std::cout << v.index() << "\t" << dataset[id].second << "\t" << bg::distance (p, dataset[id].first) << std::endl;
+	auto id = n.value().second;
+	std::cout << n.index() << "\t" << dataset.id(id) << "\t" << n.value().first << std::endl;
     }
 
     // and again something for QGIS:
@@ -174,7 +162,7 @@ int main(int argc, char **argv)
     result.clear();
     point anchor = bg::make<point> (-76.99017,38.88970);
     std::cout << "Anchor: " << bg::wkt(anchor) << std::endl;
-    rt2.query(bgi::nearest(anchor, 200), std::back_inserter(result));
+    frozen.query_nearest(anchor, 200, std::back_inserter(result));
     double radius = 0.03;
 
     box range_query_box;
@@ -183,28 +171,31 @@ int main(int argc, char **argv)
 
     std::cout << "Range Query Box:" << range_query_box << std::endl;
 
-    // function_output_iterator is a nice tool as well:
-    std::set<size_t> knnids;
-    std::ofstream ofs("range_knn.csv");
-    ofs <<  std::setprecision(std::numeric_limits<double>::digits10);
-    ofs << "wkt;role" << std::endl;
+    // one flag per polygon marks the kNN: no tree of ids to search for every hit
+    std::vector<bool> is_knn(dataset.size(), false);
+    // rows go to large blocks that a background thread writes (no flush per row), and
+    // the coordinates are written with as many digits as needed to read them back
+    spatial::result_writer ofs("range_knn.csv", true);
+    ofs << "wkt;role\n";
     // first write all kNN with their ID
     for (auto r:result)
     {
 	const auto &item = dataset[r.second];
-	ofs << bg::wkt(item.first) <<";" << 1 << std::endl;
-	knnids.insert(r.second);
+	ofs.wkt(item) << ";" << 1 << '\n';
+	is_knn[r.second] = true;
     }
         
     
-    rt2.query(bgi::within(range_query_box), boost::make_function_output_iterator([&](value const& v)
+    // the buildings within the box, decided on the polygons (a box, a spatial::circle or a
+    // polygon would do as query); the hits arrive in batches, in the order of the tree
+    spatial::range_query(frozen, dataset, range_query_box, spatial::within_predicate(),
+	[&](const size_t *ids, size_t n)
     {
-	const auto &item = dataset[v.second];
-	if (knnids.find(v.second) == knnids.end()){
-	   ofs << bg::wkt(item.first) << ";" << 2 << std::endl;
-	}
-    }
-    ));
+	for (size_t i=0; i < n; i++)
+	    if (!is_knn[ids[i]])
+		ofs.wkt(dataset[ids[i]]) << ";" << 2 << '\n';
+    }, 4096, 1 << 12, threads);
+    ofs.close();
     
     return 0;
 }
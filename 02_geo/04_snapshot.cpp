@@ -0,0 +1,111 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial 
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Binary snapshot of dataset and R-tree
+Compile: g++ -I $(BOOST_DIR) -Ofast -march=native  -Wall -std=c++11 -pthread -o 04_snapshot 04_snapshot.cpp
+*/
+
+// Parsing the WKT and bulk-loading the R-tree on every start is wasteful when the
+// data does not change. We do it once, write a binary snapshot, and from then on
+// only map the snapshot: the index is ready as soon as the file is mapped.
+//
+// Usage: 04_snapshot        (build the snapshot if missing or unreadable, then query it)
+//        04_snapshot build  (always rebuild the snapshot from the WKT file)
+
+#include<iostream>
+#include<stdexcept>
+#include<chrono>
+#include<algorithm>
+#include <boost/geometry.hpp>
+
+#include <boost/range/adaptor/indexed.hpp>
+using  boost::adaptors::indexed;
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "packed_rtree.hpp"
+#include "snapshot.hpp"
+
+const char *wkt_file = "washington_dc_osm_buildings.wkt";
+const char *snapshot_file = "washington_dc_osm_buildings.snapshot";
+
+int main(int argc, char **argv)
+{
+    bool rebuild = (argc > 1 && std::string(argv[1]) == "build");
+    if (!rebuild){
+	// a missing, corrupt or old (version 1) snapshot is rebuilt
+	try{
+	    spatial::snapshot probe(snapshot_file);
+	}catch(const std::runtime_error &e){
+	    std::cout << " " << e.what() << ": rebuilding the snapshot" << std::endl;
+	    rebuild = true;
+	}
+    }
+
+    if (rebuild)
+    { // the expensive path: parse + bulk load + write
+    auto start = std::chrono::high_resolution_clock::now();
+    spatial::polygon_store dataset;
+    box roi;
+    spatial::load_wkt_file(wkt_file, dataset, roi, spatial::default_threads());
+    rtree rt(spatial::envelopes(dataset)); // the envelopes the store computed at load
+    spatial::write_snapshot(snapshot_file, dataset, rt);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end-start;
+    std::cout << " Parse, bulk-load and write snapshot in " << diff.count() << "seconds" << std::endl;
+    }
+
+    // the cheap path: map the snapshot
+    auto start = std::chrono::high_resolution_clock::now();
+    spatial::snapshot snap(snapshot_file);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end-start;
+    std::cout << " Open snapshot in " << diff.count() << "seconds" << std::endl;
+    std::cout << "Snapshot contains " << snap.size() << " polygons" << std::endl;
+
+    // the polygon views need the ring table, built on first use (the envelopes are
+    // read from the file as they are)
+    start = std::chrono::high_resolution_clock::now();
+    const spatial::polygon_store_view &polygons = snap.polygons();
+    diff = std::chrono::high_resolution_clock::now() - start;
+    std::cout << " First polygons() (" << polygons.num_rings() << " rings) in " << diff.count() << "seconds" << std::endl;
+
+    // the kNN query of 03_rtree, now answered from the mapped file
+    point p = bg::make<point>(-76.8117, 38.812);
+    std::cout << "Anchor: " << bg::wkt(p) << std::endl;
+    // the snapshot knows bboxes only, too: knn_exact walks its nodes by box distance
+    // and refines with the polygon distance, computed on polygon views that read the
+    // coordinates from the mapped file, as 03_rtree does on the in-memory tree
+    std::vector<spatial::neighbor> neighbors;
+    size_t refined = spatial::knn_exact(snap, p, 10, std::back_inserter(neighbors));
+    std::cout << "Refined " << refined << " polygons" << std::endl;
+    for (const auto &n: neighbors | indexed())
+	std::cout << n.index() << "\t" << snap.id(n.value().second) << "\t" << n.value().first << std::endl;
+
+    // and the range query
+    double radius = 0.03;
+    point anchor = bg::make<point> (-76.99017,38.88970);
+    box range_query_box(point(bg::get<0>(anchor)-radius, bg::get<1>(anchor)-radius),
+			point(bg::get<0>(anchor)+radius, bg::get<1>(anchor)+radius));
+    std::vector<value> result;
+    snap.query_within(range_query_box, std::back_inserter(result));
+    std::cout << "Range query returned " << result.size() << " polygons" << std::endl;
+
+    // the same ids as a bgi::rtree of the envelopes in the snapshot
+    std::vector<value> expected;
+    rtree(spatial::envelopes(polygons)).query(bgi::within(range_query_box), std::back_inserter(expected));
+    auto by_id = [](const value &a, const value &b){ return a.second < b.second; };
+    std::sort(result.begin(), result.end(), by_id);
+    std::sort(expected.begin(), expected.end(), by_id);
+    bool same = result.size() == expected.size();
+    for (size_t i=0; same && i < result.size(); i++)
+	same = result[i].second == expected[i].second;
+    if (!same){
+	std::cerr << "FAILED: the snapshot answers the range query differently from the bgi::rtree" << std::endl;
+	return 1;
+    }
+    return 0;
+}
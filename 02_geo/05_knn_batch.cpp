@@ -0,0 +1,88 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial 
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Batched kNN queries
+Compile: g++ -I $(BOOST_DIR) -Ofast -march=native  -Wall -std=c++11 -pthread -o 05_knn_batch 05_knn_batch.cpp
+*/
+
+// Many GPS fixes are snapped to their nearest buildings at once. We compare one
+// query at a time (as in 03_rtree) with the batch engine, which sorts the queries
+// along a Hilbert curve and runs them on all cores into one flat result buffer.
+//
+// Usage: 05_knn_batch [queries] [k] [threads]
+
+#include<iostream>
+#include<chrono>
+#include<cstdlib>
+#include <boost/geometry.hpp>
+
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "packed_rtree.hpp"
+#include "knn.hpp"
+#include "knn_batch.hpp"
+
+point random_point_in_box(box b)
+{
+    double tau1 = static_cast<double> (std::rand()) / RAND_MAX;
+    double tau2 = static_cast<double> (std::rand()) / RAND_MAX;
+    return bg::make<point>(
+	bg::get<0>(b.min_corner())+ tau1 * (bg::get<0>(b.max_corner())-bg::get<0>(b.min_corner())),
+	bg::get<1>(b.min_corner())+ tau2 * (bg::get<1>(b.max_corner())-bg::get<1>(b.min_corner())));
+
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = (argc > 1) ? std::atol(argv[1]) : 100000;
+    size_t k = (argc > 2) ? std::atol(argv[2]) : 10;
+    unsigned threads = spatial::default_threads();
+    if (argc > 3 && !spatial::parse_threads(argv[3], threads))
+    {
+	std::cerr << "FAILED: the number of threads must be in [1, " << spatial::max_threads << "], not " << argv[3] << std::endl;
+	return 1;
+    }
+    std::srand(42);
+
+    spatial::polygon_store dataset;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", dataset, roi, threads);
+    rtree rt(spatial::envelopes(dataset, threads)); // the envelopes the store computed at load
+    std::cout << "Dataset contains " << dataset.size() << " polygons" << std::endl;
+
+    std::vector<point> queries(n);
+    for (auto &q: queries) q = random_point_in_box(roi);
+
+    // one query at a time, in the given (random) order
+    std::vector<spatial::neighbor> single;
+    single.reserve(n * k);
+    {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto &q: queries)
+	spatial::knn_exact(rt, dataset, q, k, std::back_inserter(single));
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end-start;
+    std::cout << " Single queries in " << diff.count() << "seconds (" << n / diff.count() << " queries/s)" << std::endl;
+    }
+
+    // the batch
+    spatial::knn_batch_result result;
+    result.resize(n, k); // preallocated, the engine only fills it
+    spatial::knn_batch(rt, dataset, queries.data(), n, k, result, threads);
+    std::cout << " Batch with " << threads << " threads: " << result.queries_per_second << " queries/s, "
+	      << static_cast<double>(result.refined) / n << " polygons refined per query" << std::endl;
+
+    size_t mismatches = 0;
+    for (size_t i=0; i < single.size(); i++)
+	if (single[i].second != result.index[i]) ++mismatches;
+    std::cout << "Results differing from single queries: " << mismatches << std::endl;
+
+    std::cout << "Nearest buildings of the first fix " << bg::wkt(queries[0]) << ":" << std::endl;
+    for (size_t j = result.offsets[0]; j < result.offsets[1]; j++)
+	std::cout << j << "\t" << dataset.id(result.index[j]) << "\t" << result.distance[j] << std::endl;
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial 
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Spatial join of two polygon layers
+Compile: g++ -I $(BOOST_DIR) -Ofast -march=native  -Wall -std=c++11 -pthread -o 06_spatial_join 06_spatial_join.cpp
+*/
+
+// 02_simplefeatures relates two polygons, 03_rtree indexes one layer. Here we join
+// two whole layers: the buildings and a layer of "parcels" (a regular grid of
+// blocks over the city, as we do not have a parcel layer at hand). The R-tree over
+// the parcels filters by box, the threads refine with the exact predicate, and the
+// matching pairs are streamed into a CSV file while the join is running.
+//
+// Usage: 06_spatial_join [threads]
+
+#include<iostream>
+#include<fstream>
+#include<chrono>
+#include<cstdlib>
+#include <boost/geometry.hpp>
+
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "packed_rtree.hpp"
+#include "spatial_join.hpp"
+
+// n x n square blocks covering the box
+spatial::polygon_store make_parcels(const box &roi, size_t n)
+{
+    spatial::polygon_store parcels;
+    double x0 = bg::get<bg::min_corner,0>(roi), y0 = bg::get<bg::min_corner,1>(roi);
+    double dx = (bg::get<bg::max_corner,0>(roi) - x0) / n, dy = (bg::get<bg::max_corner,1>(roi) - y0) / n;
+    for (size_t i=0; i < n; i++)
+	for (size_t j=0; j < n; j++)
+	{
+	    polygon p;
+	    bg::convert(box(point(x0 + i*dx, y0 + j*dy), point(x0 + (i+1)*dx, y0 + (j+1)*dy)), p);
+	    bg::correct(p);
+	    parcels.push_back(p, i*n + j);
+	}
+    return parcels;
+}
+
+template<typename Predicate>
+void run_join(const char *name, const spatial::polygon_store &buildings, const spatial::polygon_store &parcels,
+	      const rtree &parcel_tree, Predicate predicate, unsigned threads, std::ostream &ofs)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    auto stats = spatial::spatial_join(buildings, parcels, parcel_tree, predicate,
+	[&](const spatial::join_pair *pairs, size_t n){
+	    for (size_t i=0; i < n; i++)
+		ofs << buildings.id(pairs[i].first) << ";" << parcels.id(pairs[i].second) << ";" << name << "\n";
+	}, threads);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end-start;
+    std::cout << " Join (" << name << ") in " << diff.count() << "seconds: " << stats.candidates
+	      << " candidates, " << stats.matches << " matches (" << stats.candidates / diff.count()
+	      << " candidate pairs/s)" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned threads = spatial::default_threads();
+    if (argc > 1 && !spatial::parse_threads(argv[1], threads))
+    {
+	std::cerr << "FAILED: the number of threads must be in [1, " << spatial::max_threads << "], not " << argv[1] << std::endl;
+	return 1;
+    }
+    spatial::polygon_store buildings;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", buildings, roi, threads);
+    spatial::polygon_store parcels = make_parcels(roi, 200);
+    rtree parcel_tree(spatial::envelopes(parcels, threads)); // the envelopes the store computed
+    std::cout << buildings.size() << " buildings x " << parcels.size() << " parcels, "
+	      << threads << " threads" << std::endl;
+
+    std::ofstream ofs("join.csv");
+    ofs << "building;parcel;relation" << std::endl;
+    run_join("intersects", buildings, parcels, parcel_tree, spatial::intersects_predicate(), threads, ofs);
+    // within as DE-9IM mask, exactly as in 02_simplefeatures
+    run_join("within", buildings, parcels, parcel_tree,
+	     spatial::relate_predicate(bg::de9im::mask("T*F**F***")), threads, ofs);
+    run_join("overlaps", buildings, parcels, parcel_tree, spatial::overlaps_predicate(), threads, ofs);
+    return 0;
+}
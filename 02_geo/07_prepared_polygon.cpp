@@ -0,0 +1,249 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Prepared polygons
+Compile: g++ -I $(BOOST_DIR) -Ofast -march=native  -Wall -std=c++11 -pthread -o 07_prepared_polygon 07_prepared_polygon.cpp
+*/
+
+// Point-in-polygon for many points against the same polygons: bg::within against
+// prepared polygons (prepared_polygon.hpp). First a large polygon with a hole and
+// many random points, then 7-gons in projected metres with points a few units in
+// the last place off their edges, then GPS fixes against the DC buildings with the
+// R-tree as filter. Both must give exactly the same answers, also for points
+// placed on vertices and edges.
+//
+// Usage: 07_prepared_polygon [points] [vertices]
+
+#include<iostream>
+#include<chrono>
+#include<cstdlib>
+#include<cmath>
+#include<algorithm>
+#include <boost/geometry.hpp>
+
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "packed_rtree.hpp"
+#include "prepared_polygon.hpp"
+#include "parallel.hpp"
+
+point random_point_in_box(box b)
+{
+    double tau1 = static_cast<double> (std::rand()) / RAND_MAX;
+    double tau2 = static_cast<double> (std::rand()) / RAND_MAX;
+    return bg::make<point>(
+	bg::get<0>(b.min_corner())+ tau1 * (bg::get<0>(b.max_corner())-bg::get<0>(b.min_corner())),
+	bg::get<1>(b.min_corner())+ tau2 * (bg::get<1>(b.max_corner())-bg::get<1>(b.min_corner())));
+
+}
+
+// a convex polygon of n vertices on a circle around (cx, cy) (ccw, open ring)
+polygon make_ngon(double cx, double cy, double radius, size_t n)
+{
+    std::vector<double> phi(n);
+    for (auto &a: phi) a = 2 * M_PI * std::rand() / RAND_MAX;
+    std::sort(phi.begin(), phi.end());
+    polygon g;
+    for (double a: phi)
+	bg::append(bg::exterior_ring(g), bg::make<point>(cx + radius * std::cos(a), cy + radius * std::sin(a)));
+    return g;
+}
+
+// x moved by k units in the last place
+double ulps(double x, int k)
+{
+    for (; k > 0; k--) x = std::nextafter(x, HUGE_VAL);
+    for (; k < 0; k++) x = std::nextafter(x, -HUGE_VAL);
+    return x;
+}
+
+// a wobbly star with n vertices and a square hole (ccw outside, cw hole, open rings)
+polygon make_star(size_t n)
+{
+    polygon star;
+    for (size_t i=0; i < n; i++)
+    {
+	double phi = 2 * M_PI * i / n;
+	double r = 1 + 0.3 * std::sin(7 * phi) + 0.05 * (static_cast<double>(std::rand()) / RAND_MAX);
+	bg::append(bg::exterior_ring(star), bg::make<point>(r * std::cos(phi), r * std::sin(phi)));
+    }
+    star.inners().resize(1);
+    bg::append(star.inners()[0], bg::make<point>(-0.2,-0.2));
+    bg::append(star.inners()[0], bg::make<point>(-0.2, 0.2));
+    bg::append(star.inners()[0], bg::make<point>( 0.2, 0.2));
+    bg::append(star.inners()[0], bg::make<point>( 0.2,-0.2));
+    return star;
+}
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = (argc > 1) ? std::atol(argv[1]) : 100000;
+    size_t vertices = (argc > 2) ? std::atol(argv[2]) : 10000;
+    std::srand(42);
+
+    // 1. one large polygon
+    {
+    polygon star = make_star(vertices);
+    std::vector<point> points(n);
+    for (auto &p: points) p = random_point_in_box(bg::make<box>(-1.5,-1.5,1.5,1.5));
+    // the difficult ones: vertices and edge midpoints
+    const auto &ring = bg::exterior_ring(star);
+    for (size_t i=0; i < ring.size() && i < n / 10; i++)
+    {
+	const point &a = ring[i], &b = ring[(i+1) % ring.size()];
+	points[2*i] = a;
+	points[2*i+1] = bg::make<point>((bg::get<0>(a)+bg::get<0>(b))/2, (bg::get<1>(a)+bg::get<1>(b))/2);
+    }
+
+    std::vector<int> expected(n), got(n);
+    double t_bg = seconds([&](){
+	for (size_t i=0; i < n; i++)
+	    expected[i] = bg::within(points[i], star) ? 1 : (bg::covered_by(points[i], star) ? 0 : -1);
+    });
+    spatial::prepared_polygon<polygon> *prepared = nullptr;
+    double t_prepare = seconds([&](){prepared = new spatial::prepared_polygon<polygon>(star);});
+    double t_prepared = seconds([&](){
+	for (size_t i=0; i < n; i++)
+	    got[i] = prepared->locate(points[i]);
+    });
+    size_t mismatches = 0, inside = 0, boundary = 0;
+    for (size_t i=0; i < n; i++)
+    {
+	if (expected[i] != got[i]) ++mismatches;
+	if (expected[i] > 0) ++inside;
+	if (expected[i] == 0) ++boundary;
+    }
+    std::cout << "Polygon with " << vertices << " vertices, " << n << " points ("
+	      << inside << " inside, " << boundary << " on the boundary)" << std::endl;
+    std::cout << " bg::within/covered_by: " << t_bg << " seconds" << std::endl;
+    std::cout << " prepared:              " << t_prepared << " seconds (+ " << t_prepare
+	      << " seconds to prepare), speedup " << t_bg / t_prepared << std::endl;
+    std::cout << " Results differing: " << mismatches << std::endl;
+    delete prepared;
+    if (mismatches){
+	std::cerr << "FAILED: prepared_polygon differs from bg::within / bg::covered_by" << std::endl;
+	return 1;
+    }
+    }
+
+    // 2. projected coordinates (metres): 7-gons far from the origin, in all four
+    // quadrants, and points a few units in the last place off their edges, where
+    // the rounding error of the side test is largest compared to its value
+    {
+    const size_t n_polygons = 1000, per_polygon = 400;
+    std::vector<polygon> polygons(n_polygons);
+    std::vector<spatial::prepared_polygon<polygon>> prepared;
+    prepared.reserve(n_polygons);
+    for (size_t j=0; j < n_polygons; j++)
+    {
+	const double sx = (j & 1) ? -1 : 1, sy = (j & 2) ? -1 : 1;
+	polygons[j] = make_ngon(sx * (5e6 + 1e6 * std::rand() / RAND_MAX), sy * (5e6 + 1e6 * std::rand() / RAND_MAX), 2e5, 7);
+	prepared.emplace_back(polygons[j]);
+    }
+    size_t mismatches = 0, boundary = 0;
+    for (size_t j=0; j < n_polygons; j++)
+	for (size_t i=0; i < per_polygon; i++)
+	{
+	    const auto &ring = bg::exterior_ring(polygons[j]);
+	    const point &a = ring[i % ring.size()], &b = ring[(i + 1) % ring.size()];
+	    double t = static_cast<double>(std::rand()) / RAND_MAX;
+	    point p = bg::make<point>(ulps(bg::get<0>(a) + t * (bg::get<0>(b) - bg::get<0>(a)), std::rand() % 17 - 8),
+				      ulps(bg::get<1>(a) + t * (bg::get<1>(b) - bg::get<1>(a)), std::rand() % 17 - 8));
+	    int expected = bg::within(p, polygons[j]) ? 1 : (bg::covered_by(p, polygons[j]) ? 0 : -1);
+	    boundary += (expected == 0);
+	    mismatches += (prepared[j].locate(p) != expected);
+	}
+    std::cout << "Projected 7-gons: " << n_polygons * per_polygon << " points next to the edges ("
+	      << boundary << " on the boundary)" << std::endl;
+    std::cout << " Results differing: " << mismatches << std::endl;
+    if (mismatches){
+	std::cerr << "FAILED: prepared_polygon differs from bg::within / bg::covered_by" << std::endl;
+	return 1;
+    }
+    }
+
+    // 3. GPS fixes against the buildings, the R-tree being the filter
+    {
+    spatial::polygon_store dataset;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", dataset, roi, spatial::default_threads());
+    rtree rt(spatial::envelopes(dataset)); // the envelopes the store computed at load
+
+    std::vector<spatial::prepared_polygon<spatial::polygon_view>> prepared;
+    double t_prepare = seconds([&](){
+	prepared.reserve(dataset.size());
+	for (const auto &poly: dataset)
+	    prepared.emplace_back(poly);
+    });
+
+    // random fixes hardly hit a building: half of them are placed in the box of a
+    // building, a quarter on one of its vertices
+    std::vector<point> fixes(n);
+    for (size_t i=0; i < n; i++)
+    {
+	size_t k = std::rand() % dataset.size();
+	auto building = dataset[k];
+	const box &b = dataset.envelope(k);
+	switch (i % 4){
+	    case 0: fixes[i] = building.exterior()[0]; break;
+	    case 1: fixes[i] = random_point_in_box(roi); break;
+	    default: fixes[i] = random_point_in_box(b);
+	}
+    }
+
+    std::vector<value> hits;
+    size_t candidates = 0, within_bg = 0, within_prepared = 0, mismatches = 0;
+    std::vector<char> expected;
+    expected.reserve(4 * n);
+    double t_bg = seconds([&](){
+	for (const auto &p: fixes)
+	{
+	    hits.clear();
+	    rt.query(bgi::intersects(p), std::back_inserter(hits));
+	    candidates += hits.size();
+	    for (const auto &h: hits)
+	    {
+		expected.push_back(bg::within(p, dataset[h.second]));
+		within_bg += expected.back();
+	    }
+	}
+    });
+    size_t j = 0;
+    double t_prepared = seconds([&](){
+	for (const auto &p: fixes)
+	{
+	    hits.clear();
+	    rt.query(bgi::intersects(p), std::back_inserter(hits));
+	    for (const auto &h: hits)
+	    {
+		bool w = prepared[h.second].within(p);
+		within_prepared += w;
+		mismatches += (w != static_cast<bool>(expected[j++]));
+	    }
+	}
+    });
+    std::cout << "Buildings: " << dataset.size() << " prepared in " << t_prepare << " seconds" << std::endl;
+    std::cout << " " << n << " fixes, " << candidates << " candidates, " << within_bg << " within a building" << std::endl;
+    std::cout << " R-tree + bg::within: " << t_bg << " seconds" << std::endl;
+    std::cout << " R-tree + prepared:   " << t_prepared << " seconds, speedup " << t_bg / t_prepared << std::endl;
+    std::cout << " Results differing: " << mismatches << " (" << within_prepared << " within)" << std::endl;
+    if (mismatches){
+	std::cerr << "FAILED: prepared_polygon differs from bg::within" << std::endl;
+	return 1;
+    }
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Distance kernels
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++11 -o 08_distance_kernels 08_distance_kernels.cpp
+*/
+
+// Micro-benchmark of the vectorized distance kernels (distance_kernels.hpp)
+// against one bg::comparable_distance at a time. Built without -march=native:
+// the AVX2 and AVX-512 versions are chosen at runtime.
+//
+// Two cases: one long packed array of boxes or points (candidate refinement) and
+// the boxes of R-tree leaves, i.e. 16 (box, id) pairs (leaf scans).
+//
+// Usage: 08_distance_kernels [elements] [rounds]
+
+#include<iostream>
+#include<chrono>
+#include<cstdlib>
+#include<cmath>
+#include<vector>
+#include <boost/geometry.hpp>
+
+#include "types.hpp"
+#include "distance_kernels.hpp"
+
+double random_double(double lo, double hi)
+{
+    return lo + (hi - lo) * static_cast<double>(std::rand()) / RAND_MAX;
+}
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+double max_difference(const std::vector<double> &a, const std::vector<double> &b)
+{
+    double d = 0;
+    for (size_t i=0; i < a.size(); i++)
+	d = std::max(d, std::fabs(a[i] - b[i]) / std::max(1e-300, std::fabs(a[i])));
+    return d;
+}
+
+// time the kernels at every level against the Boost loop; get(e) is the geometry of element e
+template<typename Element, typename Kernel, typename Get>
+void compare(const char *name, const std::vector<point> &queries, const std::vector<Element> &elements,
+	     size_t block, Kernel kernel, Get get)
+{
+    const size_t n = elements.size();
+    std::vector<double> expected(n), got(n);
+    double t_bg = seconds([&](){
+	for (const auto &q: queries)
+	    for (size_t i=0; i < n; i++)
+		expected[i] = bg::comparable_distance(q, get(elements[i]));
+    });
+    std::cout << name << ": " << queries.size() << " x " << n << " in blocks of " << block << std::endl;
+    std::cout << "  bg::comparable_distance " << t_bg << " seconds" << std::endl;
+
+    for (int l = spatial::simd_scalar; l <= spatial::best_simd_level(); l++)
+    {
+	spatial::simd_level level = static_cast<spatial::simd_level>(l);
+	double t = seconds([&](){
+	    for (const auto &q: queries)
+		for (size_t i=0; i < n; i += block)
+		    kernel(q, &elements[i], std::min(block, n - i), &got[i], level);
+	});
+	std::cout << "  " << spatial::simd_level_name(level) << "\t\t\t  " << t << " seconds, speedup "
+		  << t_bg / t << ", max. relative difference " << max_difference(expected, got) << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = (argc > 1) ? std::atol(argv[1]) : 4096;
+    size_t rounds = (argc > 2) ? std::atol(argv[2]) : 2000;
+    std::srand(42);
+    std::cout << "Best SIMD level of this CPU: " << spatial::simd_level_name(spatial::best_simd_level()) << std::endl;
+
+    // buildings around Washington DC
+    std::vector<box> boxes(n);
+    std::vector<point> points(n);
+    for (size_t i=0; i < n; i++)
+    {
+	double x = random_double(-77.12, -76.91), y = random_double(38.80, 38.99);
+	boxes[i] = bg::make<box>(x, y, x + random_double(0, 0.001), y + random_double(0, 0.001));
+	points[i] = bg::make<point>(x, y);
+    }
+    std::vector<point> queries(rounds);
+    for (auto &q: queries) q = bg::make<point>(random_double(-77.12, -76.91), random_double(38.80, 38.99));
+
+    auto packed_boxes = [](const point &q, const box *b, size_t m, double *out, spatial::simd_level level){
+	spatial::comparable_distances(q, b, m, out, level);
+    };
+    auto packed_points = [](const point &q, const point *p, size_t m, double *out, spatial::simd_level level){
+	spatial::comparable_distances(q, p, m, out, level);
+    };
+    auto self = [](const box &b) -> const box & {return b;};
+    auto self_point = [](const point &p) -> const point & {return p;};
+    compare("Point to box", queries, boxes, n, packed_boxes, self);
+    compare("Point to point", queries, points, n, packed_points, self_point);
+
+    // R-tree leaves: blocks of 16 values (box, id), the boxes sizeof(value) bytes apart
+    std::vector<value> leaves(n);
+    for (size_t i=0; i < n; i++) leaves[i] = value(boxes[i], i);
+    auto leaf = [](const point &q, const value *v, size_t m, double *out, spatial::simd_level level){
+	spatial::comparable_distances(q, &v->first, sizeof(value), m, out, level);
+    };
+    compare("R-tree leaves", queries, leaves, 16, leaf, [](const value &v) -> const box & {return v.first;});
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Batch haversine
+Compile: g++ -I $(BOOST_DIR) -O3 -Wall -std=c++11 -o 09_haversine 09_haversine.cpp
+*/
+
+// The great-circle distance of 01_sphere.cpp for many pairs at once: Boost.Geometry
+// one pair at a time against haversine_distances (haversine.hpp) on the same
+// coordinates, with the largest deviation from Boost.Geometry. Three inputs: a
+// GPS track with steps of a few meters, random pairs on the globe and pairs that
+// are nearly antipodal.
+//
+// Usage: 09_haversine [pairs]
+
+#include<iostream>
+#include<chrono>
+#include<cstdlib>
+#include<cmath>
+#include<vector>
+#include <boost/geometry.hpp>
+
+#include "haversine.hpp"
+
+namespace bg = boost::geometry;
+
+typedef bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>> spherical_point;
+
+double const earth_radius = 6371; // km
+
+double random_double(double lo, double hi)
+{
+    return lo + (hi - lo) * static_cast<double>(std::rand()) / RAND_MAX;
+}
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+// SoA coordinates of n pairs
+struct pairs
+{
+    std::vector<double> lon1, lat1, lon2, lat2;
+    explicit pairs(size_t n): lon1(n), lat1(n), lon2(n), lat2(n) {}
+    size_t size() const {return lon1.size();}
+};
+
+void compare(const char *name, const pairs &p)
+{
+    const size_t n = p.size();
+    std::vector<double> expected(n), got(n);
+    double t_bg = seconds([&](){
+	for (size_t i=0; i < n; i++)
+	    expected[i] = bg::distance(spherical_point(p.lon1[i], p.lat1[i]),
+				       spherical_point(p.lon2[i], p.lat2[i])) * earth_radius;
+    });
+    std::cout << name << ": " << n << " pairs" << std::endl;
+    std::cout << "  bg::distance\t" << t_bg << " seconds (" << n / t_bg / 1e6 << " M pairs/s)" << std::endl;
+    for (int l = spatial::simd_scalar; l <= spatial::best_simd_level(); l++)
+    {
+	spatial::simd_level level = static_cast<spatial::simd_level>(l);
+	double t = seconds([&](){
+	    spatial::haversine_distances(p.lon1.data(), p.lat1.data(), p.lon2.data(), p.lat2.data(),
+					 n, got.data(), earth_radius, level);
+	});
+	double max_abs = 0, max_rel = 0;
+	for (size_t i=0; i < n; i++)
+	{
+	    double d = std::fabs(got[i] - expected[i]);
+	    max_abs = std::max(max_abs, d);
+	    if (expected[i] > 0) max_rel = std::max(max_rel, d / expected[i]);
+	}
+	std::cout << "  " << spatial::simd_level_name(level) << "\t" << t << " seconds (" << n / t / 1e6
+		  << " M pairs/s), speedup " << t_bg / t << ", max. error " << max_abs * 1e6 << " mm ("
+		  << max_rel << " relative)" << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = (argc > 1) ? std::atol(argv[1]) : 4000000;
+    std::srand(42);
+
+    // a random walk around Washington DC with steps of up to ~10 m: consecutive fixes
+    std::vector<double> lon(n + 1), lat(n + 1);
+    lon[0] = -77.03; lat[0] = 38.89;
+    for (size_t i=1; i <= n; i++)
+    {
+	lon[i] = lon[i-1] + random_double(-1e-4, 1e-4);
+	lat[i] = lat[i-1] + random_double(-1e-4, 1e-4);
+    }
+    pairs track(n);
+    track.lon1.assign(lon.begin(), lon.end() - 1); track.lat1.assign(lat.begin(), lat.end() - 1);
+    track.lon2.assign(lon.begin() + 1, lon.end()); track.lat2.assign(lat.begin() + 1, lat.end());
+    compare("GPS track", track);
+
+    pairs globe(n), antipodes(n);
+    for (size_t i=0; i < n; i++)
+    {
+	globe.lon1[i] = random_double(-180, 180); globe.lat1[i] = random_double(-90, 90);
+	globe.lon2[i] = random_double(-180, 180); globe.lat2[i] = random_double(-90, 90);
+	antipodes.lon1[i] = globe.lon1[i]; antipodes.lat1[i] = globe.lat1[i];
+	antipodes.lon2[i] = globe.lon1[i] + ((globe.lon1[i] < 0) ? 180 : -180) + random_double(-1e-3, 1e-3);
+	antipodes.lat2[i] = -globe.lat1[i] + random_double(-1e-3, 1e-3);
+    }
+    compare("Random pairs", globe);
+    compare("Nearly antipodal pairs", antipodes);
+
+    // the same track through the trajectory interface
+    std::vector<double> steps(n);
+    spatial::haversine_track(lon.data(), lat.data(), n + 1, steps.data(), earth_radius);
+    double length = 0;
+    for (auto s: steps) length += s;
+    std::cout << "Length of the track: " << length << " km" << std::endl;
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Geodesic tiers
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++11 -o 10_geodesic 10_geodesic.cpp
+*/
+
+// Throughput versus error of the geodesic formulas: bg::distance with the Andoyer,
+// Thomas and Vincenty strategies against the prepared points of geodesic.hpp. The
+// error is measured against Vincenty's iteration in long double (accurate to some
+// micrometers; the Karney formula of Boost 1.74 is still experimental and off by
+// kilometers). Inputs are a GPS track with steps of a few meters and random pairs.
+//
+// Usage: 10_geodesic [pairs]
+
+#include<iostream>
+#include<chrono>
+#include<cstdlib>
+#include<cmath>
+#include<vector>
+#include <boost/geometry.hpp>
+
+#include "geodesic.hpp"
+
+namespace bg = boost::geometry;
+
+typedef bg::model::point<double, 2, bg::cs::geographic<bg::degree>> geographic_point;
+
+double random_double(double lo, double hi)
+{
+    return lo + (hi - lo) * static_cast<double>(std::rand()) / RAND_MAX;
+}
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+void report(const char *name, double t, size_t n, const std::vector<double> &got, const std::vector<double> &reference)
+{
+    double max_error = 0, sum = 0;
+    for (size_t i=0; i < n; i++)
+    {
+	double e = std::fabs(got[i] - reference[i]);
+	max_error = std::max(max_error, e);
+	sum += e;
+    }
+    std::cout << "  " << name << "\t" << n / t / 1e6 << " M pairs/s, error max. " << max_error * 1000
+	      << " mm, mean " << sum / n * 1000 << " mm" << std::endl;
+}
+
+template<typename Strategy>
+void boost_tier(const char *name, const std::vector<geographic_point> &p, const std::vector<geographic_point> &q,
+		const std::vector<double> &reference, Strategy strategy)
+{
+    std::vector<double> d(p.size());
+    double t = seconds([&](){
+	for (size_t i=0; i < p.size(); i++)
+	    d[i] = bg::distance(p[i], q[i], strategy);
+    });
+    report(name, t, p.size(), d, reference);
+}
+
+// p[i] to q[i]; in a track q is p shifted by one, so every fix is prepared only once
+void compare(const char *name, const std::vector<geographic_point> &p, const std::vector<geographic_point> &q,
+	     bool is_track)
+{
+    const size_t n = p.size();
+    typedef bg::formula::vincenty_inverse<long double, true, false> reference_formula;
+    const long double d2r = M_PI / 180;
+    std::vector<double> reference(n);
+    for (size_t i=0; i < n; i++)
+	reference[i] = reference_formula::apply(bg::get<0>(p[i]) * d2r, bg::get<1>(p[i]) * d2r,
+						bg::get<0>(q[i]) * d2r, bg::get<1>(q[i]) * d2r,
+						bg::srs::spheroid<long double>()).distance;
+    std::cout << name << ": " << n << " pairs" << std::endl;
+
+    std::cout << " bg::distance" << std::endl;
+    boost_tier("andoyer", p, q, reference, bg::strategy::distance::andoyer<>());
+    boost_tier("thomas", p, q, reference, bg::strategy::distance::thomas<>());
+    boost_tier("vincenty", p, q, reference, bg::strategy::distance::vincenty<>());
+
+    spatial::geodesic geodesic;
+    std::vector<double> lon(n + 1), lat(n + 1), d(n);
+    for (size_t i=0; i < n; i++)
+    {
+	lon[i] = bg::get<0>(p[i]);
+	lat[i] = bg::get<1>(p[i]);
+    }
+    lon[n] = bg::get<0>(q[n-1]);
+    lat[n] = bg::get<1>(q[n-1]);
+    std::vector<spatial::geodesic_point> prepared(n + 1), prepared_q;
+    double t_prepare = seconds([&](){
+	geodesic.prepare(lon.data(), lat.data(), n + 1, prepared.data());
+	if (!is_track){
+	    prepared_q.resize(n);
+	    for (size_t i=0; i < n; i++)
+		prepared_q[i] = geodesic.prepare(bg::get<0>(q[i]), bg::get<1>(q[i]));
+	}
+    });
+    std::cout << " geodesic.hpp (preparing the points: " << n / t_prepare / 1e6 << " M pairs/s)" << std::endl;
+    for (int f = spatial::geodesic_andoyer; f <= spatial::geodesic_vincenty; f++)
+    {
+	spatial::geodesic_formula formula = static_cast<spatial::geodesic_formula>(f);
+	double t = seconds([&](){
+	    if (is_track)
+		geodesic.track(prepared.data(), n + 1, d.data(), formula);
+	    else
+		geodesic.distances(prepared.data(), prepared_q.data(), n, d.data(), formula);
+	});
+	report(spatial::geodesic_formula_name(formula), t + t_prepare, n, d, reference);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = (argc > 1) ? std::atol(argv[1]) : 1000000;
+    std::srand(42);
+
+    // a random walk around Washington DC with steps of up to ~10 m
+    std::vector<geographic_point> track(n + 1);
+    track[0] = geographic_point(-77.03, 38.89);
+    for (size_t i=1; i <= n; i++)
+	track[i] = geographic_point(bg::get<0>(track[i-1]) + random_double(-1e-4, 1e-4),
+				    bg::get<1>(track[i-1]) + random_double(-1e-4, 1e-4));
+    std::vector<geographic_point> from(track.begin(), track.end() - 1), to(track.begin() + 1, track.end());
+    compare("GPS track", from, to, true);
+
+    // random pairs, not (nearly) antipodal where Vincenty does not converge
+    std::vector<geographic_point> p(n), q(n);
+    for (size_t i=0; i < n; i++)
+    {
+	p[i] = geographic_point(random_double(-180, 180), random_double(-85, 85));
+	q[i] = geographic_point(bg::get<0>(p[i]) + random_double(-150, 150), random_double(-85, 85));
+	if (bg::get<0>(q[i]) > 180) bg::set<0>(q[i], bg::get<0>(q[i]) - 360);
+	if (bg::get<0>(q[i]) < -180) bg::set<0>(q[i], bg::get<0>(q[i]) + 360);
+    }
+    compare("Random pairs", p, q, false);
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Batch sphere transform
+Compile: g++ -I $(BOOST_DIR) -Ofast -march=native -Wall -std=c++11 -pthread -o 11_sphere_transform 11_sphere_transform.cpp
+*/
+
+// The transformation of 01_sphere.cpp for a whole data set: bg::transform one point
+// at a time against spherical_to_xyz (sphere_transform.hpp) into x, y, z arrays, on
+// one and on all threads, and back with xyz_to_spherical. Then the chord ("drill
+// hole") distances along a track, once with the transformation in every query and
+// once on the transformed arrays. Built with -Ofast as the R-tree programs, which
+// must not change the results: larger errors than 1e-12 fail the program.
+//
+// Usage: 11_sphere_transform [points]
+
+#include<iostream>
+#include<chrono>
+#include<cstdlib>
+#include<cmath>
+#include<vector>
+#include <boost/geometry.hpp>
+
+#include "sphere_transform.hpp"
+
+namespace bg = boost::geometry;
+
+typedef bg::model::point<double, 2, bg::cs::spherical_equatorial<bg::degree>> spherical_point;
+typedef bg::model::point<double, 3, bg::cs::cartesian> cartesian_point;
+
+double const earth_radius = 6371; // km
+
+double random_double(double lo, double hi)
+{
+    return lo + (hi - lo) * static_cast<double>(std::rand()) / RAND_MAX;
+}
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+double max_difference(const std::vector<double> &a, const std::vector<double> &b)
+{
+    double m = 0;
+    for (size_t i=0; i < a.size(); i++)
+	m = std::max(m, std::fabs(a[i] - b[i]));
+    return m;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = (argc > 1) ? std::atol(argv[1]) : 4000000;
+    std::srand(42);
+    std::vector<double> lon(n), lat(n);
+    for (size_t i=0; i < n; i++)
+    {
+	lon[i] = random_double(-180, 180);
+	lat[i] = random_double(-90, 90);
+    }
+
+    std::vector<double> ex(n), ey(n), ez(n);
+    auto tf = [](const spherical_point &p)->cartesian_point { cartesian_point ret; bg::transform(p, ret); return ret;};
+    double t_bg = seconds([&](){
+	for (size_t i=0; i < n; i++)
+	{
+	    cartesian_point c = tf(spherical_point(lon[i], lat[i]));
+	    ex[i] = bg::get<0>(c); ey[i] = bg::get<1>(c); ez[i] = bg::get<2>(c);
+	}
+    });
+    std::cout << n << " points" << std::endl;
+    std::cout << "  bg::transform\t" << t_bg << " seconds (" << n / t_bg / 1e6 << " M points/s)" << std::endl;
+
+    std::vector<double> x(n), y(n), z(n), lon2(n), lat2(n);
+    std::vector<unsigned> thread_counts(1, 1);
+    if (spatial::default_threads() > 1) thread_counts.push_back(spatial::default_threads());
+    for (int l = spatial::simd_scalar; l <= spatial::best_simd_level(); l++)
+	for (unsigned threads: thread_counts)
+	{
+	    spatial::simd_level level = static_cast<spatial::simd_level>(l);
+	    double t = seconds([&](){ spatial::spherical_to_xyz(lon.data(), lat.data(), n, x.data(), y.data(), z.data(),
+								 level, threads); });
+	    double t_back = seconds([&](){ spatial::xyz_to_spherical(x.data(), y.data(), z.data(), n,
+								      lon2.data(), lat2.data(), level, threads); });
+	    double error = std::max(max_difference(x, ex), std::max(max_difference(y, ey), max_difference(z, ez)));
+	    std::cout << "  " << spatial::simd_level_name(level) << ", " << threads << " thread(s)\t"
+		      << t << " seconds, speedup " << t_bg / t << ", max. error " << error
+		      << "; back in " << t_back << " seconds, max. error " << max_difference(lon, lon2) << " / "
+		      << max_difference(lat, lat2) << " degrees" << std::endl;
+	    if (error > 1e-12 || max_difference(lon, lon2) > 1e-10 || max_difference(lat, lat2) > 1e-10){
+		std::cerr << "FAILED: " << spatial::simd_level_name(level) << " differs from bg::transform" << std::endl;
+		return 1;
+	    }
+	}
+
+    // drill holes between consecutive points
+    double sum_bg = 0, sum = 0;
+    double t_query = seconds([&](){
+	for (size_t i=0; i + 1 < n; i++)
+	    sum_bg += bg::distance(tf(spherical_point(lon[i], lat[i])), tf(spherical_point(lon[i+1], lat[i+1])));
+    });
+    double t_arrays = seconds([&](){
+	for (size_t i=0; i + 1 < n; i++)
+	{
+	    double dx = x[i+1] - x[i], dy = y[i+1] - y[i], dz = z[i+1] - z[i];
+	    sum += std::sqrt(dx * dx + dy * dy + dz * dz);
+	}
+    });
+    std::cout << "Drill holes: " << sum_bg * earth_radius << " km in " << t_query
+	      << " seconds transforming every query, " << sum * earth_radius << " km in " << t_arrays
+	      << " seconds on the transformed arrays" << std::endl;
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Sphere index
+Compile: g++ -I $(BOOST_DIR) -Ofast -march=native -Wall -std=c++11 -pthread -o 12_sphere_index 12_sphere_index.cpp
+*/
+
+// Points all over the globe in the planar R-tree of 03_rtree.cpp (lon/lat degrees as
+// x and y) and in sphere_index (unit vectors in a 3D R-tree). Queries at indexed
+// points must find them at distance 0. The kNN results of
+// both are checked against a brute force scan with the haversine distance, for
+// queries anywhere, near the poles and next to the antimeridian, as are the radius
+// queries of sphere_index; then the throughput of both. Built with the -Ofast flags
+// of 03_rtree; a wrong answer of sphere_index fails the program.
+//
+// Usage: 12_sphere_index [points] [queries]
+
+#include<iostream>
+#include<chrono>
+#include<cstdlib>
+#include<cmath>
+#include<vector>
+#include<algorithm>
+
+#include "types.hpp"
+#include "sphere_index.hpp"
+#include "haversine.hpp"
+
+double const earth_radius = 6371; // km
+
+double random_double(double lo, double hi)
+{
+    return lo + (hi - lo) * static_cast<double>(std::rand()) / RAND_MAX;
+}
+
+// uniform on the sphere
+double random_latitude(double lo, double hi)
+{
+    const double d2r = M_PI / 180;
+    return std::asin(random_double(std::sin(lo * d2r), std::sin(hi * d2r))) / d2r;
+}
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+struct query_set
+{
+    const char *name;
+    std::vector<double> lon, lat;
+};
+
+int main(int argc, char **argv)
+{
+    size_t n = (argc > 1) ? std::atol(argv[1]) : 1000000;
+    size_t n_queries = (argc > 2) ? std::atol(argv[2]) : 100000;
+    const size_t k = 10, checked = 200;
+    std::srand(42);
+
+    std::vector<double> lon(n), lat(n);
+    for (size_t i=0; i < n; i++)
+    {
+	lon[i] = random_double(-180, 180);
+	lat[i] = random_latitude(-90, 90);
+    }
+
+    point_rtree planar;
+    double t_planar = seconds([&](){
+	std::vector<point_value> values;
+	for (size_t i=0; i < n; i++)
+	    values.push_back(point_value(point(lon[i], lat[i]), i));
+	planar = point_rtree(values);
+    });
+    spatial::sphere_index sphere;
+    double t_sphere = seconds([&](){ sphere = spatial::sphere_index(lon.data(), lat.data(), n, earth_radius); });
+    std::cout << n << " points, bulk loading: planar " << t_planar << " seconds, sphere " << t_sphere
+	      << " seconds" << std::endl;
+
+    // a query at an indexed point finds it at distance 0: the points and the queries
+    // are transformed by the same kernel
+    size_t not_found = 0;
+    for (size_t i=0; i < n; i += std::max<size_t>(1, n / 1000))
+    {
+	std::vector<spatial::neighbor> self;
+	sphere.within_distance(lon[i], lat[i], 0, std::back_inserter(self));
+	not_found += std::none_of(self.begin(), self.end(), [&](const spatial::neighbor &v){ return v.second == i; });
+    }
+    std::cout << "Indexed points not found at distance 0: " << not_found << std::endl;
+    if (not_found){
+	std::cerr << "FAILED: sphere_index maps queries to other points than the indexed ones" << std::endl;
+	return 1;
+    }
+
+    query_set sets[3] = {{"anywhere", {}, {}}, {"polar", {}, {}}, {"antimeridian", {}, {}}};
+    for (size_t i=0; i < n_queries; i++)
+    {
+	sets[0].lon.push_back(random_double(-180, 180));
+	sets[0].lat.push_back(random_latitude(-90, 90));
+	sets[1].lon.push_back(random_double(-180, 180));
+	sets[1].lat.push_back((i % 2 ? 1 : -1) * random_latitude(85, 90));
+	sets[2].lon.push_back((i % 2 ? 1 : -1) * random_double(179.5, 180));
+	sets[2].lat.push_back(random_latitude(-60, 60));
+    }
+
+    std::vector<double> d(n);
+    for (const auto &s: sets)
+    {
+	// the true k nearest by a scan over all points
+	size_t wrong_planar = 0, wrong_sphere = 0, wrong_range = 0;
+	for (size_t q=0; q < checked; q++)
+	{
+	    std::vector<double> qlon(n, s.lon[q]), qlat(n, s.lat[q]);
+	    spatial::haversine_distances(qlon.data(), qlat.data(), lon.data(), lat.data(), n, d.data(), earth_radius);
+	    std::vector<spatial::neighbor> truth;
+	    for (size_t i=0; i < n; i++) truth.push_back(spatial::neighbor(d[i], i));
+	    std::partial_sort(truth.begin(), truth.begin() + k, truth.end());
+	    std::vector<size_t> expected, got;
+	    for (size_t i=0; i < k; i++) expected.push_back(truth[i].second);
+	    std::sort(expected.begin(), expected.end());
+
+	    planar.query(bgi::nearest(point(s.lon[q], s.lat[q]), k), boost::make_function_output_iterator(
+		[&](const point_value &v){ got.push_back(v.second); }));
+	    std::sort(got.begin(), got.end());
+	    wrong_planar += (got != expected);
+
+	    std::vector<spatial::neighbor> neighbors;
+	    sphere.knn(s.lon[q], s.lat[q], k, std::back_inserter(neighbors));
+	    got.clear();
+	    for (const auto &nb: neighbors) got.push_back(nb.second);
+	    std::sort(got.begin(), got.end());
+	    wrong_sphere += (got != expected);
+
+	    size_t within = std::count_if(d.begin(), d.end(), [](double x){ return x <= 50; });
+	    wrong_range += (within != sphere.within_distance(s.lon[q], s.lat[q], 50, boost::make_function_output_iterator(
+		[](const spatial::neighbor &){})));
+	}
+
+	size_t id_sum = 0; // printed, so that the queries are not optimized away
+	double t_knn_planar = seconds([&](){
+	    for (size_t q=0; q < n_queries; q++)
+		planar.query(bgi::nearest(point(s.lon[q], s.lat[q]), k), boost::make_function_output_iterator(
+		    [&](const point_value &v){ id_sum += v.second; }));
+	});
+	double t_knn_sphere = seconds([&](){
+	    for (size_t q=0; q < n_queries; q++)
+		sphere.knn(s.lon[q], s.lat[q], k, boost::make_function_output_iterator(
+		    [&](const spatial::neighbor &v){ id_sum += v.second; }));
+	});
+	size_t found = 0;
+	double t_range = seconds([&](){
+	    for (size_t q=0; q < n_queries; q++)
+		found += sphere.within_distance(s.lon[q], s.lat[q], 50, boost::make_function_output_iterator(
+		    [&](const spatial::neighbor &v){ id_sum += v.second; }));
+	});
+	std::cout << s.name << " queries: " << k << "-NN wrong in " << wrong_planar << " (planar) and "
+		  << wrong_sphere << " (sphere) of " << checked << ", within 50 km wrong in " << wrong_range << std::endl;
+	if (wrong_sphere || wrong_range){
+	    std::cerr << "FAILED: sphere_index differs from the haversine scan" << std::endl;
+	    return 1;
+	}
+	std::cout << "  kNN: planar " << n_queries / t_knn_planar << " queries/s, sphere "
+		  << n_queries / t_knn_sphere << " queries/s; within 50 km: " << n_queries / t_range
+		  << " queries/s, " << static_cast<double>(found) / n_queries << " points per query, id sum "
+		  << id_sum << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Result writer
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++17 -pthread -o 13_result_writer 13_result_writer.cpp
+*/
+
+// All buildings written as a CSV of WKT and OSM id, as 03_rtree writes its results:
+// through an ofstream with bg::wkt and std::endl, then with result_writer in the
+// calling thread and with a background thread. The result_writer file is read back
+// to check that every coordinate survived the round trip.
+//
+// Usage: 13_result_writer [output file]
+
+#include<iostream>
+#include<fstream>
+#include<chrono>
+#include<string>
+#include<limits>
+#include<iomanip>
+#include <boost/geometry.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "result_writer.hpp"
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+int main(int argc, char **argv)
+{
+    std::string filename = (argc > 1) ? argv[1] : "buildings.csv";
+    spatial::polygon_store dataset;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", dataset, roi, spatial::default_threads());
+    std::cout << "Dataset contains " << dataset.size() << " polygons" << std::endl;
+
+    double t_stream = seconds([&](){
+	std::ofstream ofs(filename);
+	ofs << std::setprecision(std::numeric_limits<double>::digits10);
+	ofs << "wkt;id" << std::endl;
+	for (size_t i=0; i < dataset.size(); i++)
+	    ofs << bg::wkt(dataset[i]) << ";" << dataset.id(i) << std::endl;
+    });
+    std::cout << "  ofstream, bg::wkt, std::endl\t" << t_stream << " seconds" << std::endl;
+
+    for (bool background: {false, true})
+    {
+	double t = seconds([&](){
+	    spatial::result_writer out(filename, background);
+	    out << "wkt;id\n";
+	    for (size_t i=0; i < dataset.size(); i++)
+		out.wkt(dataset[i]) << ';' << dataset.id(i) << '\n';
+	    out.close();
+	});
+	std::cout << "  result_writer" << (background ? ", background" : "") << "\t" << t << " seconds, speedup "
+		  << t_stream / t << std::endl;
+    }
+
+    // read back: the same polygons, bit for bit, with the same ids
+    auto same_ring = [](const auto &r, const polygon::ring_type &s){
+	return r.size() == s.size()
+	    && std::equal(r.begin(), r.end(), s.begin(), [](const point &a, const point &b){
+		    return bg::get<0>(a) == bg::get<0>(b) && bg::get<1>(a) == bg::get<1>(b); });
+    };
+    std::ifstream ifs(filename);
+    std::string line;
+    std::getline(ifs, line);
+    size_t i = 0, different = 0;
+    for (; std::getline(ifs, line) && i < dataset.size(); i++)
+    {
+	polygon p;
+	size_t sep = line.find(';');
+	bg::read_wkt(line.substr(0, sep), p);
+	auto q = dataset[i];
+	bool same = std::to_string(dataset.id(i)) == line.substr(sep + 1) && same_ring(bg::exterior_ring(q), p.outer())
+	    && bg::interior_rings(q).size() == p.inners().size();
+	for (size_t k=0; same && k < p.inners().size(); k++)
+	    same = same_ring(bg::interior_rings(q)[k], p.inners()[k]);
+	different += !same;
+    }
+    std::cout << "Read back " << i << " of " << dataset.size() << " polygons, " << different << " different" << std::endl;
+    if (different || i != dataset.size() || std::getline(ifs, line)){
+	std::cerr << "FAILED: the file does not hold the polygons of the dataset" << std::endl;
+	return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Packing strategies
+Compile: g++ -I $(BOOST_DIR) -Ofast -march=native -Wall -std=c++11 -pthread -o 14_packing 14_packing.cpp
+*/
+
+// The buildings of 03_rtree in R-trees built in different ways: bgi::rtree by
+// insertion and by its packing constructor, and packed_rtree with STR, Hilbert and
+// OMT packing for fanouts 8, 16 and 32. For each tree: build time, number of
+// nodes, height, coverage and overlap of the nodes, and the latency of kNN
+// (k = 10) and range queries (boxes of 0.003 degrees) at random points.
+//
+// Usage: 14_packing [queries]
+
+#include<iostream>
+#include<iomanip>
+#include<chrono>
+#include<cstdlib>
+#include<vector>
+#include <boost/geometry.hpp>
+#include <boost/function_output_iterator.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "packed_rtree.hpp"
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+point random_point_in_box(const box &b)
+{
+    double tau1 = static_cast<double>(std::rand()) / RAND_MAX;
+    double tau2 = static_cast<double>(std::rand()) / RAND_MAX;
+    return point(bg::get<bg::min_corner,0>(b) + tau1 * (bg::get<bg::max_corner,0>(b) - bg::get<bg::min_corner,0>(b)),
+		 bg::get<bg::min_corner,1>(b) + tau2 * (bg::get<bg::max_corner,1>(b) - bg::get<bg::min_corner,1>(b)));
+}
+
+std::vector<point> queries;
+std::vector<box> ranges;
+
+void report(const std::string &name, double t_build, const spatial::tree_stats &s, double t_knn, double t_range,
+	    double knn_sum, size_t range_sum)
+{
+    std::cout << std::left << std::setw(18) << name << std::right << std::setw(10) << t_build
+	      << std::setw(8) << s.nodes << std::setw(4) << s.height
+	      << std::setw(12) << s.coverage << std::setw(12) << s.overlap
+	      << std::setw(10) << t_knn / queries.size() * 1e6 << std::setw(10) << t_range / ranges.size() * 1e6
+	      << std::setw(14) << knn_sum << std::setw(14) << range_sum << std::endl;
+}
+
+template<typename Rtree>
+void run_bgi(const std::string &name, double t_build, const Rtree &rt)
+{
+    double knn_sum = 0;
+    size_t range_sum = 0;
+    double t_knn = seconds([&](){
+	for (const auto &q: queries)
+	    rt.query(bgi::nearest(q, 10), boost::make_function_output_iterator([&](const value &v){
+		knn_sum += bg::distance(q, v.first); }));
+    });
+    double t_range = seconds([&](){
+	for (const auto &r: ranges)
+	    rt.query(bgi::intersects(r), boost::make_function_output_iterator([&](const value &v){ range_sum += v.second; }));
+    });
+    report(name, t_build, spatial::rtree_stats(rt), t_knn, t_range, knn_sum, range_sum);
+}
+
+template<size_t Fanout>
+void run_packed(const std::vector<value> &values)
+{
+    for (int p = spatial::packing_str; p <= spatial::packing_omt; p++)
+    {
+	spatial::packing packing = static_cast<spatial::packing>(p);
+	spatial::packed_rtree<Fanout> rt;
+	double t_build = seconds([&](){ rt = spatial::packed_rtree<Fanout>(values, packing); });
+	double knn_sum = 0;
+	size_t range_sum = 0;
+	double t_knn = seconds([&](){
+	    for (const auto &q: queries)
+		rt.nearest(q, 10, boost::make_function_output_iterator([&](const value &v){
+		    knn_sum += bg::distance(q, v.first); }));
+	});
+	double t_range = seconds([&](){
+	    for (const auto &r: ranges)
+		rt.query_intersects(r, [&](const box &, size_t id){ range_sum += id; });
+	});
+	report(std::string(spatial::packing_name(packing)) + " " + std::to_string(Fanout), t_build, rt.stats(),
+	       t_knn, t_range, knn_sum, range_sum);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t n_queries = (argc > 1) ? std::atol(argv[1]) : 100000;
+    spatial::polygon_store dataset;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", dataset, roi, spatial::default_threads());
+    std::vector<value> values = spatial::envelopes(dataset, 1); // the envelopes the store computed at load
+    std::cout << "Dataset contains " << values.size() << " polygons" << std::endl;
+
+    std::srand(42);
+    for (size_t i=0; i < n_queries; i++)
+    {
+	point p = random_point_in_box(roi);
+	queries.push_back(p);
+	ranges.push_back(box(point(bg::get<0>(p) - 0.0015, bg::get<1>(p) - 0.0015),
+			     point(bg::get<0>(p) + 0.0015, bg::get<1>(p) + 0.0015)));
+    }
+
+    // the sums of the kNN box distances and of the ids in the ranges are the same for all trees
+    std::cout << std::left << std::setw(18) << "tree" << std::right << std::setw(10) << "build [s]"
+	      << std::setw(8) << "nodes" << std::setw(4) << "h" << std::setw(12) << "coverage" << std::setw(12)
+	      << "overlap" << std::setw(10) << "kNN [us]" << std::setw(10) << "range [us]"
+	      << std::setw(14) << "kNN sum" << std::setw(14) << "range sum" << std::endl;
+    {
+	rtree rt;
+	double t = seconds([&](){ for (const auto &v: values) rt.insert(v); });
+	run_bgi("rstar insert", t, rt);
+    }
+    {
+	rtree rt;
+	double t = seconds([&](){ rt = rtree(values); });
+	run_bgi("rstar packing", t, rt);
+    }
+    run_packed<8>(values);
+    run_packed<16>(values);
+    run_packed<32>(values);
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Parallel bulk loading
+Compile: g++ -I $(BOOST_DIR) -Ofast -march=native -Wall -std=c++11 -pthread -o 15_parallel_bulk_load 15_parallel_bulk_load.cpp
+*/
+
+// Bulk loading of the buildings on one thread and on many: the envelopes, then
+// packed_rtree with each packing. The trees of both runs are compared node by
+// node and entry by entry; they must be identical.
+//
+// Usage: 15_parallel_bulk_load [threads] [copies]
+//        copies > 1 repeats the buildings, shifted, to get a larger data set
+
+#include<iostream>
+#include<chrono>
+#include<thread>
+#include<cstdlib>
+#include<vector>
+#include <boost/geometry.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "packed_rtree.hpp"
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+bool same_box(const box &a, const box &b)
+{
+    return bg::get<bg::min_corner,0>(a) == bg::get<bg::min_corner,0>(b)
+	&& bg::get<bg::min_corner,1>(a) == bg::get<bg::min_corner,1>(b)
+	&& bg::get<bg::max_corner,0>(a) == bg::get<bg::max_corner,0>(b)
+	&& bg::get<bg::max_corner,1>(a) == bg::get<bg::max_corner,1>(b);
+}
+
+template<typename Tree>
+bool same_tree(const Tree &a, const Tree &b)
+{
+    if (a.all_nodes().size() != b.all_nodes().size() || a.entry_ids() != b.entry_ids()) return false;
+    for (size_t i=0; i < a.all_nodes().size(); i++)
+    {
+	const auto &m = a.all_nodes()[i], &n = b.all_nodes()[i];
+	if (m.first != n.first || m.count != n.count || m.leaf != n.leaf || !same_box(m.bounds, n.bounds)) return false;
+    }
+    for (size_t i=0; i < a.entry_boxes().size(); i++)
+	if (!same_box(a.entry_boxes()[i], b.entry_boxes()[i])) return false;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned threads = spatial::default_threads();
+    if (argc > 1 && !spatial::parse_threads(argv[1], threads))
+    {
+	std::cerr << "FAILED: the number of threads must be in [1, " << spatial::max_threads << "], not " << argv[1] << std::endl;
+	return 1;
+    }
+    size_t copies = (argc > 2) ? std::atol(argv[2]) : 1;
+
+    spatial::polygon_store dataset;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", dataset, roi, threads);
+    std::cout << "Dataset contains " << dataset.size() << " polygons, " << copies << " copies, "
+	      << threads << " threads" << std::endl;
+
+    std::vector<value> serial_values, values;
+    double t_serial = seconds([&](){ serial_values = spatial::envelopes(dataset, 1); });
+    double t_parallel = seconds([&](){ values = spatial::envelopes(dataset, threads); });
+    std::cout << "  envelopes\t" << t_serial << " s serial, " << t_parallel << " s parallel, speedup "
+	      << t_serial / t_parallel << std::endl;
+    // more data: copies shifted to the east
+    double width = bg::get<bg::max_corner,0>(roi) - bg::get<bg::min_corner,0>(roi);
+    const size_t n = values.size();
+    for (size_t c=1; c < copies; c++)
+	for (size_t i=0; i < n; i++)
+	{
+	    box b = values[i].first;
+	    bg::set<bg::min_corner,0>(b, bg::get<bg::min_corner,0>(b) + c * width);
+	    bg::set<bg::max_corner,0>(b, bg::get<bg::max_corner,0>(b) + c * width);
+	    values.push_back(value(b, values.size()));
+	}
+
+    size_t different = 0;
+    for (int p = spatial::packing_str; p <= spatial::packing_omt; p++)
+    {
+	spatial::packing packing = static_cast<spatial::packing>(p);
+	spatial::packed_rtree<16> a, b;
+	double t1 = seconds([&](){ a = spatial::packed_rtree<16>(values, packing, 16, 1); });
+	double t2 = seconds([&](){ b = spatial::packed_rtree<16>(values, packing, 16, threads); });
+	bool same = same_tree(a, b);
+	std::cout << "  " << spatial::packing_name(packing) << "\t" << t1 << " s serial, " << t2
+		  << " s parallel, speedup " << t1 / t2 << ", " << (same ? "identical" : "DIFFERENT")
+		  << " trees" << std::endl;
+	different += !same;
+    }
+    if (different){
+	std::cerr << "FAILED: the parallel build differs from the serial one for " << different << " packings" << std::endl;
+	return 1;
+    }
+    return 0;
+}
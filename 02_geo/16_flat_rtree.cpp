@@ -0,0 +1,172 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Flat R-tree
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++14 -pthread -o 16_flat_rtree 16_flat_rtree.cpp
+*/
+
+// The bulk-loaded R-tree of 03_rtree frozen into a flat_rtree, once from the
+// bgi::rtree and once directly from the polygons. For both kinds of trees: the
+// memory (heap bytes of the bgi::rtree, arrays of the flat tree) and the latency
+// of within and intersects queries (boxes of 0.003 degrees) and of kNN (k = 10)
+// at random points, the flat tree with each kernel the CPU has. The results of
+// the flat trees are compared with those of the bgi::rtree.
+//
+// Usage: 16_flat_rtree [queries]
+
+#include<iostream>
+#include<iomanip>
+#include<chrono>
+#include<cstdlib>
+#include<vector>
+#include<algorithm>
+#include<malloc.h>
+#include <boost/geometry.hpp>
+#include <boost/function_output_iterator.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "flat_rtree.hpp"
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+point random_point_in_box(const box &b)
+{
+    double tau1 = static_cast<double>(std::rand()) / RAND_MAX;
+    double tau2 = static_cast<double>(std::rand()) / RAND_MAX;
+    return point(bg::get<bg::min_corner,0>(b) + tau1 * (bg::get<bg::max_corner,0>(b) - bg::get<bg::min_corner,0>(b)),
+		 bg::get<bg::min_corner,1>(b) + tau2 * (bg::get<bg::max_corner,1>(b) - bg::get<bg::min_corner,1>(b)));
+}
+
+size_t heap_in_use()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+std::vector<point> queries;
+std::vector<box> ranges;
+
+// latency of the queries; the sums of the ids found and of the kNN distances are the same for all trees
+template<typename Within, typename Intersects, typename Nearest>
+void run(const std::string &name, size_t bytes, Within within, Intersects intersects, Nearest nearest)
+{
+    size_t sum = 0;
+    double knn_sum = 0;
+    auto add_id = boost::make_function_output_iterator([&](const value &v){ sum += v.second; });
+    double t_within = seconds([&](){ for (const auto &q: ranges) within(q, add_id); });
+    double t_intersects = seconds([&](){ for (const auto &q: ranges) intersects(q, add_id); });
+    double t_knn = seconds([&](){
+	for (const auto &q: queries)
+	    nearest(q, boost::make_function_output_iterator([&](const value &v){ knn_sum += bg::distance(q, v.first); }));
+    });
+    std::cout << std::left << std::setw(22) << name << std::right << std::setw(8) << bytes / (1024.0*1024.0)
+	      << std::setw(13) << t_within / ranges.size() * 1e6 << std::setw(17) << t_intersects / ranges.size() * 1e6
+	      << std::setw(10) << t_knn / queries.size() * 1e6 << std::setw(14) << sum << std::setw(14) << knn_sum << std::endl;
+}
+
+bool same_values(const std::vector<value> &a, const std::vector<value> &b)
+{
+    if (a.size() != b.size()) return false;
+    for (size_t i=0; i < a.size(); i++)
+	if (a[i].second != b[i].second || !bg::equals(a[i].first, b[i].first)) return false;
+    return true;
+}
+
+// queries for which flat gives other values than rt (bgi::nearest returns the
+// values in no particular order, so the kNN are compared by distance)
+size_t differences(const rtree &rt, const spatial::flat_rtree &flat)
+{
+    size_t different = 0;
+    std::vector<value> a, b;
+    for (size_t i=0; i < queries.size(); i++)
+    {
+	a.clear(); b.clear();
+	rt.query(bgi::within(ranges[i]), std::back_inserter(a));
+	flat.query_within(ranges[i], std::back_inserter(b));
+	bool same = same_values(a, b);
+	a.clear(); b.clear();
+	rt.query(bgi::intersects(ranges[i]), std::back_inserter(a));
+	flat.query_intersects(ranges[i], std::back_inserter(b));
+	same = same && same_values(a, b);
+	a.clear(); b.clear();
+	rt.query(bgi::nearest(queries[i], 10), std::back_inserter(a));
+	flat.query_nearest(queries[i], 10, std::back_inserter(b));
+	std::vector<double> da, db;
+	for (const auto &v: a) da.push_back(bg::comparable_distance(queries[i], v.first));
+	for (const auto &v: b) db.push_back(bg::comparable_distance(queries[i], v.first));
+	std::sort(da.begin(), da.end());
+	different += !(same && da == db);
+    }
+    return different;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n_queries = (argc > 1) ? std::atol(argv[1]) : 100000;
+    unsigned threads = spatial::default_threads();
+    spatial::polygon_store dataset;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", dataset, roi, threads);
+    std::cout << "Dataset contains " << dataset.size() << " polygons" << std::endl;
+    std::vector<value> values = spatial::envelopes(dataset, threads);
+
+    std::srand(42);
+    for (size_t i=0; i < n_queries; i++)
+    {
+	point p = random_point_in_box(roi);
+	queries.push_back(p);
+	ranges.push_back(box(point(bg::get<0>(p) - 0.0015, bg::get<1>(p) - 0.0015),
+			     point(bg::get<0>(p) + 0.0015, bg::get<1>(p) + 0.0015)));
+    }
+
+    size_t before = heap_in_use();
+    rtree *rt = new rtree(values);
+    size_t rtree_bytes = heap_in_use() - before;
+
+    spatial::flat_rtree frozen;
+    double t_freeze = seconds([&](){ frozen = spatial::flat_rtree(*rt); });
+    spatial::flat_rtree direct;
+    double t_direct = seconds([&](){ direct = spatial::flat_rtree(dataset, threads); });
+    std::cout << "Flat tree: " << frozen.num_nodes() << " nodes, " << frozen.num_leaves() << " leaves, frozen in "
+	      << t_freeze << " s, built from the polygons in " << t_direct << " s" << std::endl;
+
+    std::cout << std::left << std::setw(22) << "tree" << std::right << std::setw(8) << "MB"
+	      << std::setw(13) << "within [us]" << std::setw(17) << "intersects [us]" << std::setw(10) << "kNN [us]"
+	      << std::setw(14) << "id sum" << std::setw(14) << "kNN sum" << std::endl;
+    run("bgi::rtree", rtree_bytes,
+	[&](const box &q, auto out){ rt->query(bgi::within(q), out); },
+	[&](const box &q, auto out){ rt->query(bgi::intersects(q), out); },
+	[&](const point &q, auto out){ rt->query(bgi::nearest(q, 10), out); });
+    for (int l = spatial::simd_scalar; l <= spatial::best_simd_level(); l++)
+    {
+	spatial::simd_level level = static_cast<spatial::simd_level>(l);
+	spatial::flat_rtree flat(*rt, level);
+	run(std::string("flat_rtree ") + spatial::simd_level_name(level), flat.memory_usage(),
+	    [&](const box &q, auto out){ flat.query_within(q, out); },
+	    [&](const box &q, auto out){ flat.query_intersects(q, out); },
+	    [&](const point &q, auto out){ flat.query_nearest(q, 10, out); });
+    }
+    size_t different_frozen = differences(*rt, frozen), different_direct = differences(*rt, direct);
+    std::cout << "Queries with other results than the bgi::rtree: " << different_frozen << " (frozen), "
+	      << different_direct << " (from the polygons)" << std::endl;
+    delete rt;
+    if (different_frozen || different_direct){
+	std::cerr << "FAILED: the flat tree answers differently from the bgi::rtree" << std::endl;
+	return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Live index
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++14 -pthread -o 17_live_index 17_live_index.cpp
+*/
+
+// Queries during bursts of building edits. Reader threads run kNN (k = 10) and
+// range queries (boxes of 0.003 degrees) at random points and record the latency
+// of every query, first without updates, then while a writer moves random
+// buildings by a few meters in bursts of 20 batches of 100 edits, a burst every
+// 100 ms. Once with a bgi::rtree behind a reader/writer lock, once with
+// live_rtree. At the end the live_rtree is compared with a bgi::rtree built from
+// the final state, and size() with a count of all values after removes of values
+// it does not hold.
+//
+// Usage: 17_live_index [seconds] [readers] [merge threshold]
+
+#include<iostream>
+#include<iomanip>
+#include<chrono>
+#include<thread>
+#include<atomic>
+#include<shared_mutex>
+#include<random>
+#include<cstdlib>
+#include<vector>
+#include<algorithm>
+#include <boost/geometry.hpp>
+#include <boost/function_output_iterator.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "live_rtree.hpp"
+
+typedef std::chrono::steady_clock clock_type;
+
+const size_t batch_size = 100, batches_per_burst = 20;
+
+box roi;
+
+point random_point(std::mt19937 &gen)
+{
+    std::uniform_real_distribution<double> x(bg::get<bg::min_corner,0>(roi), bg::get<bg::max_corner,0>(roi));
+    std::uniform_real_distribution<double> y(bg::get<bg::min_corner,1>(roi), bg::get<bg::max_corner,1>(roi));
+    return point(x(gen), y(gen));
+}
+
+box range_around(const point &p)
+{
+    return box(point(bg::get<0>(p) - 0.0015, bg::get<1>(p) - 0.0015), point(bg::get<0>(p) + 0.0015, bg::get<1>(p) + 0.0015));
+}
+
+// the next batch of edits: random buildings moved by up to 5 meters
+void next_batch(std::vector<value> &state, std::mt19937 &gen, std::vector<value> &inserts, std::vector<value> &removes)
+{
+    std::uniform_int_distribution<size_t> pick(0, state.size() - 1);
+    std::uniform_real_distribution<double> shift(-0.00005, 0.00005);
+    inserts.clear();
+    removes.clear();
+    for (size_t i=0; i < batch_size; i++)
+    {
+	value &v = state[pick(gen)];
+	if (std::find_if(removes.begin(), removes.end(), [&](const value &r){ return r.second == v.second; }) != removes.end())
+	    continue; // once per batch
+	removes.push_back(v);
+	double dx = shift(gen), dy = shift(gen);
+	v.first = box(point(bg::get<bg::min_corner,0>(v.first) + dx, bg::get<bg::min_corner,1>(v.first) + dy),
+		      point(bg::get<bg::max_corner,0>(v.first) + dx, bg::get<bg::max_corner,1>(v.first) + dy));
+	inserts.push_back(v);
+    }
+}
+
+// readers query for the given time while the writer applies bursts of batches (or
+// not, for updates = false); apply(inserts, removes) applies one batch,
+// query(reader, gen) runs one query
+template<typename MakeReader, typename Query, typename Apply>
+void run(const std::string &name, double duration, unsigned n_readers, bool updates, std::vector<value> &state,
+	 MakeReader make_reader, Query query, Apply apply)
+{
+    std::atomic<bool> stop(false);
+    std::vector<std::vector<double>> latencies(n_readers);
+    std::vector<std::thread> readers;
+    for (unsigned r=0; r < n_readers; r++)
+	readers.emplace_back([&, r](){
+	    auto reader = make_reader();
+	    std::mt19937 gen(r + 1);
+	    while (!stop)
+	    {
+		auto start = clock_type::now();
+		query(*reader, gen);
+		latencies[r].push_back(std::chrono::duration<double, std::micro>(clock_type::now() - start).count());
+	    }
+	});
+    size_t edits = 0;
+    std::mt19937 gen(42);
+    std::vector<value> inserts, removes;
+    clock_type::time_point now = clock_type::now();
+    clock_type::time_point end = now + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(duration));
+    for (auto next = now; next < end; next += std::chrono::milliseconds(100))
+    {
+	std::this_thread::sleep_until(next);
+	for (size_t b=0; updates && b < batches_per_burst; b++)
+	{
+	    next_batch(state, gen, inserts, removes);
+	    apply(inserts, removes);
+	    edits += inserts.size();
+	}
+    }
+    std::this_thread::sleep_until(end);
+    stop = true;
+    for (auto &t: readers) t.join();
+
+    std::vector<double> all;
+    for (const auto &l: latencies) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p){ return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+    std::cout << std::left << std::setw(30) << name + (updates ? ", bursts" : ", quiet") << std::right << std::setw(10) << all.size()
+	      << std::setw(10) << edits << std::setw(10) << percentile(0.5) << std::setw(10) << percentile(0.99)
+	      << std::setw(10) << percentile(0.999) << std::setw(10) << all.back() << std::endl;
+}
+
+// kNN and range queries alternately
+template<typename Reader>
+void one_query(Reader &reader, std::mt19937 &gen)
+{
+    static thread_local size_t count = 0;
+    static thread_local std::vector<value> result;
+    point p = random_point(gen);
+    result.clear();
+    if (count++ % 2) reader.query_nearest(p, 10, std::back_inserter(result));
+    else reader.query_intersects(range_around(p), std::back_inserter(result));
+}
+
+// bgi::rtree behind a reader/writer lock
+struct locked_rtree
+{
+    rtree rt;
+    mutable std::shared_timed_mutex mutex;
+
+    template<typename OutIter>
+    void query_nearest(const point &p, size_t k, OutIter out) const
+    {
+	std::shared_lock<std::shared_timed_mutex> lock(mutex);
+	rt.query(bgi::nearest(p, static_cast<unsigned>(k)), out);
+    }
+    template<typename OutIter>
+    void query_intersects(const box &q, OutIter out) const
+    {
+	std::shared_lock<std::shared_timed_mutex> lock(mutex);
+	rt.query(bgi::intersects(q), out);
+    }
+};
+
+int main(int argc, char **argv)
+{
+    double duration = (argc > 1) ? std::atof(argv[1]) : 5;
+    unsigned n_readers = 2;
+    if (argc > 2 && !spatial::parse_threads(argv[2], n_readers))
+    {
+	std::cerr << "FAILED: the number of threads must be in [1, " << spatial::max_threads << "], not " << argv[2] << std::endl;
+	return 1;
+    }
+    size_t merge_threshold = (argc > 3) ? std::atol(argv[3]) : 1 << 14;
+    spatial::polygon_store dataset;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", dataset, roi, spatial::default_threads());
+    std::vector<value> values = spatial::envelopes(dataset, spatial::default_threads());
+    std::cout << "Dataset contains " << values.size() << " polygons, " << n_readers << " readers, "
+	      << batch_size << " edits per batch, " << batches_per_burst << " batches per burst" << std::endl;
+
+    std::cout << std::left << std::setw(30) << "index" << std::right << std::setw(10) << "queries" << std::setw(10)
+	      << "edits" << std::setw(10) << "p50 [us]" << std::setw(10) << "p99 [us]" << std::setw(10) << "p99.9"
+	      << std::setw(10) << "max" << std::endl;
+    {
+	std::vector<value> state = values;
+	locked_rtree index;
+	index.rt = rtree(values);
+	for (bool updates: {false, true})
+	    run("locked bgi::rtree", duration, n_readers, updates, state,
+		[&](){ return &index; },
+		[](const locked_rtree &r, std::mt19937 &gen){ one_query(r, gen); },
+		[&](const std::vector<value> &inserts, const std::vector<value> &removes){
+		    std::unique_lock<std::shared_timed_mutex> lock(index.mutex);
+		    for (const auto &v: removes) index.rt.remove(v);
+		    index.rt.insert(inserts.begin(), inserts.end());
+		});
+    }
+
+    std::vector<value> state = values;
+    spatial::live_rtree index(values, merge_threshold);
+    for (bool updates: {false, true})
+	run("live_rtree", duration, n_readers, updates, state,
+	    [&](){ return std::unique_ptr<spatial::live_rtree::reader>(new spatial::live_rtree::reader(index)); },
+	    [](const spatial::live_rtree::reader &r, std::mt19937 &gen){ one_query(r, gen); },
+	    [&](const std::vector<value> &inserts, const std::vector<value> &removes){ index.apply(inserts, removes); });
+    std::cout << "live_rtree: " << index.merges() << " merges, " << index.delta_size() << " values in the delta, "
+	      << index.retired_versions() << " retired versions not yet deleted" << std::endl;
+
+    // the same answers as a tree of the final state
+    rtree reference(state);
+    spatial::live_rtree::reader reader(index);
+    std::mt19937 gen(7);
+    size_t different = 0;
+    for (size_t i=0; i < 10000; i++)
+    {
+	point p = random_point(gen);
+	std::vector<value> a, b;
+	reference.query(bgi::intersects(range_around(p)), std::back_inserter(a));
+	reader.query_intersects(range_around(p), std::back_inserter(b));
+	auto by_id = [](const value &x, const value &y){ return x.second < y.second; };
+	std::sort(a.begin(), a.end(), by_id);
+	std::sort(b.begin(), b.end(), by_id);
+	bool same = a.size() == b.size();
+	for (size_t j=0; same && j < a.size(); j++)
+	    same = a[j].second == b[j].second && bg::equals(a[j].first, b[j].first);
+	a.clear(); b.clear();
+	reference.query(bgi::nearest(p, 10), std::back_inserter(a));
+	reader.query_nearest(p, 10, std::back_inserter(b));
+	std::vector<double> da, db;
+	for (const auto &v: a) da.push_back(bg::comparable_distance(p, v.first));
+	for (const auto &v: b) db.push_back(bg::comparable_distance(p, v.first));
+	std::sort(da.begin(), da.end());
+	different += !(same && da == db);
+    }
+    std::cout << "Queries with other results than a tree of the final state: " << different
+	      << " (" << reader.size() << " values)" << std::endl;
+    if (different){
+	std::cerr << "FAILED: the live index answers differently from a tree of the final state" << std::endl;
+	return 1;
+    }
+
+    // removes of values the index does not hold change nothing: one never inserted,
+    // one removed twice in a batch and again in the next (of the base or the delta)
+    size_t before = reader.size();
+    for (size_t k: {size_t(0), state.size() - 1})
+    {
+	value gone = state[k];
+	index.apply(std::vector<value>(), std::vector<value>{gone, gone, value(gone.first, ~size_t(0))});
+	index.apply(std::vector<value>(), std::vector<value>(1, gone));
+    }
+    size_t counted = 0;
+    reader.query_intersects(box(point(-180, -90), point(180, 90)), boost::make_function_output_iterator([&](const value &){ ++counted; }));
+    std::cout << "After removing 2 values, a missing one and each twice: size() " << reader.size() << " of "
+	      << before << ", query count " << counted << std::endl;
+    if (reader.size() != before - 2 || counted != before - 2){
+	std::cerr << "FAILED: size() does not match the values in the index" << std::endl;
+	return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Point grid
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++14 -pthread -o 18_point_grid 18_point_grid.cpp
+*/
+
+// Uniform random points over Washington, DC, indexed once by a bgi::rtree
+// (bulk loaded, rstar<16,4>) and once by a point_grid. For both: the build time,
+// the memory (heap bytes of the bgi::rtree, arrays of the grid) and the latency
+// of within and intersects queries (boxes holding about 100 points) and of kNN
+// (k = 10) at random points. The results of the grid are compared with those of
+// the bgi::rtree.
+//
+// Usage: 18_point_grid [million points ...] (default 1 10)
+//        100 million points take about 10 GB
+
+#include<iostream>
+#include<iomanip>
+#include<chrono>
+#include<random>
+#include<cstdlib>
+#include<cmath>
+#include<vector>
+#include<algorithm>
+#include<malloc.h>
+#include <boost/geometry.hpp>
+#include <boost/function_output_iterator.hpp>
+
+#include "types.hpp"
+#include "point_grid.hpp"
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+size_t heap_in_use()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+const box roi(point(-77.12, 38.80), point(-76.91, 38.99));
+
+point random_point(std::mt19937 &gen)
+{
+    std::uniform_real_distribution<double> x(bg::get<bg::min_corner,0>(roi), bg::get<bg::max_corner,0>(roi));
+    std::uniform_real_distribution<double> y(bg::get<bg::min_corner,1>(roi), bg::get<bg::max_corner,1>(roi));
+    return point(x(gen), y(gen));
+}
+
+std::vector<point> queries;
+std::vector<box> ranges;
+
+// latency of the queries; the sums of the ids found and of the kNN distances are the same for both indexes
+template<typename Within, typename Intersects, typename Nearest>
+void run(const std::string &name, double t_build, size_t bytes, Within within, Intersects intersects, Nearest nearest)
+{
+    size_t sum = 0;
+    double knn_sum = 0;
+    auto add_id = boost::make_function_output_iterator([&](const point_value &v){ sum += v.second; });
+    double t_within = seconds([&](){ for (const auto &q: ranges) within(q, add_id); });
+    double t_intersects = seconds([&](){ for (const auto &q: ranges) intersects(q, add_id); });
+    double t_knn = seconds([&](){
+	for (const auto &q: queries)
+	    nearest(q, boost::make_function_output_iterator([&](const point_value &v){ knn_sum += bg::distance(q, v.first); }));
+    });
+    std::cout << std::left << std::setw(14) << name << std::right << std::setw(10) << t_build << std::setw(10)
+	      << bytes / (1024.0*1024.0) << std::setw(13) << t_within / ranges.size() * 1e6 << std::setw(17)
+	      << t_intersects / ranges.size() * 1e6 << std::setw(10) << t_knn / queries.size() * 1e6
+	      << std::setw(16) << sum << std::setw(14) << knn_sum << std::endl;
+}
+
+// queries for which the grid gives other values than the tree (compared by id
+// and, for kNN, by distance since bgi::nearest returns no particular order)
+size_t differences(const point_rtree &rt, const spatial::point_grid &grid)
+{
+    size_t different = 0;
+    std::vector<point_value> a, b;
+    auto by_id = [](const point_value &x, const point_value &y){ return x.second < y.second; };
+    auto same_ids = [&](){
+	std::sort(a.begin(), a.end(), by_id);
+	std::sort(b.begin(), b.end(), by_id);
+	if (a.size() != b.size()) return false;
+	for (size_t j=0; j < a.size(); j++)
+	    if (a[j].second != b[j].second) return false;
+	return true;
+    };
+    for (size_t i=0; i < std::min<size_t>(queries.size(), 10000); i++)
+    {
+	a.clear(); b.clear();
+	rt.query(bgi::within(ranges[i]), std::back_inserter(a));
+	grid.query_within(ranges[i], std::back_inserter(b));
+	bool same = same_ids();
+	a.clear(); b.clear();
+	rt.query(bgi::intersects(ranges[i]), std::back_inserter(a));
+	grid.query_intersects(ranges[i], std::back_inserter(b));
+	same = same && same_ids();
+	a.clear(); b.clear();
+	rt.query(bgi::nearest(queries[i], 10), std::back_inserter(a));
+	grid.query_nearest(queries[i], 10, std::back_inserter(b));
+	std::vector<double> da, db;
+	for (const auto &v: a) da.push_back(bg::comparable_distance(queries[i], v.first));
+	for (const auto &v: b) db.push_back(bg::comparable_distance(queries[i], v.first));
+	std::sort(da.begin(), da.end());
+	different += !(same && da == db);
+    }
+    return different;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<double> sizes;
+    for (int i=1; i < argc; i++) sizes.push_back(std::atof(argv[i]));
+    if (sizes.empty()) sizes = {1, 10};
+    unsigned threads = spatial::default_threads();
+    size_t failures = 0;
+
+    for (double millions: sizes)
+    {
+	const size_t n = static_cast<size_t>(millions * 1e6);
+	std::mt19937 gen(42);
+	std::vector<point_value> values(n);
+	for (size_t i=0; i < n; i++)
+	    values[i] = point_value(random_point(gen), i);
+
+	// boxes holding about 100 points
+	double area = bg::area(roi) * 100 / n, side = std::sqrt(area);
+	queries.clear();
+	ranges.clear();
+	for (size_t i=0; i < 100000; i++)
+	{
+	    point p = random_point(gen);
+	    queries.push_back(p);
+	    ranges.push_back(box(point(bg::get<0>(p) - side / 2, bg::get<1>(p) - side / 2),
+				 point(bg::get<0>(p) + side / 2, bg::get<1>(p) + side / 2)));
+	}
+
+	std::cout << n << " points" << std::endl;
+	std::cout << std::left << std::setw(14) << "index" << std::right << std::setw(10) << "build [s]" << std::setw(10) << "MB"
+		  << std::setw(13) << "within [us]" << std::setw(17) << "intersects [us]" << std::setw(10) << "kNN [us]"
+		  << std::setw(16) << "id sum" << std::setw(14) << "kNN sum" << std::endl;
+	size_t before = heap_in_use();
+	point_rtree *rt = nullptr;
+	double t_rtree = seconds([&](){ rt = new point_rtree(values); });
+	size_t rtree_bytes = heap_in_use() - before;
+	run("bgi::rtree", t_rtree, rtree_bytes,
+	    [&](const box &q, auto out){ rt->query(bgi::within(q), out); },
+	    [&](const box &q, auto out){ rt->query(bgi::intersects(q), out); },
+	    [&](const point &q, auto out){ rt->query(bgi::nearest(q, 10), out); });
+
+	spatial::point_grid grid;
+	double t_grid = seconds([&](){ grid = spatial::point_grid(std::move(values), 4, threads); });
+	run("point_grid", t_grid, grid.memory_usage(),
+	    [&](const box &q, auto out){ grid.query_within(q, out); },
+	    [&](const box &q, auto out){ grid.query_intersects(q, out); },
+	    [&](const point &q, auto out){ grid.query_nearest(q, 10, out); });
+	size_t different = differences(*rt, grid);
+	std::cout << "Grid of " << grid.num_cells() << " cells; queries with other results than the bgi::rtree: "
+		  << different << std::endl << std::endl;
+	failures += different;
+	delete rt;
+    }
+    if (failures){
+	std::cerr << "FAILED: the grid answers differently from the bgi::rtree" << std::endl;
+	return 1;
+    }
+    return 0;
+}
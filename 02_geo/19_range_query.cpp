@@ -0,0 +1,165 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Range queries with exact refinement
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++14 -pthread -o 19_range_query 19_range_query.cpp
+*/
+
+// Range queries around random points with a box, a circle and a hexagon as
+// query geometry, each with intersects and within, decided on the building
+// polygons. For each: the candidates of the index filter, the hits, and the time
+// per query on one thread and on all (refinement in parallel above 4096
+// candidates). Both runs must give the same hits in the same order, and for a
+// few queries the hits are compared with a scan over all buildings.
+//
+// Usage: 19_range_query [queries] [size in degrees]
+
+#include<iostream>
+#include<iomanip>
+#include<chrono>
+#include<cstdlib>
+#include<cmath>
+#include<vector>
+#include<algorithm>
+#include <boost/geometry.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "flat_rtree.hpp"
+#include "range_query.hpp"
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+point random_point_in_box(const box &b)
+{
+    double tau1 = static_cast<double>(std::rand()) / RAND_MAX;
+    double tau2 = static_cast<double>(std::rand()) / RAND_MAX;
+    return point(bg::get<bg::min_corner,0>(b) + tau1 * (bg::get<bg::max_corner,0>(b) - bg::get<bg::min_corner,0>(b)),
+		 bg::get<bg::min_corner,1>(b) + tau2 * (bg::get<bg::max_corner,1>(b) - bg::get<bg::min_corner,1>(b)));
+}
+
+polygon hexagon(const point &c, double r)
+{
+    polygon h;
+    for (int i=0; i < 6; i++)
+	bg::append(h.outer(), point(bg::get<0>(c) + r * std::cos(i * M_PI / 3), bg::get<1>(c) + r * std::sin(i * M_PI / 3)));
+    bg::correct(h);
+    return h;
+}
+
+spatial::polygon_store dataset;
+
+// the hits of range_query as one vector
+template<typename Query, typename Predicate>
+std::vector<size_t> hits(const spatial::flat_rtree &index, const Query &q, Predicate predicate, unsigned threads,
+			 spatial::range_stats &stats)
+{
+    std::vector<size_t> result;
+    stats = spatial::range_query(index, dataset, q, predicate,
+	[&](const size_t *ids, size_t n){ result.insert(result.end(), ids, ids + n); }, 4096, 4096, threads);
+    return result;
+}
+
+// the same by testing every building with test(building, its envelope, q)
+template<typename Query, typename Test>
+std::vector<size_t> scan(const Query &q, Test test)
+{
+    std::vector<size_t> result;
+    for (size_t i=0; i < dataset.size(); i++)
+	if (test(dataset[i], dataset.envelope(i), q))
+	    result.push_back(i);
+    return result;
+}
+
+// the number of queries with other hits on all threads than on one, plus those
+// with other hits than the scan
+template<typename MakeQuery, typename Predicate, typename Test>
+size_t run(const std::string &name, const spatial::flat_rtree &index, const std::vector<point> &anchors,
+	 MakeQuery make_query, Predicate predicate, Test test, unsigned threads)
+{
+    size_t candidates = 0, matches = 0, different = 0, wrong = 0;
+    spatial::range_stats stats;
+    std::vector<std::vector<size_t>> serial(anchors.size());
+    double t1 = seconds([&](){
+	for (size_t i=0; i < anchors.size(); i++)
+	{
+	    serial[i] = hits(index, make_query(anchors[i]), predicate, 1, stats);
+	    candidates += stats.candidates;
+	    matches += stats.matches;
+	}
+    });
+    double tn = seconds([&](){
+	for (size_t i=0; i < anchors.size(); i++)
+	    different += hits(index, make_query(anchors[i]), predicate, threads, stats) != serial[i];
+    });
+    for (size_t i=0; i < std::min<size_t>(anchors.size(), 5); i++)
+    {
+	std::vector<size_t> a = serial[i], b = scan(make_query(anchors[i]), test);
+	std::sort(a.begin(), a.end());
+	wrong += a != b;
+    }
+    std::cout << std::left << std::setw(20) << name << std::right << std::setw(14)
+	      << static_cast<double>(candidates) / anchors.size() << std::setw(10) << static_cast<double>(matches) / anchors.size()
+	      << std::setw(14) << t1 / anchors.size() * 1e6 << std::setw(14) << tn / anchors.size() * 1e6
+	      << std::setw(12) << different << std::setw(8) << wrong << std::endl;
+    return different + wrong;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n_queries = (argc > 1) ? std::atol(argv[1]) : 1000;
+    double size = (argc > 2) ? std::atof(argv[2]) : 0.01;
+    unsigned threads = spatial::default_threads();
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", dataset, roi, threads);
+    std::cout << "Dataset contains " << dataset.size() << " polygons, queries of " << size << " degrees, "
+	      << threads << " threads" << std::endl;
+    spatial::flat_rtree index(dataset, threads);
+
+    std::srand(42);
+    std::vector<point> anchors;
+    for (size_t i=0; i < n_queries; i++)
+	anchors.push_back(random_point_in_box(roi));
+
+    std::cout << std::left << std::setw(20) << "query" << std::right << std::setw(14) << "candidates" << std::setw(10)
+	      << "hits" << std::setw(14) << "1 thread [us]" << std::setw(14) << "all [us]" << std::setw(12) << "different"
+	      << std::setw(8) << "wrong" << std::endl;
+    auto make_box = [&](const point &p){
+	return box(point(bg::get<0>(p) - size / 2, bg::get<1>(p) - size / 2), point(bg::get<0>(p) + size / 2, bg::get<1>(p) + size / 2));
+    };
+    auto make_circle = [&](const point &p){ return spatial::circle(p, size / 2); };
+    auto make_hexagon = [&](const point &p){ return hexagon(p, size / 2); };
+    typedef spatial::polygon_view building;
+    size_t failures = 0;
+    failures += run("box intersects", index, anchors, make_box, spatial::intersects_predicate(),
+	[](const building &g, const box &, const box &q){ return bg::intersects(g, q); }, threads);
+    failures += run("box within", index, anchors, make_box, spatial::within_predicate(),
+	[](const building &, const box &b, const box &q){ return bg::covered_by(b, q); }, threads);
+    failures += run("circle intersects", index, anchors, make_circle, spatial::intersects_predicate(),
+	[](const building &g, const box &, const spatial::circle &q){ return bg::distance(q.center, g) <= q.radius; }, threads);
+    failures += run("circle within", index, anchors, make_circle, spatial::within_predicate(),
+	[](const building &g, const box &, const spatial::circle &q){
+	    for (const auto &p: bg::exterior_ring(g))
+		if (bg::distance(q.center, p) > q.radius) return false;
+	    return true;
+	}, threads);
+    failures += run("hexagon intersects", index, anchors, make_hexagon, spatial::intersects_predicate(),
+	[](const building &g, const box &, const polygon &q){ return bg::intersects(g, q); }, threads);
+    failures += run("hexagon within", index, anchors, make_hexagon, spatial::within_predicate(),
+	[](const building &g, const box &, const polygon &q){ return bg::within(g, q); }, threads);
+    if (failures){
+	std::cerr << "FAILED: " << failures << " queries with different or wrong hits" << std::endl;
+	return 1;
+    }
+    return 0;
+}
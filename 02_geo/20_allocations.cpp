@@ -0,0 +1,206 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Allocation counts
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++14 -pthread -o 20_allocations 20_allocations.cpp
+*/
+
+// Calls of operator new per row of the building file and per query, counted by
+// replacing the global operator new. Ingest: the original way of 03_rtree (a
+// string per row, bg::read_wkt into a multi_polygon, a copy of every polygon
+// into a vector of (polygon, id)), the in-place parser into such a vector, into
+// the polygon store, and bg::read_wkt into a scratch_multi_polygon (arena.hpp).
+// Queries on the same tree: the range query of 03_rtree as it was (a new result
+// vector, a std::set of the kNN ids, bgi::within on the boxes) and as it is now,
+// exact kNN, kNN on the flat tree and bgi::nearest into a new vector. The queries
+// run once before counting, so that the scratch arena has grown to its size.
+//
+// Usage: 20_allocations [rows] [queries]
+
+#include<iostream>
+#include<iomanip>
+#include<chrono>
+#include<atomic>
+#include<new>
+#include<cstdlib>
+#include<cstring>
+#include<string>
+#include<vector>
+#include<set>
+#include <boost/geometry.hpp>
+#include <boost/function_output_iterator.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "flat_rtree.hpp"
+#include "knn.hpp"
+#include "range_query.hpp"
+#include "arena.hpp"
+
+std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size)
+{
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept {std::free(p);}
+void operator delete(void *p, size_t) noexcept {std::free(p);}
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+point random_point_in_box(const box &b)
+{
+    double tau1 = static_cast<double>(std::rand()) / RAND_MAX;
+    double tau2 = static_cast<double>(std::rand()) / RAND_MAX;
+    return point(bg::get<bg::min_corner,0>(b) + tau1 * (bg::get<bg::max_corner,0>(b) - bg::get<bg::min_corner,0>(b)),
+		 bg::get<bg::min_corner,1>(b) + tau2 * (bg::get<bg::max_corner,1>(b) - bg::get<bg::min_corner,1>(b)));
+}
+
+// n calls of f: operator new calls and microseconds per call
+template<typename F>
+void count(const std::string &name, size_t n, F f)
+{
+    size_t before = allocations;
+    double t = seconds([&](){ for (size_t i=0; i < n; i++) f(i); });
+    std::cout << std::left << std::setw(44) << name << std::right << std::setw(12)
+	      << static_cast<double>(allocations - before) / n << std::setw(12) << t / n * 1e6 << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n_rows = (argc > 1) ? std::atol(argv[1]) : 20000;
+    size_t n_queries = (argc > 2) ? std::atol(argv[2]) : 1000;
+
+    spatial::mapped_file file("washington_dc_osm_buildings.wkt");
+    std::vector<const char *> rows(1, file.begin());
+    while (rows.size() <= n_rows && rows.back() != file.end())
+    {
+	const char *nl = static_cast<const char *>(std::memchr(rows.back(), '\n', file.end() - rows.back()));
+	rows.push_back(nl ? nl + 1 : file.end());
+    }
+    n_rows = rows.size() - 1;
+    std::cout << std::left << std::setw(44) << "ingest of " + std::to_string(n_rows) + " rows" << std::right
+	      << std::setw(12) << "new/row" << std::setw(12) << "us/row" << std::endl;
+
+    {
+	std::vector<std::pair<polygon, size_t>> dataset;
+	count("getline, bg::read_wkt, copy (03_rtree)", n_rows, [&](size_t i){
+	    std::string line(rows[i], rows[i + 1] - 1);
+	    size_t sep = line.find(';');
+	    size_t osm_id = std::stoul(line.substr(0, sep));
+	    std::string wkt = line.substr(sep + 2, line.size() - sep - 3); // without the quotes
+	    multi_polygon mp;
+	    bg::read_wkt(wkt, mp);
+	    for (auto &p: mp)
+	    {
+		bg::correct(p);
+		dataset.push_back(std::make_pair(p, osm_id));
+	    }
+	});
+    }
+    {
+	std::vector<std::pair<polygon, size_t>> dataset;
+	count("in-place parser, vector of polygons", n_rows, [&](size_t i){
+	    spatial::parse_wkt_rows(rows[i], rows[i + 1], dataset);
+	});
+    }
+    {
+	spatial::polygon_store dataset;
+	count("in-place parser, polygon store", n_rows, [&](size_t i){
+	    spatial::parse_wkt_rows(rows[i], rows[i + 1], dataset);
+	});
+    }
+    {
+	spatial::polygon_store dataset;
+	std::string wkt;
+	count("bg::read_wkt, scratch_multi_polygon, store", n_rows, [&](size_t i){
+	    const char *begin = static_cast<const char *>(std::memchr(rows[i], '"', rows[i + 1] - rows[i])) + 1;
+	    wkt.assign(begin, static_cast<const char *>(std::memchr(begin, '"', rows[i + 1] - begin)));
+	    spatial::scratch_scope scope;
+	    spatial::scratch_multi_polygon mp;
+	    bg::read_wkt(wkt, mp);
+	    for (auto &p: mp)
+	    {
+		bg::correct(p);
+		dataset.push_back(p, std::atol(rows[i]));
+	    }
+	});
+    }
+
+    spatial::polygon_store dataset;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", dataset, roi, 1);
+    rtree rt(spatial::envelopes(dataset, 1));
+    spatial::flat_rtree frozen(rt);
+    std::srand(42);
+    std::vector<point> anchors;
+    for (size_t i=0; i < n_queries; i++)
+	anchors.push_back(random_point_in_box(roi));
+    auto range_box = [](const point &p){
+	return box(point(bg::get<0>(p) - 0.005, bg::get<1>(p) - 0.005), point(bg::get<0>(p) + 0.005, bg::get<1>(p) + 0.005));
+    };
+
+    std::cout << std::endl << std::left << std::setw(44) << std::to_string(n_queries) + " queries" << std::right
+	      << std::setw(12) << "new/query" << std::setw(12) << "us/query" << std::endl;
+    size_t hits = 0;
+    auto old_range = [&](size_t i){
+	std::vector<value> result;
+	frozen.query_nearest(anchors[i], 200, std::back_inserter(result));
+	std::set<size_t> knnids;
+	for (const auto &r: result) knnids.insert(r.second);
+	rt.query(bgi::within(range_box(anchors[i])), boost::make_function_output_iterator([&](const value &v){
+	    hits += knnids.find(v.second) == knnids.end(); }));
+    };
+    std::vector<value> result;
+    std::vector<bool> is_knn(dataset.size(), false);
+    auto new_range = [&](size_t i){
+	result.clear();
+	frozen.query_nearest(anchors[i], 200, std::back_inserter(result));
+	for (const auto &r: result) is_knn[r.second] = true;
+	spatial::range_query(frozen, dataset, range_box(anchors[i]), spatial::within_predicate(),
+	    [&](const size_t *ids, size_t n){ for (size_t j=0; j < n; j++) hits += !is_knn[ids[j]]; });
+	for (const auto &r: result) is_knn[r.second] = false;
+    };
+    std::vector<spatial::neighbor> neighbors;
+    auto exact_knn = [&](size_t i){
+	neighbors.clear();
+	spatial::knn_exact(rt, dataset, anchors[i], 10, std::back_inserter(neighbors));
+    };
+    auto flat_knn = [&](size_t i){
+	result.clear();
+	frozen.query_nearest(anchors[i], 10, std::back_inserter(result));
+    };
+    auto bgi_knn = [&](size_t i){
+	std::vector<value> fresh;
+	rt.query(bgi::nearest(anchors[i], 10), std::back_inserter(fresh));
+    };
+    for (size_t i=0; i < n_queries; i++)
+    {
+	new_range(i);
+	exact_knn(i);
+	flat_knn(i);
+    }
+    size_t before = hits;
+    count("range + kNN ids, std::set (03_rtree before)", n_queries, old_range);
+    size_t old_hits = hits - before;
+    before = hits;
+    count("range_query + kNN flags (03_rtree now)", n_queries, new_range);
+    std::cout << "  (" << old_hits << " and " << hits - before << " buildings in the range and not in the kNN)" << std::endl;
+    count("knn_exact, k = 10", n_queries, exact_knn);
+    count("flat_rtree::query_nearest, k = 10", n_queries, flat_knn);
+    count("bgi::nearest into a new vector, k = 10", n_queries, bgi_knn);
+    std::cout << "Scratch arena of the main thread: " << spatial::scratch_arena().capacity() / 1024.0 << " KB" << std::endl;
+    return 0;
+}
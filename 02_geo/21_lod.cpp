@@ -0,0 +1,201 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Levels of detail
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++14 -pthread -o 21_lod 21_lod.cpp
+*/
+
+// Simplified tiers with Hausdorff bounds (lod.hpp). The buildings have at most a
+// few dozen vertices and get no tiers, so the queries run on detailed polygons
+// made up around random points of the city: wavy outlines of [points] vertices,
+// every other one with a hole. For kNN, "within distance" and point-in-polygon,
+// the time, the vertices read per query and the share of answers given by a
+// tier are compared with the plain queries on the full polygons; the answers
+// must not differ.
+//
+// Usage: 21_lod [polygons] [points] [queries]
+
+#include<iostream>
+#include<iomanip>
+#include<chrono>
+#include<cstdlib>
+#include<cmath>
+#include<vector>
+#include<limits>
+#include <boost/geometry.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "packed_rtree.hpp"
+#include "knn.hpp"
+#include "lod.hpp"
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+double uniform() {return static_cast<double>(std::rand()) / RAND_MAX;}
+
+point random_point_in_box(const box &b)
+{
+    return point(bg::get<bg::min_corner,0>(b) + uniform() * (bg::get<bg::max_corner,0>(b) - bg::get<bg::min_corner,0>(b)),
+		 bg::get<bg::min_corner,1>(b) + uniform() * (bg::get<bg::max_corner,1>(b) - bg::get<bg::min_corner,1>(b)));
+}
+
+// a star-shaped polygon of n vertices around c with a wavy outline (and a hole)
+polygon detailed_polygon(const point &c, double radius, size_t n, bool hole)
+{
+    polygon g;
+    const double phase = 2 * M_PI * uniform();
+    for (size_t i=0; i < n; i++)
+    {
+	const double a = 2 * M_PI * i / n;
+	const double r = radius * (1 + 0.3 * std::sin(3 * a + phase) + 0.1 * std::sin(17 * a)
+				   + 0.03 * std::sin(97 * a + phase) + 0.01 * uniform());
+	bg::append(g.outer(), point(bg::get<0>(c) + r * std::cos(a), bg::get<1>(c) + r * std::sin(a)));
+    }
+    if (hole){
+	g.inners().resize(1);
+	for (size_t i=0; i < n / 4; i++)
+	{
+	    const double a = 2 * M_PI * i / (n / 4);
+	    const double r = 0.3 * radius * (1 + 0.05 * std::sin(11 * a));
+	    bg::append(g.inners()[0], point(bg::get<0>(c) + r * std::cos(a), bg::get<1>(c) + r * std::sin(a)));
+	}
+    }
+    bg::correct(g);
+    return g;
+}
+
+void report(const std::string &name, size_t queries, double t_full, const spatial::lod_stats &full,
+	    double t_lod, const spatial::lod_stats &lod, size_t different)
+{
+    std::cout << std::left << std::setw(16) << name << std::right
+	      << std::setw(12) << t_full / queries * 1e6 << std::setw(12) << t_lod / queries * 1e6
+	      << std::setw(14) << static_cast<double>(full.points) / queries
+	      << std::setw(14) << static_cast<double>(lod.points) / queries
+	      << std::setw(10) << 100.0 * lod.coarse / std::max<size_t>(lod.coarse + lod.full, 1)
+	      << std::setw(11) << different << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n_polygons = (argc > 1) ? std::atol(argv[1]) : 2000;
+    size_t n_points = (argc > 2) ? std::atol(argv[2]) : 2000;
+    size_t n_queries = (argc > 3) ? std::atol(argv[3]) : 10000;
+
+    spatial::polygon_store buildings;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", buildings, roi, spatial::default_threads());
+    spatial::lod_store building_lod;
+    double t = seconds([&](){ building_lod = spatial::lod_store(buildings); });
+    std::cout << buildings.size() << " buildings (" << buildings.num_points() << " points): "
+	      << building_lod.num_tiers() << " tiers in " << t << " seconds" << std::endl;
+
+    std::srand(42);
+    spatial::polygon_store dataset;
+    for (size_t i=0; i < n_polygons; i++)
+	dataset.push_back(detailed_polygon(random_point_in_box(roi), 0.002 + 0.004 * uniform(), n_points, i % 2), i);
+    spatial::lod_store lod;
+    t = seconds([&](){ lod = spatial::lod_store(dataset); });
+    std::cout << dataset.size() << " detailed polygons (" << dataset.num_points() << " points): "
+	      << lod.num_tiers() << " tiers (" << lod.tiers().num_points() << " points, "
+	      << lod.memory_usage() / (1024.0 * 1024.0) << " MB) in " << t << " seconds" << std::endl;
+    for (size_t t=0; t < lod.num_tiers(0); t++)
+	std::cout << "  tier " << t << " of polygon 0: " << lod.tier(0, t).num_points() << " of "
+		  << dataset[0].num_points() << " points, error " << lod.error(0, t) << std::endl;
+
+    rtree rt(spatial::envelopes(dataset));
+    std::vector<point> anchors;
+    for (size_t i=0; i < n_queries; i++)
+	anchors.push_back(random_point_in_box(roi));
+
+    std::cout << std::left << std::setw(16) << "query" << std::right << std::setw(12) << "full [us]"
+	      << std::setw(12) << "lod [us]" << std::setw(14) << "points full" << std::setw(14) << "points lod"
+	      << std::setw(10) << "tier [%]" << std::setw(11) << "different" << std::endl;
+    size_t failures = 0;
+
+    // kNN: the plain refinement reads every candidate in full, as with no tiers at all
+    {
+	const size_t k = 10;
+	spatial::lod_store none(dataset, std::vector<double>(), std::numeric_limits<size_t>::max());
+	spatial::lod_stats full, coarse;
+	std::vector<std::vector<spatial::neighbor>> a(n_queries), b(n_queries);
+	double t_full = seconds([&](){
+	    for (size_t i=0; i < n_queries; i++)
+		spatial::knn_exact(rt, spatial::with_lod(dataset, none, &full), anchors[i], k,
+				   std::back_inserter(a[i]));
+	});
+	double t_lod = seconds([&](){
+	    for (size_t i=0; i < n_queries; i++)
+		spatial::knn_exact(rt, spatial::with_lod(dataset, lod, &coarse), anchors[i], k, std::back_inserter(b[i]));
+	});
+	size_t different = 0;
+	for (size_t i=0; i < n_queries; i++)
+	    different += a[i] != b[i];
+	report("kNN, k = 10", n_queries, t_full, full, t_lod, coarse, different);
+	failures += different;
+    }
+
+    // the polygons within a distance of the anchor and the polygons containing it
+    const double radius = 0.002;
+    std::vector<std::vector<value>> candidates(n_queries), containing(n_queries);
+    for (size_t i=0; i < n_queries; i++)
+    {
+	const double x = bg::get<0>(anchors[i]), y = bg::get<1>(anchors[i]);
+	rt.query(bgi::intersects(box(point(x - radius, y - radius), point(x + radius, y + radius))),
+		 std::back_inserter(candidates[i]));
+	rt.query(bgi::intersects(anchors[i]), std::back_inserter(containing[i]));
+    }
+    {
+	spatial::lod_stats full, coarse;
+	std::vector<char> a, b;
+	double t_full = seconds([&](){
+	    for (size_t i=0; i < n_queries; i++)
+		for (const auto &c: candidates[i])
+		{
+		    full.points += dataset[c.second].num_points();
+		    a.push_back(bg::distance(anchors[i], dataset[c.second]) <= radius);
+		}
+	});
+	double t_lod = seconds([&](){
+	    for (size_t i=0; i < n_queries; i++)
+		for (const auto &c: candidates[i])
+		    b.push_back(spatial::lod_within_distance(lod, dataset, c.second, anchors[i], radius, &coarse));
+	});
+	report("within distance", n_queries, t_full, full, t_lod, coarse, a != b);
+	failures += a != b;
+    }
+    {
+	spatial::lod_stats full, coarse;
+	std::vector<char> a, b;
+	double t_full = seconds([&](){
+	    for (size_t i=0; i < n_queries; i++)
+		for (const auto &c: containing[i])
+		{
+		    full.points += dataset[c.second].num_points();
+		    a.push_back(bg::covered_by(anchors[i], dataset[c.second]));
+		}
+	});
+	double t_lod = seconds([&](){
+	    for (size_t i=0; i < n_queries; i++)
+		for (const auto &c: containing[i])
+		    b.push_back(spatial::lod_covered_by(lod, dataset, c.second, anchors[i], &coarse));
+	});
+	report("point in polygon", n_queries, t_full, full, t_lod, coarse, a != b);
+	failures += a != b;
+    }
+    if (failures){
+	std::cerr << "FAILED: the answers with tiers differ from those on the full polygons" << std::endl;
+	return 1;
+    }
+    return 0;
+}
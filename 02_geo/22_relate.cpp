@@ -0,0 +1,164 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Many predicates from one relate pass
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++14 -pthread -o 22_relate 22_relate.cpp
+*/
+
+// The candidate pairs of two joins: buildings x the parcel grid of 06_spatial_join
+// (shifted by a third of a block) and buildings x buildings. For each pair the
+// nine named predicates of relate.hpp, answered by one bg:: call each (plus
+// bg::relation, as 02_simplefeatures does), by one relate pass with the matrix,
+// by one pass stopping early, and on all threads with relate_pairs. Then a single
+// predicate, within, by bg::within and by relate. The answers must not differ.
+//
+// Usage: 22_relate [pairs] [threads]
+
+#include<iostream>
+#include<iomanip>
+#include<chrono>
+#include<cstdlib>
+#include<vector>
+#include<string>
+#include <boost/geometry.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "packed_rtree.hpp"
+#include "spatial_join.hpp"
+#include "relate.hpp"
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+// n x n square blocks covering the box, shifted by a third of a block
+spatial::polygon_store make_parcels(const box &roi, size_t n)
+{
+    spatial::polygon_store parcels;
+    double dx = (bg::get<bg::max_corner,0>(roi) - bg::get<bg::min_corner,0>(roi)) / n;
+    double dy = (bg::get<bg::max_corner,1>(roi) - bg::get<bg::min_corner,1>(roi)) / n;
+    double x0 = bg::get<bg::min_corner,0>(roi) - dx / 3, y0 = bg::get<bg::min_corner,1>(roi) - dy / 3;
+    for (size_t i=0; i <= n; i++)
+	for (size_t j=0; j <= n; j++)
+	{
+	    polygon p;
+	    bg::convert(box(point(x0 + i*dx, y0 + j*dy), point(x0 + (i+1)*dx, y0 + (j+1)*dy)), p);
+	    bg::correct(p);
+	    parcels.push_back(p, i*(n+1) + j);
+	}
+    return parcels;
+}
+
+// the nine predicates with one Boost.Geometry call each, as bits of spatial::relation
+template<typename G1, typename G2>
+uint64_t separate_calls(const G1 &a, const G2 &b, std::string &matrix)
+{
+    matrix = bg::relation(a, b).str();
+    return uint64_t(bg::intersects(a, b)) * spatial::rel_intersects | uint64_t(bg::disjoint(a, b)) * spatial::rel_disjoint
+	| uint64_t(bg::within(a, b)) * spatial::rel_within | uint64_t(bg::covered_by(a, b)) * spatial::rel_covered_by
+	| uint64_t(bg::within(b, a)) * spatial::rel_contains | uint64_t(bg::covered_by(b, a)) * spatial::rel_covers
+	| uint64_t(bg::equals(a, b)) * spatial::rel_equals | uint64_t(bg::overlaps(a, b)) * spatial::rel_overlaps
+	| uint64_t(bg::touches(a, b)) * spatial::rel_touches;
+}
+
+void run(const std::string &name, const spatial::polygon_store &left, const spatial::polygon_store &right,
+	 const std::vector<spatial::join_pair> &pairs, unsigned threads)
+{
+    const size_t n = pairs.size();
+    std::vector<uint64_t> a(n), b(n), c(n), d(n);
+    std::vector<std::string> ma(n), mb(n);
+    spatial::relate_query all(spatial::rel_all);
+    double t_separate = seconds([&](){
+	for (size_t i=0; i < n; i++)
+	    a[i] = separate_calls(left[pairs[i].first], right[pairs[i].second], ma[i]);
+    });
+    double t_matrix = seconds([&](){
+	for (size_t i=0; i < n; i++)
+	    b[i] = spatial::relate(left[pairs[i].first], right[pairs[i].second], all, &mb[i]);
+    });
+    double t_early = seconds([&](){
+	for (size_t i=0; i < n; i++)
+	    c[i] = spatial::relate(left[pairs[i].first], right[pairs[i].second], all);
+    });
+    double t_parallel = seconds([&](){
+	spatial::relate_pairs(left, right, pairs.data(), n, all, d.data(), threads);
+    });
+    size_t different = 0, holds[spatial::relate_query::named] = {};
+    for (size_t i=0; i < n; i++)
+    {
+	different += a[i] != b[i] || a[i] != c[i] || a[i] != d[i] || ma[i] != mb[i];
+	for (size_t k=0; k < spatial::relate_query::named; k++)
+	    holds[k] += (a[i] >> k) & 1;
+    }
+    std::cout << name << ": " << n << " pairs; intersects " << holds[0] << ", within " << holds[2] << ", covered_by "
+	      << holds[3] << ", contains " << holds[4] << ", equals " << holds[6] << ", overlaps " << holds[7]
+	      << ", touches " << holds[8] << std::endl;
+    auto line = [&](const std::string &what, double t, size_t diff){
+	std::cout << "  " << std::left << std::setw(44) << what << std::right << std::setw(10) << t / n * 1e6
+		  << " us/pair" << std::setw(10) << diff << " different" << std::endl;
+    };
+    line("bg::relation + 9 bg:: predicates", t_separate, 0);
+    line("spatial::relate, all 9 + matrix", t_matrix, different);
+    line("spatial::relate, all 9, early exit", t_early, different);
+    line("relate_pairs, all 9, " + std::to_string(threads) + " threads", t_parallel, different);
+
+    spatial::relate_query within(spatial::rel_within);
+    std::vector<char> wa(n), wb(n);
+    double t_bg = seconds([&](){
+	for (size_t i=0; i < n; i++)
+	    wa[i] = bg::within(left[pairs[i].first], right[pairs[i].second]);
+    });
+    double t_relate = seconds([&](){
+	for (size_t i=0; i < n; i++)
+	    wb[i] = spatial::relate(left[pairs[i].first], right[pairs[i].second], within) != 0;
+    });
+    size_t diff = 0;
+    for (size_t i=0; i < n; i++)
+	diff += wa[i] != wb[i];
+    line("bg::within", t_bg, 0);
+    line("spatial::relate, within", t_relate, diff);
+}
+
+int main(int argc, char **argv)
+{
+    size_t max_pairs = (argc > 1) ? std::atol(argv[1]) : 100000;
+    unsigned threads = spatial::default_threads();
+    if (argc > 2 && !spatial::parse_threads(argv[2], threads))
+    {
+	std::cerr << "FAILED: the number of threads must be in [1, " << spatial::max_threads << "], not " << argv[2] << std::endl;
+	return 1;
+    }
+    spatial::polygon_store buildings;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", buildings, roi, threads);
+    rtree building_tree(spatial::envelopes(buildings, threads));
+    spatial::polygon_store parcels = make_parcels(roi, 200);
+    rtree parcel_tree(spatial::envelopes(parcels, threads));
+
+    // the candidate pairs (box filter) of the two joins, in the order of the buildings
+    auto candidates = [&](const spatial::polygon_store &right, const rtree &tree, bool skip_self){
+	std::vector<spatial::join_pair> pairs;
+	std::vector<value> hits;
+	for (size_t i=0; i < buildings.size() && pairs.size() < max_pairs; i++)
+	{
+	    hits.clear();
+	    tree.query(bgi::intersects(buildings.envelope(i)), std::back_inserter(hits));
+	    for (const auto &h: hits)
+		if (!(skip_self && h.second == i) && pairs.size() < max_pairs)
+		    pairs.push_back(spatial::join_pair(i, h.second));
+	}
+	return pairs;
+    };
+    run("buildings x parcels", buildings, parcels, candidates(parcels, parcel_tree, false), threads);
+    run("buildings x buildings", buildings, buildings, candidates(buildings, building_tree, true), threads);
+    return 0;
+}
@@ -0,0 +1,254 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Program: Bulk point classification against zones
+Compile: g++ -I $(BOOST_DIR) -O2 -Wall -std=c++14 -pthread -o 23_classify 23_classify.cpp
+*/
+
+// The points.csv loop of 02_simplefeatures at scale: random points in the city
+// against made-up zones (wavy polygons of [vertices] points around random
+// centers, overlapping, every other one with a hole). The first zone of every
+// point is found by the zone_classifier (classify.hpp) with each SIMD level on
+// one thread and on all, and for a sample by an R-tree with bg::within and with
+// prepared polygons. Points on vertices and edges of the zones test the
+// boundary cases, for within and covered_by, and points a few ulps off the edges
+// of 7-gons in projected metres those of a large rounding error. The answers
+// must not differ. The zone ids are written as a binary column (zones.u32, 4
+// bytes per point).
+//
+// Usage: 23_classify [points] [zones] [vertices] [threads]
+
+#include<iostream>
+#include<iomanip>
+#include<chrono>
+#include<cstdlib>
+#include<cmath>
+#include<vector>
+#include<algorithm>
+#include<memory>
+#include <boost/geometry.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp"
+#include "polygon_store.hpp"
+#include "packed_rtree.hpp"
+#include "prepared_polygon.hpp"
+#include "result_writer.hpp"
+#include "classify.hpp"
+
+template<typename F>
+double seconds(F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    return diff.count();
+}
+
+double uniform() {return static_cast<double>(std::rand()) / RAND_MAX;}
+
+point random_point_in_box(const box &b)
+{
+    return point(bg::get<bg::min_corner,0>(b) + uniform() * (bg::get<bg::max_corner,0>(b) - bg::get<bg::min_corner,0>(b)),
+		 bg::get<bg::min_corner,1>(b) + uniform() * (bg::get<bg::max_corner,1>(b) - bg::get<bg::min_corner,1>(b)));
+}
+
+// a star-shaped polygon of n vertices around c with a wavy outline (and a hole)
+polygon zone_polygon(const point &c, double radius, size_t n, bool hole)
+{
+    polygon g;
+    const double phase = 2 * M_PI * uniform();
+    for (size_t i=0; i < n; i++)
+    {
+	const double a = 2 * M_PI * i / n;
+	const double r = radius * (1 + 0.3 * std::sin(3 * a + phase) + 0.1 * std::sin(17 * a) + 0.01 * uniform());
+	bg::append(g.outer(), point(bg::get<0>(c) + r * std::cos(a), bg::get<1>(c) + r * std::sin(a)));
+    }
+    if (hole){
+	g.inners().resize(1);
+	for (size_t i=0; i < n / 4; i++)
+	{
+	    const double a = 2 * M_PI * i / (n / 4);
+	    bg::append(g.inners()[0], point(bg::get<0>(c) + 0.3 * radius * std::cos(a), bg::get<1>(c) + 0.3 * radius * std::sin(a)));
+	}
+    }
+    bg::correct(g);
+    return g;
+}
+
+// the first zone containing p by the R-tree and test(zone, p)
+template<typename Test>
+uint32_t first_zone(const rtree &rt, const point &p, Test test)
+{
+    std::vector<value> candidates;
+    rt.query(bgi::intersects(p), std::back_inserter(candidates));
+    std::sort(candidates.begin(), candidates.end(), [](const value &a, const value &b){ return a.second < b.second; });
+    for (const auto &c: candidates)
+	if (test(c.second, p)) return static_cast<uint32_t>(c.second);
+    return spatial::zone_classifier::no_zone;
+}
+
+// x moved by k units in the last place
+double ulps(double x, int k)
+{
+    for (; k > 0; k--) x = std::nextafter(x, HUGE_VAL);
+    for (; k < 0; k++) x = std::nextafter(x, -HUGE_VAL);
+    return x;
+}
+
+template<typename T>
+size_t differences(const std::vector<T> &a, const std::vector<T> &b, size_t n)
+{
+    size_t d = 0;
+    for (size_t i=0; i < n; i++)
+	d += a[i] != b[i];
+    return d;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n_points = (argc > 1) ? std::atol(argv[1]) : 10000000;
+    size_t n_zones = (argc > 2) ? std::atol(argv[2]) : 2000;
+    size_t n_vertices = (argc > 3) ? std::atol(argv[3]) : 200;
+    unsigned threads = spatial::default_threads();
+    if (argc > 4 && !spatial::parse_threads(argv[4], threads))
+    {
+	std::cerr << "FAILED: the number of threads must be in [1, " << spatial::max_threads << "], not " << argv[4] << std::endl;
+	return 1;
+    }
+
+    spatial::polygon_store buildings;
+    box roi;
+    spatial::load_wkt_file("washington_dc_osm_buildings.wkt", buildings, roi, threads);
+    std::srand(42);
+    spatial::polygon_store zones;
+    for (size_t i=0; i < n_zones; i++)
+	zones.push_back(zone_polygon(random_point_in_box(roi), 0.001 + 0.003 * uniform(), n_vertices, i % 2), i);
+    std::vector<point> points(n_points);
+    for (auto &p: points)
+	p = random_point_in_box(roi);
+
+    double t = 0;
+    std::unique_ptr<spatial::zone_classifier> classifier;
+    t = seconds([&](){ classifier.reset(new spatial::zone_classifier(zones, false, 8, 16, threads)); });
+    std::cout << n_zones << " zones of " << n_vertices << " vertices: " << classifier->num_cells() << " cells, "
+	      << classifier->num_edges() << " edges in bands, " << classifier->memory_usage() / (1024.0 * 1024.0)
+	      << " MB, prepared in " << t << " seconds" << std::endl;
+
+    // the baselines on a sample
+    const size_t sample = std::min<size_t>(n_points, 200000);
+    rtree rt(spatial::envelopes(zones));
+    std::vector<spatial::prepared_polygon<spatial::polygon_view>> prepared;
+    for (size_t i=0; i < zones.size(); i++)
+	prepared.push_back(spatial::prepared_polygon<spatial::polygon_view>(zones[i]));
+    std::vector<uint32_t> by_bg(n_points), by_prepared(n_points);
+    double t_bg = seconds([&](){
+	for (size_t i=0; i < sample; i++)
+	    by_bg[i] = first_zone(rt, points[i], [&](size_t z, const point &p){ return bg::within(p, zones[z]); });
+    });
+    double t_prepared = seconds([&](){
+	for (size_t i=0; i < sample; i++)
+	    by_prepared[i] = first_zone(rt, points[i], [&](size_t z, const point &p){ return prepared[z].within(p); });
+    });
+    std::cout << std::left << std::setw(36) << "method" << std::right << std::setw(14) << "points/s"
+	      << std::setw(12) << "different" << std::endl;
+    auto line = [](const std::string &name, double rate, size_t different){
+	std::cout << std::left << std::setw(36) << name << std::right << std::setw(14) << std::setprecision(4) << rate
+		  << std::setw(12) << different << std::endl;
+    };
+    // every difference from bg::within (or between levels and thread counts) fails the run
+    size_t failures = differences(by_bg, by_prepared, sample);
+    line("R-tree + bg::within", sample / t_bg, 0);
+    line("R-tree + prepared_polygon", sample / t_prepared, failures);
+
+    std::vector<uint32_t> zone(n_points), reference;
+    for (int level = spatial::simd_scalar; level <= spatial::best_simd_level(); level++)
+	for (unsigned th: {1u, threads})
+	{
+	    t = seconds([&](){ classifier->classify(points.data(), n_points, zone.data(), th, spatial::simd_level(level)); });
+	    if (reference.empty()) reference = zone;
+	    size_t different = differences(by_bg, zone, sample) + differences(reference, zone, n_points);
+	    line(std::string("zone_classifier, ") + spatial::simd_level_name(spatial::simd_level(level)) + ", "
+		 + std::to_string(th) + " threads", n_points / t, different);
+	    failures += different;
+	    if (th == threads) break;
+	}
+    size_t inside = n_points - std::count(zone.begin(), zone.end(), spatial::zone_classifier::no_zone);
+    std::cout << inside << " of " << n_points << " points are in a zone" << std::endl;
+
+    // vertices and edge midpoints of the zones, within and covered_by
+    {
+	spatial::zone_classifier closed(zones, true, 8, 16, threads);
+	std::vector<point> hard;
+	for (size_t i=0; i < zones.size() && hard.size() < 100000; i++)
+	    for (const spatial::ring_view *r = zones[i].first; r != zones[i].last; ++r)
+		for (size_t k=0; k < r->size(); k += 7)
+		{
+		    const point &a = (*r)[k], &b = (*r)[(k + 1) % r->size()];
+		    hard.push_back(a);
+		    hard.push_back(point((bg::get<0>(a) + bg::get<0>(b)) / 2, (bg::get<1>(a) + bg::get<1>(b)) / 2));
+		}
+	std::vector<uint32_t> a(hard.size()), b(hard.size()), c(hard.size()), d(hard.size());
+	classifier->classify(hard.data(), hard.size(), a.data(), threads);
+	closed.classify(hard.data(), hard.size(), c.data(), threads);
+	for (size_t i=0; i < hard.size(); i++)
+	{
+	    b[i] = first_zone(rt, hard[i], [&](size_t z, const point &p){ return bg::within(p, zones[z]); });
+	    d[i] = first_zone(rt, hard[i], [&](size_t z, const point &p){ return bg::covered_by(p, zones[z]); });
+	}
+	const size_t within_different = differences(a, b, hard.size()), covered_different = differences(c, d, hard.size());
+	std::cout << hard.size() << " points on the boundaries: " << within_different << " different (within), "
+		  << covered_different << " different (covered_by)" << std::endl;
+	failures += within_different + covered_different;
+    }
+
+    // projected coordinates (metres): 7-gons far from the origin in all four
+    // quadrants and points a few units in the last place off their edges, with
+    // every SIMD level
+    {
+	spatial::polygon_store projected;
+	for (size_t i=0; i < 1000; i++)
+	{
+	    const double sx = (i & 1) ? -1 : 1, sy = (i & 2) ? -1 : 1;
+	    projected.push_back(zone_polygon(point(sx * (5e6 + 1e6 * uniform()), sy * (5e6 + 1e6 * uniform())), 2e5, 7, false), i);
+	}
+	spatial::zone_classifier metres(projected, false, 8, 16, threads);
+	rtree prt(spatial::envelopes(projected));
+	std::vector<point> near(400000);
+	for (size_t i=0; i < near.size(); i++)
+	{
+	    const spatial::ring_view &r = *projected[i % projected.size()].first;
+	    const point &a = r[i % r.size()], &b = r[(i + 1) % r.size()];
+	    const double s = uniform();
+	    near[i] = point(ulps(bg::get<0>(a) + s * (bg::get<0>(b) - bg::get<0>(a)), std::rand() % 17 - 8),
+			    ulps(bg::get<1>(a) + s * (bg::get<1>(b) - bg::get<1>(a)), std::rand() % 17 - 8));
+	}
+	std::vector<uint32_t> expected(near.size()), got(near.size());
+	for (size_t i=0; i < near.size(); i++)
+	    expected[i] = first_zone(prt, near[i], [&](size_t z, const point &p){ return bg::within(p, projected[z]); });
+	std::cout << near.size() << " points next to the edges of projected 7-gons:";
+	for (int level = spatial::simd_scalar; level <= spatial::best_simd_level(); level++)
+	{
+	    metres.classify(near.data(), near.size(), got.data(), threads, spatial::simd_level(level));
+	    const size_t different = differences(expected, got, near.size());
+	    std::cout << " " << different << " different (" << spatial::simd_level_name(spatial::simd_level(level)) << ")";
+	    failures += different;
+	}
+	std::cout << std::endl;
+    }
+
+    t = seconds([&](){
+	spatial::result_writer column("zones.u32", true);
+	column.write(zone.data(), zone.size() * sizeof(uint32_t));
+	column.close();
+    });
+    std::cout << "Wrote zones.u32 (" << zone.size() * sizeof(uint32_t) / (1024.0 * 1024.0) << " MB) in " << t
+	      << " seconds" << std::endl;
+    if (failures){
+	std::cerr << "FAILED: " << failures << " results differ from bg::within / bg::covered_by" << std::endl;
+	return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Arenas for polygon parsing and query temporaries
+
+A query that fills a std::vector, a heap and a result vector calls malloc a few
+times and free as often, every time. An arena hands out memory by moving a
+pointer through a few large blocks and never frees single allocations; rewinding
+it to a mark releases everything allocated since in one step, and the blocks are
+kept for the next round. So once the blocks are large enough, a loop of queries
+or rows does not call malloc at all.
+
+Every thread has its own scratch arena. arena_allocator<T> allocates from the
+scratch arena of the thread that constructs it (or from a given arena), and
+plugs into std::vector and into the Boost.Geometry models: scratch_polygon is a
+polygon whose rings live in the arena. A scratch_scope rewinds the scratch arena
+when it goes out of scope:
+
+   {
+       spatial::scratch_scope scope;
+       spatial::scratch_vector<value> candidates; // memory of the scratch arena
+       ...
+   } // candidates is gone, its memory is free for the next query
+
+Scopes nest like the stack. A scratch container must neither outlive its scope
+nor grow inside a nested one (the inner scope would hand that memory out again),
+and it must not be passed to another thread.
+*/
+#pragma once
+
+#include<vector>
+#include<cstdint>
+#include<new>
+#include<algorithm>
+
+#include "types.hpp"
+
+namespace spatial{
+
+class arena
+{
+    struct block
+    {
+	char *data;
+	size_t size;
+    };
+    std::vector<block> blocks;
+    size_t current = 0; // the block allocations come from
+    size_t used = 0;    // bytes used in it
+    size_t first_size;
+
+public:
+    struct mark_type
+    {
+	size_t block, used;
+    };
+
+    explicit arena(size_t first_block = 1 << 16): first_size(first_block) {}
+    ~arena()
+    {
+	for (auto &b: blocks) ::operator delete(b.data);
+    }
+    arena(const arena &) = delete;
+    arena &operator=(const arena &) = delete;
+
+    void *allocate(size_t bytes, size_t align)
+    {
+	while (current < blocks.size())
+	{
+	    const block &b = blocks[current];
+	    uintptr_t base = reinterpret_cast<uintptr_t>(b.data);
+	    size_t offset = ((base + used + align - 1) & ~static_cast<uintptr_t>(align - 1)) - base;
+	    if (offset + bytes <= b.size){
+		used = offset + bytes;
+		return b.data + offset;
+	    }
+	    ++current; // too small for this one, the rest of the block stays unused
+	    used = 0;
+	}
+	// a new block, at least twice the last one
+	size_t size = std::max(blocks.empty() ? first_size : 2 * blocks.back().size, bytes + align);
+	block b = {static_cast<char *>(::operator new(size)), size};
+	blocks.push_back(b);
+	current = blocks.size() - 1;
+	used = 0;
+	return allocate(bytes, align);
+    }
+
+    mark_type mark() const
+    {
+	mark_type m = {current, used};
+	return m;
+    }
+    // everything allocated since m is free again
+    void rewind(const mark_type &m)
+    {
+	current = m.block;
+	used = m.used;
+    }
+    void reset()
+    {
+	current = used = 0;
+    }
+
+    // bytes held in blocks
+    size_t capacity() const
+    {
+	size_t n = 0;
+	for (const auto &b: blocks) n += b.size;
+	return n;
+    }
+};
+
+// the scratch arena of the calling thread
+inline arena &scratch_arena()
+{
+    static thread_local arena a;
+    return a;
+}
+
+// rewinds the scratch arena of the thread to where it was at construction
+class scratch_scope
+{
+    arena &a;
+    arena::mark_type m;
+public:
+    scratch_scope(): a(scratch_arena()), m(a.mark()) {}
+    ~scratch_scope() {a.rewind(m);}
+    scratch_scope(const scratch_scope &) = delete;
+    scratch_scope &operator=(const scratch_scope &) = delete;
+    // free everything allocated in this scope so far
+    void rewind() {a.rewind(m);}
+};
+
+// Allocator on an arena; deallocate does nothing, the arena is rewound instead
+template<typename T>
+struct arena_allocator
+{
+    typedef T value_type;
+    arena *a;
+
+    arena_allocator(): a(&scratch_arena()) {}
+    explicit arena_allocator(arena &ar): a(&ar) {}
+    template<typename U> arena_allocator(const arena_allocator<U> &other): a(other.a) {}
+
+    T *allocate(size_t n) {return static_cast<T *>(a->allocate(n * sizeof(T), alignof(T)));}
+    void deallocate(T *, size_t) {}
+};
+template<typename T, typename U>
+bool operator==(const arena_allocator<T> &x, const arena_allocator<U> &y) {return x.a == y.a;}
+template<typename T, typename U>
+bool operator!=(const arena_allocator<T> &x, const arena_allocator<U> &y) {return x.a != y.a;}
+
+template<typename T>
+using scratch_vector = std::vector<T, arena_allocator<T>>;
+
+// the geometry types of types.hpp with their points and rings in the scratch arena
+typedef bg::model::ring<point, false, false, std::vector, arena_allocator> scratch_ring;
+typedef bg::model::polygon<point, false, false, std::vector, std::vector, arena_allocator, arena_allocator> scratch_polygon;
+typedef bg::model::multi_polygon<scratch_polygon, std::vector, arena_allocator> scratch_multi_polygon;
+
+} // spatial
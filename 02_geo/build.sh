@@ -4,7 +4,12 @@ function build()
 {
 for f in *.cpp; do
     echo  "Checking $f";
-    if [ $(basename $f .cpp) -nt $f ]; then
+    # programs using the local headers also depend on them
+    HEADERS=""
+    if grep -q '#include "' $f; then
+	HEADERS=$(find . -maxdepth 1 -name '*.hpp' -newer $(basename $f .cpp) 2>/dev/null)
+    fi
+    if [ $(basename $f .cpp) -nt $f ] && [ -z "$HEADERS" ]; then
        echo "==> Up to date"
     else
 	   
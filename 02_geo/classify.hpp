@@ -0,0 +1,475 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Bulk classification of points against a set of zones
+
+Which zone is a GPS fix in? For many points and many zones, the zone_classifier
+prepares the zones once:
+
+ - a uniform grid over all zones lists, per cell, the zones that can contain a
+   point of the cell, in zone order. A zone whose boundary does not come near a
+   cell and that contains the cell is marked as containing it: its points need
+   no test at all. A zone that does not reach into a cell is not listed.
+ - the edges of every zone are sorted into horizontal bands as in
+   prepared_polygon.hpp, but stored as columns (x1, y1, x2, y2), so that the
+   crossings of the ray from a point with the edges of its band are counted 4
+   (AVX2) or 8 (AVX-512) edges at a time (see simd.hpp for the runtime choice).
+
+The answers are those of bg::within (or bg::covered_by, with boundary = true):
+like prepared_polygon, the kernels flag a point that comes close to an edge or
+to the height of a vertex, and Boost.Geometry decides it.
+
+classify writes the first zone of each point (or no_zone), classify_mask the
+set of zones as bits (up to 64 zones), for an array of points on all threads.
+*/
+#pragma once
+
+#include<vector>
+#include<cstdint>
+#include<cmath>
+#include<limits>
+#include<algorithm>
+#include<stdexcept>
+
+#include "types.hpp"
+#include "simd.hpp"
+#include "parallel.hpp"
+#include "polygon_store.hpp"
+#include "prepared_polygon.hpp"
+
+namespace spatial{
+
+namespace detail{
+
+// Crossings of the ray from (px, py) to the right with the edges [b, e) of the
+// columns: the parity is flipped per crossing. true if the point is too close to
+// an edge or a vertex height to decide (ray_crossing of prepared_polygon.hpp).
+inline bool crossings_scalar(const double *x1, const double *y1, const double *x2, const double *y2,
+			     size_t b, size_t e, double px, double py, double tx, double ty, double m, unsigned &parity)
+{
+    for (size_t i=b; i < e; i++)
+    {
+	int crossing = ray_crossing(x1[i], y1[i], x2[i], y2[i], px, py, tx, ty, m);
+	if (crossing < 0) return true;
+	parity ^= static_cast<unsigned>(crossing);
+    }
+    return false;
+}
+
+#ifdef SPATIAL_X86_KERNELS
+
+__attribute__((target("avx2,popcnt")))
+inline bool crossings_avx2(const double *x1, const double *y1, const double *x2, const double *y2,
+			   size_t b, size_t e, double px, double py, double tx, double ty, double m, unsigned &parity)
+{
+    const __m256d PX = _mm256_set1_pd(px), PY = _mm256_set1_pd(py), TY = _mm256_set1_pd(ty);
+    const __m256d LEFT = _mm256_set1_pd(px - tx), ONE = _mm256_set1_pd(1.0), ZERO = _mm256_setzero_pd();
+    const __m256d EPS = _mm256_set1_pd(64 * std::numeric_limits<double>::epsilon()), M = _mm256_set1_pd(m);
+    const __m256d ABS = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+    size_t i = b;
+    unsigned count = 0;
+    for (; i + 4 <= e; i += 4)
+    {
+	__m256d X1 = _mm256_loadu_pd(x1 + i), Y1 = _mm256_loadu_pd(y1 + i);
+	__m256d X2 = _mm256_loadu_pd(x2 + i), Y2 = _mm256_loadu_pd(y2 + i);
+	__m256d dpy = _mm256_sub_pd(PY, Y1);
+	__m256d near = _mm256_or_pd(_mm256_cmp_pd(_mm256_and_pd(dpy, ABS), TY, _CMP_LE_OQ),
+				    _mm256_cmp_pd(_mm256_and_pd(_mm256_sub_pd(PY, Y2), ABS), TY, _CMP_LE_OQ));
+	if (_mm256_movemask_pd(_mm256_and_pd(near, _mm256_cmp_pd(_mm256_max_pd(X1, X2), LEFT, _CMP_GE_OQ))))
+	    return true;
+	__m256d straddle = _mm256_xor_pd(_mm256_cmp_pd(Y1, PY, _CMP_GT_OQ), _mm256_cmp_pd(Y2, PY, _CMP_GT_OQ));
+	__m256d open = _mm256_andnot_pd(near, straddle);
+	if (!_mm256_movemask_pd(open)) continue;
+	__m256d dx = _mm256_sub_pd(X2, X1), dy = _mm256_sub_pd(Y2, Y1), dpx = _mm256_sub_pd(PX, X1);
+	// side and its tolerance as in ray_crossing, the products not fused into FMAs
+	__m256d a = _mm256_mul_pd(dx, dpy), c = _mm256_mul_pd(dy, dpx);
+	__asm__("" : "+x"(a), "+x"(c));
+	__m256d side = _mm256_sub_pd(a, c);
+	__m256d adx = _mm256_and_pd(dx, ABS), ady = _mm256_and_pd(dy, ABS);
+	__m256d scale = _mm256_max_pd(_mm256_max_pd(adx, ady),
+				      _mm256_max_pd(_mm256_and_pd(dpx, ABS), _mm256_and_pd(dpy, ABS)));
+	__m256d tol = _mm256_add_pd(_mm256_add_pd(_mm256_and_pd(a, ABS), _mm256_and_pd(c, ABS)),
+				    _mm256_mul_pd(_mm256_add_pd(adx, ady), M));
+	tol = _mm256_mul_pd(EPS, _mm256_add_pd(tol, _mm256_max_pd(ONE, scale)));
+	if (_mm256_movemask_pd(_mm256_and_pd(open, _mm256_cmp_pd(_mm256_and_pd(side, ABS), tol, _CMP_LE_OQ))))
+	    return true;
+	__m256d differ = _mm256_xor_pd(_mm256_cmp_pd(side, ZERO, _CMP_GT_OQ), _mm256_cmp_pd(dy, ZERO, _CMP_GT_OQ));
+	count += __builtin_popcount(_mm256_movemask_pd(_mm256_andnot_pd(differ, open)));
+    }
+    parity ^= count & 1;
+    return crossings_scalar(x1, y1, x2, y2, i, e, px, py, tx, ty, m, parity);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f,popcnt")))
+inline bool crossings_avx512(const double *x1, const double *y1, const double *x2, const double *y2,
+			     size_t b, size_t e, double px, double py, double tx, double ty, double m, unsigned &parity)
+{
+    const __m512d PX = _mm512_set1_pd(px), PY = _mm512_set1_pd(py), TY = _mm512_set1_pd(ty);
+    const __m512d LEFT = _mm512_set1_pd(px - tx), ONE = _mm512_set1_pd(1.0), ZERO = _mm512_setzero_pd();
+    const __m512d EPS = _mm512_set1_pd(64 * std::numeric_limits<double>::epsilon()), M = _mm512_set1_pd(m);
+    size_t i = b;
+    unsigned count = 0;
+    for (; i + 8 <= e; i += 8)
+    {
+	__m512d X1 = _mm512_loadu_pd(x1 + i), Y1 = _mm512_loadu_pd(y1 + i);
+	__m512d X2 = _mm512_loadu_pd(x2 + i), Y2 = _mm512_loadu_pd(y2 + i);
+	__m512d dpy = _mm512_sub_pd(PY, Y1);
+	__mmask8 near = _mm512_cmp_pd_mask(_mm512_abs_pd(dpy), TY, _CMP_LE_OQ)
+		      | _mm512_cmp_pd_mask(_mm512_abs_pd(_mm512_sub_pd(PY, Y2)), TY, _CMP_LE_OQ);
+	if (near & _mm512_cmp_pd_mask(_mm512_max_pd(X1, X2), LEFT, _CMP_GE_OQ))
+	    return true;
+	__mmask8 open = (_mm512_cmp_pd_mask(Y1, PY, _CMP_GT_OQ) ^ _mm512_cmp_pd_mask(Y2, PY, _CMP_GT_OQ)) & ~near;
+	if (!open) continue;
+	__m512d dx = _mm512_sub_pd(X2, X1), dy = _mm512_sub_pd(Y2, Y1), dpx = _mm512_sub_pd(PX, X1);
+	__m512d a = _mm512_mul_pd(dx, dpy), c = _mm512_mul_pd(dy, dpx);
+	__asm__("" : "+v"(a), "+v"(c));
+	__m512d side = _mm512_sub_pd(a, c);
+	__m512d adx = _mm512_abs_pd(dx), ady = _mm512_abs_pd(dy);
+	__m512d scale = _mm512_max_pd(_mm512_max_pd(adx, ady),
+				      _mm512_max_pd(_mm512_abs_pd(dpx), _mm512_abs_pd(dpy)));
+	__m512d tol = _mm512_add_pd(_mm512_add_pd(_mm512_abs_pd(a), _mm512_abs_pd(c)),
+				    _mm512_mul_pd(_mm512_add_pd(adx, ady), M));
+	tol = _mm512_mul_pd(EPS, _mm512_add_pd(tol, _mm512_max_pd(ONE, scale)));
+	if (open & _mm512_cmp_pd_mask(_mm512_abs_pd(side), tol, _CMP_LE_OQ))
+	    return true;
+	__mmask8 differ = _mm512_cmp_pd_mask(side, ZERO, _CMP_GT_OQ) ^ _mm512_cmp_pd_mask(dy, ZERO, _CMP_GT_OQ);
+	count += __builtin_popcount(open & ~differ);
+    }
+    parity ^= count & 1;
+    return crossings_scalar(x1, y1, x2, y2, i, e, px, py, tx, ty, m, parity);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+} // detail
+
+class zone_classifier
+{
+public:
+    static const uint32_t no_zone = std::numeric_limits<uint32_t>::max();
+
+private:
+    static const uint32_t contains_cell = 1u << 31; // flag of a grid entry
+
+    struct zone
+    {
+	double min_x, min_y, max_x, max_y; // the envelope
+	double tx, ty;                     // tolerances of the coordinates
+	double magnitude;                  // largest magnitude of the coordinates
+	double band_height;
+	uint64_t first_band;               // into band_offsets
+	uint32_t n_bands;
+    };
+
+    polygon_store zones_;               // for the points that the kernels cannot decide
+    std::vector<zone> info_;
+    std::vector<uint64_t> band_offsets_; // per zone n_bands + 1 offsets into the edge columns
+    std::vector<double> x1_, y1_, x2_, y2_;
+    bool boundary_;
+
+    // the grid: zones (and the contains_cell flag) of cell c in [cell_offsets[c], cell_offsets[c+1])
+    double gx0 = 0, gy0 = 0, cell_w = 1, cell_h = 1;
+    size_t nx = 0, ny = 0;
+    std::vector<uint64_t> cell_offsets_;
+    std::vector<uint32_t> cell_zones_;
+
+    template<typename Ring>
+    static void collect(const Ring &ring, std::vector<box> &edges)
+    {
+	const size_t n = boost::size(ring);
+	if (n < 2) return;
+	for (size_t i=0; i < n; i++) // open rings: the closing edge as well
+	    edges.push_back(box(ring[i], ring[(i + 1) % n]));
+    }
+
+    size_t band(const zone &z, double y) const
+    {
+	double b = std::floor((y - z.min_y) / z.band_height);
+	return static_cast<size_t>(std::min<double>(std::max(b, 0.0), z.n_bands - 1));
+    }
+    size_t cell_x(double x) const
+    {
+	return static_cast<size_t>(std::min<double>(std::max(std::floor((x - gx0) / cell_w), 0.0), nx - 1));
+    }
+    size_t cell_y(double y) const
+    {
+	return static_cast<size_t>(std::min<double>(std::max(std::floor((y - gy0) / cell_h), 0.0), ny - 1));
+    }
+
+    // the bands of zone i and its edges in them, as columns
+    struct prepared
+    {
+	zone z;
+	std::vector<uint64_t> offsets;
+	std::vector<double> x1, y1, x2, y2;
+    };
+    static prepared prepare(const polygon_view &g, const box &envelope, size_t edges_per_band)
+    {
+	std::vector<box> edges; // (x1, y1) - (x2, y2), not normalized
+	collect(bg::exterior_ring(g), edges);
+	for (const auto &r: bg::interior_rings(g))
+	    collect(r, edges);
+	prepared p;
+	zone &z = p.z;
+	z.min_x = bg::get<bg::min_corner,0>(envelope); z.min_y = bg::get<bg::min_corner,1>(envelope);
+	z.max_x = bg::get<bg::max_corner,0>(envelope); z.max_y = bg::get<bg::max_corner,1>(envelope);
+	z.tx = detail::crossing_tolerance(std::max(std::fabs(z.min_x), std::fabs(z.max_x)));
+	z.ty = detail::crossing_tolerance(std::max(std::fabs(z.min_y), std::fabs(z.max_y)));
+	z.magnitude = std::max(std::max(std::fabs(z.min_x), std::fabs(z.max_x)), std::max(std::fabs(z.min_y), std::fabs(z.max_y)));
+	z.n_bands = static_cast<uint32_t>(std::max<size_t>(1, edges.size() / std::max<size_t>(1, edges_per_band)));
+	z.band_height = (z.max_y > z.min_y) ? (z.max_y - z.min_y) / z.n_bands : 1;
+	z.first_band = 0;
+
+	// counting sort of the edges into all bands their y range touches, widened by
+	// the tolerance ty of the crossing tests
+	p.offsets.assign(z.n_bands + 1, 0);
+	auto range = [&](const box &e, size_t &lo, size_t &hi){
+	    auto band_of = [&](double y){
+		double b = std::floor((y - z.min_y) / z.band_height);
+		return static_cast<size_t>(std::min<double>(std::max(b, 0.0), z.n_bands - 1));
+	    };
+	    double a = std::min(bg::get<0,1>(e), bg::get<1,1>(e)), b = std::max(bg::get<0,1>(e), bg::get<1,1>(e));
+	    lo = band_of(a - z.ty);
+	    hi = band_of(b + z.ty);
+	};
+	for (const auto &e: edges)
+	{
+	    size_t lo, hi;
+	    range(e, lo, hi);
+	    for (size_t i=lo; i <= hi; i++) p.offsets[i + 1]++;
+	}
+	for (size_t i=0; i < z.n_bands; i++)
+	    p.offsets[i + 1] += p.offsets[i];
+	const size_t n = p.offsets[z.n_bands];
+	p.x1.resize(n); p.y1.resize(n); p.x2.resize(n); p.y2.resize(n);
+	std::vector<uint64_t> fill(p.offsets.begin(), p.offsets.end() - 1);
+	for (const auto &e: edges)
+	{
+	    size_t lo, hi;
+	    range(e, lo, hi);
+	    for (size_t i=lo; i <= hi; i++)
+	    {
+		const size_t k = fill[i]++;
+		p.x1[k] = bg::get<0,0>(e); p.y1[k] = bg::get<0,1>(e);
+		p.x2[k] = bg::get<1,0>(e); p.y2[k] = bg::get<1,1>(e);
+	    }
+	}
+	return p;
+    }
+
+    // the grid cells zone i reaches into, with contains_cell where it holds the whole cell
+    void cells(size_t i, std::vector<std::pair<uint64_t, uint32_t>> &out) const
+    {
+	const zone &z = info_[i];
+	const size_t cx0 = cell_x(z.min_x - z.tx), cx1 = cell_x(z.max_x + z.tx);
+	const size_t cy0 = cell_y(z.min_y - z.ty), cy1 = cell_y(z.max_y + z.ty);
+	const size_t w = cx1 - cx0 + 1, h = cy1 - cy0 + 1;
+	std::vector<char> touched(w * h, 0);
+	// the cells the box of an edge (widened by the tolerances) overlaps
+	const uint64_t b = band_offsets_[z.first_band], e = band_offsets_[z.first_band + z.n_bands];
+	for (uint64_t k=b; k < e; k++)
+	{
+	    const size_t x0 = cell_x(std::min(x1_[k], x2_[k]) - z.tx), x1 = cell_x(std::max(x1_[k], x2_[k]) + z.tx);
+	    const size_t y0 = cell_y(std::min(y1_[k], y2_[k]) - z.ty), y1 = cell_y(std::max(y1_[k], y2_[k]) + z.ty);
+	    for (size_t y=y0; y <= y1; y++)
+		for (size_t x=x0; x <= x1; x++)
+		    touched[(y - cy0) * w + (x - cx0)] = 1;
+	}
+	for (size_t y=cy0; y <= cy1; y++)
+	    for (size_t x=cx0; x <= cx1; x++)
+	    {
+		const uint64_t c = y * nx + x;
+		if (touched[(y - cy0) * w + (x - cx0)])
+		    out.push_back(std::make_pair(c, static_cast<uint32_t>(i)));
+		else if (locate(i, point(gx0 + (x + 0.5) * cell_w, gy0 + (y + 0.5) * cell_h)) > 0)
+		    out.push_back(std::make_pair(c, static_cast<uint32_t>(i) | contains_cell));
+	    }
+    }
+
+    bool member(uint32_t entry, const point &p, simd_level level) const
+    {
+	if (entry & contains_cell) return true;
+	const int where = locate(entry, p, level);
+	return boundary_ ? where >= 0 : where > 0;
+    }
+    const uint32_t *cell_begin(const point &p, const uint32_t *&end) const
+    {
+	const double x = bg::get<0>(p), y = bg::get<1>(p);
+	if (!(x >= gx0 && x <= gx0 + nx * cell_w && y >= gy0 && y <= gy0 + ny * cell_h)){
+	    end = nullptr;
+	    return nullptr;
+	}
+	const uint64_t c = cell_y(y) * nx + cell_x(x);
+	end = cell_zones_.data() + cell_offsets_[c + 1];
+	return cell_zones_.data() + cell_offsets_[c];
+    }
+
+public:
+    // boundary: points on the boundary of a zone belong to it (covered_by instead
+    // of within); about edges_per_band edges per band, cells_per_zone grid cells
+    // per zone
+    template<typename Polygons>
+    explicit zone_classifier(const Polygons &zones, bool boundary = false, size_t edges_per_band = 8,
+			     double cells_per_zone = 16, unsigned threads = default_threads())
+	: boundary_(boundary), cell_offsets_(1, 0)
+    {
+	const size_t n = zones.size();
+	if (n >= contains_cell) throw std::runtime_error("zone_classifier: too many zones");
+	zones_.reserve(n);
+	for (size_t i=0; i < n; i++)
+	    zones_.push_back(zones[i], i);
+	std::vector<prepared> p(n);
+	parallel_for(n, 64, threads, [&](size_t b, size_t e, unsigned){
+	    for (size_t i=b; i < e; i++)
+		p[i] = prepare(zones_[i], zones_.envelope(i), edges_per_band);
+	});
+	info_.reserve(n);
+	band_offsets_.reserve(n);
+	box extent;
+	bg::assign_inverse(extent);
+	for (size_t i=0; i < n; i++)
+	{
+	    const uint64_t base = x1_.size();
+	    p[i].z.first_band = band_offsets_.size();
+	    info_.push_back(p[i].z);
+	    for (uint64_t o: p[i].offsets)
+		band_offsets_.push_back(base + o);
+	    x1_.insert(x1_.end(), p[i].x1.begin(), p[i].x1.end());
+	    y1_.insert(y1_.end(), p[i].y1.begin(), p[i].y1.end());
+	    x2_.insert(x2_.end(), p[i].x2.begin(), p[i].x2.end());
+	    y2_.insert(y2_.end(), p[i].y2.begin(), p[i].y2.end());
+	    bg::expand(extent, box(point(p[i].z.min_x - p[i].z.tx, p[i].z.min_y - p[i].z.ty),
+				   point(p[i].z.max_x + p[i].z.tx, p[i].z.max_y + p[i].z.ty)));
+	    std::vector<uint64_t>().swap(p[i].offsets);
+	    std::vector<double>().swap(p[i].x1); std::vector<double>().swap(p[i].y1);
+	    std::vector<double>().swap(p[i].x2); std::vector<double>().swap(p[i].y2);
+	}
+	if (n == 0) return;
+
+	// square cells, about cells_per_zone per zone
+	gx0 = bg::get<bg::min_corner,0>(extent);
+	gy0 = bg::get<bg::min_corner,1>(extent);
+	const double w = bg::get<bg::max_corner,0>(extent) - gx0, h = bg::get<bg::max_corner,1>(extent) - gy0;
+	const double side = std::sqrt(std::max(w * h, 1e-300) / std::max(1.0, cells_per_zone * n));
+	nx = std::max<size_t>(1, static_cast<size_t>(std::ceil(w / side)));
+	ny = std::max<size_t>(1, static_cast<size_t>(std::ceil(h / side)));
+	cell_w = (w > 0) ? w / nx : 1;
+	cell_h = (h > 0) ? h / ny : 1;
+
+	// the cells of each zone, in blocks of zones, then a counting sort by cell
+	// that keeps the zones of a cell in zone order
+	const size_t chunk = 64;
+	std::vector<std::vector<std::pair<uint64_t, uint32_t>>> entries((n + chunk - 1) / chunk);
+	parallel_for(n, chunk, threads, [&](size_t b, size_t e, unsigned){
+	    for (size_t i=b; i < e; i++)
+		cells(i, entries[b / chunk]);
+	});
+	cell_offsets_.assign(nx * ny + 1, 0);
+	for (const auto &block: entries)
+	    for (const auto &c: block)
+		cell_offsets_[c.first + 1]++;
+	for (size_t c=0; c < nx * ny; c++)
+	    cell_offsets_[c + 1] += cell_offsets_[c];
+	cell_zones_.resize(cell_offsets_[nx * ny]);
+	std::vector<uint64_t> fill(cell_offsets_.begin(), cell_offsets_.end() - 1);
+	for (const auto &block: entries)
+	    for (const auto &c: block)
+		cell_zones_[fill[c.first]++] = c.second;
+    }
+
+    size_t size() const {return info_.size();}
+    size_t num_cells() const {return nx * ny;}
+    size_t num_edges() const {return x1_.size();}
+    const polygon_store &zones() const {return zones_;}
+
+    // 1: in the interior of zone i, 0: on its boundary, -1: in its exterior (as bg::relate sees it)
+    int locate(size_t i, const point &p, simd_level level = best_simd_level()) const
+    {
+	const zone &z = info_[i];
+	const double px = bg::get<0>(p), py = bg::get<1>(p);
+	if (px < z.min_x - z.tx || px > z.max_x + z.tx || py < z.min_y - z.ty || py > z.max_y + z.ty)
+	    return -1;
+	const size_t b = z.first_band + band(z, py);
+	const uint64_t first = band_offsets_[b], last = band_offsets_[b + 1];
+	unsigned parity = 0;
+	bool unsure;
+	switch (std::min(level, best_simd_level())){
+#ifdef SPATIAL_X86_KERNELS
+	    case simd_avx512:
+		unsure = detail::crossings_avx512(x1_.data(), y1_.data(), x2_.data(), y2_.data(), first, last,
+						  px, py, z.tx, z.ty, z.magnitude, parity);
+		break;
+	    case simd_avx2:
+		unsure = detail::crossings_avx2(x1_.data(), y1_.data(), x2_.data(), y2_.data(), first, last,
+						px, py, z.tx, z.ty, z.magnitude, parity);
+		break;
+#endif
+	    default:
+		unsure = detail::crossings_scalar(x1_.data(), y1_.data(), x2_.data(), y2_.data(), first, last,
+						  px, py, z.tx, z.ty, z.magnitude, parity);
+	}
+	if (!unsure) return parity ? 1 : -1;
+	// one pass over the zone for both questions
+	const std::string m = bg::relation(p, zones_[i]).str();
+	if (m[0] != 'F') return 1;
+	return (m[1] != 'F') ? 0 : -1;
+    }
+
+    // the first zone containing p, or no_zone
+    uint32_t zone_of(const point &p, simd_level level = best_simd_level()) const
+    {
+	const uint32_t *end, *it = cell_begin(p, end);
+	for (; it != end; ++it)
+	    if (member(*it, p, level))
+		return *it & ~contains_cell;
+	return no_zone;
+    }
+    // all zones containing p as bits (for at most 64 zones)
+    uint64_t zones_of(const point &p, simd_level level = best_simd_level()) const
+    {
+	uint64_t mask = 0;
+	const uint32_t *end, *it = cell_begin(p, end);
+	for (; it != end; ++it)
+	    if (member(*it, p, level))
+		mask |= uint64_t(1) << (*it & ~contains_cell);
+	return mask;
+    }
+
+    // zone[i] = zone_of(points[i]) for n points
+    void classify(const point *points, size_t n, uint32_t *zone, unsigned threads = default_threads(),
+		  simd_level level = best_simd_level()) const
+    {
+	parallel_for(n, 1 << 14, threads, [&](size_t b, size_t e, unsigned){
+	    for (size_t i=b; i < e; i++)
+		zone[i] = zone_of(points[i], level);
+	});
+    }
+    // mask[i] = zones_of(points[i]) for n points
+    void classify_mask(const point *points, size_t n, uint64_t *mask, unsigned threads = default_threads(),
+		       simd_level level = best_simd_level()) const
+    {
+	if (size() > 64) throw std::runtime_error("zone_classifier: more than 64 zones for a mask");
+	parallel_for(n, 1 << 14, threads, [&](size_t b, size_t e, unsigned){
+	    for (size_t i=b; i < e; i++)
+		mask[i] = zones_of(points[i], level);
+	});
+    }
+
+    // bytes held by the zones, the bands and the grid
+    size_t memory_usage() const
+    {
+	return zones_.memory_usage() + info_.capacity() * sizeof(zone)
+	    + (band_offsets_.capacity() + cell_offsets_.capacity()) * sizeof(uint64_t)
+	    + (x1_.capacity() + y1_.capacity() + x2_.capacity() + y2_.capacity()) * sizeof(double)
+	    + cell_zones_.capacity() * sizeof(uint32_t);
+    }
+};
+
+} // spatial
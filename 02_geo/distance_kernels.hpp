@@ -0,0 +1,217 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Vectorized comparable distances from one point to many boxes or points
+
+bg::comparable_distance(p, b) is computed one pair at a time. The kernels below
+take one query point and an array of boxes (or points) and compute the squared
+distances 4 (AVX2) or 8 (AVX-512) at a time; a plain loop does the rest and
+serves CPUs without these extensions (see simd.hpp for the runtime choice).
+
+The arrays may be strided: an R-tree node is an array of (box, something) pairs,
+so its boxes are sizeof(pair) bytes apart. The results are the same as those of
+bg::comparable_distance up to rounding.
+*/
+#pragma once
+
+#include<algorithm>
+#include<cstddef>
+
+#include "types.hpp"
+#include "simd.hpp"
+
+namespace spatial{
+
+static_assert(sizeof(point) == 2 * sizeof(double), "point must be two packed doubles");
+static_assert(sizeof(box) == 4 * sizeof(double), "box must be four packed doubles");
+
+namespace detail{
+
+// the coordinates of element i of an array with the given stride in bytes
+inline const double *element(const void *first, size_t stride, size_t i)
+{
+    return reinterpret_cast<const double *>(static_cast<const char *>(first) + i * stride);
+}
+
+inline void box_distances_scalar(double qx, double qy, const void *boxes, size_t stride,
+				 size_t first, size_t n, double *out)
+{
+    for (size_t i=first; i < n; i++)
+    {
+	const double *b = element(boxes, stride, i); // min x, min y, max x, max y
+	double dx = std::max(std::max(b[0] - qx, qx - b[2]), 0.0);
+	double dy = std::max(std::max(b[1] - qy, qy - b[3]), 0.0);
+	out[i] = dx * dx + dy * dy;
+    }
+}
+
+inline void point_distances_scalar(double qx, double qy, const void *points, size_t stride,
+				   size_t first, size_t n, double *out)
+{
+    for (size_t i=first; i < n; i++)
+    {
+	const double *p = element(points, stride, i);
+	double dx = p[0] - qx, dy = p[1] - qy;
+	out[i] = dx * dx + dy * dy;
+    }
+}
+
+#ifdef SPATIAL_X86_KERNELS
+
+__attribute__((target("avx2")))
+inline void box_distances_avx2(double qx, double qy, const void *boxes, size_t stride, size_t n, double *out)
+{
+    const __m256d x = _mm256_set1_pd(qx), y = _mm256_set1_pd(qy), zero = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+	// four boxes as rows, transposed into min x, min y, max x, max y columns
+	__m256d r0 = _mm256_loadu_pd(element(boxes, stride, i));
+	__m256d r1 = _mm256_loadu_pd(element(boxes, stride, i + 1));
+	__m256d r2 = _mm256_loadu_pd(element(boxes, stride, i + 2));
+	__m256d r3 = _mm256_loadu_pd(element(boxes, stride, i + 3));
+	__m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1);
+	__m256d t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3);
+	__m256d min_x = _mm256_permute2f128_pd(t0, t2, 0x20), max_x = _mm256_permute2f128_pd(t0, t2, 0x31);
+	__m256d min_y = _mm256_permute2f128_pd(t1, t3, 0x20), max_y = _mm256_permute2f128_pd(t1, t3, 0x31);
+
+	__m256d dx = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(min_x, x), _mm256_sub_pd(x, max_x)), zero);
+	__m256d dy = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(min_y, y), _mm256_sub_pd(y, max_y)), zero);
+	_mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)));
+    }
+    box_distances_scalar(qx, qy, boxes, stride, i, n, out);
+}
+
+__attribute__((target("avx2")))
+inline void point_distances_avx2(double qx, double qy, const void *points, size_t stride, size_t n, double *out)
+{
+    const __m256d x = _mm256_set1_pd(qx), y = _mm256_set1_pd(qy);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+	// (x0 y0 x1 y1) and (x2 y2 x3 y3) give (x0 x2 x1 x3) and (y0 y2 y1 y3)
+	__m256d a = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(element(points, stride, i))),
+					 _mm_loadu_pd(element(points, stride, i + 1)), 1);
+	__m256d b = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(element(points, stride, i + 2))),
+					 _mm_loadu_pd(element(points, stride, i + 3)), 1);
+	__m256d dx = _mm256_sub_pd(_mm256_unpacklo_pd(a, b), x);
+	__m256d dy = _mm256_sub_pd(_mm256_unpackhi_pd(a, b), y);
+	__m256d d = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+	_mm256_storeu_pd(out + i, _mm256_permute4x64_pd(d, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    point_distances_scalar(qx, qy, points, stride, i, n, out);
+}
+
+// (the AVX-512 intrinsics of GCC 12 trigger false maybe-uninitialized warnings)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// two elements of 32 bytes in one register
+__attribute__((target("avx512f")))
+inline __m512d load_pair(const double *a, const double *b)
+{
+    return _mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_loadu_pd(a)), _mm256_loadu_pd(b), 1);
+}
+
+__attribute__((target("avx512f")))
+inline void box_distances_avx512(double qx, double qy, const void *boxes, size_t stride, size_t n, double *out)
+{
+    const __m512d x = _mm512_set1_pd(qx), y = _mm512_set1_pd(qy), zero = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+	// pairs (0 2) (1 3) (4 6) (5 7), so that the transpose ends in the order 0..7
+	__m512d r0 = load_pair(element(boxes, stride, i), element(boxes, stride, i + 2));
+	__m512d r1 = load_pair(element(boxes, stride, i + 1), element(boxes, stride, i + 3));
+	__m512d r2 = load_pair(element(boxes, stride, i + 4), element(boxes, stride, i + 6));
+	__m512d r3 = load_pair(element(boxes, stride, i + 5), element(boxes, stride, i + 7));
+	__m512d t0 = _mm512_unpacklo_pd(r0, r1), t1 = _mm512_unpackhi_pd(r0, r1);
+	__m512d t2 = _mm512_unpacklo_pd(r2, r3), t3 = _mm512_unpackhi_pd(r2, r3);
+	__m512d min_x = _mm512_shuffle_f64x2(t0, t2, 0x88), max_x = _mm512_shuffle_f64x2(t0, t2, 0xDD);
+	__m512d min_y = _mm512_shuffle_f64x2(t1, t3, 0x88), max_y = _mm512_shuffle_f64x2(t1, t3, 0xDD);
+
+	__m512d dx = _mm512_max_pd(_mm512_max_pd(_mm512_sub_pd(min_x, x), _mm512_sub_pd(x, max_x)), zero);
+	__m512d dy = _mm512_max_pd(_mm512_max_pd(_mm512_sub_pd(min_y, y), _mm512_sub_pd(y, max_y)), zero);
+	_mm512_storeu_pd(out + i, _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)));
+    }
+    box_distances_scalar(qx, qy, boxes, stride, i, n, out);
+}
+
+__attribute__((target("avx512f")))
+inline void point_distances_avx512(double qx, double qy, const void *points, size_t stride, size_t n, double *out)
+{
+    const __m512d x = _mm512_set1_pd(qx), y = _mm512_set1_pd(qy);
+    const __m512i order = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+	// (p0 p1 p2 p3) and (p4 p5 p6 p7) give (x0 x4 x1 x5 ...) and (y0 y4 y1 y5 ...)
+	__m512d a, b;
+	if (stride == 2 * sizeof(double)){
+	    a = _mm512_loadu_pd(element(points, stride, i));
+	    b = _mm512_loadu_pd(element(points, stride, i + 4));
+	} else {
+	    __m256d p[4];
+	    for (size_t j=0; j < 4; j++)
+		p[j] = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_loadu_pd(element(points, stride, i + 2*j))),
+					    _mm_loadu_pd(element(points, stride, i + 2*j + 1)), 1);
+	    a = _mm512_insertf64x4(_mm512_castpd256_pd512(p[0]), p[1], 1);
+	    b = _mm512_insertf64x4(_mm512_castpd256_pd512(p[2]), p[3], 1);
+	}
+	__m512d dx = _mm512_sub_pd(_mm512_unpacklo_pd(a, b), x);
+	__m512d dy = _mm512_sub_pd(_mm512_unpackhi_pd(a, b), y);
+	__m512d d = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+	_mm512_storeu_pd(out + i, _mm512_permutexvar_pd(order, d));
+    }
+    point_distances_scalar(qx, qy, points, stride, i, n, out);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+} // detail
+
+// out[i] = bg::comparable_distance(q, box i) for n boxes that are stride bytes apart
+inline void comparable_distances(const point &q, const box *boxes, size_t stride, size_t n, double *out,
+				 simd_level level = best_simd_level())
+{
+    const double qx = bg::get<0>(q), qy = bg::get<1>(q);
+    switch (std::min(level, best_simd_level())){
+#ifdef SPATIAL_X86_KERNELS
+	case simd_avx512: detail::box_distances_avx512(qx, qy, boxes, stride, n, out); break;
+	case simd_avx2: detail::box_distances_avx2(qx, qy, boxes, stride, n, out); break;
+#endif
+	default: detail::box_distances_scalar(qx, qy, boxes, stride, 0, n, out);
+    }
+}
+
+// out[i] = bg::comparable_distance(q, point i) for n points that are stride bytes apart
+inline void comparable_distances(const point &q, const point *points, size_t stride, size_t n, double *out,
+				 simd_level level = best_simd_level())
+{
+    const double qx = bg::get<0>(q), qy = bg::get<1>(q);
+    switch (std::min(level, best_simd_level())){
+#ifdef SPATIAL_X86_KERNELS
+	case simd_avx512: detail::point_distances_avx512(qx, qy, points, stride, n, out); break;
+	case simd_avx2: detail::point_distances_avx2(qx, qy, points, stride, n, out); break;
+#endif
+	default: detail::point_distances_scalar(qx, qy, points, stride, 0, n, out);
+    }
+}
+
+// packed arrays
+inline void comparable_distances(const point &q, const box *boxes, size_t n, double *out,
+				 simd_level level = best_simd_level())
+{
+    comparable_distances(q, boxes, sizeof(box), n, out, level);
+}
+inline void comparable_distances(const point &q, const point *points, size_t n, double *out,
+				 simd_level level = best_simd_level())
+{
+    comparable_distances(q, points, sizeof(point), n, out, level);
+}
+
+} // spatial
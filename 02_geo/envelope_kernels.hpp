@@ -0,0 +1,119 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Vectorized envelope of a point array
+
+The minimum bounding rectangle of a ring is a min/max reduction over its
+coordinates. The points are packed x,y pairs, so one AVX2 register holds two
+points and one AVX-512 register four; the running minima and maxima are kept
+per lane, folded into one x and one y at the end, and a plain loop does the
+remaining points (see simd.hpp for the runtime choice). The result is exactly
+that of bg::envelope, min and max do not round.
+*/
+#pragma once
+
+#include<algorithm>
+#include<cstddef>
+
+#include "types.hpp"
+#include "simd.hpp"
+
+namespace spatial{
+
+static_assert(sizeof(point) == 2 * sizeof(double), "point must be two packed doubles");
+
+namespace detail{
+
+// e = min x, min y, max x, max y, extended by the points [first, n)
+inline void envelope_scalar(const double *xy, size_t first, size_t n, double *e)
+{
+    for (size_t i=first; i < n; i++)
+    {
+	const double x = xy[2*i], y = xy[2*i + 1];
+	e[0] = std::min(e[0], x);
+	e[1] = std::min(e[1], y);
+	e[2] = std::max(e[2], x);
+	e[3] = std::max(e[3], y);
+    }
+}
+
+#ifdef SPATIAL_X86_KERNELS
+
+__attribute__((target("avx2")))
+inline void envelope_avx2(const double *xy, size_t n, double *e)
+{
+    size_t i = 0;
+    if (n >= 4){
+	// lanes (x y x y): two running minima and maxima per coordinate
+	__m256d lo = _mm256_loadu_pd(xy), hi = lo;
+	for (i = 2; i + 2 <= n; i += 2)
+	{
+	    __m256d p = _mm256_loadu_pd(xy + 2*i);
+	    lo = _mm256_min_pd(lo, p);
+	    hi = _mm256_max_pd(hi, p);
+	}
+	__m128d l = _mm_min_pd(_mm256_castpd256_pd128(lo), _mm256_extractf128_pd(lo, 1));
+	__m128d h = _mm_max_pd(_mm256_castpd256_pd128(hi), _mm256_extractf128_pd(hi, 1));
+	e[0] = std::min(e[0], _mm_cvtsd_f64(l));
+	e[1] = std::min(e[1], _mm_cvtsd_f64(_mm_unpackhi_pd(l, l)));
+	e[2] = std::max(e[2], _mm_cvtsd_f64(h));
+	e[3] = std::max(e[3], _mm_cvtsd_f64(_mm_unpackhi_pd(h, h)));
+    }
+    envelope_scalar(xy, i, n, e);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+inline void envelope_avx512(const double *xy, size_t n, double *e)
+{
+    size_t i = 0;
+    if (n >= 8){
+	// lanes (x y x y x y x y): four running minima and maxima per coordinate
+	__m512d lo = _mm512_loadu_pd(xy), hi = lo;
+	for (i = 4; i + 4 <= n; i += 4)
+	{
+	    __m512d p = _mm512_loadu_pd(xy + 2*i);
+	    lo = _mm512_min_pd(lo, p);
+	    hi = _mm512_max_pd(hi, p);
+	}
+	__m256d l4 = _mm256_min_pd(_mm512_castpd512_pd256(lo), _mm512_extractf64x4_pd(lo, 1));
+	__m256d h4 = _mm256_max_pd(_mm512_castpd512_pd256(hi), _mm512_extractf64x4_pd(hi, 1));
+	__m128d l = _mm_min_pd(_mm256_castpd256_pd128(l4), _mm256_extractf128_pd(l4, 1));
+	__m128d h = _mm_max_pd(_mm256_castpd256_pd128(h4), _mm256_extractf128_pd(h4, 1));
+	e[0] = std::min(e[0], _mm_cvtsd_f64(l));
+	e[1] = std::min(e[1], _mm_cvtsd_f64(_mm_unpackhi_pd(l, l)));
+	e[2] = std::max(e[2], _mm_cvtsd_f64(h));
+	e[3] = std::max(e[3], _mm_cvtsd_f64(_mm_unpackhi_pd(h, h)));
+    }
+    envelope_scalar(xy, i, n, e);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+} // detail
+
+// bg::envelope of n packed points (an inverse box for n = 0)
+inline box points_envelope(const point *points, size_t n, simd_level level = best_simd_level())
+{
+    box b;
+    bg::assign_inverse(b);
+    if (n == 0) return b;
+    const double *xy = reinterpret_cast<const double *>(points);
+    double e[4] = {xy[0], xy[1], xy[0], xy[1]};
+    switch (std::min(level, best_simd_level())){
+#ifdef SPATIAL_X86_KERNELS
+	case simd_avx512: detail::envelope_avx512(xy, n, e); break;
+	case simd_avx2: detail::envelope_avx2(xy, n, e); break;
+#endif
+	default: detail::envelope_scalar(xy, 1, n, e);
+    }
+    return box(point(e[0], e[1]), point(e[2], e[3]));
+}
+
+} // spatial
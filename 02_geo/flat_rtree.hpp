@@ -0,0 +1,626 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Flat, cache-line-aligned R-tree for read-only serving
+
+A bgi::rtree keeps a heap block per node, each with a static array of (box,
+pointer) pairs: a query follows pointers all over the heap, and every box costs
+32 bytes of the 40 of a pair. Once a tree is built and only queried, its nodes
+can as well be frozen into arrays:
+
+   inner nodes  breadth-first in one array of 256-byte nodes (four cache lines),
+                the boxes of the up to 16 children as four columns of floats
+                (min x, min y, max x, max y), rounded outward, so that a node is
+                tested against a query box with one AVX-512 compare per column
+   leaves       breadth-first in one array of 512-byte nodes, the boxes of the
+                values as four columns of doubles: exact, so results are the
+                same as those of the bgi::rtree; the value ids (32 bit) in an
+                array beside them
+   links        first child and child count of every node
+
+The children of a node are consecutive nodes, and all leaves are on the same
+level, so node i is a leaf iff i >= the number of inner nodes. The float boxes of
+the inner nodes contain the exact ones, so pruning with them never loses a value;
+a query box is rounded outward as well.
+
+flat_rtree is built from a bgi::rtree of (box, id) values with at most 16 entries
+per node (rtree of types.hpp) or directly from polygons, whose envelopes are then
+packed with the packing constructor of bgi::rtree. query_intersects and
+query_within return the values of bgi::intersects and bgi::within in the same
+order, query_nearest the k nearest boxes as bgi::nearest, in increasing
+distance. The compares and distances run on AVX2 or AVX-512 as simd.hpp decides.
+*/
+#pragma once
+
+#include<vector>
+#include<algorithm>
+#include<cmath>
+#include<cstdint>
+#include<cstdlib>
+#include<limits>
+#include<new>
+#include<stdexcept>
+#include<utility>
+
+#include <boost/geometry/index/detail/rtree/utilities/view.hpp>
+
+#include "types.hpp"
+#include "simd.hpp"
+#include "packed_rtree.hpp"
+#include "arena.hpp"
+
+namespace spatial{
+
+const size_t flat_fanout = 16;
+
+// child boxes of an inner node, rounded outward to float
+struct alignas(64) flat_inner_node
+{
+    float min_x[flat_fanout], min_y[flat_fanout], max_x[flat_fanout], max_y[flat_fanout];
+};
+
+// value boxes of a leaf, exact
+struct alignas(64) flat_leaf_node
+{
+    double min_x[flat_fanout], min_y[flat_fanout], max_x[flat_fanout], max_y[flat_fanout];
+};
+
+struct flat_link
+{
+    uint32_t first; // first child node (inner nodes) or first value slot (leaves)
+    uint32_t count;
+};
+
+namespace detail{
+
+// std::vector with cache-line-aligned storage (also without the aligned new of C++17)
+template<typename T>
+struct cache_aligned_allocator
+{
+    typedef T value_type;
+    cache_aligned_allocator() {}
+    template<typename U> cache_aligned_allocator(const cache_aligned_allocator<U> &) {}
+    T *allocate(size_t n)
+    {
+	void *p = nullptr;
+	if (posix_memalign(&p, 64, n * sizeof(T)) != 0)
+	    throw std::bad_alloc();
+	return static_cast<T *>(p);
+    }
+    void deallocate(T *p, size_t) {std::free(p);}
+};
+template<typename T, typename U>
+bool operator==(const cache_aligned_allocator<T> &, const cache_aligned_allocator<U> &) {return true;}
+template<typename T, typename U>
+bool operator!=(const cache_aligned_allocator<T> &, const cache_aligned_allocator<U> &) {return false;}
+
+inline float float_below(double x)
+{
+    float f = static_cast<float>(x);
+    return (f > x) ? std::nextafter(f, -std::numeric_limits<float>::max()) : f;
+}
+
+inline float float_above(double x)
+{
+    float f = static_cast<float>(x);
+    return (f < x) ? std::nextafter(f, std::numeric_limits<float>::max()) : f;
+}
+
+inline unsigned lowest_bit(unsigned m)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(m);
+#else
+    unsigned i = 0;
+    while (!(m & 1)) {m >>= 1; i++;}
+    return i;
+#endif
+}
+
+inline unsigned highest_bit(unsigned m)
+{
+#ifdef __GNUC__
+    return 31 - __builtin_clz(m);
+#else
+    unsigned i = 0;
+    while (m >>= 1) i++;
+    return i;
+#endif
+}
+
+// The kernels test or measure all 16 slots of a node; the caller masks the used ones.
+// q is min x, min y, max x, max y of the query box.
+
+template<typename Node, typename T>
+unsigned intersects_scalar(const Node &n, const T *q)
+{
+    unsigned m = 0;
+    for (size_t i=0; i < flat_fanout; i++)
+	m |= unsigned(n.min_x[i] <= q[2] && n.max_x[i] >= q[0] && n.min_y[i] <= q[3] && n.max_y[i] >= q[1]) << i;
+    return m;
+}
+
+// bg::within of two boxes: covered, and not degenerate
+inline unsigned within_scalar(const flat_leaf_node &n, const double *q)
+{
+    unsigned m = 0;
+    for (size_t i=0; i < flat_fanout; i++)
+	m |= unsigned(q[0] <= n.min_x[i] && n.max_x[i] <= q[2] && n.min_x[i] < n.max_x[i]
+		      && q[1] <= n.min_y[i] && n.max_y[i] <= q[3] && n.min_y[i] < n.max_y[i]) << i;
+    return m;
+}
+
+template<typename Node>
+void distances_scalar(const Node &n, double x, double y, double *out)
+{
+    for (size_t i=0; i < flat_fanout; i++)
+    {
+	double dx = std::max(std::max(n.min_x[i] - x, x - n.max_x[i]), 0.0);
+	double dy = std::max(std::max(n.min_y[i] - y, y - n.max_y[i]), 0.0);
+	out[i] = dx * dx + dy * dy;
+    }
+}
+
+#ifdef SPATIAL_X86_KERNELS
+
+__attribute__((target("avx2")))
+inline unsigned intersects_avx2(const flat_inner_node &n, const float *q)
+{
+    const __m256 x1 = _mm256_set1_ps(q[0]), y1 = _mm256_set1_ps(q[1]);
+    const __m256 x2 = _mm256_set1_ps(q[2]), y2 = _mm256_set1_ps(q[3]);
+    unsigned m = 0;
+    for (size_t i=0; i < flat_fanout; i += 8)
+    {
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(n.min_x + i), x2, _CMP_LE_OQ),
+				   _mm256_cmp_ps(_mm256_load_ps(n.max_x + i), x1, _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(n.min_y + i), y2, _CMP_LE_OQ),
+					       _mm256_cmp_ps(_mm256_load_ps(n.max_y + i), y1, _CMP_GE_OQ)));
+	m |= unsigned(_mm256_movemask_ps(hit)) << i;
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+inline unsigned intersects_avx2(const flat_leaf_node &n, const double *q)
+{
+    const __m256d x1 = _mm256_set1_pd(q[0]), y1 = _mm256_set1_pd(q[1]);
+    const __m256d x2 = _mm256_set1_pd(q[2]), y2 = _mm256_set1_pd(q[3]);
+    unsigned m = 0;
+    for (size_t i=0; i < flat_fanout; i += 4)
+    {
+	__m256d hit = _mm256_and_pd(_mm256_cmp_pd(_mm256_load_pd(n.min_x + i), x2, _CMP_LE_OQ),
+				    _mm256_cmp_pd(_mm256_load_pd(n.max_x + i), x1, _CMP_GE_OQ));
+	hit = _mm256_and_pd(hit, _mm256_and_pd(_mm256_cmp_pd(_mm256_load_pd(n.min_y + i), y2, _CMP_LE_OQ),
+					       _mm256_cmp_pd(_mm256_load_pd(n.max_y + i), y1, _CMP_GE_OQ)));
+	m |= unsigned(_mm256_movemask_pd(hit)) << i;
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+inline unsigned within_avx2(const flat_leaf_node &n, const double *q)
+{
+    const __m256d x1 = _mm256_set1_pd(q[0]), y1 = _mm256_set1_pd(q[1]);
+    const __m256d x2 = _mm256_set1_pd(q[2]), y2 = _mm256_set1_pd(q[3]);
+    unsigned m = 0;
+    for (size_t i=0; i < flat_fanout; i += 4)
+    {
+	__m256d min_x = _mm256_load_pd(n.min_x + i), max_x = _mm256_load_pd(n.max_x + i);
+	__m256d min_y = _mm256_load_pd(n.min_y + i), max_y = _mm256_load_pd(n.max_y + i);
+	__m256d hit = _mm256_and_pd(_mm256_cmp_pd(x1, min_x, _CMP_LE_OQ), _mm256_cmp_pd(max_x, x2, _CMP_LE_OQ));
+	hit = _mm256_and_pd(hit, _mm256_and_pd(_mm256_cmp_pd(y1, min_y, _CMP_LE_OQ), _mm256_cmp_pd(max_y, y2, _CMP_LE_OQ)));
+	hit = _mm256_and_pd(hit, _mm256_and_pd(_mm256_cmp_pd(min_x, max_x, _CMP_LT_OQ), _mm256_cmp_pd(min_y, max_y, _CMP_LT_OQ)));
+	m |= unsigned(_mm256_movemask_pd(hit)) << i;
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+inline __m256d box_distances4(__m256d min_x, __m256d min_y, __m256d max_x, __m256d max_y, __m256d x, __m256d y)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d dx = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(min_x, x), _mm256_sub_pd(x, max_x)), zero);
+    __m256d dy = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(min_y, y), _mm256_sub_pd(y, max_y)), zero);
+    return _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+}
+
+__attribute__((target("avx2")))
+inline void distances_avx2(const flat_inner_node &n, double qx, double qy, double *out)
+{
+    const __m256d x = _mm256_set1_pd(qx), y = _mm256_set1_pd(qy);
+    for (size_t i=0; i < flat_fanout; i += 4)
+	_mm256_storeu_pd(out + i, box_distances4(_mm256_cvtps_pd(_mm_load_ps(n.min_x + i)), _mm256_cvtps_pd(_mm_load_ps(n.min_y + i)),
+						 _mm256_cvtps_pd(_mm_load_ps(n.max_x + i)), _mm256_cvtps_pd(_mm_load_ps(n.max_y + i)), x, y));
+}
+
+__attribute__((target("avx2")))
+inline void distances_avx2(const flat_leaf_node &n, double qx, double qy, double *out)
+{
+    const __m256d x = _mm256_set1_pd(qx), y = _mm256_set1_pd(qy);
+    for (size_t i=0; i < flat_fanout; i += 4)
+	_mm256_storeu_pd(out + i, box_distances4(_mm256_load_pd(n.min_x + i), _mm256_load_pd(n.min_y + i),
+						 _mm256_load_pd(n.max_x + i), _mm256_load_pd(n.max_y + i), x, y));
+}
+
+// (the AVX-512 intrinsics of GCC 12 trigger false maybe-uninitialized warnings)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+__attribute__((target("avx512f")))
+inline unsigned intersects_avx512(const flat_inner_node &n, const float *q)
+{
+    return _mm512_cmp_ps_mask(_mm512_load_ps(n.min_x), _mm512_set1_ps(q[2]), _CMP_LE_OQ)
+	& _mm512_cmp_ps_mask(_mm512_load_ps(n.max_x), _mm512_set1_ps(q[0]), _CMP_GE_OQ)
+	& _mm512_cmp_ps_mask(_mm512_load_ps(n.min_y), _mm512_set1_ps(q[3]), _CMP_LE_OQ)
+	& _mm512_cmp_ps_mask(_mm512_load_ps(n.max_y), _mm512_set1_ps(q[1]), _CMP_GE_OQ);
+}
+
+__attribute__((target("avx512f")))
+inline unsigned intersects_avx512(const flat_leaf_node &n, const double *q)
+{
+    const __m512d x1 = _mm512_set1_pd(q[0]), y1 = _mm512_set1_pd(q[1]);
+    const __m512d x2 = _mm512_set1_pd(q[2]), y2 = _mm512_set1_pd(q[3]);
+    unsigned m = 0;
+    for (size_t i=0; i < flat_fanout; i += 8)
+	m |= unsigned(_mm512_cmp_pd_mask(_mm512_load_pd(n.min_x + i), x2, _CMP_LE_OQ)
+		      & _mm512_cmp_pd_mask(_mm512_load_pd(n.max_x + i), x1, _CMP_GE_OQ)
+		      & _mm512_cmp_pd_mask(_mm512_load_pd(n.min_y + i), y2, _CMP_LE_OQ)
+		      & _mm512_cmp_pd_mask(_mm512_load_pd(n.max_y + i), y1, _CMP_GE_OQ)) << i;
+    return m;
+}
+
+__attribute__((target("avx512f")))
+inline unsigned within_avx512(const flat_leaf_node &n, const double *q)
+{
+    const __m512d x1 = _mm512_set1_pd(q[0]), y1 = _mm512_set1_pd(q[1]);
+    const __m512d x2 = _mm512_set1_pd(q[2]), y2 = _mm512_set1_pd(q[3]);
+    unsigned m = 0;
+    for (size_t i=0; i < flat_fanout; i += 8)
+    {
+	__m512d min_x = _mm512_load_pd(n.min_x + i), max_x = _mm512_load_pd(n.max_x + i);
+	__m512d min_y = _mm512_load_pd(n.min_y + i), max_y = _mm512_load_pd(n.max_y + i);
+	m |= unsigned(_mm512_cmp_pd_mask(x1, min_x, _CMP_LE_OQ) & _mm512_cmp_pd_mask(max_x, x2, _CMP_LE_OQ)
+		      & _mm512_cmp_pd_mask(y1, min_y, _CMP_LE_OQ) & _mm512_cmp_pd_mask(max_y, y2, _CMP_LE_OQ)
+		      & _mm512_cmp_pd_mask(min_x, max_x, _CMP_LT_OQ) & _mm512_cmp_pd_mask(min_y, max_y, _CMP_LT_OQ)) << i;
+    }
+    return m;
+}
+
+__attribute__((target("avx512f")))
+inline __m512d box_distances8(__m512d min_x, __m512d min_y, __m512d max_x, __m512d max_y, __m512d x, __m512d y)
+{
+    const __m512d zero = _mm512_setzero_pd();
+    __m512d dx = _mm512_max_pd(_mm512_max_pd(_mm512_sub_pd(min_x, x), _mm512_sub_pd(x, max_x)), zero);
+    __m512d dy = _mm512_max_pd(_mm512_max_pd(_mm512_sub_pd(min_y, y), _mm512_sub_pd(y, max_y)), zero);
+    return _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+}
+
+__attribute__((target("avx512f")))
+inline void distances_avx512(const flat_inner_node &n, double qx, double qy, double *out)
+{
+    const __m512d x = _mm512_set1_pd(qx), y = _mm512_set1_pd(qy);
+    for (size_t i=0; i < flat_fanout; i += 8)
+	_mm512_storeu_pd(out + i, box_distances8(_mm512_cvtps_pd(_mm256_load_ps(n.min_x + i)), _mm512_cvtps_pd(_mm256_load_ps(n.min_y + i)),
+						 _mm512_cvtps_pd(_mm256_load_ps(n.max_x + i)), _mm512_cvtps_pd(_mm256_load_ps(n.max_y + i)), x, y));
+}
+
+__attribute__((target("avx512f")))
+inline void distances_avx512(const flat_leaf_node &n, double qx, double qy, double *out)
+{
+    const __m512d x = _mm512_set1_pd(qx), y = _mm512_set1_pd(qy);
+    for (size_t i=0; i < flat_fanout; i += 8)
+	_mm512_storeu_pd(out + i, box_distances8(_mm512_load_pd(n.min_x + i), _mm512_load_pd(n.min_y + i),
+						 _mm512_load_pd(n.max_x + i), _mm512_load_pd(n.max_y + i), x, y));
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+template<typename Node, typename T>
+unsigned intersects(const Node &n, const T *q, simd_level level)
+{
+    switch (level){
+#ifdef SPATIAL_X86_KERNELS
+	case simd_avx512: return intersects_avx512(n, q);
+	case simd_avx2: return intersects_avx2(n, q);
+#endif
+	default: return intersects_scalar(n, q);
+    }
+}
+
+inline unsigned within(const flat_leaf_node &n, const double *q, simd_level level)
+{
+    switch (level){
+#ifdef SPATIAL_X86_KERNELS
+	case simd_avx512: return within_avx512(n, q);
+	case simd_avx2: return within_avx2(n, q);
+#endif
+	default: return within_scalar(n, q);
+    }
+}
+
+template<typename Node>
+void distances(const Node &n, double x, double y, double *out, simd_level level)
+{
+    switch (level){
+#ifdef SPATIAL_X86_KERNELS
+	case simd_avx512: distances_avx512(n, x, y, out); break;
+	case simd_avx2: distances_avx2(n, x, y, out); break;
+#endif
+	default: distances_scalar(n, x, y, out);
+    }
+}
+
+// Visits the nodes of a bgi::rtree breadth-first; the root first (through the view),
+// then pending[i] as node i + 1
+template<typename MembersHolder>
+struct flat_visitor : public MembersHolder::visitor_const
+{
+    typedef typename MembersHolder::internal_node internal_node;
+    typedef typename MembersHolder::leaf leaf;
+    typedef typename MembersHolder::node_pointer node_pointer;
+
+    std::vector<flat_inner_node, cache_aligned_allocator<flat_inner_node>> &inner;
+    std::vector<flat_leaf_node, cache_aligned_allocator<flat_leaf_node>> &leaves;
+    std::vector<flat_link> &links;
+    std::vector<uint32_t> &ids;
+    std::vector<node_pointer> pending;
+
+    flat_visitor(std::vector<flat_inner_node, cache_aligned_allocator<flat_inner_node>> &inner,
+		 std::vector<flat_leaf_node, cache_aligned_allocator<flat_leaf_node>> &leaves,
+		 std::vector<flat_link> &links, std::vector<uint32_t> &ids)
+	: inner(inner), leaves(leaves), links(links), ids(ids) {}
+
+    template<typename Elements>
+    static void check_size(const Elements &elements)
+    {
+	if (elements.size() > flat_fanout)
+	    throw std::runtime_error("flat_rtree: more than 16 entries in a node");
+    }
+
+    void operator()(internal_node const &n)
+    {
+	const auto &elements = bgi::detail::rtree::elements(n);
+	check_size(elements);
+	if (!leaves.empty())
+	    throw std::runtime_error("flat_rtree: the leaves are not on one level");
+	flat_inner_node node = flat_inner_node();
+	flat_link link = {static_cast<uint32_t>(pending.size() + 1), static_cast<uint32_t>(elements.size())};
+	for (size_t i=0; i < elements.size(); i++)
+	{
+	    const box &b = elements[i].first;
+	    node.min_x[i] = float_below(bg::get<bg::min_corner,0>(b));
+	    node.min_y[i] = float_below(bg::get<bg::min_corner,1>(b));
+	    node.max_x[i] = float_above(bg::get<bg::max_corner,0>(b));
+	    node.max_y[i] = float_above(bg::get<bg::max_corner,1>(b));
+	    pending.push_back(elements[i].second);
+	}
+	inner.push_back(node);
+	links.push_back(link);
+    }
+
+    void operator()(leaf const &n)
+    {
+	const auto &elements = bgi::detail::rtree::elements(n);
+	check_size(elements);
+	flat_leaf_node node = flat_leaf_node();
+	flat_link link = {static_cast<uint32_t>(leaves.size() * flat_fanout), static_cast<uint32_t>(elements.size())};
+	ids.resize(ids.size() + flat_fanout, 0);
+	for (size_t i=0; i < elements.size(); i++)
+	{
+	    const box &b = elements[i].first;
+	    node.min_x[i] = bg::get<bg::min_corner,0>(b);
+	    node.min_y[i] = bg::get<bg::min_corner,1>(b);
+	    node.max_x[i] = bg::get<bg::max_corner,0>(b);
+	    node.max_y[i] = bg::get<bg::max_corner,1>(b);
+	    if (elements[i].second > std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error("flat_rtree: value id does not fit in 32 bits");
+	    ids[link.first + i] = static_cast<uint32_t>(elements[i].second);
+	}
+	leaves.push_back(node);
+	links.push_back(link);
+    }
+};
+
+} // detail
+
+
+class flat_rtree
+{
+    std::vector<flat_inner_node, detail::cache_aligned_allocator<flat_inner_node>> inner;
+    std::vector<flat_leaf_node, detail::cache_aligned_allocator<flat_leaf_node>> leaves;
+    std::vector<flat_link> links; // inner nodes, then leaves
+    std::vector<uint32_t> ids;    // leaf l, slot i at l * 16 + i
+    size_t n_values = 0;
+    box root_bounds;
+    simd_level level = simd_scalar;
+
+    template<typename Rtree>
+    void freeze(const Rtree &rt)
+    {
+	n_values = rt.size();
+	if (rt.empty()) return;
+	root_bounds = rt.bounds();
+	typedef bgi::detail::rtree::utilities::view<Rtree> view_type;
+	view_type view(rt);
+	detail::flat_visitor<typename view_type::members_holder> v(inner, leaves, links, ids);
+	view.apply_visitor(v);
+	for (size_t i=0; i < v.pending.size(); i++)
+	    bgi::detail::rtree::apply_visitor(v, *v.pending[i]);
+	inner.shrink_to_fit();
+	leaves.shrink_to_fit();
+	ids.shrink_to_fit();
+    }
+
+    box entry_box(size_t leaf, unsigned i) const
+    {
+	const flat_leaf_node &n = leaves[leaf];
+	return box(point(n.min_x[i], n.min_y[i]), point(n.max_x[i], n.max_y[i]));
+    }
+
+    template<typename OutIter>
+    OutIter spatial_query(const box &q, bool within, OutIter out) const
+    {
+	if (links.empty()) return out;
+	const double dq[4] = {bg::get<bg::min_corner,0>(q), bg::get<bg::min_corner,1>(q),
+			      bg::get<bg::max_corner,0>(q), bg::get<bg::max_corner,1>(q)};
+	const float fq[4] = {detail::float_below(dq[0]), detail::float_below(dq[1]),
+			     detail::float_above(dq[2]), detail::float_above(dq[3])};
+	uint32_t stack[64 * flat_fanout];
+	size_t top = 0;
+	stack[top++] = 0;
+	while (top)
+	{
+	    const uint32_t i = stack[--top];
+	    const flat_link &l = links[i];
+	    const unsigned used = (1u << l.count) - 1;
+	    if (i < inner.size()){
+		// pushed last to first, so the children come off the stack in order (as in bgi)
+		for (unsigned m = detail::intersects(inner[i], fq, level) & used; m; )
+		{
+		    unsigned c = detail::highest_bit(m);
+		    m &= ~(1u << c);
+		    stack[top++] = l.first + c;
+		}
+		continue;
+	    }
+	    const size_t leaf = i - inner.size();
+	    unsigned m = within ? detail::within(leaves[leaf], dq, level) : detail::intersects(leaves[leaf], dq, level);
+	    for (m &= used; m; m &= m - 1)
+	    {
+		unsigned c = detail::lowest_bit(m);
+		*out++ = value(entry_box(leaf, c), ids[l.first + c]);
+	    }
+	}
+	return out;
+    }
+
+    typedef std::pair<double, uint32_t> candidate; // (comparable distance, node or value slot)
+
+    // depth first, the children nearest first, as long as they can hold a better value
+    template<typename Accept>
+    void nearest(uint32_t i, double x, double y, size_t k, Accept &accept, scratch_vector<candidate> &best) const
+    {
+	const flat_link &l = links[i];
+	double d[flat_fanout];
+	if (i >= inner.size()){
+	    detail::distances(leaves[i - inner.size()], x, y, d, level);
+	    for (uint32_t c=0; c < l.count; c++)
+	    {
+		if (best.size() == k && d[c] >= best.front().first) continue;
+		if (!accept(static_cast<size_t>(ids[l.first + c]))) continue;
+		if (best.size() == k){
+		    std::pop_heap(best.begin(), best.end());
+		    best.pop_back();
+		}
+		best.push_back(candidate(d[c], l.first + c));
+		std::push_heap(best.begin(), best.end());
+	    }
+	    return;
+	}
+	detail::distances(inner[i], x, y, d, level);
+	candidate children[flat_fanout];
+	uint32_t n = 0;
+	for (uint32_t c=0; c < l.count; c++)
+	{
+	    // insertion sort by distance
+	    uint32_t j = n++;
+	    for (; j > 0 && children[j - 1].first > d[c]; j--)
+		children[j] = children[j - 1];
+	    children[j] = candidate(d[c], l.first + c);
+	}
+	for (uint32_t c=0; c < n; c++)
+	{
+	    if (best.size() == k && children[c].first >= best.front().first) break;
+	    nearest(children[c].second, x, y, k, accept, best);
+	}
+    }
+
+public:
+    flat_rtree() {}
+
+    // the frozen copy of a bgi::rtree of (box, id) values
+    template<typename Rtree>
+    explicit flat_rtree(const Rtree &rt, simd_level level = best_simd_level())
+	: level(std::min(level, best_simd_level()))
+    {
+	freeze(rt);
+    }
+
+    // the envelopes of the polygons (id = position) packed as by rtree(values)
+    template<typename Polygons>
+    flat_rtree(const Polygons &polygons, unsigned threads, simd_level level = best_simd_level())
+	: level(std::min(level, best_simd_level()))
+    {
+	freeze(rtree(envelopes(polygons, threads)));
+    }
+
+    size_t size() const {return n_values;}
+    bool empty() const {return n_values == 0;}
+    box bounds() const {return root_bounds;}
+    size_t num_nodes() const {return links.size();}
+    size_t num_leaves() const {return leaves.size();}
+    simd_level kernels() const {return level;}
+
+    // bytes held by the arrays
+    size_t memory_usage() const
+    {
+	return inner.capacity() * sizeof(flat_inner_node) + leaves.capacity() * sizeof(flat_leaf_node)
+	    + links.capacity() * sizeof(flat_link) + ids.capacity() * sizeof(uint32_t);
+    }
+
+    // all values, leaf by leaf
+    template<typename OutIter>
+    OutIter all_values(OutIter out) const
+    {
+	for (size_t leaf=0; leaf < leaves.size(); leaf++)
+	{
+	    const flat_link &l = links[inner.size() + leaf];
+	    for (unsigned c=0; c < l.count; c++)
+		*out++ = value(entry_box(leaf, c), ids[l.first + c]);
+	}
+	return out;
+    }
+
+    // all values whose box is within q (same values and order as bgi::within)
+    template<typename OutIter>
+    OutIter query_within(const box &q, OutIter out) const
+    {
+	return spatial_query(q, true, out);
+    }
+
+    // all values whose box intersects q (same values and order as bgi::intersects)
+    template<typename OutIter>
+    OutIter query_intersects(const box &q, OutIter out) const
+    {
+	return spatial_query(q, false, out);
+    }
+
+    // the k values with the nearest boxes, as bgi::nearest, in increasing distance
+    template<typename OutIter>
+    OutIter query_nearest(const point &p, size_t k, OutIter out) const
+    {
+	return query_nearest(p, k, out, [](size_t){ return true; });
+    }
+
+    // the same among the values whose id passes accept(id)
+    template<typename OutIter, typename Accept>
+    OutIter query_nearest(const point &p, size_t k, OutIter out, Accept accept) const
+    {
+	if (links.empty() || k == 0) return out;
+	scratch_scope scope;
+	scratch_vector<candidate> best; // max-heap of the best k values so far
+	best.reserve(k);
+	nearest(0, bg::get<0>(p), bg::get<1>(p), k, accept, best);
+	std::sort_heap(best.begin(), best.end());
+	for (const auto &b: best)
+	    *out++ = value(entry_box(b.second / flat_fanout, b.second % flat_fanout), ids[b.second]);
+	return out;
+    }
+};
+
+} // spatial
@@ -0,0 +1,235 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Geodesic distances on a fixed ellipsoid for many pairs
+
+bg::distance on geographic points recomputes everything for every pair: the
+radians, sin and cos of both latitudes and, for Thomas and Vincenty, the reduced
+latitudes tan u = (1 - f) tan(lat). In a trajectory every fix takes part in two
+pairs, and in a distance matrix in many more. So the terms that only depend on
+one point are computed once (geodesic::prepare) and the formulas below only do
+the work that depends on the pair:
+
+   geodesic_andoyer   first order in f (meters), one sin per pair
+   geodesic_thomas    second order in f (millimeters), one sin per pair
+   geodesic_vincenty  iterative (below 0.1 mm), sin, cos and atan2 per iteration
+
+The formulas are those of Boost.Geometry (formulas/andoyer_inverse.hpp etc.),
+except that the central angle is taken from the haversine of the two latitudes
+and the longitude difference instead of acos(cos d): acos loses half of the
+digits for nearby points, which are the common case in trajectories.
+10_geodesic compares the throughput and the error of the tiers.
+*/
+#pragma once
+
+#include<cmath>
+#include<cstddef>
+#include<algorithm>
+
+#include <boost/geometry.hpp>
+
+namespace spatial{
+
+enum geodesic_formula {geodesic_andoyer, geodesic_thomas, geodesic_vincenty};
+
+inline const char *geodesic_formula_name(geodesic_formula formula)
+{
+    switch (formula){
+	case geodesic_thomas: return "thomas";
+	case geodesic_vincenty: return "vincenty";
+	default: return "andoyer";
+    }
+}
+
+// A point with the terms that do not depend on the other point of a pair
+struct geodesic_point
+{
+    double lon;              // radians
+    double sin_lat, cos_lat; // geodetic latitude
+    double sin_u, cos_u;     // reduced latitude
+};
+
+namespace detail{
+
+// sin^2(x/2) from sin x and cos x, without cancellation for small x
+inline double half_angle_sin2(double sin_x, double cos_x)
+{
+    return (cos_x >= 0) ? sin_x * sin_x / (2 * (1 + cos_x)) : (1 - cos_x) / 2;
+}
+
+// The central angle d on a sphere from hav(d) = h: d, sin d and cos d
+inline void central_angle(double h, double &d, double &sin_d, double &cos_d)
+{
+    h = std::min(std::max(h, 0.0), 1.0);
+    d = 2 * std::asin(std::sqrt(h));
+    sin_d = 2 * std::sqrt(h * (1 - h));
+    cos_d = 1 - 2 * h;
+}
+
+} // detail
+
+class geodesic
+{
+    double a, b, f;
+    double e2_prime; // (a/b)^2 - 1
+
+    double andoyer(const geodesic_point &p, const geodesic_point &q) const
+    {
+	double s_dlon = std::sin((q.lon - p.lon) / 2);
+	double h = detail::half_angle_sin2(q.sin_lat * p.cos_lat - q.cos_lat * p.sin_lat,
+					   p.cos_lat * q.cos_lat + p.sin_lat * q.sin_lat)
+	    + p.cos_lat * q.cos_lat * s_dlon * s_dlon;
+	if (h <= 0) return 0;
+	h = std::min(h, 1.0);
+	double d, sin_d, cos_d;
+	detail::central_angle(h, d, sin_d, cos_d);
+
+	double K = (p.sin_lat - q.sin_lat) * (p.sin_lat - q.sin_lat);
+	double L = (p.sin_lat + q.sin_lat) * (p.sin_lat + q.sin_lat);
+	// 1 - cos d = 2 h and 1 + cos d = 2 (1 - h), without cancellation
+	double H = (d + 3 * sin_d) / (2 * h);
+	double G = (h < 1) ? (d - 3 * sin_d) / (2 * (1 - h)) : 0;
+	return a * (d - f / 4 * (H * K + G * L));
+    }
+
+    double thomas(const geodesic_point &p, const geodesic_point &q) const
+    {
+	// theta_m = (u1 + u2) / 2, d_theta_m = (u2 - u1) / 2
+	double sin2_d_theta_m = detail::half_angle_sin2(q.sin_u * p.cos_u - q.cos_u * p.sin_u,
+							p.cos_u * q.cos_u + p.sin_u * q.sin_u);
+	double sin2_theta_m = detail::half_angle_sin2(p.sin_u * q.cos_u + p.cos_u * q.sin_u,
+						      p.cos_u * q.cos_u - p.sin_u * q.sin_u);
+	double cos2_theta_m = 1 - sin2_theta_m, cos2_d_theta_m = 1 - sin2_d_theta_m;
+	double s_dlon = std::sin((q.lon - p.lon) / 2);
+	double H = p.cos_u * q.cos_u; // = cos^2 theta_m - sin^2 d_theta_m
+	double L = sin2_d_theta_m + H * s_dlon * s_dlon;
+	if (L <= 0) return 0;
+	if (L >= 1) return andoyer(p, q); // antipodal, where the expansion breaks down
+	double d, sin_d, cos_d;
+	detail::central_angle(L, d, sin_d, cos_d);
+
+	double U = 2 * sin2_theta_m * cos2_d_theta_m / (1 - L);
+	double V = 2 * sin2_d_theta_m * cos2_theta_m / L;
+	double X = U + V, Y = U - V;
+	double T = d / sin_d;
+	double D = 4 * T * T;
+	double E = 2 * cos_d;
+	double A = D * E, B = 2 * D;
+	double C = T - (A - E) / 2;
+	double n1 = X * (A + C * X), n2 = Y * (B + E * Y), n3 = D * X * Y;
+	double delta1d = f * (T * X - Y) / 4;
+	double delta2d = f * f / 64 * (n1 - n2 + n3);
+	return a * sin_d * (T - delta1d + delta2d);
+    }
+
+    double vincenty(const geodesic_point &p, const geodesic_point &q) const
+    {
+	double L = q.lon - p.lon;
+	if (L < -M_PI) L += 2 * M_PI;
+	if (L > M_PI) L -= 2 * M_PI;
+	if (L == 0 && p.sin_u == q.sin_u && p.cos_u == q.cos_u) return 0;
+	// products of the cached terms that stay the same in all iterations
+	const double cc = p.cos_u * q.cos_u, ss = p.sin_u * q.sin_u;
+	const double cs = p.cos_u * q.sin_u, sc = p.sin_u * q.cos_u;
+
+	double lambda = L, previous_lambda;
+	double sin_sigma, cos_sigma, sigma, cos2_alpha, cos_2sigma_m;
+	int counter = 0;
+	do
+	{
+	    previous_lambda = lambda;
+	    double sin_lambda = std::sin(lambda), cos_lambda = std::cos(lambda);
+	    double t1 = q.cos_u * sin_lambda, t2 = cs - sc * cos_lambda;
+	    sin_sigma = std::sqrt(t1 * t1 + t2 * t2);
+	    if (sin_sigma == 0) return 0;
+	    cos_sigma = ss + cc * cos_lambda;
+	    double sin_alpha = cc * sin_lambda / sin_sigma;
+	    cos2_alpha = 1 - sin_alpha * sin_alpha;
+	    cos_2sigma_m = (cos2_alpha == 0) ? 0 : cos_sigma - 2 * ss / cos2_alpha;
+	    double C = f / 16 * cos2_alpha * (4 + f * (4 - 3 * cos2_alpha));
+	    sigma = std::atan2(sin_sigma, cos_sigma);
+	    lambda = L + (1 - C) * f * sin_alpha
+		* (sigma + C * sin_sigma * (cos_2sigma_m + C * cos_sigma * (-1 + 2 * cos_2sigma_m * cos_2sigma_m)));
+	} while (std::fabs(previous_lambda - lambda) > 1e-12 && std::fabs(lambda) < M_PI && ++counter < 1000);
+
+	double u2 = cos2_alpha * e2_prime;
+	double A = 1 + u2 / 16384 * (4096 + u2 * (-768 + u2 * (320 - 175 * u2)));
+	double B = u2 / 1024 * (256 + u2 * (-128 + u2 * (74 - 47 * u2)));
+	double c2 = cos_2sigma_m * cos_2sigma_m;
+	double delta_sigma = B * sin_sigma * (cos_2sigma_m + B / 4 * (cos_sigma * (-1 + 2 * c2)
+	    - B / 6 * cos_2sigma_m * (-3 + 4 * sin_sigma * sin_sigma) * (-3 + 4 * c2)));
+	return b * A * (sigma - delta_sigma);
+    }
+
+    template<typename Distance>
+    void for_pairs(const geodesic_point *p, const geodesic_point *q, size_t n, double *out, Distance d) const
+    {
+	for (size_t i=0; i < n; i++)
+	    out[i] = d(p[i], q[i]);
+    }
+
+public:
+    // WGS84 by default, as bg::srs::spheroid<double>
+    explicit geodesic(const boost::geometry::srs::spheroid<double> &s = boost::geometry::srs::spheroid<double>())
+	: a(boost::geometry::get_radius<0>(s)), b(boost::geometry::get_radius<2>(s)),
+	  f((a - b) / a), e2_prime((a / b) * (a / b) - 1) {}
+
+    // lon, lat in degrees
+    geodesic_point prepare(double lon, double lat) const
+    {
+	const double d2r = M_PI / 180;
+	geodesic_point p;
+	p.lon = lon * d2r;
+	p.sin_lat = std::sin(lat * d2r);
+	p.cos_lat = std::cos(lat * d2r);
+	// tan u = (1 - f) tan lat, also at the poles
+	double u = std::atan2((1 - f) * p.sin_lat, p.cos_lat);
+	p.sin_u = std::sin(u);
+	p.cos_u = std::cos(u);
+	return p;
+    }
+    void prepare(const double *lon, const double *lat, size_t n, geodesic_point *out) const
+    {
+	for (size_t i=0; i < n; i++)
+	    out[i] = prepare(lon[i], lat[i]);
+    }
+
+    // in the units of the spheroid (meters for WGS84)
+    double distance(const geodesic_point &p, const geodesic_point &q,
+		    geodesic_formula formula = geodesic_andoyer) const
+    {
+	switch (formula){
+	    case geodesic_thomas: return thomas(p, q);
+	    case geodesic_vincenty: return vincenty(p, q);
+	    default: return andoyer(p, q);
+	}
+    }
+
+    // out[i] = distance(p[i], q[i])
+    void distances(const geodesic_point *p, const geodesic_point *q, size_t n, double *out,
+		   geodesic_formula formula = geodesic_andoyer) const
+    {
+	switch (formula){
+	    case geodesic_thomas:
+		for_pairs(p, q, n, out, [this](const geodesic_point &x, const geodesic_point &y){return thomas(x, y);});
+		break;
+	    case geodesic_vincenty:
+		for_pairs(p, q, n, out, [this](const geodesic_point &x, const geodesic_point &y){return vincenty(x, y);});
+		break;
+	    default:
+		for_pairs(p, q, n, out, [this](const geodesic_point &x, const geodesic_point &y){return andoyer(x, y);});
+	}
+    }
+
+    // The n - 1 distances between consecutive fixes of a trajectory
+    void track(const geodesic_point *points, size_t n, double *out,
+	       geodesic_formula formula = geodesic_andoyer) const
+    {
+	if (n > 1)
+	    distances(points, points + 1, n - 1, out, formula);
+    }
+};
+
+} // spatial
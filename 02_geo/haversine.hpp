@@ -0,0 +1,234 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Great-circle distances for many pairs of spherical points at once
+
+bg::distance(a, b) on spherical_equatorial points uses the haversine formula
+
+   a = hav(lat2 - lat1) + cos(lat1) cos(lat2) hav(lon2 - lon1),  hav(x) = sin(x/2)^2
+   d = 2 asin(sqrt(a)) * radius
+
+one pair at a time, calling sin, cos and asin of the C library. For whole
+trajectories (the distance between consecutive fixes) we take the coordinates as
+separate lon and lat arrays in degrees and evaluate the formula 4 (AVX2) or 8
+(AVX-512) pairs at a time with polynomial sin and asin:
+
+ - sin(u) on [0, pi/2] by its Taylor polynomial up to u^21 (truncation < 2e-18),
+   |sin(x)| and cos(lat) are reduced to this interval by symmetry;
+ - asin(x) on [0, 1/2] by its Taylor polynomial up to x^45 (truncation < 3e-17),
+   larger arguments by asin(t) = pi/2 - 2 asin(sqrt((1 - t)/2)).
+
+Both polynomials keep the relative accuracy for tiny angles, where the formula
+with 1 - cos(x) would cancel. The result differs from the exact formula by less
+than 1e-15 in units of the radius (6 nm on the Earth), except for nearly
+antipodal points: there the haversine formula itself is ill-conditioned and any
+two evaluations, also Boost.Geometry's at different optimization levels, differ
+by up to about 1e-7 (0.6 m). 09_haversine measures this on a GPS track, random
+pairs and nearly antipodal pairs. At simd_scalar, and for CPUs without AVX2, the
+exact formula of Boost.Geometry is used.
+*/
+#pragma once
+
+#include<cmath>
+#include<cstddef>
+#include<algorithm>
+
+#include "simd.hpp"
+
+namespace spatial{
+
+namespace detail{
+
+// The exact formula, as the haversine strategy of Boost.Geometry evaluates it
+inline double haversine_exact(double lon1, double lat1, double lon2, double lat2)
+{
+    const double d2r = M_PI / 180;
+    lon1 *= d2r; lat1 *= d2r; lon2 *= d2r; lat2 *= d2r;
+    double h_lat = std::sin((lat2 - lat1) / 2), h_lon = std::sin((lon2 - lon1) / 2);
+    double a = h_lat * h_lat + std::cos(lat1) * std::cos(lat2) * (h_lon * h_lon);
+    return 2.0 * std::asin(std::sqrt(std::min(a, 1.0)));
+}
+
+// The same formula with polynomials for double and for GCC vector types, which the
+// AVX2 and AVX-512 functions below turn into vector instructions.
+//
+// The helpers take and return the values by reference: they are templates outside
+// the target functions, and GCC notes a possible ABI change (-Wpsabi) for vector
+// types passed or returned by value there, although everything is inlined.
+
+typedef double vec4 __attribute__((vector_size(32)));
+typedef double vec8 __attribute__((vector_size(64)));
+
+// x = sqrt(x)
+__attribute__((always_inline)) inline void vsqrt(double &x) {x = std::sqrt(x);}
+#ifdef SPATIAL_X86_KERNELS
+// (the builtin is checked where it ends up, i.e. in the AVX2 and AVX-512 functions;
+// these two are not templates, so the note can be silenced here alone)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+__attribute__((always_inline)) inline void vsqrt(vec4 &x)
+{
+    x = __builtin_ia32_sqrtpd256(x);
+}
+__attribute__((always_inline)) inline void vsqrt(vec8 &x)
+{
+    vec4 lo = {x[0], x[1], x[2], x[3]}, hi = {x[4], x[5], x[6], x[7]};
+    vsqrt(lo);
+    vsqrt(hi);
+    vec8 r = {lo[0], lo[1], lo[2], lo[3], hi[0], hi[1], hi[2], hi[3]};
+    x = r;
+}
+#pragma GCC diagnostic pop
+#endif
+
+// x = |x|
+template<typename V> __attribute__((always_inline)) inline void vabs(V &x) {x = (x < 0.0) ? -x : x;}
+
+// u = sin(u) for u in [0, pi/2]
+template<typename V> __attribute__((always_inline)) inline void sin_quadrant(V &u)
+{
+    V u2 = u * u;
+    V p = V() + 1.9572941063391263e-20;
+    p = p * u2 - 8.22063524662433e-18;
+    p = p * u2 + 2.8114572543455206e-15;
+    p = p * u2 - 7.647163731819816e-13;
+    p = p * u2 + 1.6059043836821613e-10;
+    p = p * u2 - 2.505210838544172e-08;
+    p = p * u2 + 2.7557319223985893e-06;
+    p = p * u2 - 0.0001984126984126984;
+    p = p * u2 + 0.008333333333333333;
+    p = p * u2 - 0.16666666666666666;
+    u = u + u * u2 * p;
+}
+
+// x = |sin(x)| for x in [-pi, pi]
+template<typename V> __attribute__((always_inline)) inline void abs_sin(V &x)
+{
+    vabs(x);
+    x = (x > M_PI / 2) ? M_PI - x : x;
+    sin_quadrant(x);
+}
+
+// x = asin(x) for x in [0, 1/2]
+template<typename V> __attribute__((always_inline)) inline void asin_half(V &x)
+{
+    static const double c[22] = {
+	0.16666666666666666, 0.075, 0.044642857142857144, 0.030381944444444444,
+	0.022372159090909092, 0.017352764423076924, 0.01396484375, 0.011551800896139705,
+	0.009761609529194078, 0.008390335809616815, 0.0073125258735988454, 0.006447210311889649,
+	0.005740037670841924, 0.005153309682319905, 0.004660143486915096, 0.004240907093679363,
+	0.003880964558837669, 0.0035692053938259347, 0.003297059503473485, 0.0030578216492580306,
+	0.002846178401108942, 0.00265787063820729};
+    V x2 = x * x;
+    V p = V() + c[21];
+    for (int i = 20; i >= 0; i--)
+	p = p * x2 + c[i];
+    x = x + x * x2 * p;
+}
+
+// t = asin(t) for t in [0, 1]
+template<typename V> __attribute__((always_inline)) inline void asin_unit(V &t)
+{
+    V x = (1.0 - t) * 0.5;
+    vsqrt(x);
+    x = (t > 0.5) ? x : t;
+    asin_half(x);
+    t = (t > 0.5) ? M_PI / 2 - 2.0 * x : x;
+}
+
+// d = the angle between (lon1, lat1) and (lon2, lat2)
+template<typename V> __attribute__((always_inline))
+inline void haversine_poly(const V &lon1, const V &lat1, const V &lon2, const V &lat2, V &d)
+{
+    const double d2r = M_PI / 180;
+    V x1 = lon1 * d2r, y1 = lat1 * d2r, x2 = lon2 * d2r, y2 = lat2 * d2r;
+    V h_lat = (y2 - y1) * 0.5, h_lon = (x2 - x1) * 0.5;
+    abs_sin(h_lat);
+    abs_sin(h_lon);
+    // cos(lat) = sin(pi/2 - |lat|)
+    V c1 = y1, c2 = y2;
+    vabs(c1);
+    vabs(c2);
+    c1 = M_PI / 2 - c1;
+    c2 = M_PI / 2 - c2;
+    sin_quadrant(c1);
+    sin_quadrant(c2);
+    V a = h_lat * h_lat + c1 * c2 * (h_lon * h_lon);
+    a = (a > 1.0) ? V() + 1.0 : a;
+    vsqrt(a);
+    asin_unit(a);
+    d = 2.0 * a;
+}
+
+template<typename V> __attribute__((always_inline))
+inline void haversine_loop(const double *lon1, const double *lat1, const double *lon2, const double *lat2,
+			   size_t n, double *out, double radius)
+{
+    const size_t w = sizeof(V) / sizeof(double);
+    size_t i = 0;
+    for (; i + w <= n; i += w)
+    {
+	V x1, y1, x2, y2, d;
+	__builtin_memcpy(&x1, lon1 + i, sizeof(V));
+	__builtin_memcpy(&y1, lat1 + i, sizeof(V));
+	__builtin_memcpy(&x2, lon2 + i, sizeof(V));
+	__builtin_memcpy(&y2, lat2 + i, sizeof(V));
+	haversine_poly(x1, y1, x2, y2, d);
+	d *= radius;
+	__builtin_memcpy(out + i, &d, sizeof(V));
+    }
+    for (; i < n; i++)
+    {
+	double d;
+	haversine_poly(lon1[i], lat1[i], lon2[i], lat2[i], d);
+	out[i] = d * radius;
+    }
+}
+
+#ifdef SPATIAL_X86_KERNELS
+__attribute__((target("avx2,fma")))
+inline void haversine_avx2(const double *lon1, const double *lat1, const double *lon2, const double *lat2,
+			   size_t n, double *out, double radius)
+{
+    haversine_loop<vec4>(lon1, lat1, lon2, lat2, n, out, radius);
+}
+
+__attribute__((target("avx512f")))
+inline void haversine_avx512(const double *lon1, const double *lat1, const double *lon2, const double *lat2,
+			     size_t n, double *out, double radius)
+{
+    haversine_loop<vec8>(lon1, lat1, lon2, lat2, n, out, radius);
+}
+#endif
+
+} // detail
+
+// out[i] = great-circle distance of (lon1[i], lat1[i]) and (lon2[i], lat2[i]), in
+// degrees, times radius (bg::distance of spherical_equatorial<degree> points times
+// radius). Longitudes may differ by at most 360 degrees.
+inline void haversine_distances(const double *lon1, const double *lat1, const double *lon2, const double *lat2,
+				size_t n, double *out, double radius = 1.0,
+				simd_level level = best_simd_level())
+{
+    switch (std::min(level, best_simd_level())){
+#ifdef SPATIAL_X86_KERNELS
+	case simd_avx512: detail::haversine_avx512(lon1, lat1, lon2, lat2, n, out, radius); break;
+	case simd_avx2: detail::haversine_avx2(lon1, lat1, lon2, lat2, n, out, radius); break;
+#endif
+	default:
+	    for (size_t i=0; i < n; i++)
+		out[i] = detail::haversine_exact(lon1[i], lat1[i], lon2[i], lat2[i]) * radius;
+    }
+}
+
+// The n - 1 distances between consecutive fixes of a trajectory
+inline void haversine_track(const double *lon, const double *lat, size_t n, double *out, double radius = 1.0,
+			    simd_level level = best_simd_level())
+{
+    if (n > 1)
+	haversine_distances(lon, lat, lon + 1, lat + 1, n - 1, out, radius, level);
+}
+
+} // spatial
@@ -0,0 +1,183 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Exact k-nearest-neighbor queries on polygon geometry
+
+The R-tree only knows boxes, so bgi::nearest returns the k nearest boxes, which
+are not necessarily the k nearest polygons: a big box can be close while its
+building is far away. The distance to the box is, however, a lower bound of the
+distance to the polygon. We walk the tree best-first by box distance, refine each
+candidate with the exact bg::distance and stop as soon as the k-th best exact
+distance is not larger than the box distance of the next candidate: no remaining
+polygon can beat it.
+
+The walk uses one priority queue for nodes and values. (The incremental
+qbegin/qend nearest iterator of bgi::rtree would do as well in principle, but it
+is depth-first and re-sorts all neighbors found so far at every leaf, which gets
+quadratic when the number of neighbors is not known in advance.)
+*/
+#pragma once
+
+#include<vector>
+#include<queue>
+#include<utility>
+#include<algorithm>
+#include<cmath>
+#include<limits>
+
+#include <boost/geometry/index/detail/rtree/utilities/view.hpp>
+
+#include "types.hpp"
+#include "distance_kernels.hpp"
+#include "arena.hpp"
+
+namespace spatial{
+
+typedef std::pair<double, size_t> neighbor; // (exact distance, index into the polygons)
+
+namespace detail{
+
+// Pushes the children of a node (or the values of a leaf) with their box distance
+template<typename MembersHolder>
+struct best_first_visitor : public MembersHolder::visitor_const
+{
+    typedef typename MembersHolder::internal_node internal_node;
+    typedef typename MembersHolder::leaf leaf;
+    typedef typename MembersHolder::node_pointer node_pointer;
+    typedef typename MembersHolder::value_type value_type;
+
+    struct item
+    {
+	double distance;
+	node_pointer node;        // either a node ...
+	const value_type *value;  // ... or a value
+	bool operator<(const item &other) const {return distance > other.distance;} // min-heap
+    };
+
+    point p;
+    scratch_vector<item> queue; // a heap, kept as vector so that it can be reused
+    scratch_vector<double> distances; // of the elements of the current node
+
+    void push(double d, node_pointer n, const value_type *v)
+    {
+	item i = {d, n, v};
+	queue.push_back(i);
+	std::push_heap(queue.begin(), queue.end());
+    }
+    // the box distances of all elements of a node at once (distance_kernels.hpp)
+    template<typename Elements>
+    const double *box_distances(const Elements &elements)
+    {
+	distances.resize(elements.size());
+	if (!elements.empty())
+	    comparable_distances(p, &elements[0].first, sizeof(elements[0]), elements.size(), distances.data());
+	return distances.data();
+    }
+    void operator()(internal_node const &n)
+    {
+	const auto &elements = bgi::detail::rtree::elements(n);
+	const double *d = box_distances(elements);
+	for (size_t i=0; i < elements.size(); i++)
+	    push(d[i], elements[i].second, nullptr);
+    }
+    void operator()(leaf const &n)
+    {
+	const auto &elements = bgi::detail::rtree::elements(n);
+	const double *d = box_distances(elements);
+	for (size_t i=0; i < elements.size(); i++)
+	    push(d[i], nullptr, &elements[i]);
+    }
+
+    // the walk of best_first_knn: the comparable distance of the nearest item left
+    bool next(double &distance) const
+    {
+	if (queue.empty()) return false;
+	distance = queue.front().distance;
+	return true;
+    }
+    // takes the nearest item: a value (true, its index) or a node, whose children
+    // are queued (false)
+    bool pop(size_t &index)
+    {
+	item top = queue.front();
+	std::pop_heap(queue.begin(), queue.end());
+	queue.pop_back();
+	if (top.node){
+	    bgi::detail::rtree::apply_visitor(*this, *top.node);
+	    return false;
+	}
+	index = top.value->second;
+	return true;
+    }
+};
+
+// The exact distance from p to polygons[i]. Specializations may return any value
+// above limit instead, when the distance is known to exceed it (see lod.hpp).
+template<typename Polygons>
+struct distance_refiner
+{
+    static double apply(const Polygons &polygons, size_t i, const point &p, double)
+    {
+	return bg::distance(p, polygons[i]);
+    }
+};
+
+// The search of knn_exact over any tree: walk hands out nodes and values by
+// comparable box distance (next, pop as in best_first_visitor), the values are
+// refined until no box left can hold a closer polygon.
+template<typename Walk, typename Polygons, typename OutIter>
+size_t best_first_knn(Walk &walk, const Polygons &polygons, const point &p, size_t k, OutIter out)
+{
+    // max-heap of the best k so far, the current k-th best on top
+    std::priority_queue<neighbor, scratch_vector<neighbor>> best;
+    size_t refined = 0, index;
+    double distance;
+    while (walk.next(distance))
+    {
+	// the queue holds comparable (squared) distances
+	if (best.size() == k && best.top().first <= std::sqrt(distance))
+	    break;
+	if (!walk.pop(index))
+	    continue;
+	const double limit = (best.size() == k) ? best.top().first : std::numeric_limits<double>::infinity();
+	neighbor candidate(distance_refiner<Polygons>::apply(polygons, index, p, limit), index);
+	++refined;
+	if (best.size() < k)
+	    best.push(candidate);
+	else if (candidate < best.top()){
+	    best.pop();
+	    best.push(candidate);
+	}
+    }
+    scratch_vector<neighbor> result;
+    result.reserve(best.size());
+    for (; !best.empty(); best.pop())
+	result.push_back(best.top());
+    std::reverse(result.begin(), result.end());
+    std::copy(result.begin(), result.end(), out);
+    return refined;
+}
+
+} // detail
+
+// Find the k polygons nearest to p. Rtree values are (box, index), polygons[index]
+// is the geometry (a polygon_store, a snapshot's polygons() or a vector of polygons).
+// The neighbors are written to out in increasing distance (ties by index); the
+// return value is the number of polygons that had to be refined.
+template<typename Rtree, typename Polygons, typename OutIter>
+size_t knn_exact(const Rtree &rt, const Polygons &polygons, const point &p, size_t k, OutIter out)
+{
+    if (k == 0 || rt.empty()) return 0;
+    scratch_scope scope; // the queues live in the scratch arena of the thread (arena.hpp)
+    typedef bgi::detail::rtree::utilities::view<Rtree> view_type;
+    typedef detail::best_first_visitor<typename view_type::members_holder> visitor_type;
+    view_type view(rt);
+    visitor_type walk;
+    walk.p = p;
+    view.apply_visitor(walk); // the children of the root
+    return detail::best_first_knn(walk, polygons, p, k, out);
+}
+
+} // spatial
@@ -0,0 +1,96 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Batched, parallel kNN queries
+
+Millions of single queries (GPS fixes to nearest building) are answered as one
+batch: the queries are ordered along a Hilbert curve so that consecutive queries
+touch the same tree nodes and polygons (which are then still in cache), the
+ordered queries are spread over threads that share the read-only tree, and all
+results go to one flat, preallocated buffer at the position of the query.
+*/
+#pragma once
+
+#include<vector>
+#include<algorithm>
+#include<chrono>
+
+#include <boost/function_output_iterator.hpp>
+
+#include "types.hpp"
+#include "knn.hpp"
+#include "parallel.hpp"
+#include "space_filling_curve.hpp"
+
+namespace spatial{
+
+// The neighbors of query i are [offsets[i], offsets[i+1]) in index and distance,
+// ordered by distance. index refers to the polygons, not to the osm id.
+struct knn_batch_result
+{
+    std::vector<size_t> offsets;
+    std::vector<size_t> index;
+    std::vector<double> distance;
+    size_t refined = 0;        // polygons refined in total
+    double queries_per_second = 0;
+
+    // allocate room for n queries with k neighbors each
+    void resize(size_t n, size_t k)
+    {
+	offsets.resize(n + 1);
+	index.resize(n * k);
+	distance.resize(n * k);
+	for (size_t i=0; i <= n; i++)
+	    offsets[i] = i * k;
+    }
+};
+
+// Exact kNN (see knn_exact) for queries[0..n). Every query gets min(k, rt.size())
+// neighbors. The output only allocates if its capacity is below n * k results.
+template<typename Rtree, typename Polygons>
+void knn_batch(const Rtree &rt, const Polygons &polygons, const point *queries, size_t n, size_t k,
+	       knn_batch_result &result, unsigned threads = default_threads())
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    k = std::min(k, rt.size());
+    result.resize(n, k); // no allocation when the buffers are large enough already
+
+    // Hilbert order of the queries over their own extent
+    box extent;
+    bg::assign_inverse(extent);
+    for (size_t i=0; i < n; i++)
+	bg::expand(extent, queries[i]);
+    std::vector<std::pair<uint32_t, size_t>> order(n);
+    parallel_for(n, 1 << 16, threads, [&](size_t b, size_t e, unsigned){
+	for (size_t i=b; i < e; i++)
+	    order[i] = std::make_pair(hilbert_key(queries[i], extent), i);
+    });
+    parallel_sort(order.begin(), order.end(), std::less<std::pair<uint32_t, size_t>>(), threads);
+
+    // blocks of consecutive queries along the curve go to the same thread
+    std::vector<size_t> refined(threads ? threads : 1, 0);
+    parallel_for(n, 256, threads, [&](size_t b, size_t e, unsigned t){
+	size_t block_refined = 0; // counted here: the slots of refined share cache lines
+	for (size_t j=b; j < e; j++)
+	{
+	    size_t q = order[j].second;
+	    size_t slot = result.offsets[q];
+	    block_refined += knn_exact(rt, polygons, queries[q], k,
+		boost::make_function_output_iterator([&](const neighbor &nb){
+		    result.index[slot] = nb.second;
+		    result.distance[slot] = nb.first;
+		    ++slot;
+		}));
+	}
+	refined[t] += block_refined;
+    });
+    result.refined = 0;
+    for (auto r: refined) result.refined += r;
+
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    result.queries_per_second = n / diff.count();
+}
+
+} // spatial
@@ -0,0 +1,411 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: R-tree with concurrent queries and batched updates
+
+bgi::rtree is not thread safe: inserting or removing while another thread queries
+is a data race, and a lock around the tree makes every query wait for the
+updates. live_rtree serves the queries from immutable versions instead:
+
+   version   a flat_rtree (the base, shared between versions) and a delta: a
+             small bgi::rtree of the values inserted since the base was built
+             and the sorted ids of the base values removed since
+   readers   announce the current epoch in their slot, load the current
+             version and query it; no locks, no reference counts
+   writers   apply(inserts, removes) copies the delta of the current version,
+             applies the batch and publishes the new version with one atomic
+             store (writers are serialized by a mutex)
+   merge     when the delta reaches merge_threshold values, a background thread
+             builds a new base from the base and the delta, then publishes it
+             with the batches that came in meanwhile as the new delta
+   epochs    a replaced version is retired with the epoch of its replacement
+             and deleted as soon as no reader has announced an epoch up to it
+
+Queries see the state after some batch, never a half-applied batch. The delta
+stays small, so copying it per batch is cheap. A query costs the base query, a
+query of the delta and a look at a bitmap of the removed ids per base value (a
+binary search only where the bitmap has a bit set); kNN asks the delta only for
+boxes within the k-th distance found in the base.
+
+Values are identified by their id: remove takes the value as it was inserted, and
+an edit is a remove of the old value and an insert of the new one in one batch.
+Removing a value the index does not hold (again, or never inserted) does nothing.
+A live_rtree::reader holds one of max_readers slots; readers must not outlive the
+index. 17_live_index measures the query latency during update bursts.
+*/
+#pragma once
+
+#include<vector>
+#include<algorithm>
+#include<cmath>
+#include<limits>
+#include<atomic>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include<condition_variable>
+#include<stdexcept>
+#include<string>
+#include<utility>
+
+#include <boost/function_output_iterator.hpp>
+
+#include "types.hpp"
+#include "flat_rtree.hpp"
+
+namespace spatial{
+
+namespace detail{
+
+struct alignas(64) reader_slot
+{
+    std::atomic<uint64_t> epoch; // announced epoch while querying, 0 otherwise
+    std::atomic<bool> used;
+};
+
+} // detail
+
+class live_rtree
+{
+    static const size_t filter_bits = 1 << 17;
+
+    struct version
+    {
+	std::shared_ptr<const flat_rtree> base;
+	rtree inserted;              // values inserted since base was built
+	std::vector<size_t> removed; // sorted ids of base values removed since
+	std::vector<uint64_t> filter; // bit id % filter_bits set for the removed ids
+
+	// most ids are rejected by the filter without searching
+	bool is_removed(size_t id) const
+	{
+	    size_t bit = id % filter_bits;
+	    return !removed.empty() && (filter[bit / 64] >> (bit % 64) & 1)
+		&& std::binary_search(removed.begin(), removed.end(), id);
+	}
+	size_t delta_size() const {return inserted.size() + removed.size();}
+    };
+
+    struct batch
+    {
+	std::vector<value> inserts, removes;
+    };
+
+    std::atomic<version *> current;
+    std::atomic<uint64_t> epoch;
+    std::vector<detail::reader_slot, detail::cache_aligned_allocator<detail::reader_slot>> slots;
+
+    // writer side, under write_mutex
+    std::mutex write_mutex;
+    std::vector<std::pair<version *, uint64_t>> retired; // (version, epoch of its replacement)
+    std::vector<batch> log; // batches applied while a merge builds its base
+    bool merging = false;
+    size_t merge_threshold;
+    size_t n_merges = 0;
+    std::string error;
+
+    std::mutex merge_mutex; // one merge at a time
+    std::thread merger;
+    std::condition_variable cv;
+    bool merge_requested = false, closing = false;
+
+    // r is a value of the base that is not removed yet
+    static bool in_base(const version &v, const value &r)
+    {
+	if (v.is_removed(r.second)) return false;
+	bool found = false;
+	v.base->query_intersects(r.first, boost::make_function_output_iterator([&](const value &x){
+	    found |= x.second == r.second && bg::equals(x.first, r.first); }));
+	return found;
+    }
+
+    // removes of values the version does not hold (never inserted or removed before)
+    // are skipped
+    static void apply_batch(version &v, const std::vector<value> &inserts, const std::vector<value> &removes)
+    {
+	std::vector<size_t> removed;
+	for (const auto &r: removes)
+	    if (v.inserted.remove(r) == 0 && in_base(v, r))
+		removed.push_back(r.second);
+	if (!removed.empty()){
+	    if (v.filter.empty()) v.filter.resize(filter_bits / 64, 0);
+	    for (size_t id: removed)
+		v.filter[id % filter_bits / 64] |= uint64_t(1) << (id % filter_bits % 64);
+	    std::sort(removed.begin(), removed.end());
+	    removed.erase(std::unique(removed.begin(), removed.end()), removed.end());
+	    std::vector<size_t> all;
+	    std::set_union(v.removed.begin(), v.removed.end(), removed.begin(), removed.end(), std::back_inserter(all));
+	    v.removed.swap(all);
+	}
+	v.inserted.insert(inserts.begin(), inserts.end());
+    }
+
+    // with write_mutex held
+    void publish(version *v)
+    {
+	version *old = current.exchange(v);
+	retired.push_back(std::make_pair(old, epoch.fetch_add(1)));
+	reclaim();
+    }
+
+    // deletes the retired versions no reader can still see
+    void reclaim()
+    {
+	uint64_t oldest = ~uint64_t(0);
+	for (const auto &s: slots)
+	{
+	    uint64_t e = s.epoch.load();
+	    if (e) oldest = std::min(oldest, e);
+	}
+	size_t kept = 0;
+	for (const auto &r: retired)
+	{
+	    if (r.second < oldest) delete r.first;
+	    else retired[kept++] = r;
+	}
+	retired.resize(kept);
+    }
+
+    void run()
+    {
+	std::unique_lock<std::mutex> lock(write_mutex);
+	for (;;)
+	{
+	    cv.wait(lock, [this](){ return closing || merge_requested; });
+	    if (closing) return;
+	    merge_requested = false;
+	    lock.unlock();
+	    try{
+		merge();
+	    }catch(const std::exception &x){
+		lock.lock();
+		error = x.what();
+		continue;
+	    }
+	    lock.lock();
+	}
+    }
+
+    // the version a reader queries, pinned until the end of the scope
+    class pin
+    {
+	detail::reader_slot &slot;
+    public:
+	const version *v;
+	pin(const live_rtree &index, detail::reader_slot &slot): slot(slot)
+	{
+	    slot.epoch.store(index.epoch.load());
+	    v = index.current.load();
+	}
+	~pin() {slot.epoch.store(0);}
+    };
+
+public:
+    static const size_t max_readers = 64;
+
+    // A reader for one thread at a time
+    class reader
+    {
+	const live_rtree &index;
+	detail::reader_slot *slot;
+
+    public:
+	explicit reader(live_rtree &index): index(index), slot(nullptr)
+	{
+	    for (auto &s: index.slots)
+	    {
+		bool unused = false;
+		if (s.used.compare_exchange_strong(unused, true)){
+		    slot = &s;
+		    return;
+		}
+	    }
+	    throw std::runtime_error("live_rtree: too many readers");
+	}
+	reader(const reader &) = delete;
+	reader &operator=(const reader &) = delete;
+	~reader() {slot->used.store(false);}
+
+	// all values whose box intersects q, as bgi::intersects
+	template<typename OutIter>
+	OutIter query_intersects(const box &q, OutIter out) const
+	{
+	    pin p(index, *slot);
+	    const version &v = *p.v;
+	    v.base->query_intersects(q, boost::make_function_output_iterator([&](const value &x){
+		if (!v.is_removed(x.second)) *out++ = x; }));
+	    v.inserted.query(bgi::intersects(q), boost::make_function_output_iterator([&](const value &x){ *out++ = x; }));
+	    return out;
+	}
+
+	// all values whose box is within q, as bgi::within
+	template<typename OutIter>
+	OutIter query_within(const box &q, OutIter out) const
+	{
+	    pin p(index, *slot);
+	    const version &v = *p.v;
+	    v.base->query_within(q, boost::make_function_output_iterator([&](const value &x){
+		if (!v.is_removed(x.second)) *out++ = x; }));
+	    v.inserted.query(bgi::within(q), boost::make_function_output_iterator([&](const value &x){ *out++ = x; }));
+	    return out;
+	}
+
+	// the k values with the nearest boxes, in increasing distance
+	template<typename OutIter>
+	OutIter query_nearest(const point &p, size_t k, OutIter out) const
+	{
+	    if (k == 0) return out;
+	    typedef std::pair<double, value> candidate;
+	    std::vector<candidate> a, b;
+	    a.reserve(k);
+	    {
+		pin pinned(index, *slot);
+		const version &v = *pinned.v;
+		v.base->query_nearest(p, k, boost::make_function_output_iterator([&](const value &x){
+		    a.push_back(candidate(bg::comparable_distance(p, x.first), x)); }),
+		    [&](size_t id){ return !v.is_removed(id); });
+		auto add = boost::make_function_output_iterator([&](const value &x){
+		    double d = bg::comparable_distance(p, x.first);
+		    if (a.size() < k || d <= a.back().first) b.push_back(candidate(d, x)); });
+		if (!v.inserted.empty() && a.size() == k){
+		    // only delta values within the k-th distance of the base can be among the k
+		    double r = std::nextafter(std::sqrt(a.back().first), std::numeric_limits<double>::max());
+		    box window(point(bg::get<0>(p) - r, bg::get<1>(p) - r), point(bg::get<0>(p) + r, bg::get<1>(p) + r));
+		    v.inserted.query(bgi::intersects(window), add);
+		} else if (!v.inserted.empty())
+		    v.inserted.query(bgi::nearest(p, static_cast<unsigned>(k)), add);
+	    }
+	    auto closer = [](const candidate &x, const candidate &y){ return x.first < y.first; };
+	    std::sort(b.begin(), b.end(), closer);
+	    size_t i = 0, j = 0;
+	    for (size_t n=0; n < k && (i < a.size() || j < b.size()); n++)
+		*out++ = (j == b.size() || (i < a.size() && a[i].first <= b[j].first)) ? a[i++].second : b[j++].second;
+	    return out;
+	}
+
+	// the number of values
+	size_t size() const
+	{
+	    pin p(index, *slot);
+	    return p.v->base->size() - p.v->removed.size() + p.v->inserted.size();
+	}
+    };
+
+    // background = false leaves merging to the caller (merge())
+    explicit live_rtree(const std::vector<value> &values, size_t merge_threshold = 1 << 14, bool background = true)
+	: current(nullptr), epoch(1), slots(max_readers), merge_threshold(merge_threshold)
+    {
+	for (auto &s: slots)
+	{
+	    s.epoch.store(0);
+	    s.used.store(false);
+	}
+	version *v = new version;
+	v->base = std::make_shared<const flat_rtree>(rtree(values));
+	current.store(v);
+	if (background)
+	    merger = std::thread([this](){ run(); });
+    }
+    live_rtree(const live_rtree &) = delete;
+    live_rtree &operator=(const live_rtree &) = delete;
+
+    ~live_rtree()
+    {
+	if (merger.joinable()){
+	    {
+		std::lock_guard<std::mutex> lock(write_mutex);
+		closing = true;
+	    }
+	    cv.notify_all();
+	    merger.join();
+	}
+	for (const auto &r: retired)
+	    delete r.first;
+	delete current.load();
+    }
+
+    // One batch of updates, visible to the queries at once. Throws the error of a
+    // failed background merge.
+    void apply(const std::vector<value> &inserts, const std::vector<value> &removes)
+    {
+	std::lock_guard<std::mutex> lock(write_mutex);
+	if (!error.empty()){
+	    std::string e;
+	    e.swap(error);
+	    throw std::runtime_error("live_rtree: merge failed: " + e);
+	}
+	version *v = new version(*current.load());
+	apply_batch(*v, inserts, removes);
+	if (merging){
+	    batch b = {inserts, removes};
+	    log.push_back(b);
+	}
+	size_t delta = v->delta_size();
+	publish(v);
+	if (!merging && merger.joinable() && delta >= merge_threshold){
+	    merge_requested = true;
+	    cv.notify_all();
+	}
+    }
+
+    // Builds a new base from the base and the delta of the current version. The
+    // batches applied meanwhile become the delta of the new version.
+    void merge()
+    {
+	std::lock_guard<std::mutex> one(merge_mutex);
+	std::shared_ptr<const flat_rtree> base;
+	std::vector<value> values;
+	std::vector<size_t> removed;
+	{
+	    std::lock_guard<std::mutex> lock(write_mutex);
+	    const version &v = *current.load();
+	    if (v.delta_size() == 0) return;
+	    base = v.base;
+	    values.assign(v.inserted.begin(), v.inserted.end());
+	    removed = v.removed;
+	    merging = true;
+	    log.clear();
+	}
+	std::shared_ptr<const flat_rtree> merged;
+	try{
+	    values.reserve(base->size() + values.size());
+	    base->all_values(boost::make_function_output_iterator([&](const value &x){
+		if (!std::binary_search(removed.begin(), removed.end(), x.second)) values.push_back(x); }));
+	    merged = std::make_shared<const flat_rtree>(rtree(values));
+	}catch(...){
+	    std::lock_guard<std::mutex> lock(write_mutex);
+	    merging = false;
+	    throw;
+	}
+	std::lock_guard<std::mutex> lock(write_mutex);
+	version *v = new version;
+	v->base = merged;
+	for (const auto &b: log)
+	    apply_batch(*v, b.inserts, b.removes);
+	log.clear();
+	merging = false;
+	++n_merges;
+	publish(v);
+    }
+
+    // number of merges so far, values in the delta, versions waiting for readers
+    size_t merges()
+    {
+	std::lock_guard<std::mutex> lock(write_mutex);
+	return n_merges;
+    }
+    size_t delta_size()
+    {
+	std::lock_guard<std::mutex> lock(write_mutex);
+	return current.load()->delta_size();
+    }
+    size_t retired_versions()
+    {
+	std::lock_guard<std::mutex> lock(write_mutex);
+	return retired.size();
+    }
+};
+
+} // spatial
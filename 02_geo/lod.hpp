@@ -0,0 +1,327 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Levels of detail with error bounds for exact queries
+
+A distance or point-in-polygon test reads every vertex of the polygon, even when
+the answer is clear from a rough outline. The lod_store keeps, per polygon, a few
+versions simplified with bg::simplify (Douglas-Peucker) at tolerances relative to
+the size of the polygon, coarsest first, each with a bound h on the Hausdorff
+distance between its boundary and the original one. Every point of the original
+boundary is then within h of the simplified boundary and vice versa, so
+
+   |distance(p, polygon) - distance(p, tier)| <= h
+
+and a point farther than h from the boundary of a tier is inside the polygon iff
+it is inside the tier. The queries below try the tiers from the coarsest and
+read the full polygon only when the bound leaves the answer open; the answers
+are those of the full polygon.
+
+The bound is measured, not assumed: the simplified ring is a subsequence of the
+original one, and h is the largest distance of an original vertex to the chord
+that replaced it. A tier is only kept when it is valid and has at most half the
+points of the next finer version; small polygons (fewer than min_points points,
+e.g. the buildings of the tutorial) get no tiers and cost nothing.
+*/
+#pragma once
+
+#include<vector>
+#include<cstdint>
+#include<cmath>
+#include<limits>
+#include<algorithm>
+
+#include "types.hpp"
+#include "parallel.hpp"
+#include "polygon_store.hpp"
+#include "knn.hpp"
+
+namespace spatial{
+
+struct lod_stats
+{
+    size_t coarse = 0; // answers given by a simplified tier
+    size_t full = 0;   // answers that needed the full polygon
+    size_t points = 0; // vertices read, tiers and full polygons
+};
+
+namespace detail{
+
+typedef bg::model::ring<point, false, false> lod_ring;
+typedef bg::model::polygon<point, false, false> lod_polygon;
+
+inline double segment_distance2(const point &p, const point &a, const point &b)
+{
+    const double ax = bg::get<0>(a), ay = bg::get<1>(a);
+    const double dx = bg::get<0>(b) - ax, dy = bg::get<1>(b) - ay;
+    const double px = bg::get<0>(p) - ax, py = bg::get<1>(p) - ay;
+    const double len2 = dx * dx + dy * dy;
+    double t = (len2 > 0) ? (px * dx + py * dy) / len2 : 0;
+    t = std::min(1.0, std::max(0.0, t));
+    const double ex = px - t * dx, ey = py - t * dy;
+    return ex * ex + ey * ey;
+}
+
+// The Hausdorff bound (squared) of an open ring simplified to s, a subsequence of
+// r that may start elsewhere; -1 if s does not walk along r.
+template<typename Ring>
+double chord_error2(const Ring &r, const lod_ring &s)
+{
+    const size_t n = r.size(), m = s.size();
+    size_t start = 0;
+    while (start < n && !bg::equals(r[start], s[0])) ++start;
+    if (start == n) return -1;
+    double h2 = 0;
+    size_t j = 0; // the chord s[j] s[j+1] the next vertices of r belong to
+    for (size_t k=1; k <= n && j < m; k++)
+    {
+	const point &v = r[(start + k) % n];
+	const point &b = s[(j + 1) % m];
+	h2 = std::max(h2, segment_distance2(v, s[j], b));
+	if (bg::equals(v, b)) ++j;
+    }
+    return j == m ? h2 : -1;
+}
+
+// simplifies ring r with the given tolerance into out; -1 if it degenerates
+template<typename Ring>
+double simplify_ring(const Ring &r, double tolerance, lod_ring &out)
+{
+    lod_ring in(r.begin(), r.end());
+    out.clear();
+    bg::simplify(in, out, tolerance);
+    if (out.size() > 1 && bg::equals(out.front(), out.back()))
+	out.pop_back(); // simplify closes open rings
+    if (out.size() < 3) return -1;
+    return chord_error2(r, out);
+}
+
+// one point against all rings of g: inside (even-odd) and the squared distance to the boundary
+template<typename Polygon>
+std::pair<bool, double> locate(const Polygon &g, const point &p, size_t &points)
+{
+    const double px = bg::get<0>(p), py = bg::get<1>(p);
+    bool inside = false;
+    double d2 = std::numeric_limits<double>::infinity();
+    auto ring = [&](const typename bg::ring_return_type<const Polygon>::type r){
+	const size_t n = boost::size(r);
+	points += n;
+	for (size_t k=0; k < n; k++)
+	{
+	    const point &a = r[k], &b = r[(k + 1) % n];
+	    const double ax = bg::get<0>(a), ay = bg::get<1>(a), bx = bg::get<0>(b), by = bg::get<1>(b);
+	    if ((ay > py) != (by > py) && px < (bx - ax) * (py - ay) / (by - ay) + ax)
+		inside = !inside;
+	    d2 = std::min(d2, segment_distance2(p, a, b));
+	}
+    };
+    ring(bg::exterior_ring(g));
+    for (const auto &r: bg::interior_rings(g))
+	ring(r);
+    return std::make_pair(inside, d2);
+}
+
+} // detail
+
+class lod_store
+{
+    polygon_store tiers_;         // all tiers of all polygons, coarsest first; id = the polygon
+    std::vector<uint64_t> first_; // [n+1] first tier of each polygon
+    std::vector<double> errors_;  // the Hausdorff bound of each tier
+
+    // the tiers of polygons [b, e)
+    struct block
+    {
+	polygon_store tiers;
+	std::vector<uint64_t> counts;
+	std::vector<double> errors;
+    };
+
+    template<typename Polygon>
+    static void build(const Polygon &g, size_t id, const box &envelope, const std::vector<double> &fractions,
+		      size_t min_points, block &out)
+    {
+	size_t kept = 0;
+	const size_t points = bg::num_points(g);
+	if (points >= min_points){
+	    const double diagonal = bg::distance(envelope.min_corner(), envelope.max_corner());
+	    size_t finer = points; // points of the next finer version kept
+	    detail::lod_polygon tier;
+	    detail::lod_ring r;
+	    std::vector<std::pair<detail::lod_polygon, double>> found;
+	    for (double fraction: fractions) // finest first
+	    {
+		tier.clear();
+		double h2 = detail::simplify_ring(bg::exterior_ring(g), fraction * diagonal, tier.outer());
+		if (h2 < 0) continue;
+		for (const auto &hole: bg::interior_rings(g))
+		{
+		    double e2 = detail::simplify_ring(hole, fraction * diagonal, r);
+		    if (e2 < 0){ // a hole that vanishes stays as it is
+			r.assign(hole.begin(), hole.end());
+			e2 = 0;
+		    }
+		    tier.inners().push_back(r);
+		    h2 = std::max(h2, e2);
+		}
+		const size_t n = bg::num_points(tier);
+		if (2 * n > finer || !bg::is_valid(tier)) continue;
+		// a little more than measured, for the rounding of the distances it is compared with
+		found.push_back(std::make_pair(tier, std::sqrt(h2) * (1 + 1e-9) + 1e-12 * diagonal));
+		finer = n;
+	    }
+	    for (auto it = found.rbegin(); it != found.rend(); ++it)
+	    {
+		out.tiers.push_back(it->first, id);
+		out.errors.push_back(it->second);
+	    }
+	    kept = found.size();
+	}
+	out.counts.push_back(kept);
+    }
+
+public:
+    lod_store(): first_(1, 0) {}
+
+    // tolerances are fractions of the diagonal of the envelope of each polygon
+    template<typename Polygons>
+    explicit lod_store(const Polygons &polygons, std::vector<double> tolerances = {0.05, 0.01},
+		       size_t min_points = 64, unsigned threads = default_threads())
+	: first_(1, 0)
+    {
+	std::sort(tolerances.begin(), tolerances.end()); // finest first while building
+	const size_t n = polygons.size(), chunk = 1024;
+	std::vector<block> blocks((n + chunk - 1) / chunk);
+	parallel_for(n, chunk, threads, [&](size_t b, size_t e, unsigned){
+	    block &out = blocks[b / chunk];
+	    for (size_t i=b; i < e; i++)
+		build(polygons[i], i, polygon_envelope(polygons, i), tolerances, min_points, out);
+	});
+	first_.reserve(n + 1);
+	for (const auto &b: blocks)
+	{
+	    tiers_.append(b.tiers);
+	    errors_.insert(errors_.end(), b.errors.begin(), b.errors.end());
+	    for (size_t c: b.counts)
+		first_.push_back(first_.back() + c);
+	}
+    }
+
+    size_t size() const {return first_.size() - 1;}
+    size_t num_tiers(size_t i) const {return first_[i + 1] - first_[i];}
+    size_t num_tiers() const {return tiers_.size();}
+    // tier t of polygon i, t = 0 is the coarsest
+    polygon_view tier(size_t i, size_t t) const {return tiers_[first_[i] + t];}
+    double error(size_t i, size_t t) const {return errors_[first_[i] + t];}
+    const polygon_store &tiers() const {return tiers_;}
+
+    // bytes held by the tiers and the tables
+    size_t memory_usage() const
+    {
+	return tiers_.memory_usage() + first_.capacity() * sizeof(uint64_t) + errors_.capacity() * sizeof(double);
+    }
+};
+
+// The distance from p to polygons[i] if it is at most limit; otherwise possibly
+// only a lower bound above limit (the k-th best distance of a kNN query, say).
+template<typename Polygons>
+double lod_distance(const lod_store &lod, const Polygons &polygons, size_t i, const point &p, double limit,
+		    lod_stats *stats = nullptr)
+{
+    lod_stats local;
+    lod_stats &s = stats ? *stats : local;
+    if (limit < std::numeric_limits<double>::infinity())
+	for (size_t t=0; t < lod.num_tiers(i); t++)
+	{
+	    const polygon_view g = lod.tier(i, t);
+	    s.points += g.num_points();
+	    const double bound = bg::distance(p, g) - lod.error(i, t);
+	    if (bound > limit){
+		++s.coarse;
+		return bound;
+	    }
+	}
+    ++s.full;
+    s.points += bg::num_points(polygons[i]);
+    return bg::distance(p, polygons[i]);
+}
+
+// distance(p, polygons[i]) <= radius
+template<typename Polygons>
+bool lod_within_distance(const lod_store &lod, const Polygons &polygons, size_t i, const point &p, double radius,
+			 lod_stats *stats = nullptr)
+{
+    lod_stats local;
+    lod_stats &s = stats ? *stats : local;
+    for (size_t t=0; t < lod.num_tiers(i); t++)
+    {
+	const polygon_view g = lod.tier(i, t);
+	s.points += g.num_points();
+	const double d = bg::distance(p, g), h = lod.error(i, t);
+	if (d + h <= radius || d - h > radius){
+	    ++s.coarse;
+	    return d + h <= radius;
+	}
+    }
+    ++s.full;
+    s.points += bg::num_points(polygons[i]);
+    return bg::distance(p, polygons[i]) <= radius;
+}
+
+// bg::covered_by(p, polygons[i])
+template<typename Polygons>
+bool lod_covered_by(const lod_store &lod, const Polygons &polygons, size_t i, const point &p,
+		    lod_stats *stats = nullptr)
+{
+    lod_stats local;
+    lod_stats &s = stats ? *stats : local;
+    for (size_t t=0; t < lod.num_tiers(i); t++)
+    {
+	const double h = lod.error(i, t);
+	auto where = detail::locate(lod.tier(i, t), p, s.points);
+	if (where.second > h * h){
+	    ++s.coarse;
+	    return where.first;
+	}
+    }
+    ++s.full;
+    s.points += bg::num_points(polygons[i]);
+    return bg::covered_by(p, polygons[i]);
+}
+
+// The polygons together with their tiers, for knn_exact: candidates whose
+// coarsest tier is already farther than the k-th best are not read in full.
+template<typename Polygons>
+struct lod_polygons
+{
+    const Polygons &polygons;
+    const lod_store &lod;
+    lod_stats *stats;
+
+    lod_polygons(const Polygons &p, const lod_store &l, lod_stats *s = nullptr): polygons(p), lod(l), stats(s) {}
+    size_t size() const {return polygons.size();}
+    auto operator[](size_t i) const -> decltype(polygons[i]) {return polygons[i];}
+};
+
+template<typename Polygons>
+lod_polygons<Polygons> with_lod(const Polygons &polygons, const lod_store &lod, lod_stats *stats = nullptr)
+{
+    return lod_polygons<Polygons>(polygons, lod, stats);
+}
+
+namespace detail{
+
+template<typename Polygons>
+struct distance_refiner<lod_polygons<Polygons>>
+{
+    static double apply(const lod_polygons<Polygons> &l, size_t i, const point &p, double limit)
+    {
+	return lod_distance(l.lod, l.polygons, i, p, limit, l.stats);
+    }
+};
+
+} // detail
+
+} // spatial
@@ -0,0 +1,500 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Static R-trees with a choice of packing
+
+The packing constructor of bgi::rtree builds the tree top-down by splitting at
+medians. How the boxes are grouped into nodes decides how much the nodes overlap
+and so how many nodes a query visits. packed_rtree builds a read-only tree from
+all values at once with one of three classic packings:
+
+   packing_str      Sort-Tile-Recursive (Leutenegger et al. 1997): bottom-up, the
+                    boxes are sorted by x into sqrt(P) slices (P nodes on the
+                    level), every slice by y, and cut into full nodes; the same
+                    for the next level on the node boxes
+   packing_hilbert  bottom-up, sorted once along the Hilbert curve of the box
+                    centers (space_filling_curve.hpp), consecutive runs of boxes
+                    form nodes on every level
+   packing_omt      Overlap Minimizing Top-down (Lee and Lee 2003): the root
+                    spreads all boxes evenly over as many children as full
+                    subtrees one level lower would need, in x and y slices, and
+                    so on down; all leaves are on the same level
+
+The fanout is a template parameter (the capacity of a node, which fixes the
+loops over a node at compile time); the constructor may fill the nodes with
+fewer entries. Nodes are stored in plain vectors, children before their parent
+and the root last: node i has the entries [first, first + count) of boxes and
+ids, which are value ids in leaves and node indexes above. stats() gives the node count and the overlap and
+coverage that 14_packing compares; rtree_stats does the same for bgi::rtree.
+
+Bulk loading runs on threads: the envelopes (envelopes()), the Hilbert keys, the
+sorts (parallel_sort), the slices of STR and OMT, the nodes of a level and the
+subtrees below the root of OMT. Every step gives the same result as the serial
+one, so the tree does not depend on the number of threads (15_parallel_bulk_load).
+*/
+#pragma once
+
+#include<vector>
+#include<algorithm>
+#include<cmath>
+#include<cstdint>
+#include<utility>
+#include<stdexcept>
+#include<functional>
+
+#include <boost/geometry/index/detail/rtree/utilities/view.hpp>
+
+#include "types.hpp"
+#include "space_filling_curve.hpp"
+#include "distance_kernels.hpp"
+#include "parallel.hpp"
+#include "polygon_store.hpp"
+
+namespace spatial{
+
+enum packing {packing_str, packing_hilbert, packing_omt};
+
+inline const char *packing_name(packing p)
+{
+    switch (p){
+	case packing_hilbert: return "hilbert";
+	case packing_omt: return "omt";
+	default: return "str";
+    }
+}
+
+// Shape of a tree: the sums are over all nodes except the root
+struct tree_stats
+{
+    size_t nodes = 0, leaves = 0, height = 0;
+    double coverage = 0; // sum of the node box areas
+    double overlap = 0;  // sum of the pairwise intersection areas of sibling boxes
+};
+
+namespace detail{
+
+inline point center(const box &b)
+{
+    return point((bg::get<bg::min_corner,0>(b) + bg::get<bg::max_corner,0>(b)) / 2,
+		 (bg::get<bg::min_corner,1>(b) + bg::get<bg::max_corner,1>(b)) / 2);
+}
+
+inline double overlap_area(const box &a, const box &b)
+{
+    double w = std::min(bg::get<bg::max_corner,0>(a), bg::get<bg::max_corner,0>(b))
+	- std::max(bg::get<bg::min_corner,0>(a), bg::get<bg::min_corner,0>(b));
+    double h = std::min(bg::get<bg::max_corner,1>(a), bg::get<bg::max_corner,1>(b))
+	- std::max(bg::get<bg::min_corner,1>(a), bg::get<bg::min_corner,1>(b));
+    return (w > 0 && h > 0) ? w * h : 0;
+}
+
+struct box_itself {const box &operator()(const box &b) const {return b;}};
+struct box_of_pair {template<typename Pair> const box &operator()(const Pair &p) const {return p.first;}};
+
+// adds the sibling boxes [first, last) to the stats
+template<typename Iter, typename GetBox>
+void add_siblings(tree_stats &s, Iter first, Iter last, GetBox get_box)
+{
+    for (Iter i = first; i != last; ++i)
+    {
+	s.coverage += bg::area(get_box(*i));
+	for (Iter j = i + 1; j != last; ++j)
+	    s.overlap += overlap_area(get_box(*i), get_box(*j));
+    }
+}
+
+template<typename MembersHolder>
+struct stats_visitor : public MembersHolder::visitor_const
+{
+    typedef typename MembersHolder::internal_node internal_node;
+    typedef typename MembersHolder::leaf leaf;
+
+    tree_stats s;
+    size_t level = 0;
+
+    void operator()(internal_node const &n)
+    {
+	const auto &elements = bgi::detail::rtree::elements(n);
+	++s.nodes;
+	s.height = std::max(s.height, level + 1);
+	add_siblings(s, elements.begin(), elements.end(), box_of_pair());
+	++level;
+	for (const auto &e: elements)
+	    bgi::detail::rtree::apply_visitor(*this, *e.second);
+	--level;
+    }
+    void operator()(leaf const &)
+    {
+	++s.nodes;
+	++s.leaves;
+	s.height = std::max(s.height, level + 1);
+    }
+};
+
+} // detail
+
+// tree_stats of a bgi::rtree of (box, id) values
+template<typename Rtree>
+tree_stats rtree_stats(const Rtree &rt)
+{
+    typedef bgi::detail::rtree::utilities::view<Rtree> view_type;
+    view_type view(rt);
+    detail::stats_visitor<typename view_type::members_holder> v;
+    if (!rt.empty()) view.apply_visitor(v);
+    return v.s;
+}
+
+// The values (envelope of polygons[i], i) for bulk loading, computed on the threads
+// (a polygon store has them at hand, see polygon_envelope)
+template<typename Polygons>
+std::vector<value> envelopes(const Polygons &polygons, unsigned threads = default_threads())
+{
+    std::vector<value> values(polygons.size());
+    parallel_for(values.size(), 1 << 12, threads, [&](size_t b, size_t e, unsigned){
+	for (size_t i=b; i < e; i++)
+	    values[i] = value(polygon_envelope(polygons, i), i);
+    });
+    return values;
+}
+
+template<size_t Fanout = 16>
+class packed_rtree
+{
+    static_assert(Fanout >= 2, "a node needs at least two entries");
+
+public:
+    struct node
+    {
+	box bounds;
+	uint32_t first, count;
+	bool leaf;
+    };
+
+private:
+    typedef std::pair<box, size_t> item; // (box, value id or node index)
+
+    // the entries of all nodes, node by node, and the nodes, children before their parent
+    struct storage
+    {
+	std::vector<box> boxes;
+	std::vector<size_t> ids; // value id (leaf) or node index (internal node)
+	std::vector<node> nodes;
+
+	// one node with the entries [first, last)
+	size_t make_node(const item *first, const item *last, bool leaf)
+	{
+	    node n;
+	    n.bounds = bounds_of(first, last);
+	    n.first = static_cast<uint32_t>(boxes.size());
+	    n.count = static_cast<uint32_t>(last - first);
+	    n.leaf = leaf;
+	    for (const item *i = first; i != last; ++i)
+	    {
+		boxes.push_back(i->first);
+		ids.push_back(i->second);
+	    }
+	    nodes.push_back(n);
+	    return nodes.size() - 1;
+	}
+	// appends a tree built on its own, renumbering its nodes and entries
+	void append(const storage &other)
+	{
+	    const size_t node_base = nodes.size(), entry_base = boxes.size();
+	    boxes.insert(boxes.end(), other.boxes.begin(), other.boxes.end());
+	    for (const auto &n: other.nodes)
+	    {
+		node m = n;
+		m.first += static_cast<uint32_t>(entry_base);
+		nodes.push_back(m);
+		for (uint32_t i = n.first; i < n.first + n.count; i++)
+		    ids.push_back(n.leaf ? other.ids[i] : other.ids[i] + node_base);
+	    }
+	}
+    };
+
+    storage t;
+    size_t fill = Fanout;
+    size_t n_values = 0;
+
+    static box bounds_of(const item *first, const item *last)
+    {
+	box b = first->first;
+	for (const item *i = first + 1; i != last; ++i)
+	    bg::expand(b, i->first);
+	return b;
+    }
+
+    void sort_by(item *first, item *last, int dimension, unsigned threads) const
+    {
+	parallel_sort(first, last, [dimension](const item &a, const item &b){
+	    double ca = (dimension == 0) ? bg::get<0>(detail::center(a.first)) : bg::get<1>(detail::center(a.first));
+	    double cb = (dimension == 0) ? bg::get<0>(detail::center(b.first)) : bg::get<1>(detail::center(b.first));
+	    return ca < cb || (ca == cb && a.second < b.second);
+	}, threads);
+    }
+
+    // sorts the slices [b, b + slice_size) of [first, last) by y, in parallel
+    void sort_slices(item *first, item *last, size_t slice_size, unsigned threads) const
+    {
+	size_t n = last - first;
+	parallel_for(n, slice_size, threads, [&](size_t b, size_t e, unsigned){ sort_by(first + b, first + e, 1, 1); });
+    }
+
+    // STR order of one level: sqrt(P) slices by x, each by y
+    void str_order(std::vector<item> &level, unsigned threads) const
+    {
+	size_t n_nodes = (level.size() + fill - 1) / fill;
+	size_t slices = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(n_nodes))));
+	size_t slice_size = ((n_nodes + slices - 1) / slices) * fill;
+	sort_by(level.data(), level.data() + level.size(), 0, threads);
+	sort_slices(level.data(), level.data() + level.size(), slice_size, threads);
+    }
+
+    void hilbert_order(std::vector<item> &level, unsigned threads) const
+    {
+	box extent = bounds_of(level.data(), level.data() + level.size());
+	std::vector<std::pair<uint32_t, item>> keyed(level.size());
+	parallel_for(level.size(), 1 << 14, threads, [&](size_t b, size_t e, unsigned){
+	    for (size_t i=b; i < e; i++)
+		keyed[i] = std::make_pair(hilbert_key(detail::center(level[i].first), extent), level[i]);
+	});
+	parallel_sort(keyed.begin(), keyed.end(), [](const std::pair<uint32_t, item> &a, const std::pair<uint32_t, item> &b){
+	    return a.first < b.first || (a.first == b.first && a.second.second < b.second.second);
+	}, threads);
+	for (size_t i=0; i < level.size(); i++)
+	    level[i] = keyed[i].second;
+    }
+
+    // the nodes of one level at once: node j gets the entries [j fill, (j+1) fill)
+    void pack_level(const std::vector<item> &level, bool leaf, std::vector<item> &next, unsigned threads)
+    {
+	const size_t count = (level.size() + fill - 1) / fill;
+	const size_t node_base = t.nodes.size(), entry_base = t.boxes.size();
+	t.nodes.resize(node_base + count);
+	t.boxes.resize(entry_base + level.size());
+	t.ids.resize(entry_base + level.size());
+	next.resize(count);
+	parallel_for(count, 1 << 10, threads, [&](size_t b, size_t e, unsigned){
+	    for (size_t j=b; j < e; j++)
+	    {
+		size_t first = j * fill, last = std::min(level.size(), first + fill);
+		node &n = t.nodes[node_base + j];
+		n.bounds = bounds_of(level.data() + first, level.data() + last);
+		n.first = static_cast<uint32_t>(entry_base + first);
+		n.count = static_cast<uint32_t>(last - first);
+		n.leaf = leaf;
+		for (size_t i = first; i < last; i++)
+		{
+		    t.boxes[entry_base + i] = level[i].first;
+		    t.ids[entry_base + i] = level[i].second;
+		}
+		next[j] = item(n.bounds, node_base + j);
+	    }
+	});
+    }
+
+    // bottom-up: order a level, cut it into nodes, repeat on the node boxes (in level)
+    void build_bottom_up(std::vector<item> &level, packing p, unsigned threads)
+    {
+	bool leaf = true;
+	for (;;)
+	{
+	    if (p == packing_str || leaf) // Hilbert keeps the order of the leaves above
+		(p == packing_str) ? str_order(level, threads) : hilbert_order(level, threads);
+	    std::vector<item> next;
+	    pack_level(level, leaf, next, threads);
+	    if (next.size() == 1) return;
+	    level.swap(next);
+	    leaf = false;
+	}
+    }
+
+    // top-down: the node of the given height for [first, last) in out, returns its
+    // index. The items are spread evenly over ceil(n / capacity) children, capacity
+    // being the size of a full subtree one level lower, so that all leaves end up
+    // on the same level. The subtrees of the children are independent: with
+    // threads > 1 they are built on the threads and appended in order, which gives
+    // the same nodes as building them one by one.
+    size_t build_omt(item *first, item *last, size_t height, storage &out, unsigned threads) const
+    {
+	size_t n = last - first;
+	if (height == 1)
+	    return out.make_node(first, last, true);
+	size_t capacity = 1;
+	for (size_t h=1; h < height; h++) capacity *= fill;
+	size_t children = (n + capacity - 1) / capacity;
+	size_t slices = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(children))));
+
+	// child j gets n / children items (one more for the first n % children), slice
+	// k the next children / slices children (one more for the first children % slices)
+	std::vector<std::pair<item *, item *>> ranges, slice_ranges;
+	item *c = first;
+	for (size_t k=0, j=0; k < slices; k++)
+	{
+	    item *slice_begin = c;
+	    for (size_t m = children / slices + (k < children % slices); m > 0; m--, j++)
+	    {
+		item *child_end = c + n / children + (j < n % children);
+		ranges.push_back(std::make_pair(c, child_end));
+		c = child_end;
+	    }
+	    slice_ranges.push_back(std::make_pair(slice_begin, c));
+	}
+	sort_by(first, last, 0, threads);
+	parallel_for(slice_ranges.size(), 1, threads, [&](size_t b, size_t e, unsigned){
+	    for (size_t i=b; i < e; i++)
+		sort_by(slice_ranges[i].first, slice_ranges[i].second, 1, 1);
+	});
+
+	std::vector<item> entries;
+	if (threads > 1){
+	    std::vector<storage> subtrees(ranges.size());
+	    std::vector<size_t> roots(ranges.size());
+	    parallel_for(ranges.size(), 1, threads, [&](size_t b, size_t e, unsigned){
+		for (size_t i=b; i < e; i++)
+		    roots[i] = build_omt(ranges[i].first, ranges[i].second, height - 1, subtrees[i], 1);
+	    });
+	    for (size_t i=0; i < ranges.size(); i++)
+	    {
+		size_t base = out.nodes.size();
+		out.append(subtrees[i]);
+		entries.push_back(item(out.nodes[base + roots[i]].bounds, base + roots[i]));
+	    }
+	} else
+	    for (const auto &r: ranges)
+	    {
+		size_t id = build_omt(r.first, r.second, height - 1, out, 1);
+		entries.push_back(item(out.nodes[id].bounds, id));
+	    }
+	return out.make_node(entries.data(), entries.data() + entries.size(), false);
+    }
+
+public:
+    typedef std::pair<box, size_t> value_type;
+
+    packed_rtree() {}
+
+    // All values (box, id) at once; fill is the number of entries per node (at most
+    // Fanout). The sorting and packing run on the given number of threads, the tree
+    // is the same for any number of threads.
+    template<typename Range>
+    explicit packed_rtree(const Range &values, packing p = packing_str, size_t fill = Fanout,
+			  unsigned threads = 1)
+	: fill(fill)
+    {
+	if (fill < 2 || fill > Fanout)
+	    throw std::runtime_error("packed_rtree: fill must be in [2, Fanout]");
+	std::vector<item> level;
+	level.reserve(boost::size(values));
+	for (auto it = boost::begin(values); it != boost::end(values); ++it)
+	    level.push_back(item(it->first, it->second));
+	n_values = level.size();
+	if (level.empty()) return;
+	t.boxes.reserve(n_values + n_values / (fill - 1) + 1);
+	t.ids.reserve(t.boxes.capacity());
+	if (threads == 0) threads = 1;
+	if (p == packing_omt){
+	    // the height the values need: fill^height >= n
+	    size_t height = 1;
+	    for (size_t capacity = fill; capacity < n_values; capacity *= fill) height++;
+	    build_omt(level.data(), level.data() + level.size(), height, t, threads);
+	}
+	else
+	    build_bottom_up(level, p, threads);
+    }
+
+    size_t size() const {return n_values;}
+    bool empty() const {return n_values == 0;}
+    const std::vector<node> &all_nodes() const {return t.nodes;}
+    const std::vector<box> &entry_boxes() const {return t.boxes;}
+    const std::vector<size_t> &entry_ids() const {return t.ids;}
+
+    // f(box, id) for every value whose box intersects b
+    template<typename F>
+    void query_intersects(const box &b, F f) const
+    {
+	if (t.nodes.empty()) return;
+	const double x1 = bg::get<bg::min_corner,0>(b), y1 = bg::get<bg::min_corner,1>(b);
+	const double x2 = bg::get<bg::max_corner,0>(b), y2 = bg::get<bg::max_corner,1>(b);
+	uint32_t stack[64 * Fanout];
+	size_t top = 0;
+	stack[top++] = static_cast<uint32_t>(t.nodes.size() - 1);
+	while (top)
+	{
+	    const node &n = t.nodes[stack[--top]];
+	    for (uint32_t i = n.first; i < n.first + n.count; i++)
+	    {
+		const box &e = t.boxes[i];
+		if (bg::get<bg::min_corner,0>(e) > x2 || bg::get<bg::max_corner,0>(e) < x1
+		    || bg::get<bg::min_corner,1>(e) > y2 || bg::get<bg::max_corner,1>(e) < y1) continue;
+		if (n.leaf) f(t.boxes[i], t.ids[i]);
+		else stack[top++] = static_cast<uint32_t>(t.ids[i]);
+	    }
+	}
+    }
+
+    // the k values with the nearest boxes, as bgi::nearest, in increasing distance
+    template<typename OutIter>
+    void nearest(const point &p, size_t k, OutIter out) const
+    {
+	if (t.nodes.empty() || k == 0) return;
+	typedef std::pair<double, uint32_t> candidate; // (comparable distance, entry or node)
+	std::vector<candidate> queue; // min-heap of nodes
+	std::vector<candidate> best;  // max-heap of the best k entries so far
+	double d[Fanout];
+	queue.push_back(candidate(0, static_cast<uint32_t>(t.nodes.size() - 1)));
+	while (!queue.empty())
+	{
+	    candidate next = queue.front();
+	    std::pop_heap(queue.begin(), queue.end(), std::greater<candidate>());
+	    queue.pop_back();
+	    if (best.size() == k && next.first > best.front().first) break;
+	    const node &n = t.nodes[next.second];
+	    comparable_distances(p, &t.boxes[n.first], n.count, d);
+	    for (uint32_t i=0; i < n.count; i++)
+	    {
+		bool full = best.size() == k;
+		if (full && d[i] >= best.front().first) continue;
+		if (!n.leaf){
+		    queue.push_back(candidate(d[i], static_cast<uint32_t>(t.ids[n.first + i])));
+		    std::push_heap(queue.begin(), queue.end(), std::greater<candidate>());
+		    continue;
+		}
+		if (full){
+		    std::pop_heap(best.begin(), best.end());
+		    best.pop_back();
+		}
+		best.push_back(candidate(d[i], n.first + i));
+		std::push_heap(best.begin(), best.end());
+	    }
+	}
+	std::sort_heap(best.begin(), best.end());
+	for (const auto &b: best)
+	    *out++ = value_type(t.boxes[b.second], t.ids[b.second]);
+    }
+
+    tree_stats stats() const
+    {
+	tree_stats s;
+	s.nodes = t.nodes.size();
+	for (const auto &n: t.nodes)
+	{
+	    s.leaves += n.leaf;
+	    if (!n.leaf)
+		detail::add_siblings(s, t.boxes.begin() + n.first, t.boxes.begin() + n.first + n.count, detail::box_itself());
+	}
+	// the height of every node from those of its children, which come before it
+	std::vector<size_t> height(t.nodes.size(), 1);
+	for (size_t i=0; i < t.nodes.size(); i++)
+	    if (!t.nodes[i].leaf)
+		for (uint32_t j = t.nodes[i].first; j < t.nodes[i].first + t.nodes[i].count; j++)
+		    height[i] = std::max(height[i], height[t.ids[j]] + 1);
+	if (!t.nodes.empty())
+	    s.height = height.back();
+	return s;
+    }
+};
+
+} // spatial
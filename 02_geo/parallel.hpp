@@ -0,0 +1,102 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: A minimal parallel for loop on std::thread
+
+The range [0,n) is cut into blocks that the threads take from a shared atomic
+counter, so fast threads simply take more blocks. The calling thread works as
+well, and the first exception thrown by any block is rethrown after the join.
+
+parallel_sort sorts one block per thread and merges them in rounds. For a
+comparison that is a strict total order (no ties) the result is the same as
+that of std::sort, which is what deterministic bulk loading needs.
+*/
+#pragma once
+
+#include<vector>
+#include<thread>
+#include<atomic>
+#include<exception>
+#include<mutex>
+#include<algorithm>
+#include<cstdlib>
+#include<cctype>
+
+namespace spatial{
+
+// more threads than this are a typo, not a machine
+const unsigned max_threads = 1024;
+
+inline unsigned default_threads()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? std::min(n, max_threads) : 1;
+}
+
+// A thread count from the command line: digits only, from 1 to max_threads.
+// std::atoi("-1") as unsigned would be 4294967295 threads. false if arg is
+// anything else, threads is then unchanged.
+inline bool parse_threads(const char *arg, unsigned &threads)
+{
+    char *end = const_cast<char *>(arg);
+    unsigned long t = std::isdigit(static_cast<unsigned char>(arg[0])) ? std::strtoul(arg, &end, 10) : 0;
+    if (*end != 0 || t < 1 || t > max_threads)
+	return false;
+    threads = static_cast<unsigned>(t);
+    return true;
+}
+
+// f(begin, end, thread_index) is called for consecutive blocks of at most block elements
+template<typename F>
+void parallel_for(size_t n, size_t block, unsigned threads, F f)
+{
+    if (n == 0) return;
+    if (block == 0) block = 1;
+    size_t n_blocks = (n + block - 1) / block;
+    threads = std::max(1u, std::min(threads, max_threads));
+    if (threads > n_blocks) threads = static_cast<unsigned>(n_blocks);
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&](unsigned t){
+	for (size_t b = next++; b < n_blocks; b = next++)
+	{
+	    try{
+		f(b * block, std::min(n, (b + 1) * block), t);
+	    }catch(...){
+		std::lock_guard<std::mutex> lock(error_mutex);
+		if (!error) error = std::current_exception();
+		next = n_blocks; // stop handing out blocks
+	    }
+	}
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t=1; t < threads; t++)
+	pool.emplace_back(worker, t);
+    worker(0);
+    for (auto &t: pool) t.join();
+    if (error) std::rethrow_exception(error);
+}
+
+// std::sort(first, last, comp) on several threads
+template<typename Iter, typename Compare>
+void parallel_sort(Iter first, Iter last, Compare comp, unsigned threads)
+{
+    const size_t n = last - first;
+    if (threads <= 1 || n < (1 << 14)){
+	std::sort(first, last, comp);
+	return;
+    }
+    size_t chunk = (n + threads - 1) / threads;
+    parallel_for(n, chunk, threads, [&](size_t b, size_t e, unsigned){ std::sort(first + b, first + e, comp); });
+    for (size_t width = chunk; width < n; width *= 2)
+	parallel_for(n, 2 * width, threads, [&](size_t b, size_t e, unsigned){
+	    if (b + width < e)
+		std::inplace_merge(first + b, first + b + width, first + e, comp);
+	});
+}
+
+} // spatial
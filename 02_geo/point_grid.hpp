@@ -0,0 +1,242 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: A uniform grid index for point data
+
+The extent of the points is cut into 2^b x 2^b cells of equal size, with b chosen
+for a few points per cell. The points are counting-sorted by the Morton key of
+their cell into one array, and an offset array indexed by the Morton key gives the
+points of each cell; that is all the index there is. Neighboring cells are mostly
+close in memory, there are no nodes to follow and the build is linear.
+
+A range query visits the cells under the box and tests only the points of the
+border cells. A kNN query visits rings of cells around the query point until the
+k-th best distance is not larger than the distance to the cells not yet visited.
+The results are those of a bgi::rtree of the same (point, id) values: within
+means strictly inside the box, intersects includes the border. For clustered data
+with empty and crowded cells the R-tree is the better choice.
+*/
+#pragma once
+
+#include<vector>
+#include<cstdint>
+#include<cmath>
+#include<limits>
+#include<algorithm>
+#include<stdexcept>
+#include<utility>
+
+#include "types.hpp"
+#include "space_filling_curve.hpp"
+#include "parallel.hpp"
+#include "arena.hpp"
+
+namespace spatial{
+
+class point_grid
+{
+    std::vector<point_value> values; // sorted by the Morton key of the cell
+    std::vector<uint32_t> offsets;   // the points of cell c are [offsets[c], offsets[c+1])
+    box extent;
+    uint32_t side = 0;               // cells per row and column
+    double min_x = 0, min_y = 0, cell_w = 0, cell_h = 0, inv_w = 0, inv_h = 0;
+
+    // the same monotone mapping for the points and the queries, so that a point
+    // between two coordinates lies in a cell between (or on) their cells
+    uint32_t cell_x(double x) const
+    {
+	double t = (x - min_x) * inv_w;
+	return t > 0 ? static_cast<uint32_t>(std::min(t, side - 1.0)) : 0;
+    }
+    uint32_t cell_y(double y) const
+    {
+	double t = (y - min_y) * inv_h;
+	return t > 0 ? static_cast<uint32_t>(std::min(t, side - 1.0)) : 0;
+    }
+
+    void build(unsigned threads, double points_per_cell)
+    {
+	if (values.size() >= std::numeric_limits<uint32_t>::max())
+	    throw std::runtime_error("point_grid: too many points");
+	if (values.empty()) return;
+	extent = box(values[0].first, values[0].first);
+	for (const auto &v: values)
+	    bg::expand(extent, v.first);
+	min_x = bg::get<bg::min_corner,0>(extent);
+	min_y = bg::get<bg::min_corner,1>(extent);
+	double cells = values.size() / std::max(points_per_cell, 1.0);
+	unsigned bits = static_cast<unsigned>(std::max(0.0, std::min(15.0, std::round(std::log2(cells) / 2))));
+	side = 1u << bits;
+	cell_w = (bg::get<bg::max_corner,0>(extent) - min_x) / side;
+	cell_h = (bg::get<bg::max_corner,1>(extent) - min_y) / side;
+	inv_w = cell_w > 0 ? 1 / cell_w : 0;
+	inv_h = cell_h > 0 ? 1 / cell_h : 0;
+
+	// counting sort by cell; stable, so the points of a cell keep their input order
+	std::vector<uint32_t> keys(values.size());
+	parallel_for(values.size(), 1 << 16, threads, [&](size_t b, size_t e, unsigned){
+	    for (size_t i=b; i < e; i++)
+		keys[i] = morton_key(cell_x(bg::get<0>(values[i].first)), cell_y(bg::get<1>(values[i].first)));
+	});
+	offsets.assign(static_cast<size_t>(side) * side + 1, 0);
+	for (uint32_t k: keys)
+	    offsets[k + 1]++;
+	for (size_t c=1; c < offsets.size(); c++)
+	    offsets[c] += offsets[c - 1];
+	std::vector<point_value> sorted(values.size());
+	std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+	for (size_t i=0; i < values.size(); i++)
+	    sorted[next[keys[i]]++] = values[i];
+	values.swap(sorted);
+    }
+
+    template<typename OutIter>
+    OutIter spatial_query(const box &q, bool within, OutIter out) const
+    {
+	if (values.empty() || !bg::intersects(q, extent)) return out;
+	const double qx0 = bg::get<bg::min_corner,0>(q), qy0 = bg::get<bg::min_corner,1>(q);
+	const double qx1 = bg::get<bg::max_corner,0>(q), qy1 = bg::get<bg::max_corner,1>(q);
+	const uint32_t x0 = cell_x(qx0), x1 = cell_x(qx1), y0 = cell_y(qy0), y1 = cell_y(qy1);
+	for (uint32_t cy = y0; cy <= y1; cy++)
+	    for (uint32_t cx = x0; cx <= x1; cx++)
+	    {
+		const uint32_t c = morton_key(cx, cy);
+		const point_value *v = values.data() + offsets[c], *end = values.data() + offsets[c + 1];
+		if (cx > x0 && cx < x1 && cy > y0 && cy < y1){
+		    // all points of an inner cell lie strictly inside the box
+		    for (; v != end; ++v) *out++ = *v;
+		    continue;
+		}
+		for (; v != end; ++v)
+		{
+		    const double x = bg::get<0>(v->first), y = bg::get<1>(v->first);
+		    bool hit = within ? (x > qx0 && x < qx1 && y > qy0 && y < qy1)
+			: (x >= qx0 && x <= qx1 && y >= qy0 && y <= qy1);
+		    if (hit) *out++ = *v;
+		}
+	    }
+	return out;
+    }
+
+    typedef std::pair<double, uint32_t> candidate; // (comparable distance, position in values)
+
+    template<typename Accept>
+    void nearest_in_cell(uint32_t cx, uint32_t cy, double x, double y, size_t k, Accept &accept,
+			 scratch_vector<candidate> &best) const
+    {
+	const uint32_t c = morton_key(cx, cy);
+	for (uint32_t i = offsets[c]; i < offsets[c + 1]; i++)
+	{
+	    const double dx = bg::get<0>(values[i].first) - x, dy = bg::get<1>(values[i].first) - y;
+	    const double d = dx * dx + dy * dy;
+	    if (best.size() == k && d >= best.front().first) continue;
+	    if (!accept(values[i].second)) continue;
+	    if (best.size() == k){
+		std::pop_heap(best.begin(), best.end());
+		best.pop_back();
+	    }
+	    best.push_back(candidate(d, i));
+	    std::push_heap(best.begin(), best.end());
+	}
+    }
+
+public:
+    point_grid() {}
+
+    // points_per_cell sets the cell size: about that many points per cell for uniform data
+    // (pass the points with std::move to build in place)
+    explicit point_grid(std::vector<point_value> points, double points_per_cell = 4,
+			unsigned threads = default_threads())
+	: values(std::move(points))
+    {
+	build(threads, points_per_cell);
+    }
+
+    size_t size() const {return values.size();}
+    bool empty() const {return values.empty();}
+    box bounds() const {return extent;}
+    size_t num_cells() const {return static_cast<size_t>(side) * side;}
+
+    // bytes held by the arrays
+    size_t memory_usage() const
+    {
+	return values.capacity() * sizeof(point_value) + offsets.capacity() * sizeof(uint32_t);
+    }
+
+    // all values, cell by cell in Morton order
+    template<typename OutIter>
+    OutIter all_values(OutIter out) const
+    {
+	return std::copy(values.begin(), values.end(), out);
+    }
+
+    // all values strictly inside q (as bgi::within)
+    template<typename OutIter>
+    OutIter query_within(const box &q, OutIter out) const
+    {
+	return spatial_query(q, true, out);
+    }
+
+    // all values in q or on its border (as bgi::intersects)
+    template<typename OutIter>
+    OutIter query_intersects(const box &q, OutIter out) const
+    {
+	return spatial_query(q, false, out);
+    }
+
+    // the k nearest values, as bgi::nearest, in increasing distance
+    template<typename OutIter>
+    OutIter query_nearest(const point &p, size_t k, OutIter out) const
+    {
+	return query_nearest(p, k, out, [](size_t){ return true; });
+    }
+
+    // the same among the values whose id passes accept(id)
+    template<typename OutIter, typename Accept>
+    OutIter query_nearest(const point &p, size_t k, OutIter out, Accept accept) const
+    {
+	if (values.empty() || k == 0) return out;
+	const double x = bg::get<0>(p), y = bg::get<1>(p);
+	const int64_t cx = cell_x(x), cy = cell_y(y), last = side - 1;
+	// cells are placed up to rounding; keep the lower bound on the safe side
+	const double slack = 1e-9 * (cell_w + cell_h);
+	scratch_scope scope;
+	scratch_vector<candidate> best; // max-heap of the best k values so far
+	best.reserve(k);
+	for (int64_t r = 0; ; r++)
+	{
+	    // the ring of cells at Chebyshev distance r, clipped to the grid
+	    const int64_t x0 = cx - r, x1 = cx + r, y0 = cy - r, y1 = cy + r;
+	    const int64_t cx0 = std::max<int64_t>(x0, 0), cx1 = std::min(x1, last);
+	    const int64_t cy0 = std::max<int64_t>(y0, 0), cy1 = std::min(y1, last);
+	    for (int64_t i = cx0; i <= cx1; i++)
+	    {
+		if (y0 >= 0) nearest_in_cell(i, y0, x, y, k, accept, best);
+		if (y1 <= last && r > 0) nearest_in_cell(i, y1, x, y, k, accept, best);
+	    }
+	    for (int64_t j = std::max(y0 + 1, cy0); j <= std::min(y1 - 1, cy1); j++)
+	    {
+		if (x0 >= 0) nearest_in_cell(x0, j, x, y, k, accept, best);
+		if (x1 <= last && r > 0) nearest_in_cell(x1, j, x, y, k, accept, best);
+	    }
+	    if (x0 <= 0 && y0 <= 0 && x1 >= last && y1 >= last) break; // the whole grid
+	    if (best.size() < k) continue;
+	    // the cells not yet visited lie beyond one of the open sides of the block
+	    double bound = std::numeric_limits<double>::infinity();
+	    if (x0 > 0) bound = std::min(bound, x - (min_x + x0 * cell_w));
+	    if (x1 < last) bound = std::min(bound, min_x + (x1 + 1) * cell_w - x);
+	    if (y0 > 0) bound = std::min(bound, y - (min_y + y0 * cell_h));
+	    if (y1 < last) bound = std::min(bound, min_y + (y1 + 1) * cell_h - y);
+	    bound = std::max(0.0, bound - slack);
+	    if (bound * bound >= best.front().first) break;
+	}
+	std::sort_heap(best.begin(), best.end());
+	for (const auto &b: best)
+	    *out++ = values[b.second];
+	return out;
+    }
+};
+
+} // spatial
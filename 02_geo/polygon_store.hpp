@@ -0,0 +1,316 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Structure-of-arrays polygon store
+
+A std::vector<std::pair<polygon, size_t>> keeps every ring in its own heap block.
+The store below keeps all polygons in five flat arrays instead:
+
+   points           all ring points, one ring after the other (open rings)
+   ring_offsets     [n_rings+1]    first point of each ring
+   polygon_offsets  [n_polygons+1] first ring of each polygon, the exterior ring first
+   ids              [n_polygons]   the osm id
+   envelopes        [n_polygons]   the MBR, computed once when the polygon is added
+
+store[i] returns a lightweight polygon_view registered with Boost.Geometry, so
+bg::distance, bg::within, bg::envelope, bg::wkt etc. work on it unchanged while
+reading the coordinates straight from the shared buffer.
+*/
+#pragma once
+
+#include<vector>
+#include<cstdint>
+#include<iterator>
+
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/range/iterator_range.hpp>
+
+#include<type_traits>
+
+#include "types.hpp"
+#include "envelope_kernels.hpp"
+
+namespace spatial{
+
+static_assert(sizeof(point) == 2 * sizeof(double), "point must be two packed doubles");
+
+// An open, counter-clockwise ring as a pair of pointers into the point buffer
+struct ring_view
+{
+    typedef const point *iterator;
+    typedef const point *const_iterator;
+    typedef point value_type;
+    typedef size_t size_type;
+
+    const point *first = nullptr, *last = nullptr;
+
+    ring_view() {}
+    ring_view(const point *f, const point *l): first(f), last(l) {}
+    const point *begin() const {return first;}
+    const point *end() const {return last;}
+    size_t size() const {return last - first;}
+    bool empty() const {return first == last;}
+    const point &operator[](size_t i) const {return first[i];}
+};
+
+typedef boost::iterator_range<const ring_view *> ring_range;
+
+// One polygon of the store: the exterior ring followed by its interior rings.
+// Boost.Geometry keeps references to rings while it works (e.g. in the section
+// views of get_turns), so the rings are real objects in the ring table of the
+// store and not temporaries made up from the offsets.
+struct polygon_view
+{
+    const ring_view *first = nullptr, *last = nullptr;
+
+    polygon_view() {}
+    polygon_view(const ring_view *f, const ring_view *l): first(f), last(l) {}
+
+    const ring_view &exterior() const {return *first;}
+    ring_range interiors() const {return ring_range(first + 1, last);}
+    size_t num_points() const {return last[-1].end() - first->begin();}
+};
+
+
+// Turn point offsets into the table of ring_views the polygon_views point into
+inline void make_ring_table(const point *points, const uint64_t *ring_offsets, size_t n_rings,
+			    std::vector<ring_view> &rings, size_t from = 0)
+{
+    rings.resize(n_rings);
+    for (size_t r = from; r < n_rings; r++)
+	rings[r] = ring_view(points + ring_offsets[r], points + ring_offsets[r+1]);
+}
+
+
+// Non-owning access to the flat arrays, e.g. a store or a mapped snapshot
+class polygon_store_view
+{
+protected:
+    const point *_points = nullptr;
+    const ring_view *_rings = nullptr;
+    const uint64_t *_ring_offsets = nullptr;
+    const uint64_t *_polygon_offsets = nullptr;
+    const uint64_t *_ids = nullptr;
+    const box *_envelopes = nullptr;
+    size_t _size = 0;
+
+public:
+    class iterator
+	: public boost::iterator_facade<iterator, polygon_view const, std::random_access_iterator_tag, polygon_view const>
+    {
+	const polygon_store_view *store = nullptr;
+	size_t i = 0;
+    public:
+	iterator() {}
+	iterator(const polygon_store_view *s, size_t index): store(s), i(index) {}
+    private:
+	friend class boost::iterator_core_access;
+	polygon_view dereference() const {return (*store)[i];}
+	bool equal(const iterator &other) const {return i == other.i;}
+	void increment() {++i;}
+	void decrement() {--i;}
+	void advance(std::ptrdiff_t n) {i += n;}
+	std::ptrdiff_t distance_to(const iterator &other) const {return other.i - i;}
+    };
+    typedef iterator const_iterator;
+
+    polygon_store_view() {}
+    // rings must hold one ring_view per ring offset, see make_ring_table
+    polygon_store_view(const point *points, const ring_view *rings, const uint64_t *ring_offsets,
+		       const uint64_t *polygon_offsets, const uint64_t *ids, const box *envelopes, size_t size)
+	: _points(points), _rings(rings), _ring_offsets(ring_offsets),
+	  _polygon_offsets(polygon_offsets), _ids(ids), _envelopes(envelopes), _size(size) {}
+
+    size_t size() const {return _size;}
+    bool empty() const {return _size == 0;}
+    size_t id(size_t i) const {return _ids[i];}
+    // the same box as bg::envelope((*this)[i]), without touching the coordinates
+    const box &envelope(size_t i) const {return _envelopes[i];}
+    polygon_view operator[](size_t i) const
+    {
+	return polygon_view(_rings + _polygon_offsets[i], _rings + _polygon_offsets[i+1]);
+    }
+    iterator begin() const {return iterator(this, 0);}
+    iterator end() const {return iterator(this, _size);}
+
+    size_t num_rings() const {return _size ? _polygon_offsets[_size] : 0;}
+    size_t num_points() const {return _size ? _ring_offsets[num_rings()] : 0;}
+    const point *points() const {return _points;}
+    const ring_view *rings() const {return _rings;}
+    const uint64_t *ring_offsets() const {return _ring_offsets;}
+    const uint64_t *polygon_offsets() const {return _polygon_offsets;}
+    const uint64_t *ids() const {return _ids;}
+    const box *envelopes() const {return _envelopes;}
+};
+
+
+// The owning store. Appending may move the buffers, so views taken before an
+// append (including iterators and polygon_views) are invalidated by it.
+class polygon_store : public polygon_store_view
+{
+    std::vector<point> points_;
+    std::vector<uint64_t> ring_offsets_ = std::vector<uint64_t>(1, 0);
+    std::vector<uint64_t> polygon_offsets_ = std::vector<uint64_t>(1, 0);
+    std::vector<uint64_t> ids_;
+    std::vector<box> envelopes_;
+    std::vector<ring_view> rings_;
+
+    void update()
+    {
+	// only new rings need a view, unless the point buffer has moved
+	size_t from = (_points == points_.data()) ? rings_.size() : 0;
+	make_ring_table(points_.data(), ring_offsets_.data(), ring_offsets_.size() - 1, rings_, from);
+	_points = points_.data();
+	_rings = rings_.data();
+	_ring_offsets = ring_offsets_.data();
+	_polygon_offsets = polygon_offsets_.data();
+	_ids = ids_.data();
+	_envelopes = envelopes_.data();
+	_size = ids_.size();
+    }
+    template<typename Ring>
+    void add_ring(const Ring &r)
+    {
+	points_.insert(points_.end(), boost::begin(r), boost::end(r));
+	ring_offsets_.push_back(points_.size());
+    }
+
+public:
+    polygon_store() {update();}
+    polygon_store(const polygon_store &other)
+	: points_(other.points_), ring_offsets_(other.ring_offsets_),
+	  polygon_offsets_(other.polygon_offsets_), ids_(other.ids_), envelopes_(other.envelopes_) {update();}
+    polygon_store(polygon_store &&other)
+	: points_(std::move(other.points_)), ring_offsets_(std::move(other.ring_offsets_)),
+	  polygon_offsets_(std::move(other.polygon_offsets_)), ids_(std::move(other.ids_)),
+	  envelopes_(std::move(other.envelopes_)), rings_(std::move(other.rings_))
+    {
+	_points = points_.data(); // the ring table moved along with its buffer
+	update();
+	other.clear();
+    }
+    polygon_store &operator=(polygon_store other)
+    {
+	points_.swap(other.points_);
+	ring_offsets_.swap(other.ring_offsets_);
+	polygon_offsets_.swap(other.polygon_offsets_);
+	ids_.swap(other.ids_);
+	envelopes_.swap(other.envelopes_);
+	rings_.swap(other.rings_);
+	_points = points_.data();
+	update();
+	return *this;
+    }
+
+    void clear()
+    {
+	points_.clear();
+	ring_offsets_.assign(1, 0);
+	polygon_offsets_.assign(1, 0);
+	ids_.clear();
+	envelopes_.clear();
+	rings_.clear();
+	update();
+    }
+
+    void reserve(size_t polygons, size_t rings = 0, size_t points = 0)
+    {
+	ids_.reserve(polygons);
+	envelopes_.reserve(polygons);
+	polygon_offsets_.reserve(polygons + 1);
+	ring_offsets_.reserve(rings + 1);
+	rings_.reserve(rings);
+	points_.reserve(points);
+	update();
+    }
+
+    // copy any Boost.Geometry polygon into the flat arrays
+    template<typename Polygon>
+    void push_back(const Polygon &poly, size_t id)
+    {
+	const size_t first = points_.size();
+	add_ring(bg::exterior_ring(poly));
+	// the envelope of a polygon is that of its exterior ring
+	envelopes_.push_back(points_envelope(points_.data() + first, points_.size() - first));
+	for (const auto &r: bg::interior_rings(poly))
+	    add_ring(r);
+	polygon_offsets_.push_back(ring_offsets_.size() - 1);
+	ids_.push_back(id);
+	update();
+    }
+
+    // append all polygons of another store (used to merge per-thread results)
+    void append(const polygon_store_view &other)
+    {
+	uint64_t point_base = points_.size(), ring_base = ring_offsets_.size() - 1;
+	points_.insert(points_.end(), other.points(), other.points() + other.num_points());
+	for (size_t r = 1; r <= other.num_rings(); r++)
+	    ring_offsets_.push_back(point_base + other.ring_offsets()[r]);
+	for (size_t i = 1; i <= other.size(); i++)
+	    polygon_offsets_.push_back(ring_base + other.polygon_offsets()[i]);
+	ids_.insert(ids_.end(), other.ids(), other.ids() + other.size());
+	envelopes_.insert(envelopes_.end(), other.envelopes(), other.envelopes() + other.size());
+	update();
+    }
+
+    // bytes held by the arrays
+    size_t memory_usage() const
+    {
+	return points_.capacity() * sizeof(point) + rings_.capacity() * sizeof(ring_view)
+	    + (ring_offsets_.capacity() + polygon_offsets_.capacity() + ids_.capacity()) * sizeof(uint64_t)
+	    + envelopes_.capacity() * sizeof(box);
+    }
+};
+
+namespace detail{
+
+template<typename Polygons>
+box polygon_envelope(const Polygons &polygons, size_t i, std::true_type) {return polygons.envelope(i);}
+template<typename Polygons>
+box polygon_envelope(const Polygons &polygons, size_t i, std::false_type)
+{
+    box b;
+    bg::envelope(polygons[i], b);
+    return b;
+}
+
+} // detail
+
+// The envelope of polygons[i]: the cached one of a store (or snapshot), else bg::envelope
+template<typename Polygons>
+box polygon_envelope(const Polygons &polygons, size_t i)
+{
+    return detail::polygon_envelope(polygons, i, std::is_base_of<polygon_store_view, Polygons>());
+}
+
+} // spatial
+
+
+// Register the views with Boost.Geometry: ring_view is an open ccw ring, polygon_view a polygon
+namespace boost { namespace geometry { namespace traits {
+
+template<> struct tag<spatial::ring_view> { typedef ring_tag type; };
+template<> struct point_order<spatial::ring_view> { static const order_selector value = counterclockwise; };
+template<> struct closure<spatial::ring_view> { static const closure_selector value = open; };
+// the rings of a polygon_view are always const, so the ring type seen through it is const, too
+template<> struct point_order<spatial::ring_view const> : point_order<spatial::ring_view> {};
+template<> struct closure<spatial::ring_view const> : closure<spatial::ring_view> {};
+
+template<> struct tag<spatial::polygon_view> { typedef polygon_tag type; };
+template<> struct ring_const_type<spatial::polygon_view> { typedef spatial::ring_view const &type; };
+template<> struct ring_mutable_type<spatial::polygon_view> { typedef spatial::ring_view const &type; };
+template<> struct interior_const_type<spatial::polygon_view> { typedef spatial::ring_range const type; };
+template<> struct interior_mutable_type<spatial::polygon_view> { typedef spatial::ring_range type; };
+
+template<> struct exterior_ring<spatial::polygon_view>
+{
+    static spatial::ring_view const &get(spatial::polygon_view const &p) {return p.exterior();}
+};
+template<> struct interior_rings<spatial::polygon_view>
+{
+    static spatial::ring_range get(spatial::polygon_view const &p) {return p.interiors();}
+};
+
+}}} // boost::geometry::traits
@@ -0,0 +1,213 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Prepared polygons for repeated point-in-polygon tests
+
+bg::within(p, A) visits all edges of A for every point. When many points are
+tested against the same polygon, we sort the edges into horizontal bands once:
+a point then only counts the crossings of the few edges of its own band.
+
+The answer has to be the same as the one of bg::within / bg::covered_by. Those
+decide "on the boundary" with a small tolerance, so whenever a point comes close
+to an edge or has nearly the y value of a vertex, the fast test steps back and
+asks Boost.Geometry. Far from the boundary, the crossing number is unambiguous.
+*/
+#pragma once
+
+#include<vector>
+#include<cmath>
+#include<limits>
+#include<algorithm>
+#include<cstdint>
+#include<utility>
+
+#include <boost/geometry.hpp>
+
+namespace spatial{
+
+namespace detail{
+
+// much larger than the tolerance of the Boost.Geometry equality tests
+inline double crossing_tolerance(double scale)
+{
+    return 1024 * std::numeric_limits<double>::epsilon() * std::max(1.0, scale);
+}
+
+// A bound on the rounding error of side = dx * dpy - dy * dpx (and of the side
+// Boost.Geometry computes from the same points) plus the tolerance of its zero
+// test. The differences carry an error of about eps times the magnitude m of the
+// coordinates, the products and the subtraction one of eps times their values.
+inline double side_tolerance(double dx, double dy, double dpx, double dpy, double m)
+{
+    double scale = std::max(std::max(std::fabs(dx), std::fabs(dy)), std::max(std::fabs(dpx), std::fabs(dpy)));
+    return 64 * std::numeric_limits<double>::epsilon()
+	* (std::fabs(dx * dpy) + std::fabs(dy * dpx) + (std::fabs(dx) + std::fabs(dy)) * m + std::max(1.0, scale));
+}
+
+// x as a rounded double: a product passed through here is not contracted with
+// the following subtraction into an FMA (-ffp-contract), so that all kernels
+// compute the same side
+inline double unfused(double x)
+{
+#if defined(__GNUC__) && defined(__SSE2_MATH__)
+    __asm__("" : "+x"(x));
+#elif defined(__GNUC__)
+    __asm__("" : "+m"(x));
+#endif
+    return x;
+}
+
+// The edge (x1, y1)-(x2, y2) and the horizontal ray from (px, py) to the right:
+// 1 if it crosses the ray, 0 if not, -1 if p is too close to the edge or to the
+// height of a vertex to decide (tx, ty: the tolerances in x and y, m: the largest
+// magnitude of the coordinates). Also used by the scalar kernel of classify.hpp.
+inline int ray_crossing(double x1, double y1, double x2, double y2, double px, double py,
+			double tx, double ty, double m)
+{
+    // near a vertex height: unless the edge lies completely left of p, the ray
+    // passes (almost) through a vertex or along the edge
+    if (std::fabs(py - y1) <= ty || std::fabs(py - y2) <= ty)
+	return (std::max(x1, x2) >= px - tx) ? -1 : 0;
+    if ((y1 > py) == (y2 > py))
+	return 0;
+    // which side of the edge is p on? (same formula as side_by_triangle)
+    double dx = x2 - x1, dy = y2 - y1, dpx = px - x1, dpy = py - y1;
+    double side = unfused(dx * dpy) - unfused(dy * dpx);
+    if (std::fabs(side) <= side_tolerance(dx, dy, dpx, dpy, m))
+	return -1;
+    // the edge crosses the ray to the right of p
+    return ((side > 0) == (dy > 0)) ? 1 : 0;
+}
+
+} // detail
+
+template<typename Polygon>
+class prepared_polygon
+{
+    typedef typename boost::geometry::point_type<Polygon>::type point_type;
+    typedef boost::geometry::model::box<point_type> box_type;
+
+    struct edge
+    {
+	double x1, y1, x2, y2;
+    };
+
+    Polygon geometry; // for the rare points near the boundary
+    double min_x, min_y, max_x, max_y;
+    double magnitude;      // of the coordinates, for the side tolerance
+    double band_height = 1;
+    std::vector<uint32_t> band_offsets; // edges of band b: [band_offsets[b], band_offsets[b+1])
+    std::vector<edge> band_edges;
+
+    size_t band(double y) const
+    {
+	double b = std::floor((y - min_y) / band_height);
+	return static_cast<size_t>(std::min<double>(std::max(b, 0.0), band_offsets.size() - 2));
+    }
+
+    template<typename Ring>
+    void collect(const Ring &ring, std::vector<edge> &edges)
+    {
+	namespace bg = boost::geometry;
+	size_t n = boost::size(ring);
+	if (n < 2) return;
+	// open rings get their closing edge, closed ones already have it
+	size_t m = (bg::closure<Polygon>::value == bg::open) ? n : n - 1;
+	for (size_t i=0; i < m; i++)
+	{
+	    const auto &a = *(boost::begin(ring) + i);
+	    const auto &b = *(boost::begin(ring) + (i + 1) % n);
+	    edge e = {bg::get<0>(a), bg::get<1>(a), bg::get<0>(b), bg::get<1>(b)};
+	    edges.push_back(e);
+	}
+    }
+
+public:
+    explicit prepared_polygon(const Polygon &p, size_t edges_per_band = 4): geometry(p)
+    {
+	namespace bg = boost::geometry;
+	std::vector<edge> edges;
+	collect(bg::exterior_ring(p), edges);
+	for (const auto &r: bg::interior_rings(p))
+	    collect(r, edges);
+
+	box_type b;
+	bg::envelope(p, b);
+	min_x = bg::get<bg::min_corner,0>(b); min_y = bg::get<bg::min_corner,1>(b);
+	max_x = bg::get<bg::max_corner,0>(b); max_y = bg::get<bg::max_corner,1>(b);
+	magnitude = std::max(std::max(std::fabs(min_x), std::fabs(max_x)), std::max(std::fabs(min_y), std::fabs(max_y)));
+
+	size_t n_bands = std::max<size_t>(1, edges.size() / std::max<size_t>(1, edges_per_band));
+	band_height = (max_y > min_y) ? (max_y - min_y) / n_bands : 1;
+	band_offsets.assign(n_bands + 1, 0);
+
+	// counting sort of the edges into all bands their y range touches, widened by
+	// the same tolerance locate gives the crossing tests
+	const double ty = detail::crossing_tolerance(std::max(std::fabs(min_y), std::fabs(max_y)));
+	std::vector<std::pair<size_t, size_t>> range(edges.size());
+	for (size_t j=0; j < edges.size(); j++)
+	{
+	    double lo = std::min(edges[j].y1, edges[j].y2), hi = std::max(edges[j].y1, edges[j].y2);
+	    range[j] = std::make_pair(band(lo - ty), band(hi + ty));
+	    for (size_t i = range[j].first; i <= range[j].second; i++)
+		band_offsets[i+1]++;
+	}
+	for (size_t i=0; i < n_bands; i++)
+	    band_offsets[i+1] += band_offsets[i];
+	band_edges.resize(band_offsets[n_bands]);
+	std::vector<uint32_t> fill(band_offsets.begin(), band_offsets.end() - 1);
+	for (size_t j=0; j < edges.size(); j++)
+	    for (size_t i = range[j].first; i <= range[j].second; i++)
+		band_edges[fill[i]++] = edges[j];
+    }
+
+    // 1: in the interior, 0: on the boundary, -1: in the exterior (as bg::relate sees it)
+    int locate(const point_type &p) const
+    {
+	namespace bg = boost::geometry;
+	const double px = bg::get<0>(p), py = bg::get<1>(p);
+	const double tx = detail::crossing_tolerance(std::max(std::fabs(min_x), std::fabs(max_x)));
+	const double ty = detail::crossing_tolerance(std::max(std::fabs(min_y), std::fabs(max_y)));
+	if (px < min_x - tx || px > max_x + tx || py < min_y - ty || py > max_y + ty)
+	    return -1;
+
+	size_t b = band(py);
+	bool inside = false;
+	for (uint32_t i = band_offsets[b]; i < band_offsets[b+1]; i++)
+	{
+	    const edge &e = band_edges[i];
+	    int crossing = detail::ray_crossing(e.x1, e.y1, e.x2, e.y2, px, py, tx, ty, magnitude);
+	    if (crossing < 0)
+		return slow_locate(p);
+	    if (crossing)
+		inside = !inside;
+	}
+	return inside ? 1 : -1;
+    }
+
+    bool within(const point_type &p) const {return locate(p) > 0;}
+    bool covered_by(const point_type &p) const {return locate(p) >= 0;}
+
+    const Polygon &polygon() const {return geometry;}
+    size_t edges_in_bands() const {return band_edges.size();}
+
+private:
+    int slow_locate(const point_type &p) const
+    {
+	namespace bg = boost::geometry;
+	// one pass over the polygon for both questions
+	bg::de9im::matrix m = bg::relation(p, geometry);
+	if (m.str()[0] != 'F') return 1;       // interior of p meets interior of A
+	return (m.str()[1] != 'F') ? 0 : -1;   // ... boundary of A
+    }
+};
+
+template<typename Polygon>
+prepared_polygon<Polygon> prepare(const Polygon &p)
+{
+    return prepared_polygon<Polygon>(p);
+}
+
+} // spatial
@@ -0,0 +1,187 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Range queries with exact refinement
+
+bgi::within(box) answers on the bounding boxes of the buildings. range_query
+takes the query geometry itself: a box, a circle or a polygon. The index filters
+by the envelope of the query (for within and covered_by, the box of a candidate
+must moreover lie in it), then the exact predicate decides on each candidate
+with the polygon (the predicate functors of spatial_join.hpp, called as
+predicate(building, query)). The hits go to a sink in batches, in the order in
+which the index returns the candidates.
+
+Many candidates need no polygon at all: a polygon lies in a box iff its
+envelope does, so within and covered_by a box are decided by the filter, and a
+candidate whose box lies in the query box or disc intersects it. Otherwise, for
+a circle, intersects is a distance test and within means all vertices in the disc.
+
+Above a number of candidates the refinement runs on several threads, each
+marking the hits of its own block; the sink still sees them in the same order,
+so the result does not depend on the number of threads. The candidates and the
+batch live in the scratch arena of the calling thread (arena.hpp), so the sink
+must not grow scratch containers of its own.
+*/
+#pragma once
+
+#include<vector>
+#include<cstddef>
+#include<cmath>
+#include<iterator>
+#include<algorithm>
+
+#include "types.hpp"
+#include "parallel.hpp"
+#include "spatial_join.hpp"
+#include "arena.hpp"
+
+namespace spatial{
+
+// all points within radius of center (radius in the units of the coordinates)
+struct circle
+{
+    point center;
+    double radius;
+    circle(const point &c, double r): center(c), radius(r) {}
+};
+
+struct range_stats
+{
+    size_t candidates = 0; // values passing the index filter
+    size_t matches = 0;    // values passing the predicate
+};
+
+namespace detail{
+
+inline box query_envelope(const box &q) {return q;}
+inline box query_envelope(const circle &q)
+{
+    const double x = bg::get<0>(q.center), y = bg::get<1>(q.center);
+    return box(point(x - q.radius, y - q.radius), point(x + q.radius, y + q.radius));
+}
+template<typename Geometry>
+box query_envelope(const Geometry &q)
+{
+    box b;
+    bg::envelope(q, b);
+    return b;
+}
+
+// the box of a candidate has to lie in the envelope of the query for within and covered_by
+template<typename Predicate> bool needs_containment(Predicate) {return false;}
+inline bool needs_containment(within_predicate) {return true;}
+inline bool needs_containment(covered_by_predicate) {return true;}
+
+// the values whose box intersects q: bgi::rtree, or any index with query_intersects
+template<typename Index, typename OutIter>
+void box_candidates(const Index &index, const box &q, OutIter out)
+{
+    index.query_intersects(q, out);
+}
+template<typename Value, typename Parameters, typename IndexableGetter, typename EqualTo, typename Allocator,
+	 typename OutIter>
+void box_candidates(const bgi::rtree<Value, Parameters, IndexableGetter, EqualTo, Allocator> &index, const box &q,
+		    OutIter out)
+{
+    index.query(bgi::intersects(q), out);
+}
+
+// the exact test of a building g that passed the filter with its box b
+template<typename Geometry, typename Query, typename Predicate>
+bool refine(const Geometry &g, const box &, const Query &q, Predicate predicate)
+{
+    return predicate(g, q);
+}
+template<typename Geometry>
+bool refine(const Geometry &, const box &, const box &, within_predicate) {return true;}
+template<typename Geometry>
+bool refine(const Geometry &, const box &, const box &, covered_by_predicate) {return true;}
+template<typename Geometry>
+bool refine(const Geometry &g, const box &b, const box &q, intersects_predicate)
+{
+    return bg::covered_by(b, q) || bg::intersects(g, q);
+}
+
+// the square distance of the box corner farthest from p
+inline double farthest_corner(const point &p, const box &b)
+{
+    const double dx = std::max(std::abs(bg::get<0>(p) - bg::get<bg::min_corner,0>(b)),
+			       std::abs(bg::get<0>(p) - bg::get<bg::max_corner,0>(b)));
+    const double dy = std::max(std::abs(bg::get<1>(p) - bg::get<bg::min_corner,1>(b)),
+			       std::abs(bg::get<1>(p) - bg::get<bg::max_corner,1>(b)));
+    return dx * dx + dy * dy;
+}
+template<typename Geometry>
+bool refine(const Geometry &g, const box &b, const circle &q, intersects_predicate)
+{
+    if (bg::comparable_distance(q.center, b) > q.radius * q.radius) return false;
+    if (farthest_corner(q.center, b) <= q.radius * q.radius) return true;
+    return bg::distance(q.center, g) <= q.radius;
+}
+template<typename Geometry>
+bool refine(const Geometry &g, const box &b, const circle &q, covered_by_predicate)
+{
+    if (farthest_corner(q.center, b) <= q.radius * q.radius) return true;
+    for (const auto &p: bg::exterior_ring(g))
+	if (bg::comparable_distance(q.center, p) > q.radius * q.radius) return false;
+    return true;
+}
+template<typename Geometry>
+bool refine(const Geometry &g, const box &b, const circle &q, within_predicate)
+{
+    return refine(g, b, q, covered_by_predicate());
+}
+
+} // detail
+
+// The ids (value.second, indices into polygons) of the values of index whose
+// polygon satisfies predicate(polygon, query). sink(const size_t *ids, size_t n)
+// receives the hits in batches of up to batch_size, in index order. Above
+// parallel_threshold candidates the refinement uses threads threads.
+template<typename Index, typename Polygons, typename Query, typename Predicate, typename Sink>
+range_stats range_query(const Index &index, const Polygons &polygons, const Query &query, Predicate predicate,
+			Sink sink, size_t batch_size = 4096, size_t parallel_threshold = 1 << 12,
+			unsigned threads = default_threads())
+{
+    scratch_scope scope; // the temporaries live in the scratch arena of the thread (arena.hpp)
+    const box envelope = detail::query_envelope(query);
+    const bool contained = detail::needs_containment(predicate);
+    scratch_vector<value> candidates;
+    detail::box_candidates(index, envelope, std::back_inserter(candidates));
+    if (contained)
+	candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+					[&](const value &v){ return !bg::covered_by(v.first, envelope); }),
+			 candidates.end());
+
+    range_stats stats;
+    stats.candidates = candidates.size();
+    scratch_vector<size_t> buffer;
+    buffer.reserve(batch_size);
+    auto emit = [&](size_t id){
+	buffer.push_back(id);
+	++stats.matches;
+	if (buffer.size() == batch_size){
+	    sink(buffer.data(), buffer.size());
+	    buffer.clear();
+	}
+    };
+    if (threads > 1 && candidates.size() > parallel_threshold){
+	scratch_vector<char> hit(candidates.size());
+	parallel_for(candidates.size(), 256, threads, [&](size_t b, size_t e, unsigned){
+	    for (size_t i=b; i < e; i++)
+		hit[i] = detail::refine(polygons[candidates[i].second], candidates[i].first, query, predicate);
+	});
+	for (size_t i=0; i < candidates.size(); i++)
+	    if (hit[i]) emit(candidates[i].second);
+    }else{
+	for (const auto &c: candidates)
+	    if (detail::refine(polygons[c.second], c.first, query, predicate)) emit(c.second);
+    }
+    if (!buffer.empty())
+	sink(buffer.data(), buffer.size());
+    return stats;
+}
+
+} // spatial
@@ -0,0 +1,260 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Many DE-9IM predicates from one relate pass
+
+bg::within, bg::touches, bg::overlaps, ... each compute the turns (the
+intersection points of the boundaries) of the two geometries again, and
+bg::relation computes them for the whole matrix. relate() below runs the relate
+algorithm of Boost.Geometry once with a result handler that answers a set of
+predicates together. Each predicate is one DE-9IM mask or several (any of them
+matching), e.g. covered_by is "T*F**F***" or "*TF**F***" or "**FT*F***" or
+"**F*TF***".
+
+The entries of the matrix only grow while the algorithm runs (F, 0, 1, 2), so a
+mask is false as soon as an entry exceeds what it allows, and true as soon as
+all of its T entries are set if it has no F or dimension entries (intersects).
+The handler stops the algorithm when every predicate is decided and tells it
+to skip the work for entries no open predicate looks at.
+
+relate_pairs answers the same predicates for many pairs on several threads.
+*/
+#pragma once
+
+#include<vector>
+#include<string>
+#include<cstdint>
+#include<stdexcept>
+#include<algorithm>
+
+#include <boost/geometry.hpp>
+
+#include "parallel.hpp"
+
+namespace spatial{
+
+// The named predicates, as bits of the result of relate()
+enum relation
+{
+    rel_intersects = 1 << 0,
+    rel_disjoint   = 1 << 1,
+    rel_within     = 1 << 2,
+    rel_covered_by = 1 << 3,
+    rel_contains   = 1 << 4,
+    rel_covers     = 1 << 5,
+    rel_equals     = 1 << 6,
+    rel_overlaps   = 1 << 7,
+    rel_touches    = 1 << 8,
+    rel_all        = (1 << 9) - 1
+};
+
+// The predicates to answer: the named ones in the bits of the relation enum, and
+// masks added with add(), each in the bit it returns (up to 64 in all)
+class relate_query
+{
+public:
+    static const size_t named = 9;
+
+private:
+    std::vector<std::vector<std::string>> predicates_; // the masks of each predicate
+    uint64_t cares_[9] = {};                            // per matrix entry: the predicates with a mask on it
+    uint64_t asked_ = 0;
+
+    static bool valid(const std::string &mask)
+    {
+	if (mask.size() != 9) return false;
+	for (char c: mask)
+	    if (c != 'T' && c != 'F' && c != '*' && (c < '0' || c > '2'))
+		return false;
+	return true;
+    }
+    void set(size_t i, const std::vector<std::string> &masks)
+    {
+	for (const auto &m: masks)
+	{
+	    if (!valid(m)) throw std::runtime_error("relate_query: invalid DE-9IM mask " + m);
+	    for (size_t e=0; e < 9; e++)
+		if (m[e] != '*') cares_[e] |= uint64_t(1) << i;
+	}
+	predicates_[i] = masks;
+	asked_ |= uint64_t(1) << i;
+    }
+
+public:
+    explicit relate_query(unsigned relations = 0): predicates_(named)
+    {
+	// as bg::intersects, bg::disjoint, bg::within, ... define them for areal geometries
+	const std::vector<std::string> masks[named] = {
+	    {"T********", "*T*******", "***T*****", "****T****"},
+	    {"FF*FF****"},
+	    {"T*F**F***"},
+	    {"T*F**F***", "*TF**F***", "**FT*F***", "**F*TF***"},
+	    {"T*****FF*"},
+	    {"T*****FF*", "*T****FF*", "***T**FF*", "****T*FF*"},
+	    {"T*F**FFF*"},
+	    {"T*T***T**"},
+	    {"FT*******", "F**T*****", "F***T****"}};
+	for (size_t i=0; i < named; i++)
+	    if (relations & (1u << i))
+		set(i, masks[i]);
+    }
+
+    // a predicate that holds if any of the masks matches; returns its bit in the result
+    uint64_t add(const std::vector<std::string> &masks)
+    {
+	if (predicates_.size() == 64) throw std::runtime_error("relate_query: more than 64 predicates");
+	predicates_.emplace_back();
+	set(predicates_.size() - 1, masks);
+	return uint64_t(1) << (predicates_.size() - 1);
+    }
+    uint64_t add(const std::string &mask) {return add(std::vector<std::string>(1, mask));}
+
+    size_t size() const {return predicates_.size();}
+    uint64_t asked() const {return asked_;}
+    uint64_t cares(size_t entry) const {return cares_[entry];}
+    const std::vector<std::string> &masks(size_t i) const {return predicates_[i];}
+};
+
+namespace detail{
+
+// A result handler for the relate algorithms of Boost.Geometry (the interface of
+// its mask_handler): the matrix, the decided predicates and those that hold
+class multi_mask_handler
+{
+    typedef boost::geometry::detail::relate::field field;
+
+    const relate_query &query;
+    const bool full_matrix;
+    char m[9];
+    uint64_t decided, holds = 0;
+
+    // the state of a mask now: -1 cannot match any more, 1 matches whatever comes, 0 open
+    int state(const std::string &mask) const
+    {
+	bool final = true;
+	for (size_t e=0; e < 9; e++)
+	{
+	    const char k = mask[e], c = m[e];
+	    if (k == '*') continue;
+	    if (k == 'F'){
+		if (c != 'F') return -1;
+		final = false;
+	    }else if (k == 'T'){
+		if (c == 'F') final = false;
+	    }else{ // a dimension
+		if (c != 'F' && c != 'T' && c > k) return -1;
+		if (c != k || k != '2') final = false;
+	    }
+	}
+	return final ? 1 : 0;
+    }
+    // decide the open predicates that look at entry e
+    void changed(size_t e)
+    {
+	uint64_t open = query.cares(e) & ~decided;
+	for (size_t i=0; open; i++, open >>= 1)
+	{
+	    if (!(open & 1)) continue;
+	    bool all_false = true;
+	    for (const auto &mask: query.masks(i))
+	    {
+		int s = state(mask);
+		if (s == 1){
+		    holds |= uint64_t(1) << i;
+		    decided |= uint64_t(1) << i;
+		    break;
+		}
+		all_false &= s < 0;
+	    }
+	    if (all_false) decided |= uint64_t(1) << i;
+	}
+	if (decided == ~uint64_t(0) && !full_matrix)
+	    interrupt = true;
+    }
+    static bool matches(const std::string &mask, const char *m)
+    {
+	for (size_t e=0; e < 9; e++)
+	{
+	    const char k = mask[e];
+	    if (k == '*' || (k == 'T' && m[e] != 'F') || k == m[e]) continue;
+	    return false;
+	}
+	return true;
+    }
+
+public:
+    typedef uint64_t result_type;
+    bool interrupt = false;
+
+    multi_mask_handler(const relate_query &q, bool full): query(q), full_matrix(full), decided(~q.asked())
+    {
+	std::fill(m, m + 9, 'F');
+    }
+
+    template<field F1, field F2, char D>
+    bool may_update() const
+    {
+	const char c = m[F1 * 3 + F2];
+	return (D > c || c > '9') && (full_matrix || (query.cares(F1 * 3 + F2) & ~decided));
+    }
+    template<field F1, field F2, char V>
+    void set()
+    {
+	m[F1 * 3 + F2] = V;
+	changed(F1 * 3 + F2);
+    }
+    template<field F1, field F2, char D>
+    void update()
+    {
+	const char c = m[F1 * 3 + F2];
+	if (D > c || c > '9'){
+	    m[F1 * 3 + F2] = D;
+	    changed(F1 * 3 + F2);
+	}
+    }
+
+    // the predicates that hold, once the algorithm is done
+    uint64_t result() const
+    {
+	uint64_t r = holds;
+	for (size_t i=0; i < query.size(); i++)
+	    if (!(decided & (uint64_t(1) << i)))
+		for (const auto &mask: query.masks(i))
+		    if (matches(mask, m)){
+			r |= uint64_t(1) << i;
+			break;
+		    }
+	return r;
+    }
+    std::string matrix() const {return std::string(m, 9);}
+};
+
+} // detail
+
+// The predicates of q that hold for (a, b), as bits (see relation and
+// relate_query::add). With matrix, the whole DE-9IM matrix is computed as well
+// (as bg::relation(a, b).str()), which rules out stopping early.
+template<typename G1, typename G2>
+uint64_t relate(const G1 &a, const G2 &b, const relate_query &q, std::string *matrix = nullptr)
+{
+    detail::multi_mask_handler handler(q, matrix != nullptr);
+    boost::geometry::resolve_strategy::relate::apply(a, b, handler, boost::geometry::default_strategy());
+    if (matrix) *matrix = handler.matrix();
+    return handler.result();
+}
+
+// relate(left[pairs[i].first], right[pairs[i].second], q) into out[i], for n pairs
+// (e.g. the candidates of a join) on several threads
+template<typename Left, typename Right, typename Pair>
+void relate_pairs(const Left &left, const Right &right, const Pair *pairs, size_t n, const relate_query &q,
+		  uint64_t *out, unsigned threads = default_threads())
+{
+    parallel_for(n, 256, threads, [&](size_t b, size_t e, unsigned){
+	for (size_t i=b; i < e; i++)
+	    out[i] = relate(left[pairs[i].first], right[pairs[i].second], q);
+    });
+}
+
+} // spatial
@@ -0,0 +1,338 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Buffered CSV/WKT output of query results
+
+Writing results with ofs << bg::wkt(g) << std::endl flushes the file for every
+row, and iostream formats every coordinate with the stream's precision: with the
+default 6 digits the coordinates do not survive the round trip, with digits10 (15)
+neither, and 17 digits print 0.1 as 0.10000000000000001.
+
+result_writer appends rows to a large block in memory and writes whole blocks.
+Doubles get the shortest representation that reads back to the same value
+(std::to_chars with C++17, otherwise the shortest of %.15g, %.16g and %.17g that
+survives strtod). wkt(g) writes the same text as bg::wkt for points, linestrings,
+rings, boxes, polygons and multi polygons, also for the views of polygon_store
+(except that open rings are always closed, as bg::wkt only does in polygons).
+
+write(data, n) appends raw bytes, so a result can also be written as binary
+columns (one file per column) instead of text.
+
+With background = true a thread writes the full blocks to the file, so the loop
+producing the rows does not wait for the disk; used blocks are recycled. At most
+three full blocks are queued: when the disk falls behind, handing over the next
+block waits, so the memory stays bounded. I/O errors
+are thrown as std::runtime_error from flush() and close() (the destructor closes
+as well, but cannot throw).
+*/
+#pragma once
+
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<string>
+#include<vector>
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<stdexcept>
+#include<type_traits>
+#if __cplusplus >= 201703L
+#include<charconv>
+#endif
+
+#include <boost/geometry.hpp>
+
+namespace spatial{
+
+namespace detail{
+
+// shortest text of x that reads back as x; buf needs 32 characters
+inline size_t format_double(double x, char *buf)
+{
+#if __cplusplus >= 201703L
+    return std::to_chars(buf, buf + 32, x).ptr - buf;
+#else
+    int n = 0;
+    for (int precision = 15; precision <= 17; precision++)
+    {
+	n = std::snprintf(buf, 32, "%.*g", precision, x);
+	if (std::strtod(buf, nullptr) == x) break;
+    }
+    return n;
+#endif
+}
+
+} // detail
+
+class result_writer
+{
+    static const size_t max_queued = 3;
+
+    std::FILE *file;
+    size_t block_size;
+    std::string block; // the rows not yet handed over
+
+    bool background;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::string> full; // blocks for the thread, at most max_queued
+    std::vector<std::string> spare; // written blocks for reuse
+    size_t writing; // blocks taken by the thread and not yet written
+    bool closing;
+    std::string error;
+
+    void write_block(const std::string &b, std::string &error_out)
+    {
+	if (!b.empty() && std::fwrite(b.data(), 1, b.size(), file) != b.size() && error_out.empty())
+	    error_out = "result_writer: write failed";
+    }
+
+    void run()
+    {
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+	    cv.wait(lock, [this](){ return closing || !full.empty(); });
+	    if (full.empty()) return; // closing and nothing left
+	    std::string b;
+	    b.swap(full.front());
+	    full.pop_front();
+	    ++writing;
+	    lock.unlock();
+	    std::string e;
+	    write_block(b, e);
+	    lock.lock();
+	    --writing;
+	    if (!e.empty() && error.empty()) error = e;
+	    b.clear();
+	    spare.push_back(std::move(b));
+	    cv.notify_all();
+	}
+    }
+
+    // hands the current block over (background) or writes it
+    void hand_over()
+    {
+	if (block.empty()) return;
+	if (!background){
+	    std::string e;
+	    write_block(block, e);
+	    block.clear();
+	    if (!e.empty()) throw std::runtime_error(e);
+	    return;
+	}
+	std::string next;
+	{
+	    // a disk slower than the rows waits here instead of queueing without bound
+	    std::unique_lock<std::mutex> lock(mutex);
+	    cv.wait(lock, [this](){ return full.size() < max_queued; });
+	    full.push_back(std::move(block));
+	    if (!spare.empty()){
+		next.swap(spare.back());
+		spare.pop_back();
+	    }
+	}
+	cv.notify_all();
+	block.swap(next);
+	block.clear();
+	block.reserve(block_size);
+    }
+
+    void append(const char *s, size_t n)
+    {
+	block.append(s, n);
+	if (block.size() >= block_size) hand_over();
+    }
+
+    template<typename Point>
+    void coordinates(const Point &p)
+    {
+	*this << boost::geometry::get<0>(p) << ' ' << boost::geometry::get<1>(p);
+    }
+    template<typename Range>
+    void points(const Range &r, bool close)
+    {
+	*this << '(';
+	bool first = true;
+	for (auto it = boost::begin(r); it != boost::end(r); ++it, first = false)
+	{
+	    if (!first) *this << ',';
+	    coordinates(*it);
+	}
+	if (close && boost::begin(r) != boost::end(r)){
+	    *this << ',';
+	    coordinates(*boost::begin(r));
+	}
+	*this << ')';
+    }
+    template<typename Ring>
+    void ring(const Ring &r)
+    {
+	points(r, boost::geometry::closure<Ring>::value == boost::geometry::open);
+    }
+    template<typename Polygon>
+    void polygon_body(const Polygon &p)
+    {
+	*this << '(';
+	ring(boost::geometry::exterior_ring(p));
+	const auto &inners = boost::geometry::interior_rings(p);
+	for (auto it = boost::begin(inners); it != boost::end(inners); ++it)
+	{
+	    *this << ',';
+	    ring(*it);
+	}
+	*this << ')';
+    }
+
+    template<typename G> void wkt(const G &g, boost::geometry::point_tag)
+    {
+	*this << "POINT(";
+	coordinates(g);
+	*this << ')';
+    }
+    template<typename G> void wkt(const G &g, boost::geometry::linestring_tag)
+    {
+	*this << "LINESTRING";
+	points(g, false);
+    }
+    template<typename G> void wkt(const G &g, boost::geometry::ring_tag)
+    {
+	*this << "POLYGON(";
+	ring(g);
+	*this << ')';
+    }
+    template<typename G> void wkt(const G &g, boost::geometry::box_tag)
+    {
+	namespace bg = boost::geometry;
+	double x1 = bg::get<bg::min_corner, 0>(g), y1 = bg::get<bg::min_corner, 1>(g);
+	double x2 = bg::get<bg::max_corner, 0>(g), y2 = bg::get<bg::max_corner, 1>(g);
+	*this << "POLYGON((" << x1 << ' ' << y1 << ',' << x1 << ' ' << y2 << ',' << x2 << ' ' << y2 << ','
+	      << x2 << ' ' << y1 << ',' << x1 << ' ' << y1 << "))";
+    }
+    template<typename G> void wkt(const G &g, boost::geometry::polygon_tag)
+    {
+	*this << "POLYGON";
+	polygon_body(g);
+    }
+    template<typename G> void wkt(const G &g, boost::geometry::multi_polygon_tag)
+    {
+	*this << "MULTIPOLYGON(";
+	bool first = true;
+	for (auto it = boost::begin(g); it != boost::end(g); ++it, first = false)
+	{
+	    if (!first) *this << ',';
+	    polygon_body(*it);
+	}
+	*this << ')';
+    }
+
+public:
+    // block_size is the size of the blocks written at once
+    explicit result_writer(const std::string &filename, bool background = false, size_t block_size = 1 << 20)
+	: file(std::fopen(filename.c_str(), "wb")), block_size(block_size), background(background),
+	  writing(0), closing(false)
+    {
+	if (!file)
+	    throw std::runtime_error("result_writer: cannot open " + filename);
+	std::setvbuf(file, nullptr, _IONBF, 0); // the blocks are our buffer
+	block.reserve(block_size);
+	if (background)
+	    thread = std::thread([this](){ run(); });
+    }
+    result_writer(const result_writer &) = delete;
+    result_writer &operator=(const result_writer &) = delete;
+
+    ~result_writer()
+    {
+	try{
+	    close();
+	}catch(...){
+	}
+    }
+
+    result_writer &operator<<(const char *s) {append(s, std::strlen(s)); return *this;}
+    result_writer &operator<<(const std::string &s) {append(s.data(), s.size()); return *this;}
+    result_writer &operator<<(char c) {append(&c, 1); return *this;}
+    result_writer &operator<<(double x)
+    {
+	char buf[32];
+	append(buf, detail::format_double(x, buf));
+	return *this;
+    }
+    template<typename Integer>
+    typename std::enable_if<std::is_integral<Integer>::value, result_writer &>::type operator<<(Integer i)
+    {
+	char buf[24];
+	char *end = buf + sizeof(buf), *p = end;
+	typename std::make_unsigned<Integer>::type u = i;
+	bool negative = i < 0;
+	if (negative) u = 0 - u;
+	do { *--p = static_cast<char>('0' + u % 10); u /= 10; } while (u);
+	if (negative) *--p = '-';
+	append(p, end - p);
+	return *this;
+    }
+
+    // n raw bytes, e.g. a column of numbers in binary
+    result_writer &write(const void *data, size_t n)
+    {
+	append(static_cast<const char *>(data), n);
+	return *this;
+    }
+
+    // the well-known text of g, as bg::wkt(g)
+    template<typename Geometry>
+    result_writer &wkt(const Geometry &g)
+    {
+	wkt(g, typename boost::geometry::tag<Geometry>::type());
+	return *this;
+    }
+
+    // writes everything so far (waits for the background thread)
+    void flush()
+    {
+	if (!file) return;
+	hand_over();
+	if (background){
+	    std::unique_lock<std::mutex> lock(mutex);
+	    cv.wait(lock, [this](){ return full.empty() && writing == 0; });
+	}
+	std::string e;
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    e.swap(error);
+	}
+	if (std::fflush(file) != 0 && e.empty()) e = "result_writer: flush failed";
+	if (!e.empty()) throw std::runtime_error(e);
+    }
+
+    void close()
+    {
+	if (!file) return;
+	std::string e;
+	try{
+	    hand_over();
+	}catch(const std::exception &x){
+	    e = x.what();
+	}
+	if (background){
+	    {
+		std::lock_guard<std::mutex> lock(mutex);
+		closing = true;
+	    }
+	    cv.notify_all();
+	    thread.join();
+	    if (e.empty()) e = error;
+	}
+	if (std::fclose(file) != 0 && e.empty()) e = "result_writer: close failed";
+	file = nullptr;
+	if (!e.empty()) throw std::runtime_error(e);
+    }
+};
+
+} // spatial
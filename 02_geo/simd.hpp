@@ -0,0 +1,54 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Runtime choice of the SIMD instruction set
+
+The vectorized kernels (distance_kernels.hpp, haversine.hpp) come in AVX2 and
+AVX-512 versions, compiled with GCC's target attribute, and a portable loop. The
+best version the CPU supports is chosen when the program runs, so the programs
+do not have to be compiled with -march=native.
+*/
+#pragma once
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPATIAL_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace spatial{
+
+enum simd_level {simd_scalar, simd_avx2, simd_avx512};
+
+inline const char *simd_level_name(simd_level level)
+{
+    switch (level){
+	case simd_avx2: return "avx2";
+	case simd_avx512: return "avx512";
+	default: return "scalar";
+    }
+}
+
+namespace detail{
+
+inline simd_level detect_simd_level()
+{
+#ifdef SPATIAL_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return simd_avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return simd_avx2;
+#endif
+    return simd_scalar;
+}
+
+} // detail
+
+// The best level this CPU supports, determined once
+inline simd_level best_simd_level()
+{
+    static const simd_level level = detail::detect_simd_level();
+    return level;
+}
+
+} // spatial
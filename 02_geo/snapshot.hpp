@@ -0,0 +1,450 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Binary snapshot of the polygon dataset and its bulk-loaded R-tree
+
+Layout (version 2, native endianness, every section 64-byte aligned):
+   header
+   ids            [n_polygons]     uint64  osm id of each polygon
+   polygon_rings  [n_polygons+1]   uint64  first ring of each polygon (exterior first)
+   ring_points    [n_rings+1]      uint64  first point of each ring
+   coords         [2*n_points]     double  x,y interleaved, rings are open as in memory
+   envelopes      [4*n_polygons]   double  min x, min y, max x, max y of each polygon
+   nodes          [n_nodes]                R-tree nodes in breadth-first order, root first
+   entries        [n_entries]              leaf values (box, index into the polygons)
+
+The polygon sections are exactly the arrays of a polygon_store, so a snapshot
+hands out the same Boost.Geometry polygon views as the in-memory store, with the
+envelopes computed once at ingest (version 1 files lacked them and are rejected).
+Children of a node are contiguous: an internal node references [first, first+count)
+in nodes, a leaf references [first, first+count) in entries. The reader maps the
+file and queries it in place: opening a snapshot parses nothing and allocates
+nothing, but it does read the offset tables, the nodes and the entries once to
+validate them, so that a corrupt file cannot send a query out of the mapping.
+*/
+#pragma once
+
+#include<string>
+#include<vector>
+#include<deque>
+#include<queue>
+#include<fstream>
+#include<stdexcept>
+#include<cstdint>
+#include<cstring>
+#include<cmath>
+#include<mutex>
+
+#include <boost/geometry/index/detail/rtree/utilities/view.hpp>
+
+#include "types.hpp"
+#include "wkt_loader.hpp" // mapped_file
+#include "polygon_store.hpp"
+#include "knn.hpp"
+
+namespace spatial{
+
+const uint32_t snapshot_version = 2;
+const char snapshot_magic[8] = {'G','I','S','+','+','S','N','P'};
+
+struct snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t n_polygons, n_rings, n_points, n_nodes, n_entries;
+    double bounds[4];
+    uint64_t off_ids, off_polygon_rings, off_ring_points, off_coords, off_nodes, off_entries;
+    uint64_t off_envelopes;
+};
+
+struct snapshot_node
+{
+    double box[4];  // min x, min y, max x, max y
+    uint32_t first; // first child node or first entry
+    uint32_t count;
+    uint32_t leaf;
+    uint32_t padding;
+};
+
+// the envelopes section is read in place as boxes
+static_assert(sizeof(box) == 4 * sizeof(double), "box must be four packed doubles");
+
+struct snapshot_entry
+{
+    double box[4];
+    uint64_t index; // position in the polygon arrays (= position in dataset)
+};
+
+
+namespace detail{
+
+inline void to_array(const box &b, double *a)
+{
+    a[0] = bg::get<bg::min_corner,0>(b); a[1] = bg::get<bg::min_corner,1>(b);
+    a[2] = bg::get<bg::max_corner,0>(b); a[3] = bg::get<bg::max_corner,1>(b);
+}
+
+inline box from_array(const double *a)
+{
+    return box(point(a[0],a[1]), point(a[2],a[3]));
+}
+
+// Visits the nodes of a bgi::rtree and appends them breadth-first
+template<typename MembersHolder>
+struct flatten_visitor : public MembersHolder::visitor_const
+{
+    typedef typename MembersHolder::internal_node internal_node;
+    typedef typename MembersHolder::leaf leaf;
+    typedef typename MembersHolder::node_pointer node_pointer;
+
+    std::vector<snapshot_node> nodes;
+    std::vector<snapshot_entry> entries;
+    std::deque<std::pair<node_pointer, size_t>> pending; // (node, its slot in nodes)
+    size_t current = 0;
+
+    void operator()(internal_node const &n)
+    {
+	const auto &elements = bgi::detail::rtree::elements(n);
+	nodes[current].first = static_cast<uint32_t>(nodes.size());
+	nodes[current].count = static_cast<uint32_t>(elements.size());
+	nodes[current].leaf = 0;
+	for (const auto &e: elements)
+	{
+	    snapshot_node child = snapshot_node();
+	    to_array(e.first, child.box);
+	    pending.push_back(std::make_pair(e.second, nodes.size()));
+	    nodes.push_back(child);
+	}
+    }
+
+    void operator()(leaf const &n)
+    {
+	const auto &elements = bgi::detail::rtree::elements(n);
+	nodes[current].first = static_cast<uint32_t>(entries.size());
+	nodes[current].count = static_cast<uint32_t>(elements.size());
+	nodes[current].leaf = 1;
+	for (const auto &v: elements)
+	{
+	    snapshot_entry e;
+	    to_array(v.first, e.box);
+	    e.index = v.second;
+	    entries.push_back(e);
+	}
+    }
+};
+
+inline uint64_t align64(uint64_t offset) {return (offset + 63) & ~uint64_t(63);}
+
+template<typename T>
+void write_section(std::ofstream &ofs, uint64_t offset, const T *data, size_t count)
+{
+    ofs.seekp(offset);
+    ofs.write(reinterpret_cast<const char *>(data), count * sizeof(T));
+}
+
+inline double box_distance(const double *b, double x, double y)
+{
+    double dx = (x < b[0]) ? b[0] - x : (x > b[2] ? x - b[2] : 0);
+    double dy = (y < b[1]) ? b[1] - y : (y > b[3] ? y - b[3] : 0);
+    return dx*dx + dy*dy; // comparable distance
+}
+
+} // detail
+
+
+// Write the polygons together with the node layout of a packed R-tree whose values
+// are (box, index into the polygons). The polygon sections are the arrays of the store.
+template<typename Rtree>
+void write_snapshot(const std::string &filename, const polygon_store_view &polygons, const Rtree &rt)
+{
+    typedef bgi::detail::rtree::utilities::view<Rtree> view_type;
+    view_type view(rt);
+    detail::flatten_visitor<typename view_type::members_holder> flat;
+    snapshot_node root = snapshot_node();
+    detail::to_array(rt.bounds(), root.box);
+    flat.nodes.push_back(root);
+    view.apply_visitor(flat);
+    while (!flat.pending.empty())
+    {
+	flat.current = flat.pending.front().second;
+	bgi::detail::rtree::apply_visitor(flat, *flat.pending.front().first);
+	flat.pending.pop_front();
+    }
+
+    snapshot_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, snapshot_magic, sizeof(h.magic));
+    h.version = snapshot_version;
+    h.header_size = sizeof(h);
+    h.n_polygons = polygons.size();
+    h.n_rings = polygons.num_rings();
+    h.n_points = polygons.num_points();
+    h.n_nodes = flat.nodes.size();
+    h.n_entries = flat.entries.size();
+    std::memcpy(h.bounds, root.box, sizeof(h.bounds));
+    h.off_ids = detail::align64(sizeof(h));
+    h.off_polygon_rings = detail::align64(h.off_ids + h.n_polygons * sizeof(uint64_t));
+    h.off_ring_points = detail::align64(h.off_polygon_rings + (h.n_polygons + 1) * sizeof(uint64_t));
+    h.off_coords = detail::align64(h.off_ring_points + (h.n_rings + 1) * sizeof(uint64_t));
+    h.off_envelopes = detail::align64(h.off_coords + 2 * h.n_points * sizeof(double));
+    h.off_nodes = detail::align64(h.off_envelopes + h.n_polygons * sizeof(box));
+    h.off_entries = detail::align64(h.off_nodes + flat.nodes.size() * sizeof(snapshot_node));
+
+    std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+    if (!ofs)
+	throw std::runtime_error("Cannot write " + filename);
+    ofs.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    // an empty store has no arrays yet, but its offsets are implicitly {0}
+    const uint64_t zero = 0;
+    detail::write_section(ofs, h.off_ids, polygons.ids(), h.n_polygons);
+    detail::write_section(ofs, h.off_polygon_rings, h.n_polygons ? polygons.polygon_offsets() : &zero, h.n_polygons + 1);
+    detail::write_section(ofs, h.off_ring_points, h.n_rings ? polygons.ring_offsets() : &zero, h.n_rings + 1);
+    detail::write_section(ofs, h.off_coords, reinterpret_cast<const double *>(polygons.points()), 2 * h.n_points);
+    detail::write_section(ofs, h.off_envelopes, reinterpret_cast<const double *>(polygons.envelopes()), 4 * h.n_polygons);
+    detail::write_section(ofs, h.off_nodes, flat.nodes.data(), flat.nodes.size());
+    detail::write_section(ofs, h.off_entries, flat.entries.data(), flat.entries.size());
+    if (!ofs)
+	throw std::runtime_error("Writing " + filename + " failed");
+}
+
+// the same for a vector of (polygon, osm_id) pairs
+template<typename Polygon, typename Rtree>
+void write_snapshot(const std::string &filename, const std::vector<std::pair<Polygon, size_t>> &dataset, const Rtree &rt)
+{
+    polygon_store store;
+    for (const auto &d: dataset)
+	store.push_back(d.first, d.second);
+    write_snapshot(filename, store, rt);
+}
+
+
+namespace detail{ struct snapshot_walk; }
+
+// Read-only view of a snapshot file, queried directly on the mapping
+class snapshot
+{
+    mapped_file file;
+    const snapshot_header *h;
+    const uint64_t *ids, *polygon_rings, *ring_points;
+    const double *coords;
+    const box *envelopes;
+    const snapshot_node *nodes;
+    const snapshot_entry *entries;
+    mutable std::vector<ring_view> rings;
+    mutable polygon_store_view store;
+    mutable std::once_flag rings_built;
+
+    template<typename T>
+    const T *section(uint64_t offset, uint64_t count) const
+    {
+	if (count == 0)
+	    return nullptr;
+	if (offset % alignof(T) != 0 || offset > file.size() || count > (file.size() - offset) / sizeof(T))
+	    throw std::runtime_error("Snapshot: section out of range");
+	return reinterpret_cast<const T *>(file.begin() + offset);
+    }
+
+public:
+    explicit snapshot(const std::string &filename): file(filename)
+    {
+	if (file.size() < sizeof(snapshot_header))
+	    throw std::runtime_error("Snapshot: file too small");
+	h = reinterpret_cast<const snapshot_header *>(file.begin());
+	if (std::memcmp(h->magic, snapshot_magic, sizeof(h->magic)) != 0)
+	    throw std::runtime_error("Snapshot: bad magic, not a snapshot file");
+	if (h->version != snapshot_version || h->header_size != sizeof(snapshot_header))
+	    throw std::runtime_error("Snapshot: unsupported version " + std::to_string(h->version));
+	if (h->n_polygons > file.size() || h->n_rings > file.size() || h->n_points > file.size())
+	    throw std::runtime_error("Snapshot: section out of range");
+	ids = section<uint64_t>(h->off_ids, h->n_polygons);
+	polygon_rings = section<uint64_t>(h->off_polygon_rings, h->n_polygons + 1);
+	ring_points = section<uint64_t>(h->off_ring_points, h->n_rings + 1);
+	coords = section<double>(h->off_coords, 2 * h->n_points);
+	envelopes = section<box>(h->off_envelopes, h->n_polygons);
+	nodes = section<snapshot_node>(h->off_nodes, h->n_nodes);
+	entries = section<snapshot_entry>(h->off_entries, h->n_entries);
+	// the offset tables run from 0 to the number of rings and points; every polygon
+	// has its exterior ring, rings may be empty
+	if (polygon_rings[0] != 0 || polygon_rings[h->n_polygons] != h->n_rings)
+	    throw std::runtime_error("Snapshot: corrupt polygon table");
+	for (uint64_t i=0; i < h->n_polygons; i++)
+	    if (polygon_rings[i+1] <= polygon_rings[i])
+		throw std::runtime_error("Snapshot: corrupt polygon " + std::to_string(i));
+	if (ring_points[0] != 0 || ring_points[h->n_rings] != h->n_points)
+	    throw std::runtime_error("Snapshot: corrupt ring table");
+	for (uint64_t r=0; r < h->n_rings; r++)
+	    if (ring_points[r+1] < ring_points[r])
+		throw std::runtime_error("Snapshot: corrupt ring " + std::to_string(r));
+	if (h->n_nodes == 0)
+	    throw std::runtime_error("Snapshot: no root node");
+	for (uint64_t i=0; i < h->n_nodes; i++)
+	{
+	    uint64_t limit = nodes[i].leaf ? h->n_entries : h->n_nodes;
+	    if (uint64_t(nodes[i].first) + nodes[i].count > limit || (!nodes[i].leaf && nodes[i].first <= i))
+		throw std::runtime_error("Snapshot: corrupt node " + std::to_string(i));
+	}
+	for (uint64_t i=0; i < h->n_entries; i++)
+	    if (entries[i].index >= h->n_polygons)
+		throw std::runtime_error("Snapshot: corrupt entry " + std::to_string(i));
+	// queries are served from disk, random access from here on
+	::madvise(const_cast<char *>(file.begin()), file.size(), MADV_RANDOM);
+    }
+
+    size_t size() const {return h->n_polygons;}
+    size_t id(size_t i) const {return ids[i];}
+    box bounds() const {return detail::from_array(h->bounds);}
+
+    // The polygons, read in place from the mapping (coordinates and envelopes). Only
+    // the ring table the views need is built, on first use, so opening stays cheap
+    // for box-only queries.
+    const polygon_store_view &polygons() const
+    {
+	std::call_once(rings_built, [this](){
+	    make_ring_table(reinterpret_cast<const point *>(coords), ring_points, h->n_rings, rings);
+	    store = polygon_store_view(reinterpret_cast<const point *>(coords), rings.data(), ring_points,
+				       polygon_rings, ids, envelopes, h->n_polygons);
+	});
+	return store;
+    }
+
+    // all values whose box is within q (same semantics as bgi::within)
+    template<typename OutIter>
+    OutIter query_within(const box &q, OutIter out) const
+    {
+	return spatial_query(q, true, out);
+    }
+
+    // all values whose box intersects q (same semantics as bgi::intersects)
+    template<typename OutIter>
+    OutIter query_intersects(const box &q, OutIter out) const
+    {
+	return spatial_query(q, false, out);
+    }
+
+    // k values with the nearest boxes, best-first, written in increasing distance
+    // (for the nearest polygons see knn_exact below)
+    template<typename OutIter>
+    OutIter query_nearest(const point &p, size_t k, OutIter out) const
+    {
+	const double x = bg::get<0>(p), y = bg::get<1>(p);
+	// (distance, index), index < n_nodes for nodes, n_nodes + e for entries
+	typedef std::pair<double, uint64_t> item;
+	std::priority_queue<item, std::vector<item>, std::greater<item>> queue;
+	queue.push(item(detail::box_distance(nodes[0].box, x, y), 0));
+	size_t found = 0;
+	while (!queue.empty() && found < k)
+	{
+	    uint64_t i = queue.top().second;
+	    queue.pop();
+	    if (i >= h->n_nodes){
+		const snapshot_entry &e = entries[i - h->n_nodes];
+		*out++ = value(detail::from_array(e.box), e.index);
+		++found;
+		continue;
+	    }
+	    const snapshot_node &n = nodes[i];
+	    for (uint32_t c = n.first; c < n.first + n.count; c++)
+	    {
+		if (n.leaf)
+		    queue.push(item(detail::box_distance(entries[c].box, x, y), h->n_nodes + c));
+		else
+		    queue.push(item(detail::box_distance(nodes[c].box, x, y), c));
+	    }
+	}
+	return out;
+    }
+
+private:
+    friend struct detail::snapshot_walk;
+
+    template<typename OutIter>
+    OutIter spatial_query(const box &q, bool within, OutIter out) const
+    {
+	double qb[4];
+	detail::to_array(q, qb);
+	auto intersects = [&](const double *b){
+	    return b[0] <= qb[2] && b[2] >= qb[0] && b[1] <= qb[3] && b[3] >= qb[1];
+	};
+	std::vector<uint32_t> stack(1, 0);
+	while (!stack.empty())
+	{
+	    const snapshot_node &n = nodes[stack.back()];
+	    stack.pop_back();
+	    for (uint32_t c = n.first; c < n.first + n.count; c++)
+	    {
+		if (!n.leaf){
+		    if (intersects(nodes[c].box)) stack.push_back(c);
+		    continue;
+		}
+		const double *b = entries[c].box;
+		// as bgi::within: a degenerate box is within nothing
+		bool hit = within ? (b[0] >= qb[0] && b[2] <= qb[2] && b[0] < b[2]
+				     && b[1] >= qb[1] && b[3] <= qb[3] && b[1] < b[3])
+		                  : intersects(b);
+		if (hit)
+		    *out++ = value(detail::from_array(b), entries[c].index);
+	    }
+	}
+	return out;
+    }
+};
+
+namespace detail{
+
+// The walk of best_first_knn (knn.hpp) over the mapped nodes, by box distance
+struct snapshot_walk
+{
+    // (comparable box distance, index), index < n_nodes for nodes, n_nodes + e for entries
+    typedef std::pair<double, uint64_t> item;
+    const snapshot &snap;
+    double x, y;
+    std::priority_queue<item, scratch_vector<item>, std::greater<item>> queue;
+
+    snapshot_walk(const snapshot &s, const point &p): snap(s), x(bg::get<0>(p)), y(bg::get<1>(p))
+    {
+	queue.push(item(box_distance(snap.nodes[0].box, x, y), 0));
+    }
+    bool next(double &distance) const
+    {
+	if (queue.empty()) return false;
+	distance = queue.top().first;
+	return true;
+    }
+    bool pop(size_t &index)
+    {
+	const uint64_t i = queue.top().second, n_nodes = snap.h->n_nodes;
+	queue.pop();
+	if (i >= n_nodes){
+	    index = snap.entries[i - n_nodes].index;
+	    return true;
+	}
+	const snapshot_node &n = snap.nodes[i];
+	for (uint32_t c = n.first; c < n.first + n.count; c++)
+	{
+	    if (n.leaf)
+		queue.push(item(box_distance(snap.entries[c].box, x, y), n_nodes + c));
+	    else
+		queue.push(item(box_distance(snap.nodes[c].box, x, y), c));
+	}
+	return false;
+    }
+};
+
+} // detail
+
+// The k polygons nearest to p, as knn_exact (knn.hpp) finds them in a bgi::rtree:
+// the same search and refinement, walking the mapped nodes. Same order, ties and
+// return value.
+template<typename OutIter>
+size_t knn_exact(const snapshot &snap, const point &p, size_t k, OutIter out)
+{
+    if (k == 0 || snap.size() == 0) return 0;
+    scratch_scope scope;
+    detail::snapshot_walk walk(snap, p);
+    return detail::best_first_knn(walk, snap.polygons(), p, k, out);
+}
+
+} // spatial
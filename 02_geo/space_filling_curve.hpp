@@ -0,0 +1,76 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Space-filling curves (Morton / Z-order and Hilbert)
+
+Points are quantized to a 2^16 x 2^16 grid over a reference box and mapped to a
+32 bit key. Sorting by key puts points that are close in space close in memory;
+the Hilbert curve does so without the long jumps of the Z-order.
+*/
+#pragma once
+
+#include<cstdint>
+#include<algorithm>
+
+#include "types.hpp"
+
+namespace spatial{
+
+// quantize a coordinate into [0, 2^16) relative to [lo, hi]
+inline uint32_t quantize16(double v, double lo, double hi)
+{
+    if (!(hi > lo)) return 0;
+    double t = (v - lo) / (hi - lo) * 65535.0;
+    return static_cast<uint32_t>(std::min(65535.0, std::max(0.0, t)));
+}
+
+// interleave the bits of x and y: x in the even, y in the odd bits
+inline uint32_t morton_key(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint32_t v){
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// position of (x,y) along the Hilbert curve of order 16
+inline uint32_t hilbert_key(uint32_t x, uint32_t y)
+{
+    uint32_t d = 0;
+    for (uint32_t s = 1u << 15; s > 0; s >>= 1)
+    {
+	uint32_t rx = (x & s) ? 1 : 0;
+	uint32_t ry = (y & s) ? 1 : 0;
+	d += s * s * ((3 * rx) ^ ry);
+	// rotate the quadrant
+	if (ry == 0){
+	    if (rx == 1){
+		x = 65535 - x;
+		y = 65535 - y;
+	    }
+	    std::swap(x, y);
+	}
+    }
+    return d;
+}
+
+inline uint32_t hilbert_key(const point &p, const box &extent)
+{
+    return hilbert_key(quantize16(bg::get<0>(p), bg::get<bg::min_corner,0>(extent), bg::get<bg::max_corner,0>(extent)),
+		       quantize16(bg::get<1>(p), bg::get<bg::min_corner,1>(extent), bg::get<bg::max_corner,1>(extent)));
+}
+
+inline uint32_t morton_key(const point &p, const box &extent)
+{
+    return morton_key(quantize16(bg::get<0>(p), bg::get<bg::min_corner,0>(extent), bg::get<bg::max_corner,0>(extent)),
+		      quantize16(bg::get<1>(p), bg::get<bg::min_corner,1>(extent), bg::get<bg::max_corner,1>(extent)));
+}
+
+} // spatial
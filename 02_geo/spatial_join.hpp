@@ -0,0 +1,139 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Parallel spatial join of two polygon layers
+
+Filter and refine: every polygon of the left layer asks the R-tree of the right
+layer for the boxes intersecting its own box (filter), then the exact predicate
+decides on each candidate pair (refine). The left layer is cut into blocks that
+the threads take in turn; every thread refines its own candidates and collects
+the matches in a small buffer which is handed to the sink when full. So neither
+the candidate pairs nor the result are ever materialized as a whole.
+
+The box filter is only valid for predicates that imply intersecting boxes, which
+holds for all the usual ones (intersects, within, covered_by, contains, overlaps,
+touches, equals) and for DE-9IM masks that require some intersection (e.g.
+"T********"); disjoint cannot be joined this way.
+*/
+#pragma once
+
+#include<vector>
+#include<mutex>
+#include<algorithm>
+#include<utility>
+
+#include "types.hpp"
+#include "parallel.hpp"
+#include "polygon_store.hpp"
+
+namespace spatial{
+
+typedef std::pair<size_t, size_t> join_pair; // (index left, index right)
+
+// The predicates of 02_simplefeatures.cpp as functors for the join
+struct intersects_predicate
+{
+    template<typename G1, typename G2>
+    bool operator()(const G1 &a, const G2 &b) const {return bg::intersects(a,b);}
+};
+struct within_predicate
+{
+    template<typename G1, typename G2>
+    bool operator()(const G1 &a, const G2 &b) const {return bg::within(a,b);}
+};
+struct covered_by_predicate
+{
+    template<typename G1, typename G2>
+    bool operator()(const G1 &a, const G2 &b) const {return bg::covered_by(a,b);}
+};
+struct overlaps_predicate
+{
+    template<typename G1, typename G2>
+    bool operator()(const G1 &a, const G2 &b) const {return bg::overlaps(a,b);}
+};
+struct touches_predicate
+{
+    template<typename G1, typename G2>
+    bool operator()(const G1 &a, const G2 &b) const {return bg::touches(a,b);}
+};
+struct equals_predicate
+{
+    template<typename G1, typename G2>
+    bool operator()(const G1 &a, const G2 &b) const {return bg::equals(a,b);}
+};
+// any DE-9IM mask, e.g. relate_predicate(bg::de9im::mask("T*F**F***")) for within
+struct relate_predicate
+{
+    bg::de9im::mask mask;
+    explicit relate_predicate(const bg::de9im::mask &m): mask(m) {}
+    template<typename G1, typename G2>
+    bool operator()(const G1 &a, const G2 &b) const {return bg::relate(a,b,mask);}
+};
+
+struct join_stats
+{
+    size_t candidates = 0; // pairs passing the box filter
+    size_t matches = 0;    // pairs passing the predicate
+};
+
+// Join left x right. right_tree indexes right as (box, index into right).
+// sink(const join_pair *pairs, size_t n) receives the matches in batches; calls to
+// the sink are serialized, the order of the pairs depends on the thread schedule.
+template<typename Left, typename Right, typename Rtree, typename Predicate, typename Sink>
+join_stats spatial_join(const Left &left, const Right &right, const Rtree &right_tree,
+			Predicate predicate, Sink sink, unsigned threads = default_threads(),
+			size_t batch_size = 4096)
+{
+    std::mutex sink_mutex;
+    // one buffer per thread, kept across the blocks it takes: the sink sees batches
+    // of batch_size pairs, only the last batch of each thread is shorter
+    struct worker
+    {
+	std::vector<join_pair> buffer;
+	std::vector<value> hits;
+	size_t candidates = 0, matches = 0;
+    };
+    std::vector<worker> workers(std::max(1u, std::min(threads, max_threads)));
+    auto flush = [&](std::vector<join_pair> &buffer){
+	if (buffer.empty()) return;
+	std::lock_guard<std::mutex> lock(sink_mutex);
+	sink(buffer.data(), buffer.size());
+	buffer.clear();
+    };
+
+    parallel_for(left.size(), 64, threads, [&](size_t b, size_t e, unsigned t){
+	worker &w = workers[t];
+	if (w.buffer.capacity() < batch_size)
+	    w.buffer.reserve(batch_size);
+	for (size_t i=b; i < e; i++)
+	{
+	    const auto &a = left[i];
+	    const box mbr = polygon_envelope(left, i);
+	    w.hits.clear();
+	    right_tree.query(bgi::intersects(mbr), std::back_inserter(w.hits));
+	    w.candidates += w.hits.size();
+	    for (const auto &h: w.hits)
+	    {
+		if (!predicate(a, right[h.second]))
+		    continue;
+		w.buffer.push_back(join_pair(i, h.second));
+		++w.matches;
+		if (w.buffer.size() >= batch_size)
+		    flush(w.buffer);
+	    }
+	}
+    });
+
+    join_stats stats;
+    for (auto &w: workers)
+    {
+	flush(w.buffer);
+	stats.candidates += w.candidates;
+	stats.matches += w.matches;
+    }
+    return stats;
+}
+
+} // spatial
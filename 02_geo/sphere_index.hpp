@@ -0,0 +1,123 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: A point index for the whole globe, in great-circle distances
+
+The R-trees of the other programs index lon/lat degrees as if they were planar.
+This is fine for a city, but one degree of longitude shrinks with the cosine of
+the latitude, the neighbors of a point near the poles or next to the antimeridian
+can be on the "other side" of the plane, and a box of 0.03 degrees is not the
+same distance everywhere.
+
+On the unit sphere the straight 3D distance (the chord, or "drill hole" of
+01_sphere.cpp) of two points is c = 2 sin(d/2) for their central angle d, so it
+grows with the great-circle distance: the k nearest points by chord are the k
+nearest by great-circle distance, and a great-circle radius d is the chord
+radius 2 sin(d/2). So we put the unit vectors (sphere_transform.hpp) into an
+ordinary 3D R-tree and translate the distances at the border. There are no seams
+and no singular points, and a query costs about as much as a planar one.
+*/
+#pragma once
+
+#include<vector>
+#include<cmath>
+#include<algorithm>
+#include<iterator>
+
+#include <boost/function_output_iterator.hpp>
+
+#include "types.hpp"
+#include "knn.hpp"              // neighbor
+#include "sphere_transform.hpp"
+
+namespace spatial{
+
+typedef bg::model::point<double, 3, bg::cs::cartesian> unit_vector;
+typedef std::pair<unit_vector, size_t> sphere_value;
+
+class sphere_index
+{
+public:
+    typedef bgi::rtree<sphere_value, bgi::rstar<16, 4>> rtree_type;
+
+private:
+    rtree_type rt;
+    double radius;
+    simd_level level; // of the transform: queries map to the same bits as the points
+
+    unit_vector to_xyz(double lon, double lat) const
+    {
+	double x, y, z;
+	spherical_to_xyz(&lon, &lat, 1, &x, &y, &z, level, 1);
+	return unit_vector(x, y, z);
+    }
+    double chord_to_distance(double chord) const
+    {
+	return 2 * std::asin(std::min(chord / 2, 1.0)) * radius;
+    }
+
+public:
+    sphere_index(): radius(1), level(best_simd_level()) {}
+
+    // Points i = 0..n-1 at (lon[i], lat[i]) in degrees; distances are central angles
+    // times radius (so radius = 6371 gives kilometers on the Earth)
+    sphere_index(const double *lon, const double *lat, size_t n, double radius = 1.0,
+		 unsigned threads = default_threads())
+	: radius(radius), level(best_simd_level())
+    {
+	std::vector<double> x(n), y(n), z(n);
+	spherical_to_xyz(lon, lat, n, x.data(), y.data(), z.data(), level, threads);
+	std::vector<sphere_value> values;
+	values.reserve(n);
+	for (size_t i=0; i < n; i++)
+	    values.push_back(sphere_value(unit_vector(x[i], y[i], z[i]), i));
+	rt = rtree_type(values); // bulk loading
+    }
+
+    size_t size() const {return rt.size();}
+    const rtree_type &rtree() const {return rt;}
+
+    // The k points nearest to (lon, lat) as (great-circle distance, index) in
+    // increasing distance
+    template<typename OutIter>
+    void knn(double lon, double lat, size_t k, OutIter out) const
+    {
+	if (k == 0) return;
+	unit_vector q = to_xyz(lon, lat);
+	std::vector<neighbor> result;
+	result.reserve(k);
+	rt.query(bgi::nearest(q, static_cast<unsigned>(k)), boost::make_function_output_iterator(
+	    [&](const sphere_value &v){ result.push_back(neighbor(chord_to_distance(bg::distance(q, v.first)), v.second)); }));
+	std::sort(result.begin(), result.end());
+	std::copy(result.begin(), result.end(), out);
+    }
+
+    // All points within the great-circle distance d of (lon, lat) as (distance, index),
+    // in no particular order; returns their number
+    template<typename OutIter>
+    size_t within_distance(double lon, double lat, double d, OutIter out) const
+    {
+	if (d < 0) return 0;
+	unit_vector q = to_xyz(lon, lat);
+	double angle = d / radius;
+	double chord = (angle >= M_PI) ? 2.0 : 2 * std::sin(angle / 2);
+	// the cube around the cap, then the exact chord
+	bg::model::box<unit_vector> cube(
+	    unit_vector(bg::get<0>(q) - chord, bg::get<1>(q) - chord, bg::get<2>(q) - chord),
+	    unit_vector(bg::get<0>(q) + chord, bg::get<1>(q) + chord, bg::get<2>(q) + chord));
+	const double chord2 = chord * chord;
+	size_t count = 0;
+	rt.query(bgi::intersects(cube), boost::make_function_output_iterator([&](const sphere_value &v){
+	    double c2 = bg::comparable_distance(q, v.first);
+	    if (c2 <= chord2){
+		*out++ = neighbor(chord_to_distance(std::sqrt(c2)), v.second);
+		++count;
+	    }
+	}));
+	return count;
+    }
+};
+
+} // spatial
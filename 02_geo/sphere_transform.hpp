@@ -0,0 +1,273 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Spherical coordinates to unit vectors (and back) for whole arrays
+
+bg::transform(spherical_point, cartesian_point) converts one point at a time:
+
+   x = cos(lat) cos(lon),  y = cos(lat) sin(lon),  z = sin(lat)
+
+Chord ("drill hole") distances, dot products and 3D boxes on the sphere only
+need these unit vectors, so it pays to convert a whole data set once into
+separate x, y and z arrays (SoA) and to work on those. spherical_to_xyz does
+this 4 (AVX2) or 8 (AVX-512) points at a time with the polynomial sin of
+haversine.hpp, reducing the angles in degrees so that 0, 90 and 180 degrees give
+exact zeros and ones (the poles are exactly (0, 0, +-1)). xyz_to_spherical is
+the inverse: lon = atan2(y, x) and lat = atan2(z, hypot(x, y)), by the
+polynomial asin of the smaller over the larger side, so the vectors need not be
+normalized and there is no loss of accuracy near the poles.
+
+Both differ from the C library by a few units in the last place. At simd_scalar,
+and for CPUs without AVX2, the C library is used. Large arrays are split over
+threads in blocks (parallel.hpp). 11_sphere_transform compares with bg::transform.
+*/
+#pragma once
+
+#include<cmath>
+#include<cstddef>
+#include<algorithm>
+
+#include "haversine.hpp"
+#include "parallel.hpp"
+
+namespace spatial{
+
+namespace detail{
+
+// x = x rounded to the nearest integer (ties to even). Not by adding and subtracting
+// 1.5 * 2^52: with -ffast-math (-Ofast) GCC folds that into x. (The helpers take the
+// values by reference, as in haversine.hpp.)
+__attribute__((always_inline)) inline void vround(double &x) {x = std::nearbyint(x);}
+#ifdef SPATIAL_X86_KERNELS
+// (as vsqrt in haversine.hpp; 0x08 is _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+__attribute__((always_inline)) inline void vround(vec4 &x)
+{
+    x = __builtin_ia32_roundpd256(x, 0x08);
+}
+__attribute__((always_inline)) inline void vround(vec8 &x)
+{
+    vec4 lo = {x[0], x[1], x[2], x[3]}, hi = {x[4], x[5], x[6], x[7]};
+    vround(lo);
+    vround(hi);
+    vec8 r = {lo[0], lo[1], lo[2], lo[3], hi[0], hi[1], hi[2], hi[3]};
+    x = r;
+}
+#pragma GCC diagnostic pop
+#endif
+
+// x = x - 360 k for the nearest integer k
+template<typename V> __attribute__((always_inline)) inline void reduce_degrees(V &x)
+{
+    V k = x * (1.0 / 360);
+    vround(k);
+    x = x - k * 360.0;
+}
+
+// s = sin(a) for a in [-180, 180] degrees
+template<typename V> __attribute__((always_inline)) inline void sin_degrees(const V &a, V &s)
+{
+    V u = a;
+    vabs(u);
+    u = (u > 90.0) ? 180.0 - u : u;
+    s = u * (M_PI / 180);
+    sin_quadrant(s);
+    s = (a < 0.0) ? -s : s;
+}
+
+// c = cos(a) for a in [-180, 180] degrees
+template<typename V> __attribute__((always_inline)) inline void cos_degrees(const V &a, V &c)
+{
+    V u = a;
+    vabs(u);
+    sin_degrees(V(90.0 - u), c);
+}
+
+template<typename V> __attribute__((always_inline))
+inline void to_xyz_poly(const V &lon, const V &lat, V &x, V &y, V &z)
+{
+    V l = lon, cos_lat, cos_lon, sin_lon;
+    reduce_degrees(l);
+    cos_degrees(lat, cos_lat);
+    cos_degrees(l, cos_lon);
+    sin_degrees(l, sin_lon);
+    x = cos_lat * cos_lon;
+    y = cos_lat * sin_lon;
+    sin_degrees(lat, z);
+}
+
+// r = atan2(b, a) for a, b >= 0 and h = hypot(a, b), in [0, pi/2]
+template<typename V> __attribute__((always_inline))
+inline void atan2_quadrant(const V &b, const V &a, const V &h, V &r)
+{
+    r = ((b <= a) ? b : a) / ((h == 0.0) ? V() + 1.0 : h);
+    asin_unit(r); // of at most sqrt(1/2)
+    r = (b <= a) ? r : M_PI / 2 - r;
+}
+
+template<typename V> __attribute__((always_inline))
+inline void from_xyz_poly(const V &x, const V &y, const V &z, V &lon, V &lat)
+{
+    const double r2d = 180 / M_PI;
+    V r_xy = x * x + y * y, r = x * x + y * y + z * z;
+    vsqrt(r_xy);
+    vsqrt(r);
+    V ax = x, ay = y, az = z, l, p;
+    vabs(ax);
+    vabs(ay);
+    vabs(az);
+    atan2_quadrant(ay, ax, r_xy, l);
+    l = (x < 0.0) ? M_PI - l : l;
+    lon = ((y < 0.0) ? -l : l) * r2d;
+    atan2_quadrant(az, r_xy, r, p);
+    lat = ((z < 0.0) ? -p : p) * r2d;
+}
+
+template<typename V> __attribute__((always_inline))
+inline void to_xyz_loop(const double *lon, const double *lat, size_t n, double *x, double *y, double *z)
+{
+    const size_t w = sizeof(V) / sizeof(double);
+    size_t i = 0;
+    for (; i + w <= n; i += w)
+    {
+	V a, b, vx, vy, vz;
+	__builtin_memcpy(&a, lon + i, sizeof(V));
+	__builtin_memcpy(&b, lat + i, sizeof(V));
+	to_xyz_poly(a, b, vx, vy, vz);
+	__builtin_memcpy(x + i, &vx, sizeof(V));
+	__builtin_memcpy(y + i, &vy, sizeof(V));
+	__builtin_memcpy(z + i, &vz, sizeof(V));
+    }
+    if (i == n) return;
+    // the rest through the vector code as well (the last one repeated), so that a
+    // point gets the same bits wherever it is in the array (sphere_index.hpp)
+    double a[w], b[w], vx[w], vy[w], vz[w];
+    for (size_t j=0; j < w; j++)
+    {
+	a[j] = lon[std::min(i + j, n - 1)];
+	b[j] = lat[std::min(i + j, n - 1)];
+    }
+    V va, vb, ox, oy, oz;
+    __builtin_memcpy(&va, a, sizeof(V));
+    __builtin_memcpy(&vb, b, sizeof(V));
+    to_xyz_poly(va, vb, ox, oy, oz);
+    __builtin_memcpy(vx, &ox, sizeof(V));
+    __builtin_memcpy(vy, &oy, sizeof(V));
+    __builtin_memcpy(vz, &oz, sizeof(V));
+    for (size_t j=0; i + j < n; j++)
+    {
+	x[i + j] = vx[j];
+	y[i + j] = vy[j];
+	z[i + j] = vz[j];
+    }
+}
+
+template<typename V> __attribute__((always_inline))
+inline void from_xyz_loop(const double *x, const double *y, const double *z, size_t n, double *lon, double *lat)
+{
+    const size_t w = sizeof(V) / sizeof(double);
+    size_t i = 0;
+    for (; i + w <= n; i += w)
+    {
+	V vx, vy, vz, a, b;
+	__builtin_memcpy(&vx, x + i, sizeof(V));
+	__builtin_memcpy(&vy, y + i, sizeof(V));
+	__builtin_memcpy(&vz, z + i, sizeof(V));
+	from_xyz_poly(vx, vy, vz, a, b);
+	__builtin_memcpy(lon + i, &a, sizeof(V));
+	__builtin_memcpy(lat + i, &b, sizeof(V));
+    }
+    for (; i < n; i++)
+	from_xyz_poly(x[i], y[i], z[i], lon[i], lat[i]);
+}
+
+inline void to_xyz_exact(const double *lon, const double *lat, size_t n, double *x, double *y, double *z)
+{
+    const double d2r = M_PI / 180;
+    for (size_t i=0; i < n; i++)
+    {
+	double cos_lat = std::cos(lat[i] * d2r);
+	x[i] = cos_lat * std::cos(lon[i] * d2r);
+	y[i] = cos_lat * std::sin(lon[i] * d2r);
+	z[i] = std::sin(lat[i] * d2r);
+    }
+}
+
+inline void from_xyz_exact(const double *x, const double *y, const double *z, size_t n, double *lon, double *lat)
+{
+    const double r2d = 180 / M_PI;
+    for (size_t i=0; i < n; i++)
+    {
+	lon[i] = std::atan2(y[i], x[i]) * r2d;
+	lat[i] = std::atan2(z[i], std::hypot(x[i], y[i])) * r2d;
+    }
+}
+
+#ifdef SPATIAL_X86_KERNELS
+__attribute__((target("avx2,fma")))
+inline void to_xyz_avx2(const double *lon, const double *lat, size_t n, double *x, double *y, double *z)
+{
+    to_xyz_loop<vec4>(lon, lat, n, x, y, z);
+}
+
+__attribute__((target("avx512f")))
+inline void to_xyz_avx512(const double *lon, const double *lat, size_t n, double *x, double *y, double *z)
+{
+    to_xyz_loop<vec8>(lon, lat, n, x, y, z);
+}
+
+__attribute__((target("avx2,fma")))
+inline void from_xyz_avx2(const double *x, const double *y, const double *z, size_t n, double *lon, double *lat)
+{
+    from_xyz_loop<vec4>(x, y, z, n, lon, lat);
+}
+
+__attribute__((target("avx512f")))
+inline void from_xyz_avx512(const double *x, const double *y, const double *z, size_t n, double *lon, double *lat)
+{
+    from_xyz_loop<vec8>(x, y, z, n, lon, lat);
+}
+#endif
+
+const size_t transform_block = 1 << 15;
+
+} // detail
+
+// (x[i], y[i], z[i]) = unit vector of (lon[i], lat[i]) in degrees, as bg::transform of
+// a spherical_equatorial<degree> point to a 3D cartesian point
+inline void spherical_to_xyz(const double *lon, const double *lat, size_t n, double *x, double *y, double *z,
+			     simd_level level = best_simd_level(), unsigned threads = default_threads())
+{
+    level = std::min(level, best_simd_level());
+    parallel_for(n, detail::transform_block, threads, [&](size_t b, size_t e, unsigned){
+	switch (level){
+#ifdef SPATIAL_X86_KERNELS
+	    case simd_avx512: detail::to_xyz_avx512(lon + b, lat + b, e - b, x + b, y + b, z + b); break;
+	    case simd_avx2: detail::to_xyz_avx2(lon + b, lat + b, e - b, x + b, y + b, z + b); break;
+#endif
+	    default: detail::to_xyz_exact(lon + b, lat + b, e - b, x + b, y + b, z + b);
+	}
+    });
+}
+
+// (lon[i], lat[i]) in degrees of the direction (x[i], y[i], z[i]), which need not be a
+// unit vector; lon in [-180, 180], lat in [-90, 90], and (0, 0) for the null vector
+inline void xyz_to_spherical(const double *x, const double *y, const double *z, size_t n, double *lon, double *lat,
+			     simd_level level = best_simd_level(), unsigned threads = default_threads())
+{
+    level = std::min(level, best_simd_level());
+    parallel_for(n, detail::transform_block, threads, [&](size_t b, size_t e, unsigned){
+	switch (level){
+#ifdef SPATIAL_X86_KERNELS
+	    case simd_avx512: detail::from_xyz_avx512(x + b, y + b, z + b, e - b, lon + b, lat + b); break;
+	    case simd_avx2: detail::from_xyz_avx2(x + b, y + b, z + b, e - b, lon + b, lat + b); break;
+#endif
+	    default: detail::from_xyz_exact(x + b, y + b, z + b, e - b, lon + b, lat + b);
+	}
+    });
+}
+
+} // spatial
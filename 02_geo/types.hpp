@@ -0,0 +1,25 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial 
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Common geometry types shared by the R-tree programs and the helper headers
+*/
+#pragma once
+
+#include <boost/geometry.hpp>
+
+namespace bg = boost::geometry;
+namespace bgi = boost::geometry::index;
+
+typedef bg::model::point<double, 2, bg::cs::cartesian> point;
+typedef bg::model::box<point> box;
+typedef bg::model::linestring<point> linestring;
+typedef bg::model::polygon<point, false, false> polygon; // ccw, open polygon
+typedef bg::model::multi_polygon<polygon> multi_polygon; // ccw, open polygon
+typedef std::pair<box, size_t> value; // <- this is what the R-tree will hold
+
+typedef bgi::rtree< value, bgi::rstar<16, 4> > rtree;
+
+typedef std::pair<point, size_t> point_value; // <- plain point data
+typedef bgi::rtree< point_value, bgi::rstar<16, 4> > point_rtree;
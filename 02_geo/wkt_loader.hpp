@@ -0,0 +1,460 @@
+/*
+(c) 2019 M. Werner - Part of the GIS++ tutorial
+- https://www.martinwerner.de/teaching/spatial-cpp
+- https://github.com/mwernerds/spatial-cpp
+
+Header: Zero-copy WKT loader
+
+Reads files of the form
+   osm_id;"MULTIPOLYGON(((x y,x y,...)),((...)))"
+by mapping them into memory and parsing the rows in place. No line, no split
+vector and no WKT string is ever copied: coordinates go straight from the
+mapped bytes into the output, either a vector of (polygon, osm_id) pairs or a
+polygon_store.
+*/
+#pragma once
+
+#include<string>
+#include<vector>
+#include<stdexcept>
+#include<algorithm>
+#include<atomic>
+#include<exception>
+#include<iterator>
+#include<thread>
+#include<cstdint>
+#include<cstdlib>
+#include<cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "types.hpp"
+#include "polygon_store.hpp"
+#include "arena.hpp"
+#include "parallel.hpp"
+
+namespace spatial{
+
+// A read-only memory mapping of a whole file (RAII)
+class mapped_file
+{
+    const char *_data = nullptr;
+    size_t _size = 0;
+public:
+    explicit mapped_file(const std::string &filename)
+    {
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	    throw std::runtime_error("Cannot open " + filename);
+	struct stat st;
+	if (::fstat(fd, &st) != 0){
+	    ::close(fd);
+	    throw std::runtime_error("Cannot stat " + filename);
+	}
+	_size = static_cast<size_t>(st.st_size);
+	if (_size != 0){
+	    void *m = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+	    if (m == MAP_FAILED){
+		::close(fd);
+		throw std::runtime_error("Cannot mmap " + filename);
+	    }
+	    ::madvise(m, _size, MADV_SEQUENTIAL);
+	    _data = static_cast<const char *>(m);
+	}
+	::close(fd); // the mapping keeps the file alive
+    }
+    ~mapped_file()
+    {
+	if (_data) ::munmap(const_cast<char *>(_data), _size);
+    }
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    const char *begin() const {return _data;}
+    const char *end() const {return _data + _size;}
+    size_t size() const {return _size;}
+};
+
+
+namespace detail{
+
+inline bool is_digit(char c) {return c >= '0' && c <= '9';}
+
+inline void skip_ws(const char *&p, const char *end)
+{
+    while (p != end && (*p == ' ' || *p == '\t')) ++p;
+}
+
+inline void expect(const char *&p, const char *end, char c)
+{
+    skip_ws(p,end);
+    if (p == end || *p != c)
+	throw std::runtime_error(std::string("WKT: expected '") + c + "'");
+    ++p;
+}
+
+// Parse a decimal floating point number. Numbers with at most 15 significant
+// digits and a small decimal exponent are converted exactly with a single
+// multiplication or division (both operands are exact doubles, so the result
+// is correctly rounded). Everything else falls back to strtod.
+inline double parse_double(const char *&p, const char *end)
+{
+    static const double pow10[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+				   1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+    skip_ws(p,end);
+    const char *start = p;
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')){
+	negative = (*p == '-');
+	++p;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (; p != end && is_digit(*p); ++p, any = true){
+	if (mantissa == 0 && *p == '0') continue; // leading zero
+	mantissa = mantissa * 10 + (*p - '0');
+	++digits;
+    }
+    if (p != end && *p == '.'){
+	for (++p; p != end && is_digit(*p); ++p, any = true){
+	    --exponent;
+	    if (mantissa == 0 && *p == '0') continue;
+	    mantissa = mantissa * 10 + (*p - '0');
+	    ++digits;
+	}
+    }
+    if (!any)
+	throw std::runtime_error("WKT: expected a number");
+    bool slow = (digits > 15);
+    if (p != end && (*p == 'e' || *p == 'E')){
+	slow = true; // rare in OSM data, let the C library deal with it
+	++p;
+	if (p != end && (*p == '-' || *p == '+')) ++p;
+	while (p != end && is_digit(*p)) ++p;
+    }
+    if (!slow && exponent >= -22 && exponent <= 22){
+	double v = static_cast<double>(mantissa);
+	v = (exponent < 0) ? v / pow10[-exponent] : v * pow10[exponent];
+	return negative ? -v : v;
+    }
+    // slow path: strtod needs a terminated string, the mapping has none. Longer
+    // numbers than the buffer are refused rather than cut short.
+    char buf[128];
+    size_t len = p - start;
+    if (len >= sizeof(buf))
+	throw std::runtime_error("WKT: number too long");
+    std::memcpy(buf, start, len);
+    buf[len] = 0;
+    return std::strtod(buf, nullptr);
+}
+
+inline size_t parse_id(const char *&p, const char *end)
+{
+    skip_ws(p,end);
+    if (p == end || !is_digit(*p))
+	throw std::runtime_error("WKT: expected a numeric id");
+    size_t v = 0;
+    for (; p != end && is_digit(*p); ++p) v = v * 10 + (*p - '0');
+    return v;
+}
+
+// case-insensitive keyword match, advances p on success
+inline bool keyword(const char *&p, const char *end, const char *kw)
+{
+    skip_ws(p,end);
+    const char *q = p;
+    for (; *kw; ++kw, ++q)
+	if (q == end || (*q | 0x20) != (*kw | 0x20)) return false;
+    p = q;
+    return true;
+}
+
+// "(x y, x y, ...)" into an open ring, with the same closing-point rule as bg::read_wkt
+template<typename Ring>
+inline void parse_ring(const char *&p, const char *end, Ring &ring)
+{
+    typedef typename bg::point_type<Ring>::type point_type;
+    expect(p,end,'(');
+    ring.clear();
+    while (true){
+	double x = parse_double(p,end);
+	double y = parse_double(p,end);
+	ring.push_back(bg::make<point_type>(x,y));
+	skip_ws(p,end);
+	if (p != end && *p == ','){ ++p; continue;}
+	break;
+    }
+    expect(p,end,')');
+    // open rings drop a repeated first point, but only from the fourth point on
+    if (bg::closure<Ring>::value == bg::open && ring.size() > 3
+	&& bg::get<0>(ring.front()) == bg::get<0>(ring.back())
+	&& bg::get<1>(ring.front()) == bg::get<1>(ring.back()))
+	ring.pop_back();
+}
+
+template<typename Polygon>
+inline void parse_polygon(const char *&p, const char *end, Polygon &poly)
+{
+    expect(p,end,'(');
+    parse_ring(p,end,bg::exterior_ring(poly));
+    size_t n_inner = 0;
+    skip_ws(p,end);
+    while (p != end && *p == ','){
+	++p;
+	if (bg::interior_rings(poly).size() <= n_inner)
+	    bg::interior_rings(poly).resize(n_inner+1);
+	parse_ring(p,end,bg::interior_rings(poly)[n_inner++]);
+	skip_ws(p,end);
+    }
+    bg::interior_rings(poly).resize(n_inner);
+    expect(p,end,')');
+}
+
+} // detail
+
+
+struct load_stats
+{
+    size_t bytes = 0;
+    size_t rows = 0;
+    size_t polygons = 0;
+    box bounds; // MBR of all parsed polygons
+    load_stats() {bg::assign_inverse(bounds);}
+};
+
+
+namespace detail{
+
+// Where the parser puts a polygon. For a vector of (polygon, id) pairs it parses
+// straight into a new element...
+template<typename Container>
+struct polygon_sink
+{
+    typedef typename Container::value_type::first_type polygon_type;
+    Container &out;
+    explicit polygon_sink(Container &o): out(o) {}
+    polygon_type &next(size_t id)
+    {
+	out.emplace_back();
+	out.back().second = id;
+	return out.back().first;
+    }
+    // the envelope of the polygon just parsed
+    box commit()
+    {
+	box b;
+	bg::envelope(out.back().first, b);
+	return b;
+    }
+};
+
+// ... while for the flat store it parses into a scratch polygon in the arena of the
+// thread (arena.hpp) and copies the coordinates into the store once the polygon is
+// complete. The arena is rewound for every polygon, so after the first rows neither
+// rings nor holes call malloc.
+template<>
+struct polygon_sink<polygon_store>
+{
+    typedef scratch_polygon polygon_type;
+    polygon_store &out;
+    scratch_scope scope;
+    scratch_polygon scratch;
+    size_t id = 0;
+    explicit polygon_sink(polygon_store &o): out(o) {}
+    scratch_polygon &next(size_t i)
+    {
+	id = i;
+	// drop the rings (and their capacity) before their memory is handed out again
+	scratch_polygon::ring_type().swap(scratch.outer());
+	scratch_polygon::inner_container_type().swap(scratch.inners());
+	scope.rewind();
+	return scratch;
+    }
+    box commit()
+    {
+	out.push_back(scratch, id);
+	return out.envelope(out.size() - 1); // computed once, by the store
+    }
+};
+
+// merging the per-thread results
+template<typename Container>
+void reserve_parts(Container &out, const std::vector<Container> &parts)
+{
+    size_t n = 0;
+    for (const auto &p: parts) n += p.size();
+    out.reserve(out.size() + n);
+}
+inline void reserve_parts(polygon_store &out, const std::vector<polygon_store> &parts)
+{
+    size_t n = out.size(), r = out.num_rings(), k = out.num_points();
+    for (const auto &p: parts){
+	n += p.size();
+	r += p.num_rings();
+	k += p.num_points();
+    }
+    out.reserve(n, r, k);
+}
+template<typename Container>
+void append_part(Container &out, Container &part)
+{
+    std::move(part.begin(), part.end(), std::back_inserter(out));
+    Container().swap(part);
+}
+inline void append_part(polygon_store &out, polygon_store &part)
+{
+    out.append(part);
+    part = polygon_store();
+}
+
+} // detail
+
+// Parse all rows in [begin,end) and append every building part (after bg::correct)
+// to out as (polygon, osm_id). Polygons are parsed directly into their final slot.
+// Errors name the line, counted from first_line for the first row of [begin,end).
+template<typename Container>
+load_stats parse_wkt_rows(const char *begin, const char *end, Container &out, size_t first_line = 1)
+{
+    load_stats stats;
+    stats.bytes = end - begin;
+    detail::polygon_sink<Container> sink(out);
+    auto add_polygon = [&](const char *&p, const char *eol, size_t osm_id){
+	auto &poly = sink.next(osm_id);
+	detail::parse_polygon(p,eol,poly);
+	bg::correct(poly);
+	bg::expand(stats.bounds, sink.commit());
+	++stats.polygons;
+    };
+    const char *p = begin;
+    size_t line = first_line - 1;
+    while (p != end){
+	++line;
+	const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+	if (!eol) eol = end;
+	detail::skip_ws(p,eol);
+	if (p == eol || *p == '\r'){ // empty line
+	    p = (eol == end) ? end : eol + 1;
+	    continue;
+	}
+	try{
+	    size_t osm_id = detail::parse_id(p,eol);
+	    detail::expect(p,eol,';');
+	    detail::skip_ws(p,eol);
+	    bool quoted = (p != eol && *p == '"');
+	    if (quoted) ++p;
+	    if (detail::keyword(p,eol,"MULTIPOLYGON")){
+		if (!detail::keyword(p,eol,"EMPTY")){
+		    detail::expect(p,eol,'(');
+		    while (true){ // each building part!
+			add_polygon(p, eol, osm_id);
+			detail::skip_ws(p,eol);
+			if (p != eol && *p == ','){ ++p; continue;}
+			break;
+		    }
+		    detail::expect(p,eol,')');
+		}
+	    }else if (detail::keyword(p,eol,"POLYGON")){
+		if (!detail::keyword(p,eol,"EMPTY")){
+		    add_polygon(p, eol, osm_id);
+		}
+	    }else{
+		throw std::runtime_error("WKT: expected POLYGON or MULTIPOLYGON");
+	    }
+	    if (quoted) detail::expect(p,eol,'"');
+	}catch(std::runtime_error &e){
+	    throw std::runtime_error(std::string(e.what()) + " in line " + std::to_string(line));
+	}
+	++stats.rows;
+	p = (eol == end) ? end : eol + 1;
+    }
+    return stats;
+}
+
+// Parallel ingest: split [begin,end) into newline-aligned chunks and let a pool of
+// threads parse them. Every chunk collects its polygons and its own MBR, then the
+// chunks are appended to out in file order, so the result is identical to the
+// serial parse no matter how many threads are used. Errors report lines of the file.
+template<typename Container>
+load_stats parse_wkt_rows_parallel(const char *begin, const char *end, Container &out,
+				   box &roi, unsigned threads)
+{
+    threads = std::max(1u, std::min(threads, max_threads));
+    // a few chunks per thread keep the pool busy when rows have very different sizes
+    size_t n_chunks = (threads == 1) ? 1 : 4 * threads;
+    std::vector<const char *> cuts(1, begin);
+    for (size_t i=1; i < n_chunks; i++)
+    {
+	const char *c = begin + (end - begin) * i / n_chunks;
+	if (c < cuts.back()) c = cuts.back();
+	const char *nl = static_cast<const char *>(std::memchr(c, '\n', end - c));
+	cuts.push_back(nl ? nl + 1 : end);
+    }
+    cuts.push_back(end);
+    n_chunks = cuts.size() - 1;
+
+    std::vector<Container> parts(n_chunks);
+    std::vector<load_stats> stats(n_chunks);
+    std::vector<std::exception_ptr> errors(n_chunks);
+    std::atomic<size_t> next(0);
+
+    auto worker = [&](){
+	for (size_t i = next++; i < n_chunks; i = next++)
+	{
+	    try{
+		stats[i] = parse_wkt_rows(cuts[i], cuts[i+1], parts[i]);
+	    }catch(...){
+		errors[i] = std::current_exception();
+	    }
+	}
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t=1; t < threads && t < n_chunks; t++)
+	pool.emplace_back(worker);
+    worker(); // the calling thread works as well
+    for (auto &t: pool) t.join();
+    for (size_t i=0; i < n_chunks; i++)
+	if (errors[i]){
+	    // the first error in the file: the chunk is parsed once more with its lines
+	    // counted from the newlines before it, which throws with the line of the file
+	    Container ignored;
+	    parse_wkt_rows(cuts[i], cuts[i+1], ignored, 1 + std::count(begin, cuts[i], '\n'));
+	    std::rethrow_exception(errors[i]);
+	}
+
+    // deterministic merge in chunk order
+    load_stats total;
+    total.bytes = end - begin;
+    for (const auto &s: stats){
+	total.rows += s.rows;
+	total.polygons += s.polygons;
+	if (s.polygons != 0)
+	    bg::expand(total.bounds, s.bounds);
+    }
+    detail::reserve_parts(out, parts);
+    for (auto &part: parts)
+	detail::append_part(out, part);
+    roi = total.bounds;
+    return total;
+}
+
+// Convenience: map the file and parse all of it
+template<typename Container>
+load_stats load_wkt_file(const std::string &filename, Container &out)
+{
+    mapped_file f(filename);
+    return parse_wkt_rows(f.begin(), f.end(), out);
+}
+
+// Convenience: map the file and parse it with the given number of threads
+template<typename Container>
+load_stats load_wkt_file(const std::string &filename, Container &out, box &roi, unsigned threads)
+{
+    mapped_file f(filename);
+    return parse_wkt_rows_parallel(f.begin(), f.end(), out, roi, threads);
+}
+
+} // spatial